@@ -0,0 +1,360 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/cli/benchmark.h"
+#include "src/cli/camerapath.h"
+
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QStringList>
+#include <QDateTime>
+
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <deque>
+#include <chrono>
+#include <cmath>
+
+static const char *STAGE_NAMES[VolumeRenderCL::NUM_STAGES] =
+    {"upload", "brick_generation", "raycast", "readback"};
+
+/**
+ * @brief Camera frames of the orbits around the y axis, one orbit per zoom level.
+ */
+static std::vector<CameraPath::Frame> orbit_frames(const Benchmark::Config &config)
+{
+    const double pi = std::acos(-1.0);
+    std::vector<CameraPath::Frame> frames;
+    for (const float zoom : config.zooms)
+    {
+        for (size_t i = 0; i < config.orbit_frames; ++i)
+        {
+            const double angle = 2.0 * pi * double(i) / double(config.orbit_frames);
+            CameraPath::Frame frame;
+            frame.rotation = {{float(std::cos(angle / 2.0)), 0.f,
+                               float(std::sin(angle / 2.0)), 0.f}};
+            frame.translation = {{0.f, 0.f, zoom}};
+            frames.push_back(frame);
+        }
+    }
+    return frames;
+}
+
+/**
+ * @brief Render frames with the output ring, frame N+1 is enqueued before waiting for N.
+ */
+static void render(VolumeRenderCL &renderer, const std::vector<CameraPath::Frame> &frames)
+{
+    std::deque<size_t> inFlight;
+    for (const auto &frame : frames)
+    {
+        renderer.updateView(CameraPath::view_matrix(frame));
+        inFlight.push_back(renderer.enqueueRaycastNoGL());
+        while (inFlight.size() > 1)
+        {
+            renderer.waitFrame(inFlight.front());
+            renderer.releaseFrame(inFlight.front());
+            inFlight.pop_front();
+        }
+    }
+    while (!inFlight.empty())
+    {
+        renderer.waitFrame(inFlight.front());
+        renderer.releaseFrame(inFlight.front());
+        inFlight.pop_front();
+    }
+}
+
+
+/*
+ * Benchmark::read_config
+ */
+void Benchmark::read_config(const std::string &file_name)
+{
+    QFile f(QString::fromStdString(file_name));
+    if (!f.open(QFile::ReadOnly))
+        throw std::invalid_argument("Could not open benchmark configuration " + file_name);
+    const QJsonObject json = QJsonDocument::fromJson(f.readAll()).object();
+
+    if (json.contains("illumTypes") && json["illumTypes"].isArray())
+    {
+        _config.illum_types.clear();
+        for (const auto v : json["illumTypes"].toArray())
+            _config.illum_types.push_back(static_cast<unsigned int>(v.toInt()));
+    }
+    if (json.contains("ess") && json["ess"].isArray())
+    {
+        _config.ess_modes.clear();
+        for (const auto v : json["ess"].toArray())
+        {
+            const QString mode = v.toString();
+            if (mode == "object")
+                _config.ess_modes.push_back(ESS_OBJECT);
+            else if (mode == "image")
+                _config.ess_modes.push_back(ESS_IMAGE);
+            else if (mode == "both")
+                _config.ess_modes.push_back(ESS_BOTH);
+            else
+                _config.ess_modes.push_back(ESS_NONE);
+        }
+    }
+    if (json.contains("samplingRates") && json["samplingRates"].isArray())
+    {
+        _config.sampling_rates.clear();
+        for (const auto v : json["samplingRates"].toArray())
+            _config.sampling_rates.push_back(v.toDouble());
+    }
+    if (json.contains("techniques") && json["techniques"].isArray())
+    {
+        _config.techniques.clear();
+        for (const auto v : json["techniques"].toArray())
+            _config.techniques.push_back(v.toString() == "pathtrace"
+                                         ? VolumeRenderCL::TECH_PATHTRACE
+                                         : VolumeRenderCL::TECH_RAYCAST);
+    }
+    if (json.contains("resolutions") && json["resolutions"].isArray())
+    {
+        // "width x height", e.g. "1920x1080"
+        _config.resolutions.clear();
+        for (const auto v : json["resolutions"].toArray())
+        {
+            const QStringList sl = v.toString().split('x');
+            if (sl.size() == 2 && sl.at(0).toInt() > 0 && sl.at(1).toInt() > 0)
+                _config.resolutions.push_back({{size_t(sl.at(0).toInt()),
+                                                size_t(sl.at(1).toInt())}});
+        }
+    }
+    if (json.contains("zooms") && json["zooms"].isArray())
+    {
+        _config.zooms.clear();
+        for (const auto v : json["zooms"].toArray())
+            _config.zooms.push_back(float(v.toDouble()));
+    }
+    if (json.contains("orbitFrames") && json["orbitFrames"].isDouble())
+        _config.orbit_frames = size_t(std::max(1, json["orbitFrames"].toInt()));
+    if (json.contains("warmupFrames") && json["warmupFrames"].isDouble())
+        _config.warmup_frames = size_t(std::max(0, json["warmupFrames"].toInt()));
+}
+
+/*
+ * Benchmark::set_labels
+ */
+void Benchmark::set_labels(const std::string &dataset, const std::string &device)
+{
+    _dataset = dataset;
+    _device = device;
+}
+
+/*
+ * Benchmark::run
+ */
+void Benchmark::run(VolumeRenderCL &renderer)
+{
+    _results.clear();
+    const std::vector<CameraPath::Frame> frames = orbit_frames(_config);
+    if (frames.empty() || _config.resolutions.empty())
+        throw std::invalid_argument("Empty benchmark configuration.");
+    const std::vector<CameraPath::Frame> warmup(_config.warmup_frames, frames.front());
+    renderer.setProfiling(true);
+    // the load of the data set is not part of any configuration
+    renderer.takeStageTimings();
+
+    // object order ESS changes rebuild the kernel and upload the volume: outermost loop
+    for (const ess_mode ess : _config.ess_modes)
+    {
+        renderer.setObjEss(ess == ESS_OBJECT || ess == ESS_BOTH);
+        renderer.setImgEss(ess == ESS_IMAGE || ess == ESS_BOTH);
+        // upload and brick generation of this ESS mode
+        auto setup = renderer.takeStageTimings();
+        for (const auto &res : _config.resolutions)
+        for (const auto tech : _config.techniques)
+        for (const auto illum : _config.illum_types)
+        for (const auto rate : _config.sampling_rates)
+        {
+            Result r;
+            r.illum_type = illum;
+            r.ess = ess;
+            r.sampling_rate = rate;
+            r.technique = tech;
+            r.resolution = res;
+            std::cout << "Benchmark: " << ess_name(ess) << " ESS, illumination " << illum
+                      << ", sampling rate " << rate << ", "
+                      << (tech == VolumeRenderCL::TECH_PATHTRACE ? "pathtrace" : "raycast")
+                      << ", " << res.at(0) << "x" << res.at(1) << std::endl;
+
+            renderer.setTechnique(tech);
+            renderer.setIllumination(illum);
+            renderer.updateSamplingRate(rate);
+            // also resets the hit images of image order ESS
+            renderer.initOutputRing(res.at(0), res.at(1), _config.frames_in_flight);
+
+            // warm up and wait for the specialized kernel, see selectRaycastVariant
+            render(renderer, warmup);
+            const auto timeout = std::chrono::steady_clock::now() + std::chrono::minutes(2);
+            while (renderer.isKernelVariantPending()
+                   && std::chrono::steady_clock::now() < timeout)
+            {
+                render(renderer, {frames.front()});
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (renderer.isKernelVariantPending())
+                std::cerr << "WARNING: Benchmarking the generic kernel." << std::endl;
+            auto timings = renderer.takeStageTimings();
+
+            const auto start = std::chrono::steady_clock::now();
+            render(renderer, frames);
+            const double seconds = std::chrono::duration<double>(
+                        std::chrono::steady_clock::now() - start).count();
+            timings = renderer.takeStageTimings();
+            for (size_t i = 0; i < timings.size(); ++i)
+            {
+                timings.at(i).insert(timings.at(i).end(), setup.at(i).begin(), setup.at(i).end());
+                r.stages.at(i) = statistics(timings.at(i));
+            }
+            // setup stages are reported with the first configuration of an ESS mode only
+            setup = std::array<std::vector<double>, VolumeRenderCL::NUM_STAGES>();
+            r.frames = frames.size();
+            r.fps = seconds > 0.0 ? double(frames.size()) / seconds : 0.0;
+            _results.push_back(r);
+        }
+    }
+    renderer.setProfiling(false);
+}
+
+/*
+ * Benchmark::statistics
+ */
+Benchmark::Stats Benchmark::statistics(std::vector<double> times)
+{
+    Stats s;
+    s.count = times.size();
+    if (times.empty())
+        return s;
+    std::sort(times.begin(), times.end());
+    // nearest rank percentile
+    auto percentile = [&](const double p) {
+        const size_t rank = size_t(std::ceil(p * double(times.size())));
+        return times.at(std::min(std::max(rank, size_t(1)), times.size()) - 1) * 1e3;
+    };
+    s.min = times.front() * 1e3;
+    s.median = percentile(0.5);
+    s.p95 = percentile(0.95);
+    s.p99 = percentile(0.99);
+    return s;
+}
+
+/*
+ * Benchmark::stage_name
+ */
+const char *Benchmark::stage_name(const size_t stage)
+{
+    return stage < VolumeRenderCL::NUM_STAGES ? STAGE_NAMES[stage] : "";
+}
+
+/*
+ * Benchmark::ess_name
+ */
+const char *Benchmark::ess_name(const ess_mode ess)
+{
+    switch (ess)
+    {
+    case ESS_OBJECT: return "object";
+    case ESS_IMAGE: return "image";
+    case ESS_BOTH: return "both";
+    default: return "none";
+    }
+}
+
+/*
+ * Benchmark::write_csv
+ */
+bool Benchmark::write_csv(const std::string &file_name) const
+{
+    std::ofstream os(file_name, std::ios::out | std::ios::trunc);
+    if (!os)
+        return false;
+    os << "dataset,device,ess,illum_type,sampling_rate,technique,width,height,frames,fps,"
+       << "stage,count,min_ms,median_ms,p95_ms,p99_ms\n";
+    for (const auto &r : _results)
+    {
+        for (size_t i = 0; i < r.stages.size(); ++i)
+        {
+            const Stats &s = r.stages.at(i);
+            os << "\"" << _dataset << "\",\"" << _device << "\"," << ess_name(r.ess) << ","
+               << r.illum_type << "," << r.sampling_rate << ","
+               << (r.technique == VolumeRenderCL::TECH_PATHTRACE ? "pathtrace" : "raycast")
+               << "," << r.resolution.at(0) << "," << r.resolution.at(1) << "," << r.frames
+               << "," << r.fps << "," << stage_name(i) << "," << s.count << "," << s.min
+               << "," << s.median << "," << s.p95 << "," << s.p99 << "\n";
+        }
+    }
+    return static_cast<bool>(os);
+}
+
+/*
+ * Benchmark::write_json
+ */
+bool Benchmark::write_json(const std::string &file_name) const
+{
+    QJsonArray results;
+    for (const auto &r : _results)
+    {
+        QJsonObject result;
+        result["ess"] = ess_name(r.ess);
+        result["illumType"] = int(r.illum_type);
+        result["samplingRate"] = r.sampling_rate;
+        result["technique"] = r.technique == VolumeRenderCL::TECH_PATHTRACE ? "pathtrace"
+                                                                            : "raycast";
+        result["resolution"] = QString("%1x%2").arg(r.resolution.at(0)).arg(r.resolution.at(1));
+        result["frames"] = int(r.frames);
+        result["fps"] = r.fps;
+        QJsonObject stages;
+        for (size_t i = 0; i < r.stages.size(); ++i)
+        {
+            const Stats &s = r.stages.at(i);
+            QJsonObject stage;
+            stage["count"] = int(s.count);
+            stage["minMs"] = s.min;
+            stage["medianMs"] = s.median;
+            stage["p95Ms"] = s.p95;
+            stage["p99Ms"] = s.p99;
+            stages[stage_name(i)] = stage;
+        }
+        result["stages"] = stages;
+        results.append(result);
+    }
+    QJsonObject json;
+    json["dataset"] = QString::fromStdString(_dataset);
+    json["device"] = QString::fromStdString(_device);
+    json["date"] = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
+    json["orbitFrames"] = int(_config.orbit_frames);
+    json["warmupFrames"] = int(_config.warmup_frames);
+    json["results"] = results;
+
+    QFile f(QString::fromStdString(file_name));
+    if (!f.open(QFile::WriteOnly))
+        return false;
+    return f.write(QJsonDocument(json).toJson()) > 0;
+}
@@ -0,0 +1,137 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/volumerendercl.h"
+
+#include <array>
+#include <string>
+#include <vector>
+
+/// <summary>
+/// Benchmark of a loaded data set: renders fixed camera orbits for every combination of
+/// the configuration matrix (illumination x ESS x sampling rate x technique x resolution)
+/// and collects the OpenCL profiling times of all stages.
+/// </summary>
+class Benchmark
+{
+public:
+    enum ess_mode
+    {
+        ESS_NONE = 0,
+        ESS_OBJECT,
+        ESS_IMAGE,
+        ESS_BOTH
+    };
+
+    /// <summary>
+    /// Configuration matrix and camera orbits.
+    /// </summary>
+    struct Config
+    {
+        std::vector<unsigned int> illum_types = {0, 1};
+        std::vector<ess_mode> ess_modes = {ESS_NONE, ESS_OBJECT, ESS_IMAGE, ESS_BOTH};
+        std::vector<double> sampling_rates = {1.0, 2.0};
+        std::vector<VolumeRenderCL::technique> techniques = {VolumeRenderCL::TECH_RAYCAST};
+        std::vector<std::array<size_t, 2> > resolutions = {{{1024, 1024}}};
+        std::vector<float> zooms = {2.0f, 1.2f};    // camera distances of the orbits
+        size_t orbit_frames = 36;                   // frames per orbit around the y axis
+        size_t warmup_frames = 5;
+        size_t frames_in_flight = 3;
+    };
+
+    /// <summary>
+    /// Statistics of the execution times of one stage in milliseconds.
+    /// </summary>
+    struct Stats
+    {
+        size_t count = 0;
+        double min = 0.0;
+        double median = 0.0;
+        double p95 = 0.0;
+        double p99 = 0.0;
+    };
+
+    /// <summary>
+    /// Results of one configuration.
+    /// </summary>
+    struct Result
+    {
+        unsigned int illum_type = 0;
+        ess_mode ess = ESS_NONE;
+        double sampling_rate = 1.0;
+        VolumeRenderCL::technique technique = VolumeRenderCL::TECH_RAYCAST;
+        std::array<size_t, 2> resolution = {{0, 0}};
+        size_t frames = 0;
+        double fps = 0.0;
+        std::array<Stats, VolumeRenderCL::NUM_STAGES> stages;
+    };
+
+    /// <summary>
+    /// Read the configuration from a JSON file, missing keys keep their defaults.
+    /// </summary>
+    /// <param name="file_name">Name and full path of the JSON file.</param>
+    /// <throws>If the file could not be read.</throws>
+    void read_config(const std::string &file_name);
+
+    /// <summary>
+    /// Run all configurations.
+    /// </summary>
+    /// <param name="renderer">Renderer with data and transfer function loaded.</param>
+    void run(VolumeRenderCL &renderer);
+
+    /// <summary>
+    /// Write the results as CSV, one line per configuration and stage.
+    /// </summary>
+    /// <returns><c>true</c> on success.</returns>
+    bool write_csv(const std::string &file_name) const;
+
+    /// <summary>
+    /// Write the results as JSON.
+    /// </summary>
+    /// <returns><c>true</c> on success.</returns>
+    bool write_json(const std::string &file_name) const;
+
+    /// <summary>
+    /// Set a name for the data set and device, written to the results.
+    /// </summary>
+    void set_labels(const std::string &dataset, const std::string &device);
+
+    Config &config() { return _config; }
+    const Config &config() const { return _config; }
+    const std::vector<Result> &results() const { return _results; }
+
+    static const char *stage_name(size_t stage);
+    static const char *ess_name(ess_mode ess);
+
+    /// <summary>
+    /// Calculate min, median and percentiles of execution times in seconds.
+    /// </summary>
+    static Stats statistics(std::vector<double> times);
+
+private:
+    Config _config;
+    std::vector<Result> _results;
+    std::string _dataset;
+    std::string _device;
+};
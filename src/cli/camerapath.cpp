@@ -0,0 +1,227 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/cli/camerapath.h"
+
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QVariant>
+#include <QMatrix4x4>
+#include <QQuaternion>
+
+#include <stdexcept>
+#include <iostream>
+
+// file name suffixes of VolumeRenderWidget::recordViewConfig
+static const char *QUAT_SUFFIX = "_quat.txt";
+static const char *TRANS_SUFFIX = "_trans.txt";
+
+/*
+ * CameraPath::read
+ */
+void CameraPath::read(const std::string &file_name)
+{
+    _frames.clear();
+    _tffs.clear();
+    _settings = Settings();
+
+    const QString name = QString::fromStdString(file_name);
+    if (name.endsWith(".json", Qt::CaseInsensitive))
+        read_json(file_name);
+    else if (name.endsWith(QUAT_SUFFIX))
+        read_view_config(name.left(name.size() - int(qstrlen(QUAT_SUFFIX))));
+    else if (name.endsWith(TRANS_SUFFIX))
+        read_view_config(name.left(name.size() - int(qstrlen(TRANS_SUFFIX))));
+    else if (!QFile::exists(name) && QFile::exists(name + QUAT_SUFFIX))
+        read_view_config(name);
+    else
+        read_sequence(file_name);
+
+    if (_frames.empty())
+        throw std::invalid_argument("No camera frames in " + file_name);
+}
+
+/*
+ * CameraPath::read_sequence
+ */
+void CameraPath::read_sequence(const std::string &file_name)
+{
+    QFile f(QString::fromStdString(file_name));
+    if (!f.open(QFile::ReadOnly | QFile::Text))
+        throw std::invalid_argument("Invalid file name for interaction log: " + file_name);
+
+    // same line format as VolumeRenderWidget::setSequenceStep, state changes apply to the
+    // next camera line
+    Frame state;
+    QTextStream sequence(&f);
+    QString line;
+    while (sequence.readLineInto(&line))
+    {
+        const int pos = line.lastIndexOf(';');
+        if (pos < 0)
+            continue;
+        QString value = line.mid(pos + 2);
+        if (line.contains("camera"))
+        {
+            QStringList values = value.remove(',').split(' ', QString::SkipEmptyParts);
+            if (values.size() < 7)
+                continue;
+            for (int i = 0; i < 4; ++i)
+                state.rotation.at(size_t(i)) = values.at(i).toFloat();
+            for (int i = 0; i < 3; ++i)
+                state.translation.at(size_t(i)) = values.at(i + 4).toFloat();
+            _frames.push_back(state);
+            state.tff = -1;
+        }
+        else if (line.contains("timestep"))
+        {
+            state.timestep = size_t(qMax(0, value.toInt()));
+        }
+        else if (line.contains("transferFunction"))
+        {
+            std::vector<unsigned char> tff;
+            for (const QString &v : value.split(' ', QString::SkipEmptyParts))
+                tff.push_back(static_cast<unsigned char>(v.toInt()));
+            if (tff.empty())
+                continue;
+            _tffs.push_back(tff);
+            state.tff = long(_tffs.size()) - 1;
+        }
+        // tffInterpolation only applies to editing control points, the sequence contains
+        // the resulting raw transfer functions
+    }
+}
+
+/*
+ * CameraPath::read_view_config
+ */
+void CameraPath::read_view_config(const QString &prefix)
+{
+    // one record per view, "w x y z; " and "x y z; " appended to the two files
+    auto records = [](const QString &file_name)
+    {
+        QFile f(file_name);
+        if (!f.open(QFile::ReadOnly | QFile::Text))
+            throw std::invalid_argument("Invalid file name for view configuration: "
+                                        + file_name.toStdString());
+        QStringList records = QString::fromUtf8(f.readAll()).split(';');
+        for (QString &r : records)
+            r = r.simplified();
+        records.removeAll(QString());
+        return records;
+    };
+    const QStringList quats = records(prefix + QUAT_SUFFIX);
+    const QStringList trans = records(prefix + TRANS_SUFFIX);
+    if (quats.size() != trans.size())
+        std::cerr << "WARNING: " << quats.size() << " rotations but " << trans.size()
+                  << " translations in the view configuration " << prefix.toStdString()
+                  << ", reading the first " << qMin(quats.size(), trans.size()) << std::endl;
+
+    for (int i = 0; i < qMin(quats.size(), trans.size()); ++i)
+    {
+        const QStringList q = quats.at(i).split(' ');
+        const QStringList t = trans.at(i).split(' ');
+        if (q.size() < 4 || t.size() < 3)
+            throw std::invalid_argument("Invalid record " + std::to_string(i)
+                                        + " in the view configuration " + prefix.toStdString());
+        Frame frame;
+        for (int j = 0; j < 4; ++j)
+            frame.rotation.at(size_t(j)) = q.at(j).toFloat();
+        for (int j = 0; j < 3; ++j)
+            frame.translation.at(size_t(j)) = t.at(j).toFloat();
+        _frames.push_back(frame);
+    }
+}
+
+/*
+ * CameraPath::read_json
+ */
+void CameraPath::read_json(const std::string &file_name)
+{
+    QFile f(QString::fromStdString(file_name));
+    if (!f.open(QFile::ReadOnly))
+        throw std::invalid_argument("Could not open state file " + file_name);
+    const QJsonObject json = QJsonDocument::fromJson(f.readAll()).object();
+    Frame frame;
+    read_state(json, frame, _settings);
+    _frames.push_back(frame);
+}
+
+/*
+ * CameraPath::read_state
+ */
+void CameraPath::read_state(const QJsonObject &json, Frame &frame, Settings &settings)
+{
+    // keys as written by MainWindow::saveCamState and VolumeRenderWidget::write
+    if (json.contains("rayStepSize") && json["rayStepSize"].isDouble())
+        settings.samplingRate = json["rayStepSize"].toDouble();
+    if (json.contains("useLerp") && json["useLerp"].isBool())
+        settings.linear = json["useLerp"].toBool();
+    if (json.contains("useAO") && json["useAO"].isBool())
+        settings.ambientOcclusion = json["useAO"].toBool();
+    if (json.contains("showContours") && json["showContours"].isBool())
+        settings.contours = json["showContours"].toBool();
+    if (json.contains("useAerial") && json["useAerial"].isBool())
+        settings.aerial = json["useAerial"].toBool();
+    if (json.contains("useOrtho") && json["useOrtho"].isBool())
+        settings.ortho = json["useOrtho"].toBool();
+
+    if (json.contains("camRotation"))
+    {
+        QStringList sl = json["camRotation"].toVariant().toString().split(' ');
+        if (sl.length() >= 4)
+            for (int i = 0; i < 4; ++i)
+                frame.rotation.at(size_t(i)) = sl.at(i).toFloat();
+    }
+    if (json.contains("camTranslation"))
+    {
+        QStringList sl = json["camTranslation"].toVariant().toString().split(' ');
+        if (sl.length() >= 3)
+            for (int i = 0; i < 3; ++i)
+                frame.translation.at(size_t(i)) = sl.at(i).toFloat();
+    }
+}
+
+/*
+ * CameraPath::view_matrix
+ */
+std::array<float, 16> CameraPath::view_matrix(const Frame &frame)
+{
+    // see VolumeRenderWidget::updateViewMatrix
+    const QQuaternion rotation(frame.rotation.at(0), frame.rotation.at(1),
+                               frame.rotation.at(2), frame.rotation.at(3));
+    const QVector3D translation(frame.translation.at(0), frame.translation.at(1),
+                                frame.translation.at(2));
+    QMatrix4x4 viewMat;
+    viewMat.rotate(rotation);
+    viewMat.translate(translation);
+    viewMat.scale(translation.z());
+
+    std::array<float, 16> viewArray;
+    const QMatrix4x4 transposed = viewMat.transposed();
+    for (size_t i = 0; i < viewArray.size(); ++i)
+        viewArray.at(i) = transposed.constData()[i];
+    return viewArray;
+}
@@ -0,0 +1,107 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <optional>
+
+class QJsonObject;
+class QString;
+
+/// <summary>
+/// Camera path for batch rendering. Reads the interaction sequences recorded by the
+/// VolumeRenderWidget (one frame per camera line), the view configurations recorded by
+/// VolumeRenderWidget::recordViewConfig (paired <name>_quat.txt and <name>_trans.txt files)
+/// and the JSON state files written by the MainWindow (a single frame including the
+/// rendering flags).
+/// </summary>
+class CameraPath
+{
+public:
+    /// <summary>
+    /// Camera and data state of one frame.
+    /// </summary>
+    struct Frame
+    {
+        std::array<float, 4> rotation = {{1.f, 0.f, 0.f, 0.f}};    // quaternion w, x, y, z
+        std::array<float, 3> translation = {{0.f, 0.f, 2.f}};
+        size_t timestep = 0;
+        long tff = -1;  // index of the transfer function set before this frame, -1: unchanged
+    };
+
+    /// <summary>
+    /// Rendering settings of a JSON state file, unset if not contained.
+    /// </summary>
+    struct Settings
+    {
+        std::optional<double> samplingRate;
+        std::optional<bool> linear;
+        std::optional<bool> ambientOcclusion;
+        std::optional<bool> contours;
+        std::optional<bool> aerial;
+        std::optional<bool> ortho;
+    };
+
+    /// <summary>
+    /// Read a camera path from an interaction sequence, a recorded view configuration or a
+    /// JSON state file (*.json).
+    /// </summary>
+    /// <param name="file_name">Name and full path of the file. For view configurations either
+    /// of the two files or their common prefix.</param>
+    /// <throws>If the file could not be read or does not contain any frame.</throws>
+    void read(const std::string &file_name);
+
+    const std::vector<Frame> &frames() const { return _frames; }
+
+    /// <summary>
+    /// Raw RGBA transfer functions of the sequence, referenced by Frame::tff.
+    /// </summary>
+    const std::vector<std::vector<unsigned char> > &transfer_functions() const { return _tffs; }
+
+    const Settings &settings() const { return _settings; }
+
+    /// <summary>
+    /// Read the camera and rendering settings of a JSON state object, keys that are not
+    /// contained leave the frame and settings unchanged.
+    /// </summary>
+    /// <param name="json">State as written by MainWindow::saveCamState.</param>
+    /// <param name="frame">Camera of the frame.</param>
+    /// <param name="settings">Rendering settings.</param>
+    static void read_state(const QJsonObject &json, Frame &frame, Settings &settings);
+
+    /// <summary>
+    /// Get the transposed view matrix of a frame, as set up by the VolumeRenderWidget.
+    /// </summary>
+    static std::array<float, 16> view_matrix(const Frame &frame);
+
+private:
+    void read_sequence(const std::string &file_name);
+    void read_view_config(const QString &prefix);
+    void read_json(const std::string &file_name);
+
+    std::vector<Frame> _frames;
+    std::vector<std::vector<unsigned char> > _tffs;
+    Settings _settings;
+};
@@ -0,0 +1,260 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/cli/framewriter.h"
+#include "src/io/halffloat.h"
+
+#include <QImage>
+#include <QString>
+
+#include <iostream>
+#include <fstream>
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+
+/**
+ * @brief Append a value in little endian byte order.
+ */
+template<typename T>
+static void put(std::vector<char> &out, const T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i)
+        out.push_back(char((uint64_t(value) >> (8*i)) & 0xffu));
+}
+
+static void put_float(std::vector<char> &out, const float value)
+{
+    uint32_t bits = 0;
+    std::memcpy(&bits, &value, sizeof(float));
+    put(out, bits);
+}
+
+static void put_attribute(std::vector<char> &out, const char *name, const char *type,
+                          const std::vector<char> &value)
+{
+    out.insert(out.end(), name, name + std::strlen(name) + 1);
+    out.insert(out.end(), type, type + std::strlen(type) + 1);
+    put(out, int32_t(value.size()));
+    out.insert(out.end(), value.begin(), value.end());
+}
+
+
+/*
+ * FrameWriter::FrameWriter
+ */
+FrameWriter::FrameWriter(size_t workers)
+{
+    if (workers == 0)
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < workers; ++i)
+        _workers.push_back(std::thread(&FrameWriter::run, this));
+}
+
+/*
+ * FrameWriter::~FrameWriter
+ */
+FrameWriter::~FrameWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+    for (auto &w : _workers)
+        w.join();
+}
+
+/*
+ * FrameWriter::write
+ */
+void FrameWriter::write(const unsigned char *pixels, size_t width, size_t height,
+                        const std::string &file_name, image_format format,
+                        std::function<void()> consumed)
+{
+    std::function<bool()> job = [=]()
+    {
+        if (format == EXR)
+            return write_exr(pixels, width, height, file_name, consumed);
+        return write_png(pixels, width, height, file_name, consumed);
+    };
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _jobs.push(job);
+        ++_pending;
+    }
+    _cv.notify_one();
+}
+
+/*
+ * FrameWriter::finish
+ */
+void FrameWriter::finish()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cvIdle.wait(lock, [&]{ return _pending == 0; });
+}
+
+/*
+ * FrameWriter::failed
+ */
+size_t FrameWriter::failed() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _failed;
+}
+
+/*
+ * FrameWriter::run
+ */
+void FrameWriter::run()
+{
+    while (true)
+    {
+        std::function<bool()> job;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            // pending jobs are written before stopping
+            _cv.wait(lock, [&]{ return _stop || !_jobs.empty(); });
+            if (_jobs.empty())
+                return;
+            job = std::move(_jobs.front());
+            _jobs.pop();
+        }
+        const bool ok = job();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!ok)
+                ++_failed;
+            --_pending;
+        }
+        _cvIdle.notify_all();
+    }
+}
+
+/*
+ * FrameWriter::write_png
+ */
+bool FrameWriter::write_png(const unsigned char *pixels, size_t width, size_t height,
+                            const std::string &file_name, const std::function<void()> &consumed)
+{
+    // the output image starts with the bottom row, mirrored() creates a deep copy
+    const QImage img = QImage(pixels, int(width), int(height), int(width*4),
+                              QImage::Format_RGBA8888).mirrored();
+    consumed();
+    if (!img.save(QString::fromStdString(file_name), "PNG"))
+    {
+        std::cerr << "WARNING: Could not write " << file_name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/*
+ * FrameWriter::write_exr
+ */
+bool FrameWriter::write_exr(const unsigned char *pixels, size_t width, size_t height,
+                            const std::string &file_name, const std::function<void()> &consumed)
+{
+    std::array<uint16_t, 256> lut;
+    for (size_t i = 0; i < lut.size(); ++i)
+        lut.at(i) = float_to_half(float(i) / 255.f);
+
+    // uncompressed scan line image with half float channels in alphabetical order (ABGR)
+    const size_t lineSize = width * 4 * sizeof(uint16_t);
+    std::vector<uint16_t> lines(width * height * 4);
+    for (size_t y = 0; y < height; ++y)
+    {
+        // first scan line is the top row
+        const unsigned char *src = pixels + (height - 1 - y) * width * 4;
+        uint16_t *dst = lines.data() + y * width * 4;
+        for (size_t x = 0; x < width; ++x)
+        {
+            dst[x]             = lut.at(src[x*4 + 3]);
+            dst[width + x]     = lut.at(src[x*4 + 2]);
+            dst[2*width + x]   = lut.at(src[x*4 + 1]);
+            dst[3*width + x]   = lut.at(src[x*4 + 0]);
+        }
+    }
+    consumed();
+
+    std::vector<char> header;
+    put(header, int32_t(20000630));     // magic number
+    put(header, int32_t(2));            // version 2, single part scan line file
+
+    std::vector<char> value;
+    for (const char *c : {"A", "B", "G", "R"})
+    {
+        value.push_back(*c);
+        value.push_back('\0');
+        put(value, int32_t(1));         // HALF
+        put(value, uint32_t(0));        // pLinear, reserved
+        put(value, int32_t(1));         // x sampling
+        put(value, int32_t(1));         // y sampling
+    }
+    value.push_back('\0');
+    put_attribute(header, "channels", "chlist", value);
+    put_attribute(header, "compression", "compression", std::vector<char>(1, 0));
+    value.clear();
+    put(value, int32_t(0));
+    put(value, int32_t(0));
+    put(value, int32_t(width - 1));
+    put(value, int32_t(height - 1));
+    put_attribute(header, "dataWindow", "box2i", value);
+    put_attribute(header, "displayWindow", "box2i", value);
+    put_attribute(header, "lineOrder", "lineOrder", std::vector<char>(1, 0));
+    value.clear();
+    put_float(value, 1.f);
+    put_attribute(header, "pixelAspectRatio", "float", value);
+    put_attribute(header, "screenWindowWidth", "float", value);
+    value.clear();
+    put_float(value, 0.f);
+    put_float(value, 0.f);
+    put_attribute(header, "screenWindowCenter", "v2f", value);
+    header.push_back('\0');
+
+    // line offset table, one chunk per scan line
+    const uint64_t chunkSize = 2*sizeof(int32_t) + lineSize;
+    const uint64_t firstChunk = header.size() + height * sizeof(uint64_t);
+    for (size_t y = 0; y < height; ++y)
+        put(header, uint64_t(firstChunk + y * chunkSize));
+
+    std::ofstream os(file_name, std::ios::out | std::ios::trunc | std::ofstream::binary);
+    os.write(header.data(), std::streamsize(header.size()));
+    std::vector<char> chunk;
+    for (size_t y = 0; y < height; ++y)
+    {
+        chunk.clear();
+        put(chunk, int32_t(y));
+        put(chunk, int32_t(lineSize));
+        for (size_t i = 0; i < width * 4; ++i)
+            put(chunk, lines.at(y * width * 4 + i));
+        os.write(chunk.data(), std::streamsize(chunk.size()));
+    }
+    if (!os)
+    {
+        std::cerr << "WARNING: Could not write " << file_name << std::endl;
+        return false;
+    }
+    return true;
+}
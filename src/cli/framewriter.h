@@ -0,0 +1,101 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/// <summary>
+/// Encodes rendered frames into image files (PNG or uncompressed half float OpenEXR)
+/// on a pool of worker threads.
+/// </summary>
+class FrameWriter
+{
+public:
+    enum image_format
+    {
+        PNG = 0,
+        EXR
+    };
+
+    /// <summary>
+    /// Start the worker threads.
+    /// </summary>
+    /// <param name="workers">Number of worker threads, 0: one per hardware thread.</param>
+    explicit FrameWriter(size_t workers = 0);
+
+    /// <summary>
+    /// Write all queued frames and stop the worker threads.
+    /// </summary>
+    ~FrameWriter();
+
+    FrameWriter(const FrameWriter &) = delete;
+    FrameWriter &operator=(const FrameWriter &) = delete;
+
+    /// <summary>
+    /// Queue a frame for encoding.
+    /// </summary>
+    /// <param name="pixels">RGBA8 pixel data, bottom row first.</param>
+    /// <param name="width">Image width in pixels.</param>
+    /// <param name="height">Image height in pixels.</param>
+    /// <param name="file_name">Name and full path of the image file.</param>
+    /// <param name="format">Image file format.</param>
+    /// <param name="consumed">Called on the worker thread as soon as the pixel data was
+    /// copied, i.e. before the file is encoded and written. The pixel data must stay valid
+    /// until then.</param>
+    void write(const unsigned char *pixels, size_t width, size_t height,
+               const std::string &file_name, image_format format,
+               std::function<void()> consumed);
+
+    /// <summary>
+    /// Wait until all queued frames are written.
+    /// </summary>
+    void finish();
+
+    /// <summary>
+    /// Get the number of frames that could not be written.
+    /// </summary>
+    size_t failed() const;
+
+private:
+    void run();
+
+    static bool write_png(const unsigned char *pixels, size_t width, size_t height,
+                          const std::string &file_name, const std::function<void()> &consumed);
+    static bool write_exr(const unsigned char *pixels, size_t width, size_t height,
+                          const std::string &file_name, const std::function<void()> &consumed);
+
+    std::vector<std::thread> _workers;
+    std::queue<std::function<bool()> > _jobs;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    std::condition_variable _cvIdle;
+    size_t _pending = 0;
+    size_t _failed = 0;
+    bool _stop = false;
+};
@@ -0,0 +1,590 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/core/volumerendercl.h"
+#include "src/cpu/volumerendercpu.h"
+#include "src/cli/camerapath.h"
+#include "src/cli/framewriter.h"
+#include "src/cli/videoencoder.h"
+#include "src/cli/benchmark.h"
+#include "src/cli/streamserver.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QDir>
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <QRegExp>
+#include <QEasingCurve>
+
+#include <iostream>
+#include <fstream>
+#include <deque>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <cstring>
+#include <future>
+#include <memory>
+
+/**
+ * @brief Read a transfer function file, either the control point format (lines of
+ *        "position r g b a") or the raw format (1024 RGBA values), see MainWindow::saveTff
+ *        and MainWindow::saveRawTff.
+ * @param fileName The transfer function file.
+ * @param interpolation Interpolation of the control points.
+ * @return The raw RGBA transfer function.
+ */
+static std::vector<unsigned char> readTransferFunction(const QString &fileName,
+                                                       const QEasingCurve &interpolation)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
+        throw std::invalid_argument("Could not open transfer function file "
+                                    + fileName.toStdString());
+    QTextStream in(&file);
+    std::vector<std::pair<double, std::array<int, 4> > > stops;
+    std::vector<unsigned char> raw;
+    while (!in.atEnd())
+    {
+        QStringList line = in.readLine().split(QRegExp("\\s"), QString::SkipEmptyParts);
+        if (line.size() == 5)
+        {
+            stops.push_back({line.at(0).toDouble(), {{line.at(1).toInt(), line.at(2).toInt(),
+                                                     line.at(3).toInt(), line.at(4).toInt()}}});
+        }
+        else if (line.size() > 5)
+        {
+            for (const QString &v : line)
+                raw.push_back(static_cast<unsigned char>(v.toInt()));
+        }
+    }
+    if (!raw.empty())
+        return raw;
+    if (stops.empty())
+        throw std::invalid_argument("Empty transfer function file " + fileName.toStdString());
+
+    // same sampling as VolumeRenderWidget::updateTransferFunction: eased progress,
+    // linearly interpolated between the control points
+    const size_t tffSize = 1024;
+    const double granularity = 8192.0;
+    std::vector<unsigned char> tff(tffSize*4, 0);
+    for (size_t i = 0; i < tffSize; ++i)
+    {
+        const double t = qRound(double(i)/double(tffSize) * granularity) / granularity;
+        const double p = interpolation.valueForProgress(t);
+        size_t k = 0;
+        while (k + 1 < stops.size() && stops.at(k + 1).first < p)
+            ++k;
+        const auto &a = stops.at(k);
+        const auto &b = stops.at(std::min(k + 1, stops.size() - 1));
+        const double range = b.first - a.first;
+        const double f = range > 0.0 ? qBound(0.0, (p - a.first) / range, 1.0) : 0.0;
+        for (size_t c = 0; c < 4; ++c)
+        {
+            const int v = int(a.second.at(c) + (b.second.at(c) - a.second.at(c)) * f);
+            tff.at(i*4 + c) = static_cast<unsigned char>(qBound(0, v - 3, 255));
+        }
+    }
+    return tff;
+}
+
+/**
+ * @brief Set a raw transfer function and its alpha prefix sum.
+ */
+template<class Renderer>
+static void setTransferFunction(Renderer &renderer, std::vector<unsigned char> tff)
+{
+    std::vector<unsigned int> prefixSum(tff.size() / 4);
+    for (size_t i = 0; i < prefixSum.size(); ++i)
+        prefixSum.at(i) = tff.at(i*4 + 3);
+    std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
+    renderer.setTransferFunction(tff);
+    renderer.setTffPrefixSum(prefixSum);
+}
+
+
+/**
+ * @brief Options of a batch rendering run.
+ */
+struct BatchOptions
+{
+    QString volume;
+    QString tff;
+    QEasingCurve interpolation = QEasingCurve(QEasingCurve::Linear);
+    size_t width = 1024;
+    size_t height = 1024;
+    size_t ringSize = 3;
+    size_t parallelFrames = 1;      // frames rendered at the same time, one per device
+    size_t workers = 0;
+    FrameWriter::image_format format = FrameWriter::PNG;
+    QDir outDir;
+    QString video;                  // encode a video instead of image files
+    double videoFps = 30.0;
+    bool setSamplingRate = false;
+    double samplingRate = 1.0;
+    bool tiled = false;             // render each frame tile by tile, see renderTiledPath
+    VolumeRenderCL::TileSettings tiles;
+};
+
+
+/**
+ * @brief Load the data and apply the settings of the camera path, identical for both backends.
+ */
+template<class Renderer>
+static void setupRenderer(Renderer &renderer, const BatchOptions &opt, const CameraPath &path)
+{
+    DatRawReader::Properties props;
+    props.dat_file_name = opt.volume.toStdString();
+    renderer.loadVolumeData(props);
+    setTransferFunction(renderer, readTransferFunction(opt.tff, opt.interpolation));
+
+    const CameraPath::Settings &s = path.settings();
+    if (opt.setSamplingRate)
+        renderer.updateSamplingRate(opt.samplingRate);
+    else if (s.samplingRate)
+        renderer.updateSamplingRate(*s.samplingRate);
+    if (s.linear)
+        renderer.setLinearInterpolation(*s.linear);
+    if (s.ambientOcclusion)
+        renderer.setAmbientOcclusion(*s.ambientOcclusion);
+    if (s.contours)
+        renderer.setContours(*s.contours);
+    if (s.aerial)
+        renderer.setAerial(*s.aerial);
+    if (s.ortho)
+        renderer.setCamOrtho(*s.ortho);
+
+    // tiled rendering only allocates the images of one tile
+    if (!opt.tiled)
+        renderer.initOutputRing(opt.width, opt.height, opt.ringSize);
+}
+
+
+/**
+ * @brief Render all frames of the camera path and write them to image files.
+ * @return The exit code.
+ */
+template<class Renderer>
+static int renderPath(Renderer &renderer, const BatchOptions &opt, const CameraPath &path)
+{
+    FrameWriter writer(opt.workers);
+    VideoEncoder video;
+    const auto start = std::chrono::steady_clock::now();
+    size_t frameCount = 0;
+    try
+    {
+        if (!opt.video.isEmpty() && !video.start(opt.video.toStdString(), opt.width, opt.height,
+                                                 opt.videoFps))
+            return EXIT_FAILURE;
+        // frames whose kernel or readback is still running, oldest first
+        std::deque<std::pair<size_t, size_t> > inFlight;   // ring slot, frame number
+        auto retire = [&]()
+        {
+            const size_t slot = inFlight.front().first;
+            const QString name = QString("frame_%1.%2").arg(inFlight.front().second, 6, 10,
+                                                             QChar('0'))
+                                 .arg(opt.format == FrameWriter::EXR ? "exr" : "png");
+            inFlight.pop_front();
+            const unsigned char *pixels = renderer.waitFrame(slot);
+            // the frames are retired in order
+            if (video.running())
+            {
+                video.write(pixels, [&renderer, slot]() { renderer.releaseFrame(slot); });
+                return;
+            }
+            writer.write(pixels, opt.width, opt.height,
+                         opt.outDir.filePath(name).toStdString(), opt.format,
+                         [&renderer, slot]() { renderer.releaseFrame(slot); });
+        };
+
+        for (const auto &frame : path.frames())
+        {
+            if (frame.tff >= 0)
+                setTransferFunction(renderer, path.transfer_functions().at(size_t(frame.tff)));
+            renderer.setTimestep(frame.timestep);
+            renderer.updateView(CameraPath::view_matrix(frame));
+            inFlight.push_back({renderer.enqueueRaycastNoGL(), frameCount++});
+            // hand over the previous frame(s) while this frame's kernel is running
+            while (inFlight.size() > opt.parallelFrames)
+                retire();
+        }
+        while (!inFlight.empty())
+            retire();
+        writer.finish();
+        if (!video.finish())
+            return EXIT_FAILURE;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        writer.finish();
+        video.finish();
+        return EXIT_FAILURE;
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                         - start).count();
+    std::cout << "Rendered " << frameCount << " frames in " << seconds << " s ("
+              << (seconds > 0.0 ? double(frameCount) / seconds : 0.0) << " fps), "
+              << writer.failed() << " failed to write." << std::endl;
+    return writer.failed() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+/**
+ * @brief Render all frames of the camera path as sequences of tiles with bounded device memory,
+ *        the finished tiles are assembled in host memory and written to image files.
+ * @return The exit code.
+ */
+static int renderTiledPath(VolumeRenderCL &renderer, const BatchOptions &opt,
+                           const CameraPath &path)
+{
+    FrameWriter writer(opt.workers);
+    const auto start = std::chrono::steady_clock::now();
+    size_t frameCount = 0;
+    size_t tileCount = 0;
+    std::vector<unsigned char> frame(opt.width*opt.height*4);
+    // copy of the last frame by the writer, before the tiles of the next frame are assembled
+    std::future<void> consumed;
+    try
+    {
+        for (const auto &f : path.frames())
+        {
+            if (f.tff >= 0)
+                setTransferFunction(renderer, path.transfer_functions().at(size_t(f.tff)));
+            renderer.setTimestep(f.timestep);
+            renderer.updateView(CameraPath::view_matrix(f));
+            if (consumed.valid())
+                consumed.wait();
+            renderer.renderTiled(opt.width, opt.height, opt.tiles,
+                                 [&](const VolumeRenderCL::Tile &tile)
+            {
+                // both the tiles and the frame start with the bottom row
+                for (size_t row = 0; row < tile.height; ++row)
+                    std::memcpy(frame.data() + ((tile.y + row)*opt.width + tile.x)*4,
+                                tile.pixels + row*tile.width*4, tile.width*4);
+                ++tileCount;
+            });
+            const QString name = QString("frame_%1.%2").arg(frameCount++, 6, 10, QChar('0'))
+                                 .arg(opt.format == FrameWriter::EXR ? "exr" : "png");
+            auto promise = std::make_shared<std::promise<void> >();
+            consumed = promise->get_future();
+            writer.write(frame.data(), opt.width, opt.height,
+                         opt.outDir.filePath(name).toStdString(), opt.format,
+                         [promise]() { promise->set_value(); });
+        }
+        writer.finish();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        writer.finish();
+        return EXIT_FAILURE;
+    }
+
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                         - start).count();
+    std::cout << "Rendered " << frameCount << " frames (" << tileCount << " tiles) in "
+              << seconds << " s, " << writer.failed() << " failed to write." << std::endl;
+    return writer.failed() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("VolumeRaycasterCLI");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless batch rendering of camera paths and benchmarks, "
+                                     "remote rendering server.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("volume", "Volume data file (*.dat).");
+    parser.addPositionalArgument("tff", "Transfer function file (*.tff).");
+    parser.addPositionalArgument("camera", "Interaction sequence, recorded view configuration "
+                                           "(<name>_quat.txt/<name>_trans.txt) or JSON "
+                                           "state file, not used for benchmarks and the server.");
+    QCommandLineOption widthOpt({"W", "width"}, "Image width in pixels.", "pixels", "1024");
+    QCommandLineOption heightOpt({"H", "height"}, "Image height in pixels.", "pixels", "1024");
+    QCommandLineOption outputOpt({"o", "output"}, "Output directory.", "dir", "frames");
+    QCommandLineOption formatOpt({"f", "format"}, "Image format: png or exr.", "format", "png");
+    QCommandLineOption ringOpt("frames-in-flight", "Number of rotating output images (2-3).",
+                               "n", "3");
+    QCommandLineOption workersOpt("workers", "Image encoding threads, 0: all cores.", "n", "0");
+    QCommandLineOption videoOpt("video", "Encode the frames into a video file with ffmpeg "
+                                "instead of writing images.", "file");
+    QCommandLineOption videoFpsOpt("video-fps", "Frame rate of the video.", "fps", "30");
+    QCommandLineOption tiledOpt("tiled", "Render each frame as a sequence of tiles with bounded "
+                                "device memory, e.g. for very high resolutions.");
+    QCommandLineOption tileBudgetOpt("tile-budget", "Kernel time per tile dispatch the tile size "
+                                     "adapts to.", "ms", "100");
+    QCommandLineOption maxTileOpt("max-tile", "Maximum edge length of a tile.", "pixels", "2048");
+    QCommandLineOption iterationsOpt("iterations", "Accumulated iterations per tile, e.g. for "
+                                     "path tracing.", "n", "1");
+    QCommandLineOption pathtraceOpt("pathtrace", "Use the path tracer instead of the ray caster.");
+    QCommandLineOption samplingOpt("sampling-rate", "Ray sampling rate per voxel.", "rate");
+    QCommandLineOption interpolOpt("tff-interpolation",
+                                   "Interpolation of control points: linear, quad or cubic.",
+                                   "type", "linear");
+    QCommandLineOption backendOpt("backend", "Render backend: opencl or native (multithreaded "
+                                  "CPU ray caster).", "backend", "opencl");
+    QCommandLineOption threadsOpt("render-threads", "Render threads of the native backend, "
+                                  "0: all cores.", "n", "0");
+    QCommandLineOption cpuOpt("cpu", "Use an OpenCL CPU device.");
+    QCommandLineOption deviceOpt("device", "Name of the OpenCL device.", "name");
+    QCommandLineOption platformOpt("platform", "Id of the OpenCL platform of the device.",
+                                   "id", "0");
+    QCommandLineOption timestepDevicesOpt("timestep-devices", "Comma separated ids of "
+                                          "additional GPUs of the platform, each one holds and "
+                                          "renders a share of the timesteps.", "ids");
+    QCommandLineOption storageOpt("storage", "Precision of the volume in device memory: native, "
+                                  "half, unorm16 or unorm8.", "format", "native");
+    QCommandLineOption gradientOpt("gradient-volume", "Precompute the gradients of the volume "
+                                   "(4 bytes per voxel of device memory).");
+    QCommandLineOption preIntegrationOpt("preintegration", "Use a pre-integrated transfer "
+                                         "function for the segments between samples.");
+    QCommandLineOption megakernelOpt("pathtrace-megakernel", "Trace the paths in the raycasting "
+                                     "kernel instead of the wavefront path tracer.");
+    QCommandLineOption noTuneOpt("no-autotune", "Use the default work-group shapes instead of "
+                                 "the ones tuned for the device.");
+    QCommandLineOption ioWorkersOpt("io-workers", "Threads reading the timesteps of a time "
+                                    "series concurrently, 0: depending on the cores.", "n", "0");
+    QCommandLineOption writeChunkedOpt("write-chunked", "Convert the volume to a chunked, "
+                                       "compressed volume container and exit.", "file");
+    QCommandLineOption benchmarkOpt("benchmark", "Run the benchmark and write the results to "
+                                    "<results>.csv and <results>.json.", "results");
+    QCommandLineOption benchConfigOpt("benchmark-config", "Benchmark configuration matrix "
+                                      "(JSON).", "file");
+    QCommandLineOption serveOpt("serve", "Stream the rendered frames to a remote client "
+                                "connecting to the given TCP port.", "port");
+    QCommandLineOption latencyOpt("stream-latency", "Round trip time the image scale of the "
+                                  "streamed frames adapts to.", "ms", "100");
+    QCommandLineOption qualityOpt("jpeg-quality", "Quality of the streamed frames (1-100).",
+                                  "q", "80");
+    parser.addOptions({widthOpt, heightOpt, outputOpt, formatOpt, ringOpt, workersOpt,
+                       samplingOpt, interpolOpt, backendOpt, threadsOpt, cpuOpt, deviceOpt,
+                       platformOpt, timestepDevicesOpt, storageOpt, gradientOpt, preIntegrationOpt,
+                       megakernelOpt, noTuneOpt, ioWorkersOpt, writeChunkedOpt, benchmarkOpt,
+                       benchConfigOpt, serveOpt, latencyOpt, qualityOpt, videoOpt, videoFpsOpt,
+                       tiledOpt, tileBudgetOpt, maxTileOpt, iterationsOpt, pathtraceOpt});
+    parser.process(app);
+
+    const bool benchmark = parser.isSet(benchmarkOpt);
+    const bool serve = parser.isSet(serveOpt);
+    const bool native = parser.value(backendOpt).toLower() == "native";
+    const bool tiled = parser.isSet(tiledOpt);
+    const QStringList args = parser.positionalArguments();
+    if (parser.isSet(writeChunkedOpt))
+    {
+        if (args.isEmpty())
+            parser.showHelp(EXIT_FAILURE);
+        try
+        {
+            // the time steps are converted one after the other
+            DatRawReader dr;
+            DatRawReader::Properties props;
+            props.dat_file_name = args.at(0).toStdString();
+            dr.read_files(props, 1);
+            dr.write_chunked(parser.value(writeChunkedOpt).toStdString());
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "ERROR: " << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    if (args.size() < (benchmark || serve ? 2 : 3))
+        parser.showHelp(EXIT_FAILURE);
+    if (benchmark && native)
+    {
+        std::cerr << "ERROR: The benchmark requires the OpenCL backend." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (serve && (native || benchmark))
+    {
+        std::cerr << "ERROR: The server requires the OpenCL backend." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (parser.isSet(timestepDevicesOpt) && (native || benchmark || serve))
+    {
+        std::cerr << "ERROR: Timestep devices require batch rendering with the OpenCL backend."
+                  << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (tiled && (native || benchmark || serve || parser.isSet(timestepDevicesOpt)
+                  || parser.isSet(videoOpt)))
+    {
+        std::cerr << "ERROR: Tiled rendering requires batch rendering of images with the OpenCL "
+                     "backend on a single device." << std::endl;
+        return EXIT_FAILURE;
+    }
+    if (parser.isSet(pathtraceOpt) && native)
+    {
+        std::cerr << "ERROR: Path tracing requires the OpenCL backend." << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    BatchOptions opt;
+    opt.volume = args.at(0);
+    opt.tff = args.at(1);
+    opt.width = size_t(qMax(1, parser.value(widthOpt).toInt()));
+    opt.height = size_t(qMax(1, parser.value(heightOpt).toInt()));
+    opt.ringSize = size_t(qBound(2, parser.value(ringOpt).toInt(), 3));
+    opt.workers = size_t(qMax(0, parser.value(workersOpt).toInt()));
+    opt.format = parser.value(formatOpt).toLower() == "exr" ? FrameWriter::EXR : FrameWriter::PNG;
+    opt.video = parser.value(videoOpt);
+    opt.videoFps = qMax(1.0, parser.value(videoFpsOpt).toDouble());
+    if (parser.value(interpolOpt) == "quad")
+        opt.interpolation.setType(QEasingCurve::InOutQuad);
+    else if (parser.value(interpolOpt) == "cubic")
+        opt.interpolation.setType(QEasingCurve::InOutCubic);
+    opt.setSamplingRate = parser.isSet(samplingOpt);
+    opt.samplingRate = parser.value(samplingOpt).toDouble();
+    opt.tiled = tiled;
+    opt.tiles.maxTileSize = size_t(qMax(1, parser.value(maxTileOpt).toInt()));
+    opt.tiles.dispatchBudget = qMax(1.0, parser.value(tileBudgetOpt).toDouble()) / 1000.0;
+    opt.tiles.iterations = size_t(qMax(1, parser.value(iterationsOpt).toInt()));
+
+    opt.outDir = QDir(parser.value(outputOpt));
+    if (!benchmark && !serve && !opt.outDir.mkpath("."))
+    {
+        std::cerr << "ERROR: Could not create output directory "
+                  << parser.value(outputOpt).toStdString() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    CameraPath path;
+    try
+    {
+        if (!benchmark && !serve)
+            path.read(args.at(2).toStdString());
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (native)
+    {
+        VolumeRenderCPU renderer;
+        try
+        {
+            renderer.initialize(size_t(qMax(0, parser.value(threadsOpt).toInt())));
+            setupRenderer(renderer, opt, path);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Rendering on " << renderer.getCurrentDeviceName() << std::endl;
+        return renderPath(renderer, opt, path);
+    }
+
+    VolumeRenderCL renderer;
+    try
+    {
+        renderer.initialize(false, parser.isSet(cpuOpt), VENDOR_ANY,
+                            parser.value(deviceOpt).toStdString(),
+                            parser.isSet(deviceOpt) ? parser.value(platformOpt).toInt() : -1);
+        if (parser.isSet(timestepDevicesOpt))
+        {
+            std::vector<size_t> ids;
+            for (const QString &id : parser.value(timestepDevicesOpt).split(',',
+                                                                          QString::SkipEmptyParts))
+                ids.push_back(size_t(qMax(0, id.toInt())));
+            renderer.setPeerDevices(size_t(qMax(0, parser.value(platformOpt).toInt())), ids,
+                                    VolumeRenderCL::TIMESTEP_OWNERSHIP);
+            // one frame in flight per device and one more image to render into
+            opt.parallelFrames = renderer.getDeviceCount();
+            opt.ringSize = std::max(opt.ringSize, opt.parallelFrames + 1);
+        }
+        const QString storage = parser.value(storageOpt).toLower();
+        if (storage == "half")
+            renderer.setStorageFormat(VolumeRenderCL::STORAGE_HALF);
+        else if (storage == "unorm16")
+            renderer.setStorageFormat(VolumeRenderCL::STORAGE_UNORM16);
+        else if (storage == "unorm8")
+            renderer.setStorageFormat(VolumeRenderCL::STORAGE_UNORM8);
+        renderer.setGradientVolume(parser.isSet(gradientOpt));
+        renderer.setPreIntegration(parser.isSet(preIntegrationOpt));
+        renderer.setWavefrontPathtracing(!parser.isSet(megakernelOpt));
+        renderer.setAutoTuning(!parser.isSet(noTuneOpt));
+        if (parser.isSet(pathtraceOpt))
+            renderer.setTechnique(VolumeRenderCL::TECH_PATHTRACE);
+        renderer.setIoWorkers(size_t(qMax(0, parser.value(ioWorkersOpt).toInt())));
+        setupRenderer(renderer, opt, path);
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (benchmark)
+    {
+        Benchmark bench;
+        try
+        {
+            if (parser.isSet(benchConfigOpt))
+                bench.read_config(parser.value(benchConfigOpt).toStdString());
+            bench.config().frames_in_flight = opt.ringSize;
+            bench.set_labels(args.at(0).toStdString(), renderer.getCurrentDeviceName() + " ("
+                            + renderer.getCurrentDriverVersion() + ")");
+            bench.run(renderer);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << e.what() << std::endl;
+            return EXIT_FAILURE;
+        }
+        const std::string results = parser.value(benchmarkOpt).toStdString();
+        if (!bench.write_csv(results + ".csv") || !bench.write_json(results + ".json"))
+        {
+            std::cerr << "ERROR: Could not write benchmark results " << results << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << "Wrote benchmark results " << results << ".csv/.json" << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+    if (serve)
+    {
+        StreamServer::Config config;
+        config.port = uint16_t(qBound(0, parser.value(serveOpt).toInt(), 65535));
+        config.width = opt.width;
+        config.height = opt.height;
+        config.quality = qBound(1, parser.value(qualityOpt).toInt(), 100);
+        config.target_latency = qMax(1, parser.value(latencyOpt).toInt()) / 1000.0;
+        StreamServer server(config);
+        return server.run(renderer);
+    }
+
+    if (opt.tiled)
+        return renderTiledPath(renderer, opt, path);
+    return renderPath(renderer, opt, path);
+}
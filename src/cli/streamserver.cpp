@@ -0,0 +1,485 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/cli/streamserver.h"
+
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QHostAddress>
+#include <QImage>
+#include <QBuffer>
+#include <QJsonDocument>
+#include <QJsonValue>
+#include <QString>
+
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <memory>
+#include <cmath>
+
+static const uint32_t MAX_MESSAGE_SIZE = 1u << 24;
+
+/**
+ * @brief Append a value in little endian byte order.
+ */
+template<typename T>
+static void put(QByteArray &out, const T value)
+{
+    for (size_t i = 0; i < sizeof(T); ++i)
+        out.append(char((uint64_t(value) >> (8*i)) & 0xffu));
+}
+
+/**
+ * @brief Read the length prefix of a message in little endian byte order.
+ */
+static uint32_t message_size(const QByteArray &in)
+{
+    uint32_t size = 0;
+    for (int i = 0; i < 4; ++i)
+        size |= uint32_t(static_cast<unsigned char>(in.at(i))) << (8*i);
+    return size;
+}
+
+
+/*
+ * StreamServer::StreamServer
+ */
+StreamServer::StreamServer(const Config &config) : _config(config)
+{
+}
+
+/*
+ * StreamServer::run
+ */
+int StreamServer::run(VolumeRenderCL &renderer)
+{
+    _network = std::thread(&StreamServer::network, this);
+
+    // frames whose kernel or readback is still running, oldest first
+    std::deque<std::pair<size_t, Job> > inFlight;   // ring slot, frame
+    const auto retire = [&]()
+    {
+        const size_t slot = inFlight.front().first;
+        Job job = inFlight.front().second;
+        inFlight.pop_front();
+        job.pixels = renderer.waitFrame(slot);
+        job.release = [&renderer, slot]() { renderer.releaseFrame(slot); };
+        queue(job);
+    };
+    // wait for more updates before rendering the last state in full resolution
+    const auto refineDelay = std::chrono::duration<double>(std::max(2.0*_config.target_latency,
+                                                                     0.05));
+    std::array<size_t, 2> viewport = {{_config.width, _config.height}};
+    std::array<size_t, 2> ringSize = {{0, 0}};
+    double scale = 1.0;
+    bool refine = false;
+    uint32_t sequence = 0;
+    try
+    {
+        while (true)
+        {
+            QJsonObject update;
+            bool interaction = false;
+            double rtt = 0.0;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                const auto pipelineFull = [&]{ return inFlight.size() + _outstanding
+                                                      + _sendTimes.size() >= _config.max_unacked; };
+                const auto ready = [&]{ return _stop
+                                               || (_connected && _dirty && !pipelineFull()); };
+                if (!inFlight.empty() && !ready())
+                {
+                    // no newer state to overlap with, hand over the last frame
+                    lock.unlock();
+                    retire();
+                    continue;
+                }
+                if (_cv.wait_for(lock, refine ? refineDelay : std::chrono::duration<double>(0.1),
+                                 ready))
+                {
+                    if (_stop)
+                        break;
+                    // bursts of updates are merged into the latest state
+                    update = _pending;
+                    _pending = QJsonObject();
+                    _dirty = false;
+                    interaction = true;
+                }
+                else if (!refine || !_connected || pipelineFull())
+                {
+                    continue;
+                }
+                rtt = _rtt;
+            }
+
+            apply(renderer, update, viewport);
+            if (interaction)
+                scale = (rtt > 0.0) ? adapt_scale(scale, rtt) : scale;
+            // quantized, so that the output ring is not resized for every frame
+            const double frameScale = interaction ? std::round(scale * 16.0) / 16.0 : 1.0;
+            refine = frameScale < 1.0;
+            std::array<size_t, 2> size = viewport;
+            if (frameScale < 1.0)
+                for (size_t &s : size)
+                    s = std::max(size_t(8), size_t(std::round(double(s) * frameScale / 8.0)) * 8);
+            if (size != ringSize)
+            {
+                while (!inFlight.empty())
+                    retire();
+                drain();
+                renderer.initOutputRing(size.at(0), size.at(1), 3);
+                ringSize = size;
+            }
+
+            renderer.updateView(CameraPath::view_matrix(_frame));
+            Job job;
+            job.width = size.at(0);
+            job.height = size.at(1);
+            job.sequence = ++sequence;
+            inFlight.push_back({renderer.enqueueRaycastNoGL(), job});
+            // the kernel of this frame runs while the previous one is encoded and sent
+            while (inFlight.size() > 1)
+                retire();
+        }
+        while (!inFlight.empty())
+            retire();
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+        _failed = true;
+    }
+    _network.join();
+    return _failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * StreamServer::apply
+ */
+void StreamServer::apply(VolumeRenderCL &renderer, const QJsonObject &update,
+                         std::array<size_t, 2> &viewport)
+{
+    CameraPath::Settings s;
+    CameraPath::read_state(update, _frame, s);
+    if (s.samplingRate)
+        renderer.updateSamplingRate(*s.samplingRate);
+    if (s.linear)
+        renderer.setLinearInterpolation(*s.linear);
+    if (s.ambientOcclusion)
+        renderer.setAmbientOcclusion(*s.ambientOcclusion);
+    if (s.contours)
+        renderer.setContours(*s.contours);
+    if (s.aerial)
+        renderer.setAerial(*s.aerial);
+    if (s.ortho)
+        renderer.setCamOrtho(*s.ortho);
+
+    if (update.contains("timestep") && update["timestep"].isDouble())
+    {
+        _frame.timestep = size_t(std::max(0, update["timestep"].toInt()));
+        renderer.setTimestep(_frame.timestep);
+    }
+    if (update.contains("tffRaw"))
+    {
+        const QByteArray raw = QByteArray::fromBase64(update["tffRaw"].toString().toLatin1());
+        if (raw.size() >= 4 && raw.size() % 4 == 0)
+        {
+            std::vector<unsigned char> tff(raw.begin(), raw.end());
+            std::vector<unsigned int> prefixSum(tff.size() / 4);
+            for (size_t i = 0; i < prefixSum.size(); ++i)
+                prefixSum.at(i) = tff.at(i*4 + 3);
+            std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
+            renderer.setTransferFunction(tff);
+            renderer.setTffPrefixSum(prefixSum);
+        }
+        else
+        {
+            std::cerr << "WARNING: Ignoring invalid transfer function." << std::endl;
+        }
+    }
+    if (update.contains("width") && update["width"].isDouble())
+        viewport.at(0) = size_t(std::clamp(update["width"].toInt(), 8, 8192));
+    if (update.contains("height") && update["height"].isDouble())
+        viewport.at(1) = size_t(std::clamp(update["height"].toInt(), 8, 8192));
+}
+
+/*
+ * StreamServer::adapt_scale
+ */
+double StreamServer::adapt_scale(const double scale, const double rtt) const
+{
+    const double target = _config.target_latency;
+    if (rtt > 0.8*target && rtt < target)
+        return scale;
+    // encoding and transfer times are roughly proportional to the number of pixels
+    const double factor = std::clamp(std::sqrt(target / rtt), 0.8, 1.1);
+    return std::clamp(scale * factor, _config.min_scale, 1.0);
+}
+
+/*
+ * StreamServer::queue
+ */
+void StreamServer::queue(const Job &job)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_connected && !_stop)
+        {
+            _jobs.push_back(job);
+            ++_outstanding;
+            return;
+        }
+    }
+    // nobody to send the frame to
+    job.release();
+}
+
+/*
+ * StreamServer::drain
+ */
+void StreamServer::drain()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cvIdle.wait(lock, [&]{ return _outstanding == 0; });
+}
+
+/*
+ * StreamServer::network
+ */
+void StreamServer::network()
+{
+    // the server and sockets belong to this thread and are used with the blocking API
+    QTcpServer server;
+    if (!server.listen(QHostAddress::Any, _config.port))
+    {
+        std::cerr << "ERROR: Could not listen on port " << _config.port << ": "
+                  << server.errorString().toStdString() << std::endl;
+        std::lock_guard<std::mutex> lock(_mutex);
+        _failed = true;
+    }
+    else
+    {
+        std::cout << "Streaming frames on port " << server.serverPort() << std::endl;
+    }
+
+    std::unique_ptr<QTcpSocket> socket;
+    QByteArray buffer;
+    while (server.isListening())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_stop)
+                break;
+        }
+        if (!socket)
+        {
+            if (!server.waitForNewConnection(100))
+                continue;
+            socket.reset(server.nextPendingConnection());
+            socket->setSocketOption(QAbstractSocket::LowDelayOption, 1);
+            buffer.clear();
+            std::cout << "Client connected from "
+                      << socket->peerAddress().toString().toStdString() << std::endl;
+            {
+                // the current state is rendered for the new client
+                std::lock_guard<std::mutex> lock(_mutex);
+                _connected = true;
+                _dirty = true;
+                _sendTimes.clear();
+                _rtt = 0.0;
+                _frameCount = 0;
+            }
+            _cv.notify_all();
+            continue;
+        }
+
+        Job job;
+        bool hasJob = false;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_jobs.empty())
+            {
+                job = _jobs.front();
+                _jobs.pop_front();
+                hasJob = true;
+            }
+        }
+        bool ok = true;
+        if (hasJob)
+        {
+            ok = send(*socket, job);
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                --_outstanding;
+            }
+            _cvIdle.notify_all();
+        }
+        if (ok)
+            ok = receive(*socket, buffer);
+        if (!ok || socket->state() != QAbstractSocket::ConnectedState)
+        {
+            disconnect();
+            socket.reset();
+        }
+    }
+    disconnect();
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_all();
+}
+
+/*
+ * StreamServer::disconnect
+ */
+void StreamServer::disconnect()
+{
+    std::deque<Job> jobs;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_connected)
+            std::cout << "Client disconnected after " << _frameCount << " frames, round trip "
+                      << _rtt * 1000.0 << " ms" << std::endl;
+        _connected = false;
+        jobs.swap(_jobs);
+        _outstanding -= jobs.size();
+        _sendTimes.clear();
+    }
+    for (auto &job : jobs)
+        job.release();
+    _cvIdle.notify_all();
+    _cv.notify_all();
+}
+
+/*
+ * StreamServer::send
+ */
+bool StreamServer::send(QTcpSocket &socket, Job &job)
+{
+    // the output image starts with the bottom row, mirrored() creates a deep copy
+    const QImage img = QImage(job.pixels, int(job.width), int(job.height), int(job.width*4),
+                              QImage::Format_RGBA8888).mirrored();
+    job.release();
+
+    QByteArray jpeg;
+    QBuffer device(&jpeg);
+    device.open(QIODevice::WriteOnly);
+    if (!img.convertToFormat(QImage::Format_RGB888).save(&device, "JPG", _config.quality))
+    {
+        std::cerr << "WARNING: Could not encode frame " << job.sequence << std::endl;
+        return true;
+    }
+    QByteArray message;
+    put(message, uint32_t(8 + jpeg.size()));
+    put(message, job.sequence);
+    put(message, uint16_t(job.width));
+    put(message, uint16_t(job.height));
+    message.append(jpeg);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _sendTimes[job.sequence] = std::chrono::steady_clock::now();
+        ++_frameCount;
+    }
+    if (socket.write(message) != message.size())
+        return false;
+    while (socket.bytesToWrite() > 0)
+        if (!socket.waitForBytesWritten(1000))
+            return false;
+    return true;
+}
+
+/*
+ * StreamServer::receive
+ */
+bool StreamServer::receive(QTcpSocket &socket, QByteArray &buffer)
+{
+    bool hasJobs = false;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        hasJobs = !_jobs.empty();
+    }
+    // short timeout, rendered frames are picked up between the reads
+    if (socket.bytesAvailable() == 0 && !socket.waitForReadyRead(hasJobs ? 0 : 2))
+        return socket.state() == QAbstractSocket::ConnectedState;
+    buffer.append(socket.readAll());
+    while (buffer.size() >= 4)
+    {
+        const uint32_t size = message_size(buffer);
+        if (size > MAX_MESSAGE_SIZE)
+        {
+            std::cerr << "WARNING: Invalid message size " << size << std::endl;
+            return false;
+        }
+        if (uint32_t(buffer.size()) < 4 + size)
+            break;
+        QJsonParseError error;
+        const QJsonDocument doc = QJsonDocument::fromJson(buffer.mid(4, int(size)), &error);
+        buffer.remove(0, int(4 + size));
+        if (error.error != QJsonParseError::NoError || !doc.isObject())
+        {
+            std::cerr << "WARNING: Ignoring invalid message: "
+                      << error.errorString().toStdString() << std::endl;
+            continue;
+        }
+        handle(doc.object());
+    }
+    return true;
+}
+
+/*
+ * StreamServer::handle
+ */
+void StreamServer::handle(const QJsonObject &message)
+{
+    if (message.contains("quality") && message["quality"].isDouble())
+        _config.quality = std::clamp(message["quality"].toInt(), 1, 100);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (message.contains("ack") && message["ack"].isDouble())
+        {
+            const uint32_t sequence = uint32_t(message["ack"].toDouble());
+            const auto it = _sendTimes.find(sequence);
+            if (it != _sendTimes.end())
+            {
+                const double sample = std::chrono::duration<double>(
+                            std::chrono::steady_clock::now() - it->second).count();
+                _rtt = _rtt > 0.0 ? 0.8*_rtt + 0.2*sample : sample;
+            }
+            // acknowledges all earlier frames as well
+            _sendTimes.erase(_sendTimes.begin(), _sendTimes.upper_bound(sequence));
+        }
+        if (message.contains("quit"))
+            _stop = true;
+        for (auto it = message.begin(); it != message.end(); ++it)
+        {
+            if (it.key() == "ack" || it.key() == "quit" || it.key() == "quality")
+                continue;
+            _pending.insert(it.key(), it.value());
+            _dirty = true;
+        }
+    }
+    _cv.notify_all();
+}
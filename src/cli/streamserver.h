@@ -0,0 +1,132 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include "src/core/volumerendercl.h"
+#include "src/cli/camerapath.h"
+
+#include <QJsonObject>
+#include <QByteArray>
+
+#include <array>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+class QTcpSocket;
+
+/// <summary>
+/// Remote rendering server: renders with the pipelined readback of the renderer
+/// (enqueueRaycastNoGL) and streams the frames as JPEG images to a single TCP client.
+///
+/// All messages are prefixed with their length in bytes (uint32, little endian).
+/// The client sends JSON objects with the keys of the state files (MainWindow::saveCamState,
+/// VolumeRenderWidget::write) and additionally "timestep", "tffRaw" (base64 RGBA transfer
+/// function), "width" and "height" (viewport), "quality" (JPEG quality), "ack" (sequence
+/// number of a displayed frame) and "quit". The server answers with frames of a header
+/// (uint32 sequence number, uint16 width, uint16 height) followed by the JPEG data.
+///
+/// Bursts of updates are merged into the latest state before a frame is rendered, the
+/// kernel of the next frame runs while the current one is encoded and sent, and at most
+/// max_unacked frames are between the renderer and the display of the client. The image
+/// scale follows the measured round trip time, a full resolution frame is rendered once
+/// the interaction stops.
+/// </summary>
+class StreamServer
+{
+public:
+    /// <summary>
+    /// Server settings.
+    /// </summary>
+    struct Config
+    {
+        uint16_t port = 9876;
+        size_t width = 1024;            // initial viewport, changed by the client
+        size_t height = 1024;
+        int quality = 80;
+        double target_latency = 0.1;    // round trip time in seconds the image scale aims at
+        double min_scale = 0.25;
+        size_t max_unacked = 3;         // frames rendered but not displayed by the client
+    };
+
+    explicit StreamServer(const Config &config);
+
+    StreamServer(const StreamServer &) = delete;
+    StreamServer &operator=(const StreamServer &) = delete;
+
+    /// <summary>
+    /// Serve clients one after the other until a client sends "quit".
+    /// </summary>
+    /// <param name="renderer">Renderer with data and transfer function loaded.</param>
+    /// <returns>The exit code.</returns>
+    int run(VolumeRenderCL &renderer);
+
+private:
+    /// <summary>
+    /// A rendered frame waiting for encoding, the pixel data is valid until release.
+    /// </summary>
+    struct Job
+    {
+        const unsigned char *pixels = nullptr;
+        size_t width = 0;
+        size_t height = 0;
+        uint32_t sequence = 0;
+        std::function<void()> release;
+    };
+
+    void network();
+    bool receive(QTcpSocket &socket, QByteArray &buffer);
+    void handle(const QJsonObject &message);
+    bool send(QTcpSocket &socket, Job &job);
+    void disconnect();
+
+    void apply(VolumeRenderCL &renderer, const QJsonObject &update,
+               std::array<size_t, 2> &viewport);
+    double adapt_scale(double scale, double rtt) const;
+    void queue(const Job &job);
+    void drain();
+
+    Config _config;
+    CameraPath::Frame _frame;
+
+    std::thread _network;
+    std::mutex _mutex;
+    std::condition_variable _cv;                // render loop: new state, acks, stop
+    std::condition_variable _cvIdle;            // all queued frames released
+    QJsonObject _pending;                       // merged updates, latest value per key
+    bool _dirty = false;
+    bool _connected = false;
+    bool _stop = false;
+    bool _failed = false;
+    std::deque<Job> _jobs;
+    size_t _outstanding = 0;                    // queued or encoding frames
+    std::map<uint32_t, std::chrono::steady_clock::time_point> _sendTimes;  // not acknowledged
+    double _rtt = 0.0;                          // smoothed round trip time in seconds
+    size_t _frameCount = 0;
+};
@@ -0,0 +1,148 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/cli/videoencoder.h"
+
+#include <QStandardPaths>
+#include <QString>
+
+#include <iostream>
+#include <sstream>
+
+#ifdef _WIN32
+    #define popen _popen
+    #define pclose _pclose
+#endif
+
+/*
+ * VideoEncoder::~VideoEncoder
+ */
+VideoEncoder::~VideoEncoder()
+{
+    finish();
+}
+
+/*
+ * VideoEncoder::available
+ */
+bool VideoEncoder::available()
+{
+    return !QStandardPaths::findExecutable("ffmpeg").isEmpty();
+}
+
+/*
+ * VideoEncoder::start
+ */
+bool VideoEncoder::start(const std::string &file_name, size_t width, size_t height, double fps)
+{
+    finish();
+    if (!available())
+    {
+        std::cerr << "WARNING: ffmpeg was not found, cannot write " << file_name << std::endl;
+        return false;
+    }
+    // the frames start with the bottom row, even sizes for the chroma subsampling
+    std::ostringstream cmd;
+    cmd << "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgba -s " << width << "x" << height
+        << " -r " << fps << " -i - -vf \"vflip,pad=ceil(iw/2)*2:ceil(ih/2)*2\""
+        << " -pix_fmt yuv420p \"" << file_name << "\"";
+#ifdef _WIN32
+    _pipe = popen(cmd.str().c_str(), "wb");
+#else
+    _pipe = popen(cmd.str().c_str(), "w");
+#endif
+    if (_pipe == nullptr)
+    {
+        std::cerr << "WARNING: Could not start ffmpeg for " << file_name << std::endl;
+        return false;
+    }
+    _width = width;
+    _height = height;
+    _stop = false;
+    _failed = false;
+    _worker = std::thread(&VideoEncoder::run, this);
+    return true;
+}
+
+/*
+ * VideoEncoder::write
+ */
+void VideoEncoder::write(const unsigned char *pixels, std::function<void()> consumed)
+{
+    if (!running())
+    {
+        consumed();
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _frames.push({pixels, consumed});
+    }
+    _cv.notify_one();
+}
+
+/*
+ * VideoEncoder::finish
+ */
+bool VideoEncoder::finish()
+{
+    if (!running())
+        return true;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cv.notify_one();
+    _worker.join();
+    // waits for the encoder to write the file
+    if (pclose(_pipe) != 0)
+        _failed = true;
+    _pipe = nullptr;
+    if (_failed)
+        std::cerr << "WARNING: Video encoding failed." << std::endl;
+    return !_failed;
+}
+
+/*
+ * VideoEncoder::run
+ */
+void VideoEncoder::run()
+{
+    const size_t frameSize = _width * _height * 4;
+    while (true)
+    {
+        std::pair<const unsigned char *, std::function<void()> > frame;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            // pending frames are encoded before stopping
+            _cv.wait(lock, [&]{ return _stop || !_frames.empty(); });
+            if (_frames.empty())
+                return;
+            frame = std::move(_frames.front());
+            _frames.pop();
+        }
+        // frames after an error are only released
+        if (!_failed && std::fwrite(frame.first, 1, frameSize, _pipe) != frameSize)
+            _failed = true;
+        frame.second();
+    }
+}
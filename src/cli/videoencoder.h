@@ -0,0 +1,95 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <queue>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+
+/// <summary>
+/// Encodes a sequence of rendered frames into a video file by piping the raw pixel data to
+/// an external ffmpeg process on a background thread, in the order the frames are queued.
+/// </summary>
+class VideoEncoder
+{
+public:
+    VideoEncoder() = default;
+
+    /// <summary>
+    /// Write all queued frames and close the video.
+    /// </summary>
+    ~VideoEncoder();
+
+    VideoEncoder(const VideoEncoder &) = delete;
+    VideoEncoder &operator=(const VideoEncoder &) = delete;
+
+    /// <summary>
+    /// Check if the ffmpeg executable can be found in the search path.
+    /// </summary>
+    static bool available();
+
+    /// <summary>
+    /// Start the encoder process. The codec is chosen by ffmpeg based on the file extension.
+    /// </summary>
+    /// <param name="file_name">Name and full path of the video file.</param>
+    /// <param name="width">Frame width in pixels.</param>
+    /// <param name="height">Frame height in pixels.</param>
+    /// <param name="fps">Frame rate of the video.</param>
+    /// <returns><c>true</c> if the encoder was started.</returns>
+    bool start(const std::string &file_name, size_t width, size_t height, double fps);
+
+    /// <summary>
+    /// Queue the next frame of the video.
+    /// </summary>
+    /// <param name="pixels">RGBA8 pixel data, bottom row first.</param>
+    /// <param name="consumed">Called on the encoder thread as soon as the pixel data was
+    /// handed to the encoder. The pixel data must stay valid until then.</param>
+    void write(const unsigned char *pixels, std::function<void()> consumed);
+
+    /// <summary>
+    /// Encode all queued frames, close the video and stop the encoder.
+    /// </summary>
+    /// <returns><c>true</c> if all frames were encoded.</returns>
+    bool finish();
+
+    bool running() const { return _pipe != nullptr; }
+    size_t width() const { return _width; }
+    size_t height() const { return _height; }
+
+private:
+    void run();
+
+    std::FILE *_pipe = nullptr;
+    std::thread _worker;
+    std::queue<std::pair<const unsigned char *, std::function<void()> > > _frames;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    size_t _width = 0;
+    size_t _height = 0;
+    bool _stop = false;
+    bool _failed = false;
+};
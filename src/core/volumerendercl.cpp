@@ -21,15 +21,48 @@
  */
 
 #include "src/core/volumerendercl.h"
+#include "src/io/volumecache.h"
+#include "src/io/halffloat.h"
 #include "inc/hdr_loader.h"
 
 #include <functional>
 #include <algorithm>
 #include <numeric>
+#include <limits>
+#include <cstring>
+#include <chrono>
+#include <sstream>
+#include <iomanip>
+#include <locale>
+#include <cmath>
+#include <fstream>
+#include <cstdio>
 
 #include <omp.h>
 
-static const size_t LOCAL_SIZE = 8;    // 8*8=64 is wavefront size or 2*warp size
+static const uint BRICK_SIZE = 32;     // voxels per brick edge in bricked mode
+static const uint ESS_CELL_SIZE = 8;   // minimum voxels per cell edge of the finest ESS level
+static const uint ESS_MAX_CELLS = 256; // maximum cells per dimension of the finest ESS level
+static const size_t BRICK_UPLOAD_BYTES = 32*1024*1024;  // host to device brick uploads per frame
+static const size_t STREAM_WINDOW = 4;          // resident timesteps if streaming is necessary
+static const size_t PATH_STATE_SIZE = 128;      // sizeof(path_state) in the kernel
+static const size_t PATH_SEGMENTS = 3;          // primary, scatter and shadow free flights
+static const size_t TUNING_WINDOW = 512;        // maximum edge of the timed part of the frame
+static const size_t TUNING_RUNS = 3;            // timed dispatches per candidate after a warm-up
+static const double TUNING_MARGIN = 0.97;       // a candidate must beat the best one by 3%
+// candidate work-group shapes of the auto-tuning, the first one is the default
+static const std::array<std::array<size_t, 2>, 7> FRAME_GROUPS = {{
+    {{8, 8}}, {{16, 4}}, {{4, 16}}, {{32, 2}}, {{16, 8}}, {{8, 16}}, {{16, 16}}}};
+static const std::array<cl_uint, 3> TRAVERSALS = {{0, 4, 16}};  // rows, strips of n groups
+static const std::array<std::array<size_t, 3>, 6> VOLUME_GROUPS = {{
+    {{4, 4, 4}}, {{8, 8, 1}}, {{8, 4, 2}}, {{16, 4, 1}}, {{32, 2, 1}}, {{16, 2, 2}}}};
+
+#ifdef _WIN32
+static const std::string KERNEL_FILE = "kernels//volumeraycast.cl";
+#else
+static const std::string KERNEL_FILE = "kernels/volumeraycast.cl";
+#endif // _WIN32
+static const std::string TUNING_FILE = "workgroups.txt";    // in the user cache directory
 
 /**
  * @brief RoundPow2
@@ -53,6 +86,152 @@ static unsigned int RoundPow2(unsigned int n)
     return (val - n) > (n - x) ? x : val;
 }
 
+/**
+ * @brief Number of levels of the min/max brick hierarchy, the coarsest level has at most
+ *        two nodes per dimension.
+ * @param bricksRes Resolution of the finest level.
+ * @return
+ */
+static cl_uint BrickLevels(const std::array<size_t, 3> &bricksRes)
+{
+    size_t maxRes = std::max(bricksRes.at(0), std::max(bricksRes.at(1), bricksRes.at(2)));
+    cl_uint levels = 1;
+    while (maxRes > 2)
+    {
+        maxRes = (maxRes + 1) / 2;
+        ++levels;
+    }
+    return levels;
+}
+
+/**
+ * @brief Inverse of the upper 3x3 part of a view matrix, which may include the zoom.
+ * @param m The row major view matrix of the kernel.
+ * @param inv Row major inverse.
+ * @return false if the matrix is singular.
+ */
+static bool InvertRotation(const cl_float16 &m, std::array<double, 9> &inv)
+{
+    const std::array<double, 9> r = {{m.s[0], m.s[1], m.s[2], m.s[4], m.s[5], m.s[6],
+                                      m.s[8], m.s[9], m.s[10]}};
+    const double det = r[0]*(r[4]*r[8] - r[5]*r[7]) - r[1]*(r[3]*r[8] - r[5]*r[6])
+                     + r[2]*(r[3]*r[7] - r[4]*r[6]);
+    if (std::abs(det) < 1e-12)
+        return false;
+    inv = {{(r[4]*r[8] - r[5]*r[7])/det,
+            (r[2]*r[7] - r[1]*r[8])/det,
+            (r[1]*r[5] - r[2]*r[4])/det,
+            (r[5]*r[6] - r[3]*r[8])/det,
+            (r[0]*r[8] - r[2]*r[6])/det,
+            (r[2]*r[3] - r[0]*r[5])/det,
+            (r[3]*r[7] - r[4]*r[6])/det,
+            (r[1]*r[6] - r[0]*r[7])/det,
+            (r[0]*r[4] - r[1]*r[3])/det}};
+    return true;
+}
+
+/**
+ * @brief Round up to a multiple.
+ */
+static size_t RoundUp(const size_t n, const size_t multiple)
+{
+    return (n + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * @brief Size of the image order ESS hit images and tile error buffers of a frame, the
+ *        work-groups of all candidate shapes fit.
+ * @param width Width of the output image.
+ * @param height Height of the output image.
+ * @return Number of work-groups per row and column.
+ */
+static std::array<size_t, 2> GroupTiles(const size_t width, const size_t height)
+{
+    std::array<size_t, 2> minShape = FRAME_GROUPS.front();
+    for (const auto &shape : FRAME_GROUPS)
+    {
+        minShape.at(0) = std::min(minShape.at(0), shape.at(0));
+        minShape.at(1) = std::min(minShape.at(1), shape.at(1));
+    }
+    return {{width/minShape.at(0) + 1, height/minShape.at(1) + 1}};
+}
+
+/**
+ * @brief Read the persisted work-group shapes of a kernel.
+ * @param key Device and kernel, see VolumeRenderCL::tuningKey.
+ * @param values The shape values.
+ * @return true if the key has been tuned before.
+ */
+static bool ReadTunedGroups(const std::string &key, std::vector<size_t> &values)
+{
+    const std::string dir = VolumeCache::user_cache_dir();
+    if (dir.empty())
+        return false;
+    // one key per line, separated from the values by a tab
+    std::ifstream is(dir + TUNING_FILE);
+    std::string line;
+    while (std::getline(is, line))
+    {
+        if (line.size() <= key.size() || line.at(key.size()) != '\t'
+                || line.compare(0, key.size(), key) != 0)
+            continue;
+        std::istringstream ss(line.substr(key.size() + 1));
+        values.clear();
+        size_t v = 0;
+        while (ss >> v)
+            values.push_back(v);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Add or replace the persisted work-group shapes of a kernel.
+ * @param key Device and kernel, see VolumeRenderCL::tuningKey.
+ * @param values The shape values.
+ */
+static void StoreTunedGroups(const std::string &key, const std::vector<size_t> &values)
+{
+    const std::string dir = VolumeCache::user_cache_dir();
+    if (dir.empty())
+        return;
+    const std::string name = dir + TUNING_FILE;
+    std::vector<std::string> lines;
+    {
+        std::ifstream is(name);
+        std::string line;
+        while (std::getline(is, line))
+        {
+            if (line.size() <= key.size() || line.at(key.size()) != '\t'
+                    || line.compare(0, key.size(), key) != 0)
+                lines.push_back(line);
+        }
+    }
+    std::ostringstream entry;
+    entry << key << '\t';
+    for (size_t i = 0; i < values.size(); ++i)
+        entry << (i > 0 ? " " : "") << values.at(i);
+    lines.push_back(entry.str());
+
+    // write to a temporary file first, other processes may read the file concurrently
+    const std::string tmpName = name + ".tmp";
+    {
+        std::ofstream os(tmpName, std::ios::out | std::ios::trunc);
+        for (const auto &line : lines)
+            os << line << '\n';
+        if (!os)
+        {
+            os.close();
+            std::remove(tmpName.c_str());
+            std::cerr << "WARNING: Could not write " << name << std::endl;
+            return;
+        }
+    }
+    std::remove(name.c_str());
+    if (std::rename(tmpName.c_str(), name.c_str()) != 0)
+        std::remove(tmpName.c_str());
+}
+
 
 /**
  * @brief VolumeRenderCL::VolumeRenderCL
@@ -73,6 +252,8 @@ VolumeRenderCL::VolumeRenderCL() :
  */
 VolumeRenderCL::~VolumeRenderCL()
 {
+    stopStreaming();
+    releaseOutputRing();
 }
 
 
@@ -96,6 +277,8 @@ void VolumeRenderCL::initialize(bool useGL, bool useCPU, cl_vendor vendor,
                                 const std::string deviceName, const int platformId)
 {
     cl_device_type type = useCPU ? CL_DEVICE_TYPE_CPU : CL_DEVICE_TYPE_GPU;
+    stopStreaming();
+    releaseOutputRing();
     try // opencl scope
     {
         // FIXME: Using CPU segfaults on most tff changes - too many enques for down sampling?
@@ -132,29 +315,80 @@ void VolumeRenderCL::initialize(bool useGL, bool useCPU, cl_vendor vendor,
             }
             _useGL = false;
         }
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+
+    initContextObjects();
+}
+
 
+/**
+ * @brief VolumeRenderCL::initContextObjects
+ */
+void VolumeRenderCL::initContextObjects()
+{
+    try
+    {
         cl_command_queue_properties cqp = 0;
 #ifdef CL_QUEUE_PROFILING_ENABLE
         cqp = CL_QUEUE_PROFILING_ENABLE;
 #endif
         _queueCL = cl::CommandQueue(_contextCL, cqp);
+
+        // placeholders for the page table and brick requests, replaced in bricked mode
+        cl_uint noEntry = 0;
+        _brickCache.pageTable = cl::Image3D(_contextCL, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                            cl::ImageFormat(CL_R, CL_UNSIGNED_INT32),
+                                            1, 1, 1, 0, 0, &noEntry);
+        _brickCache.requests = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, sizeof(cl_uint));
+        _stepCountersMem = cl::Buffer(_contextCL, CL_MEM_READ_WRITE,
+                                      2*NUM_COST_COUNTERS*sizeof(cl_uint));
+        _progressive.activeTiles = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, sizeof(cl_uint));
+        _gradients.placeholder = cl::Image3D(_contextCL, CL_MEM_READ_ONLY,
+                                             cl::ImageFormat(CL_RGBA, CL_UNORM_INT8), 1, 1, 1);
+        _preIntegration.placeholder = cl::Image2D(_contextCL, CL_MEM_READ_ONLY,
+                                                  cl::ImageFormat(CL_RGBA, CL_FLOAT), 1, 1);
+        _preIntegration.table = cl::Image2D();
+        _proxy.placeholder = cl::Image2D(_contextCL, CL_MEM_READ_ONLY,
+                                         cl::ImageFormat(CL_RGBA, CL_FLOAT), 1, 1);
+        _diagnostics.placeholder = cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY,
+                                               cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT32), 1, 1);
+        _diagnostics.image = cl::Image2D();
+        _diagnostics.rendered = false;
+        _reprojection.depthPlaceholder = cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY,
+                                                     cl::ImageFormat(CL_R, CL_FLOAT), 1, 1);
+        _reprojection.maskPlaceholder = cl::Image2D(_contextCL, CL_MEM_READ_ONLY,
+                                                    cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), 1, 1);
+        _reprojection.depth = {{cl::Image2D(), cl::Image2D()}};
+        _reprojection.resolved = cl::Image2D();
+        _reprojection.mask = cl::Image2D();
+        _environmentMap = cl::Image2D();
+        _buildFlags.clear();
+
+        // work-group shapes are tuned per device
+        const cl::Device device = _contextCL.getInfo<CL_CONTEXT_DEVICES>().front();
+        _tuning.device = device.getInfo<CL_DEVICE_NAME>() + "|"
+                + device.getInfo<CL_DRIVER_VERSION>();
+        _tuning.groups = WorkGroups();
+        _tuning.frameKey.clear();
+        _tuning.volumeTuned = false;
+        _rendering_params.traversal = 0;
     }
     catch (cl::Error err)
     {
         logCLerror(err);
     }
 
-#ifdef _WIN32
-    initKernel("kernels//volumeraycast.cl", "-DCL_STD=CL1.2 -DESS -DWIN32");
-#else
-    initKernel("kernels/volumeraycast.cl", "-DCL_STD=CL1.2 -DESS");
-#endif // _WIN32
+    initKernel(KERNEL_FILE, kernelBuildFlags());
 
     // upload volume data to device if already loaded
     if (_dr.has_data())
     {
         // update all memory objects
-        volDataToCLmem(_dr.data());
+        volDataToCLmem();
     }
 }
 
@@ -168,9 +402,22 @@ void VolumeRenderCL::initKernel(const std::string fileName, const std::string bu
 {
     try
     {
-        cl::Program program = buildProgramFromSource(_contextCL, fileName, buildFlags);
+        cl::Program program = buildProgramFromBinaryCache(_contextCL, fileName, buildFlags,
+                                                          VolumeCache::user_cache_dir());
+        _buildFlags = buildFlags;
         _raycastKernel = cl::Kernel(program, "volumeRender");
-        createEnvironmentMap("");
+        // specialized variants of the previous program are outdated
+        for (auto &pending : _variants.pending)
+            _variants.stale.push_back(std::move(pending.second));
+        _variants.pending.clear();
+        _variants.kernels.clear();
+        _variants.kernels[buildFlags] = _raycastKernel;
+        _variants.active = buildFlags;
+        // keep a previously loaded environment map
+        if (_environmentMap() == nullptr)
+            createEnvironmentMap("");
+        else
+            _raycastKernel.setArg(ENVIRONMENT, _environmentMap);
 
         // parameter
         setCameraArgs();
@@ -179,7 +426,19 @@ void VolumeRenderCL::initKernel(const std::string fileName, const std::string bu
         setPathtraceArgs();
 
         _genBricksKernel = cl::Kernel(program, "generateBricks");
+        _genBrickMipsKernel = cl::Kernel(program, "generateBrickMips");
+        _occupancyKernel = cl::Kernel(program, "generateOccupancy");
+        _occupancySlot = -1;
+        _wavefront.generate = cl::Kernel(program, "wavefrontGenerate");
+        _wavefront.freeFlight = cl::Kernel(program, "wavefrontFreeFlight");
+        _wavefront.scatter = cl::Kernel(program, "wavefrontScatter");
+        _wavefront.accumulate = cl::Kernel(program, "wavefrontAccumulate");
+        _wavefront.genMajorants = cl::Kernel(program, "generateMajorants");
+        _wavefront.majorantSlot = -1;
         _downsamplingKernel = cl::Kernel(program, "downsampling");
+        _gradients.kernel = cl::Kernel(program, "generateGradients");
+        _preIntegration.kernel = cl::Kernel(program, "preIntegrateTff");
+        _reprojection.kernel = cl::Kernel(program, "reprojectHistory");
     }
     catch (cl::Error err)
     {
@@ -188,6 +447,138 @@ void VolumeRenderCL::initKernel(const std::string fileName, const std::string bu
 }
 
 
+/**
+ * @brief VolumeRenderCL::kernelBuildFlags
+ * @return
+ */
+const std::string VolumeRenderCL::kernelBuildFlags() const
+{
+    std::string flags = "-DCL_STD=CL1.2";
+#ifdef _WIN32
+    flags += " -DWIN32";
+#endif // _WIN32
+    // bricked mode relies on the brick grid traversal of object order ESS
+    if (_useObjEss || _useBricking)
+        flags += " -DESS";
+    if (_useBricking && _dr.has_data())
+    {
+        const auto &res = _dr.properties().volume_res;
+        flags += " -DPAGED -DBRICK_SIZE=" + std::to_string(BRICK_SIZE);
+        flags += " -DVOL_RES_X=" + std::to_string(res.at(0));
+        flags += " -DVOL_RES_Y=" + std::to_string(res.at(1));
+        flags += " -DVOL_RES_Z=" + std::to_string(res.at(2));
+    }
+    if (_gradients.active)
+        flags += " -DGRADIENT_VOLUME";
+    if (_quantization.scale != 1.f || _quantization.offset != 0.f)
+    {
+        // enough digits to restore the exact float values used for the quantization
+        std::ostringstream ss;
+        ss.imbue(std::locale::classic());
+        ss << std::setprecision(9) << " -DVOL_SCALE=" << _quantization.scale << "f"
+           << " -DVOL_OFFSET=" << _quantization.offset << "f";
+        flags += ss.str();
+    }
+    return flags;
+}
+
+
+/**
+ * @brief VolumeRenderCL::kernelVariantFlags
+ * @return
+ */
+const std::string VolumeRenderCL::kernelVariantFlags() const
+{
+    std::string flags;
+    flags += " -DTECHNIQUE=" + std::to_string(_rendering_params.technique);
+    flags += " -DILLUM_TYPE=" + std::to_string(_rendering_params.illumType);
+    flags += " -DLINEAR_SAMPLING=" + std::to_string(_rendering_params.useLinear);
+    flags += " -DCONTOURS=" + std::to_string(_raycast_params.contours);
+    flags += " -DAERIAL=" + std::to_string(_raycast_params.aerial);
+    flags += " -DAMBIENT_OCCLUSION=" + std::to_string(_raycast_params.useAO);
+    flags += " -DPREINTEGRATED=" + std::to_string(_raycast_params.preIntegrated);
+    if (!_channelOrderDefine.empty())
+        flags += " -DCHANNEL_ORDER=" + _channelOrderDefine;
+    return flags;
+}
+
+
+/**
+ * @brief VolumeRenderCL::selectRaycastVariant
+ */
+void VolumeRenderCL::selectRaycastVariant()
+{
+    // drop finished builds of outdated programs
+    _variants.stale.erase(std::remove_if(_variants.stale.begin(), _variants.stale.end(),
+                                         [](const std::future<cl::Kernel> &f) {
+        return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }),
+                          _variants.stale.end());
+
+    const std::string flags = _buildFlags + kernelVariantFlags();
+    if (flags == _variants.active)
+        return;
+    if (_variants.kernels.find(flags) == _variants.kernels.end())
+    {
+        auto pending = _variants.pending.find(flags);
+        if (pending == _variants.pending.end())
+        {
+            // build in the background, never on the calling (UI) thread
+            cl::Context context = _contextCL;
+            const std::string cacheDir = VolumeCache::user_cache_dir();
+            _variants.pending.emplace(flags, std::async(std::launch::async,
+                                                        [context, flags, cacheDir]() {
+                cl::Program program = buildProgramFromBinaryCache(context, KERNEL_FILE, flags,
+                                                                  cacheDir);
+                return cl::Kernel(program, "volumeRender");
+            }));
+            pending = _variants.pending.find(flags);
+        }
+        if (pending->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            // a different variant may be bound: the generic one is correct for all parameters
+            if (_variants.active != _buildFlags)
+                bindRaycastKernel(_buildFlags);
+            return;
+        }
+        try
+        {
+            _variants.kernels[flags] = pending->second.get();
+        }
+        catch (cl::Error err)
+        {
+            std::cerr << "WARNING: Building kernel variant failed, using generic kernel: "
+                      << err.what() << " (" << getCLErrorString(err.err()) << ")" << std::endl;
+            _variants.kernels[flags] = _variants.kernels.at(_buildFlags);
+        }
+        catch (std::exception &e)
+        {
+            std::cerr << "WARNING: Building kernel variant failed, using generic kernel: "
+                      << e.what() << std::endl;
+            _variants.kernels[flags] = _variants.kernels.at(_buildFlags);
+        }
+        _variants.pending.erase(pending);
+    }
+    bindRaycastKernel(flags);
+}
+
+
+/**
+ * @brief VolumeRenderCL::bindRaycastKernel
+ * @param flags
+ */
+void VolumeRenderCL::bindRaycastKernel(const std::string &flags)
+{
+    _raycastKernel = _variants.kernels.at(flags);
+    _variants.active = flags;
+    if (_environmentMap() != nullptr)
+        _raycastKernel.setArg(ENVIRONMENT, _environmentMap);
+    setCameraArgs();
+    setRenderingArgs();
+    setRaycastArgs();
+    setPathtraceArgs();
+}
+
+
 /**
  * @brief VolumeRenderCL::setMemObjects
  */
@@ -195,13 +586,28 @@ void VolumeRenderCL::setMemObjectsRaycast(const size_t t)
 {
     // TODO: refactor
 
-    _raycastKernel.setArg(VOLUME, _volumesMem.at(t));
-    _raycastKernel.setArg(BRICKS, _bricksMem.at(t));
+    // in streaming mode, only the slot of the active timestep is bound
+    const size_t slot = isStreaming() ? _stream.active : t;
+    if (_useBricking)
+        _wavefront.volume = _brickCache.atlas;
+    else if (_lowRes.enabled && isLowResVolumeSupported())
+    {
+        // the brick grid uses normalized coordinates and stays valid for the down-sampled copy
+        _lowRes.volumes.resize(_volumesMem.size());
+        if (_lowRes.volumes.at(slot)() == nullptr)
+            _lowRes.volumes.at(slot) = downsampleVolume(_volumesMem.at(slot), _lowRes.factor);
+        _wavefront.volume = _lowRes.volumes.at(slot);
+    }
+    else
+        _wavefront.volume = _volumesMem.at(slot);
+    _raycastKernel.setArg(VOLUME, _wavefront.volume);
+    _wavefront.bricks = _bricksMem.at(slot);
+    _raycastKernel.setArg(BRICKS, _wavefront.bricks);
     _raycastKernel.setArg(TFF, _tffMem);
     if (_useGL)
-        _raycastKernel.setArg(OUTPUT, _outputMem);
+        setOutputArg(_outputMem);
     else
-        _raycastKernel.setArg(OUTPUT, _outputMemNoGL);
+        setOutputArg(_outputMemNoGL);
     _raycastKernel.setArg(TFF_PREFIX, _tffPrefixMem);
     cl_float3 modelScale = {{_modelScale[0], _modelScale[1], _modelScale[2]}};
     _rendering_params.modelScale = modelScale;
@@ -214,19 +620,46 @@ void VolumeRenderCL::setMemObjectsRaycast(const size_t t)
     _raycastKernel.setArg(IN_ACCUMULATE, _inAccumulate);
     _raycastKernel.setArg(OUT_ACCUMULATE, _outAccumulate);
 
-    setRenderingArgs();
-}
-
+    _raycastKernel.setArg(PAGE_TABLE, _brickCache.pageTable);
+    _raycastKernel.setArg(BRICK_REQUESTS, _brickCache.requests);
+    _raycastKernel.setArg(BRICK_MIPS, _brickMipsMem.at(slot));
+    _raycastKernel.setArg(ESS_COUNTERS, _stepCountersMem);
+    updateOccupancy(slot);
+    if (usesWavefront())
+        updateMajorants(slot);
+    _raycastKernel.setArg(OCCUPANCY, _occupancyMem);
+    _raycastKernel.setArg(IN_TILE_ERROR, _progressive.inTileError);
+    _raycastKernel.setArg(OUT_TILE_ERROR, _progressive.outTileError);
+    _raycastKernel.setArg(ACTIVE_TILES, _progressive.activeTiles);
+    // the sobel filter and central differences result in different gradients
+    if (_gradients.active && _gradients.sobel != (_rendering_params.illumType == 3))
+        generateGradients();
+    _raycastKernel.setArg(GRADIENTS, _gradients.active ? _gradients.volumes.at(slot)
+                                                       : _gradients.placeholder);
+    if (_raycast_params.preIntegrated)
+        preIntegrateTff();
+    _raycastKernel.setArg(PREINTEGRATION, _preIntegration.table() != nullptr
+                                          ? _preIntegration.table : _preIntegration.placeholder);
+    // the entry distances are only valid if the camera is outside of the volume
+    const cl_float16 &view = _camera_params.viewMat;
+    const bool camInVolume = std::abs(view.s[3]*_modelScale[0]) < 1.f
+                             && std::abs(view.s[7]*_modelScale[1]) < 1.f
+                             && std::abs(view.s[11]*_modelScale[2]) < 1.f;
+    _rendering_params.proxy = 0;
+    if (_useGL && _proxy.active)
+        _rendering_params.proxy = camInVolume ? 1 : 2;
+    if (_rendering_params.proxy)
+        _raycastKernel.setArg(PROXY, _proxy.image);
+    else
+        _raycastKernel.setArg(PROXY, _proxy.placeholder);
+    _raycastKernel.setArg(DIAGNOSTICS, diagnosticImage());
+    const bool reproject = _rendering_params.reproject != REPROJECT_OFF;
+    _raycastKernel.setArg(DEPTH, reproject ? _reprojection.depth.at(0)
+                                           : _reprojection.depthPlaceholder);
+    _raycastKernel.setArg(HISTORY_MASK, reproject ? _reprojection.mask
+                                                  : _reprojection.maskPlaceholder);
 
-/**
- * @brief VolumeRenderCL::setMemObjectsBrickGen
- */
-void VolumeRenderCL::setMemObjectsBrickGen(const size_t t)
-{
-    if (_volumesMem.size() <= size_t(t) || _bricksMem.size() <= size_t(t))
-        throw std::runtime_error("Error loading timeseries data: size mismatch.");
-    _genBricksKernel.setArg(VOLUME, _volumesMem.at(t));
-    _genBricksKernel.setArg(BRICKS, _bricksMem.at(t));
+    setRenderingArgs();
 }
 
 
@@ -239,6 +672,12 @@ const std::string VolumeRenderCL::volumeDownsampling(const size_t t, const int f
 {
     if (!_dr.has_data())
         throw std::runtime_error("No volume data is loaded.");
+    if (_useBricking)
+        throw std::runtime_error("Downsampling is not supported in bricked mode.");
+    if (isStreaming())
+        throw std::runtime_error("Downsampling is not supported in streaming mode.");
+    if (_quantization.active != STORAGE_NATIVE)
+        throw std::runtime_error("Downsampling is not supported with compact storage formats.");
     if (factor < 2)
         throw std::invalid_argument("Factor must be greater or equal 2.");
 
@@ -258,43 +697,18 @@ const std::string VolumeRenderCL::volumeDownsampling(const size_t t, const int f
                                      the resolution would be smaller than the minimum (64x64x64).");
     }
 
-    cl::ImageFormat format;
-    format.image_channel_order = CL_R;
     unsigned int formatMultiplier = 1;
-
-    if (_dr.properties().format == DatRawReader::UCHAR)
-    {
-        format.image_channel_data_type = CL_UNORM_INT8;
-    }
-    else if (_dr.properties().format == DatRawReader::USHORT)
-    {
-        format.image_channel_data_type = CL_UNORM_INT16;
+    if (_dr.properties().format == DatRawReader::USHORT)
         formatMultiplier = 2;
-    }
     else if (_dr.properties().format == DatRawReader::FLOAT)
-    {
-        format.image_channel_data_type = CL_FLOAT;
         formatMultiplier = 4;
-    }
-    else    // double not supported yet
-    {
+    else if (_dr.properties().format != DatRawReader::UCHAR)   // double not supported yet
         throw std::invalid_argument("Unknown or invalid volume data format.");
-    }
 
     try
     {
-        cl::Image3D lowResVol = cl::Image3D(_contextCL,
-                                            CL_MEM_WRITE_ONLY,
-                                            format,
-                                            texSize.at(0), texSize.at(1), texSize.at(2),
-                                            0, 0, nullptr);
-        _downsamplingKernel.setArg(VOLUME, _volumesMem.at(t));
-        _downsamplingKernel.setArg(1, lowResVol);
-
-        cl::NDRange globalThreads(texSize.at(0), texSize.at(1), texSize.at(2));
-        cl::Event ndrEvt;
-        _queueCL.enqueueNDRangeKernel(_downsamplingKernel, cl::NullRange,
-                                      globalThreads, cl::NullRange, nullptr, &ndrEvt);
+        cl::Image3D lowResVol = downsampleVolume(_volumesMem.at(t),
+                                                 static_cast<unsigned int>(factor));
         _queueCL.finish();    // global sync
 
         // read back volume data
@@ -342,263 +756,217 @@ const std::string VolumeRenderCL::volumeDownsampling(const size_t t, const int f
 
 
 /**
- * @brief VolumeRenderCL::calcScaling
+ * @brief VolumeRenderCL::downsampleVolume
+ * @param volume
+ * @param factor
+ * @return
  */
-void VolumeRenderCL::calcScaling()
+cl::Image3D VolumeRenderCL::downsampleVolume(const cl::Image3D &volume, const unsigned int factor)
 {
-    if (!_dr.has_data())
-        return;
-
-    _modelScale = { static_cast<float>(_dr.properties().volume_res.at(0)),
-                    static_cast<float>(_dr.properties().volume_res.at(1)),
-                    static_cast<float>(_dr.properties().volume_res.at(2)) };
-
-    std::valarray<float> thickness = { static_cast<float>(_dr.properties().slice_thickness.at(0)),
-                                       static_cast<float>(_dr.properties().slice_thickness.at(1)),
-                                       static_cast<float>(_dr.properties().slice_thickness.at(2)) };
-    _modelScale *= thickness*(1.f/thickness[0]);
-#undef max  // error here if we don't undef max
-    _modelScale = _modelScale.max() / _modelScale;
+    std::array<size_t, 3> texSize = {{volume.getImageInfo<CL_IMAGE_WIDTH>(),
+                                      volume.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                      volume.getImageInfo<CL_IMAGE_DEPTH>()}};
+    for (auto &s : texSize)
+        s = std::max(size_t(1), (s + factor - 1) / factor);
+
+    const cl_image_format f = volume.getImageInfo<CL_IMAGE_FORMAT>();
+    cl::Image3D lowResVol = cl::Image3D(_contextCL, CL_MEM_READ_WRITE,
+                                        cl::ImageFormat(f.image_channel_order,
+                                                        f.image_channel_data_type),
+                                        texSize.at(0), texSize.at(1), texSize.at(2));
+    _downsamplingKernel.setArg(VOLUME, volume);
+    _downsamplingKernel.setArg(1, lowResVol);
+    // same access pattern as the brick generation
+    const std::array<size_t, 3> &lDim = _tuning.groups.volume;
+    cl::NDRange globalThreads(RoundUp(texSize.at(0), lDim.at(0)),
+                              RoundUp(texSize.at(1), lDim.at(1)),
+                              RoundUp(texSize.at(2), lDim.at(2)));
+    cl::NDRange localThreads(lDim.at(0), lDim.at(1), lDim.at(2));
+    _queueCL.enqueueNDRangeKernel(_downsamplingKernel, cl::NullRange, globalThreads,
+                                  localThreads);
+    return lowResVol;
 }
 
 
 /**
- * @brief VolumeRenderCL::scaleVolume
- * @param scale
+ * @brief VolumeRenderCL::isLowResVolumeSupported
+ * @return
  */
-void VolumeRenderCL::scaleVolume(std::valarray<float> scale)
+bool VolumeRenderCL::isLowResVolumeSupported() const
 {
-    _modelScale *= scale;
+    return _volLoaded && !_useBricking && !isStreaming() && _channelOrderDefine == "CLK_R";
 }
 
 
 /**
- * @brief VolumeRenderCL::updateKernelArgs
- * @param viewMat
+ * @brief VolumeRenderCL::setLowResVolume
+ * @param lowRes
+ * @param factor
  */
-void VolumeRenderCL::updateView(const std::array<float, 16> viewMat)
+void VolumeRenderCL::setLowResVolume(bool lowRes, unsigned int factor)
 {
-    if (!_dr.has_data() || _modelScale.size() < 3)
-        return;
-
-    cl_float16 view;
-    for (size_t i = 0; i < 16; ++i)
-        view.s[i] = viewMat[i];
-    _camera_params.viewMat = view;
-    setCameraArgs();
-    resetIteration();
+    factor = std::max(2u, factor);
+    if (factor != _lowRes.factor)
+        _lowRes.volumes.clear();
+    _lowRes.factor = factor;
+    _lowRes.enabled = lowRes;
+    for (auto &peer : _multiDevice.peers)
+        peer->setLowResVolume(lowRes, factor);
 }
 
 
 /**
- * @brief VolumeRenderCL::updateStepSize
- * @param stepSize
+ * @brief VolumeRenderCL::setStorageFormat
+ * @param format
  */
-void VolumeRenderCL::updateSamplingRate(const double samplingRate)
+void VolumeRenderCL::setStorageFormat(const storage_format format)
 {
-    _raycast_params.samplingRate = static_cast<cl_float>(samplingRate);
-    setRaycastArgs();
+    for (auto &peer : _multiDevice.peers)
+        peer->setStorageFormat(format);
+    if (format == _quantization.requested)
+        return;
+    _quantization.requested = format;
+    if (_dr.has_data())
+    {
+        volDataToCLmem();
+        resetIteration();
+    }
 }
 
+
 /**
- * @brief VolumeRenderCL::setCameraArgs
+ * @brief VolumeRenderCL::getStorageFormat
+ * @return
  */
-void VolumeRenderCL::setCameraArgs()
+VolumeRenderCL::storage_format VolumeRenderCL::getStorageFormat() const
 {
-    try{
-        _raycastKernel.setArg(CAMERA, _camera_params);
-    } catch (cl::Error err) {
-        logCLerror(err);
-    }
+    return _quantization.active;
 }
 
+
 /**
- * @brief VolumeRenderCL::setRenderingArgs
+ * @brief VolumeRenderCL::getQuantizationError
+ * @return
  */
-void VolumeRenderCL::setRenderingArgs()
+VolumeRenderCL::QuantizationError VolumeRenderCL::getQuantizationError() const
 {
-    try{
-        _raycastKernel.setArg(RENDERING, _rendering_params);
-    } catch (cl::Error err) {
-        logCLerror(err);
-    }
+    std::lock_guard<std::mutex> lock(_stream.mutex);
+    QuantizationError error;
+    error.max = _quantization.maxError;
+    if (_quantization.voxels > 0)
+        error.rms = std::sqrt(_quantization.squaredError / double(_quantization.voxels));
+    error.timesteps = _quantization.timesteps;
+    return error;
 }
 
+
 /**
- * @brief VolumeRenderCL::setRaycastArgs
+ * @brief VolumeRenderCL::setIoWorkers
+ * @param workers
  */
-void VolumeRenderCL::setRaycastArgs()
+void VolumeRenderCL::setIoWorkers(const size_t workers)
 {
-    try{
-        _raycastKernel.setArg(RAYCAST, _raycast_params);
-    } catch (cl::Error err) {
-        logCLerror(err);
-    }
+    for (auto &peer : _multiDevice.peers)
+        peer->setIoWorkers(workers);
+    _dr.set_io_workers(workers);
 }
 
+
 /**
- * @brief VolumeRenderCL::setPathtraceArgs
+ * @brief VolumeRenderCL::setGradientVolume
+ * @param precompute
  */
-void VolumeRenderCL::setPathtraceArgs()
+void VolumeRenderCL::setGradientVolume(bool precompute)
 {
-    try{
-        _raycastKernel.setArg(PATHTRACE, _pathtrace_params);
-    } catch (cl::Error err) {
-        logCLerror(err);
+    for (auto &peer : _multiDevice.peers)
+        peer->setGradientVolume(precompute);
+    if (precompute == _gradients.requested)
+        return;
+    _gradients.requested = precompute;
+    if (_dr.has_data())
+    {
+        volDataToCLmem();
+        resetIteration();
     }
 }
 
+
 /**
- * @brief VolumeRenderCL::resetIteration
+ * @brief VolumeRenderCL::hasGradientVolume
+ * @return
  */
-void VolumeRenderCL::resetIteration()
+bool VolumeRenderCL::hasGradientVolume() const
 {
-    _rendering_params.iteration = 0;
-    setRenderingArgs();
+    return _gradients.active;
 }
 
+
 /**
- * @brief VolumeRenderCL::updateOutputImg
- * @param width
- * @param height
+ * @brief VolumeRenderCL::generateGradients
  */
-void VolumeRenderCL::updateOutputImg(const size_t width, const size_t height, GLuint texId)
+void VolumeRenderCL::generateGradients()
 {
-    cl::ImageFormat format;
-    format.image_channel_order = CL_RGBA;
-    format.image_channel_data_type = CL_UNORM_INT8;
+    _gradients.volumes.clear();
+    if (!_gradients.active)
+        return;
+    _gradients.sobel = _rendering_params.illumType == 3;
+    const auto &res = _dr.properties().volume_res;
     try
     {
-        if (_useGL)
+        cl::NDRange globalThreads(res.at(0), res.at(1), res.at(2));
+        for (size_t t = 0; t < _volumesMem.size(); ++t)
         {
-            _outputMem = cl::ImageGL(_contextCL, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, texId);
-        }
-        else
-        {
-            _outputMemNoGL = cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY, format, width, height);
-            _raycastKernel.setArg(OUTPUT, _outputMemNoGL);
+            if (!ownsTimestep(t))
+            {
+                _gradients.volumes.push_back(_gradients.placeholder);
+                continue;
+            }
+            _gradients.volumes.push_back(cl::Image3D(_contextCL, CL_MEM_READ_WRITE,
+                                                     cl::ImageFormat(CL_RGBA, CL_UNORM_INT8),
+                                                     res.at(0), res.at(1), res.at(2)));
+            _gradients.kernel.setArg(0, _volumesMem.at(t));
+            _gradients.kernel.setArg(1, _gradients.volumes.back());
+            _gradients.kernel.setArg(2, cl_uint(_gradients.sobel));
+            _queueCL.enqueueNDRangeKernel(_gradients.kernel, cl::NullRange, globalThreads);
         }
-
-        std::vector<unsigned int> initBuff((width/LOCAL_SIZE+ 1)*(height/LOCAL_SIZE+ 1), 1u);
-        format = cl::ImageFormat(CL_R, CL_UNSIGNED_INT8);
-        _outputHitMem = cl::Image2D(_contextCL, CL_MEM_READ_WRITE, format,
-                                    width/LOCAL_SIZE + 1, height/LOCAL_SIZE + 1);
-        _inputHitMem = cl::Image2D(_contextCL, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, format,
-                                   width/LOCAL_SIZE + 1, height/LOCAL_SIZE + 1, 0,
-                                   const_cast<unsigned int*>(initBuff.data()));
-
-        format.image_channel_order = CL_RGBA;
-        format.image_channel_data_type = CL_UNORM_INT8;
-        _inAccumulate = cl::Image2D(_contextCL, CL_MEM_READ_ONLY , format, width, height);
-        _outAccumulate = cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY, format, width, height);
+        _queueCL.finish();
     }
     catch (cl::Error err)
     {
+        _gradients.volumes.clear();
+        _gradients.active = false;
         logCLerror(err);
     }
 }
 
 
 /**
- * @brief VolumeRenderCL::runRaycast
- * @param imgSize
+ * @brief VolumeRenderCL::setPreIntegration
+ * @param preIntegrate
  */
-void VolumeRenderCL::runRaycast(const size_t width, const size_t height)
+void VolumeRenderCL::setPreIntegration(bool preIntegrate)
 {
-    if (!this->_volLoaded)
-        return;
-    try // opencl scope
-    {
-        setMemObjectsRaycast(_timestep);
-        cl::NDRange globalThreads(width + (LOCAL_SIZE - width % LOCAL_SIZE), height
-                                  + (LOCAL_SIZE - height % LOCAL_SIZE));
-        cl::NDRange localThreads(LOCAL_SIZE, LOCAL_SIZE);
-        cl::Event ndrEvt;
-
-        std::vector<cl::Memory> memObj;
-        memObj.push_back(_outputMem);
-        _queueCL.enqueueAcquireGLObjects(&memObj);
-        _queueCL.enqueueNDRangeKernel(
-                    _raycastKernel, cl::NullRange, globalThreads, localThreads, nullptr, &ndrEvt);
-
-        if (_useImgESS)
-        {
-            // swap hit test buffers
-            cl::Image2D tmp = _outputHitMem;
-            _outputHitMem = _inputHitMem;
-            _inputHitMem = tmp;
-        }
-
-        // swap accumulate buffers
-        _queueCL.enqueueCopyImage(_outAccumulate, _inAccumulate, {0,0,0}, {0,0,0}, {width, height, 1});
-//        cl::Image2D tmp = _outAccumulate;
-//        _outAccumulate = _inAccumulate;
-//        _inAccumulate = tmp;
-//        _raycastKernel.setArg(IN_ACCUMULATE,  (_iteration % 2) ? _outAccumulate : _inAccumulate);
-//        _raycastKernel.setArg(OUT_ACCUMULATE, (_iteration % 2) ? _inAccumulate : _outAccumulate);
-//        _iteration++;
-        _rendering_params.iteration++;
-
-        _queueCL.enqueueReleaseGLObjects(&memObj);
-        _queueCL.finish();    // global sync
-
-#ifdef CL_QUEUE_PROFILING_ENABLE
-        cl_ulong start = 0;
-        cl_ulong end = 0;
-        ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
-        ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
-        _lastExecTime = static_cast<double>(end - start)*1e-9;
-//        std::cout << "Kernel time: " << _lastExecTime << std::endl << std::endl;
-#endif
-    }
-    catch (cl::Error err)
-    {
-        logCLerror(err);
-    }
+    for (auto &peer : _multiDevice.peers)
+        peer->setPreIntegration(preIntegrate);
+    _raycast_params.preIntegrated = static_cast<cl_uint>(preIntegrate);
+    setRaycastArgs();
+    resetIteration();
 }
 
 
 /**
- * @brief VolumeRenderCL::runRaycastNoGL
- * @param width
- * @param height
- * @param t
- * @param output
+ * @brief VolumeRenderCL::setProxyTex
+ * @param texId
  */
-void VolumeRenderCL::runRaycastNoGL(const size_t width, const size_t height,
-                                    std::vector<float> &output)
+void VolumeRenderCL::setProxyTex(cl_GLuint texId)
 {
-    if (!this->_volLoaded)
+    _proxy.active = false;
+    _proxy.image = cl::ImageGL();
+    if (!_useGL || texId == 0)
         return;
-    try // opencl scope
+    try
     {
-        setMemObjectsRaycast(_timestep);
-        cl::NDRange globalThreads(width + (LOCAL_SIZE - width % LOCAL_SIZE),
-                                  height + (LOCAL_SIZE - height % LOCAL_SIZE));
-        cl::NDRange localThreads(LOCAL_SIZE, LOCAL_SIZE);
-        cl::Event ndrEvt;
-
-        _queueCL.enqueueNDRangeKernel(
-                    _raycastKernel, cl::NullRange, globalThreads, localThreads, nullptr, &ndrEvt);
-        output.resize(width*height*4);
-        cl::Event readEvt;
-        std::array<size_t, 3> origin = {{0, 0, 0}};
-        std::array<size_t, 3> region = {{width, height, 1}};
-        _queueCL.enqueueReadImage(_outputMemNoGL,
-                                  CL_TRUE,
-                                  origin, region, 0, 0,
-                                  output.data(),
-                                  nullptr, &readEvt);
-        _queueCL.flush();    // global sync
-
-#ifdef CL_QUEUE_PROFILING_ENABLE
-        cl_ulong start = 0;
-        cl_ulong end = 0;
-        ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
-        ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
-        _lastExecTime = static_cast<double>(end - start)*1e-9;
-//        std::cout << "Kernel time: " << _lastExecTime << std::endl << std::endl;
-#endif
+        _proxy.image = cl::ImageGL(_contextCL, CL_MEM_READ_ONLY, GL_TEXTURE_2D, 0, texId);
     }
     catch (cl::Error err)
     {
@@ -608,306 +976,3418 @@ void VolumeRenderCL::runRaycastNoGL(const size_t width, const size_t height,
 
 
 /**
- * @brief VolumeRenderCL::generateBricks
- * @param volumeData
+ * @brief VolumeRenderCL::setProxyActive
+ * @param active
  */
-void VolumeRenderCL::generateBricks()
+void VolumeRenderCL::setProxyActive(bool active)
 {
-    if (!_dr.has_data())
-        return;
-    try
-    {
-        // calculate brick size
-        const uint numBricks = 64u;
-        std::array<uint, 3> brickRes = {1u, 1u, 1u};
-        brickRes.at(0) = std::max(1u, RoundPow2(_dr.properties().volume_res.at(0) / numBricks));
-        brickRes.at(1) = std::max(1u, RoundPow2(_dr.properties().volume_res.at(1) / numBricks));
-        brickRes.at(2) = std::max(1u, RoundPow2(_dr.properties().volume_res.at(2) / numBricks));
-
-        cl_float3 brickResF = {{_dr.properties().volume_res.at(0) / float(brickRes.at(0)),
-                                _dr.properties().volume_res.at(1) / float(brickRes.at(1)),
-                                _dr.properties().volume_res.at(2) / float(brickRes.at(2))}};
-        _raycast_params.brickRes = brickResF;
-        setRaycastArgs();
-
-        std::array<uint, 3> bricksTexSize = {1u, 1u, 1u};
-        bricksTexSize.at(0) = uint(ceil(double(brickResF.x)));
-        bricksTexSize.at(1) = uint(ceil(double(brickResF.y)));
-        bricksTexSize.at(2) = uint(ceil(double(brickResF.z)));
+    _proxy.active = active && _proxy.image() != nullptr;
+}
 
-        // set memory object
-        cl::ImageFormat format;
-        format.image_channel_order = CL_RG;  // CL_RG for min+max
-        if (_dr.properties().format == DatRawReader::UCHAR)
-            format.image_channel_data_type = CL_UNORM_INT8;
-        else if (_dr.properties().format == DatRawReader::USHORT)
-            format.image_channel_data_type = CL_UNORM_INT16;
-        else if (_dr.properties().format == DatRawReader::FLOAT)
-            format.image_channel_data_type = CL_FLOAT;
-        else
-            throw std::invalid_argument("Unknown or invalid volume data format.");
 
-        if (!_bricksMem.empty())
-            _bricksMem.clear();
-        for (size_t i = 0; i < _dr.properties().raw_file_names.size(); ++i)
+/**
+ * @brief VolumeRenderCL::getProxyView
+ * @param width
+ * @param height
+ * @return
+ */
+VolumeRenderCL::ProxyView VolumeRenderCL::getProxyView(const size_t width,
+                                                        const size_t height) const
+{
+    ProxyView proxyView;
+    if (!_volLoaded || _camera_params.ortho || _modelScale.size() < 3)
+        return proxyView;
+
+    // kernel rays: camPos + t*normalize(R*(x, y, -1)*modelScale), camPos = c*modelScale
+    const cl_float16 &m = _camera_params.viewMat;
+    std::array<double, 9> inv;
+    if (!InvertRotation(m, inv))
+        return proxyView;
+    const std::array<double, 3> c = {{m.s[3], m.s[7], m.s[11]}};
+
+    // padded frame as in setRenderSize
+    const size_t w = width + (LOCAL_SIZE - width % LOCAL_SIZE);
+    const size_t h = height + (LOCAL_SIZE - height % LOCAL_SIZE);
+    const double maxSize = double(std::max(w, h));
+    // view plane (x, y) = -v.xy/v.z of v = R^-1*(p/modelScale - c) to normalized device
+    // coordinates, the rows of the OpenCL image are the rows of the texture (flipped y),
+    // clip z is 0: the rasterized distances are written as fragment depth
+    const std::array<double, 4> rowScale = {{maxSize / double(w), -maxSize / double(h),
+                                             0.0, -1.0}};
+    const std::array<size_t, 4> viewRow = {{0, 1, 2, 2}};
+    for (size_t row = 0; row < 4; ++row)
+    {
+        const size_t k = viewRow.at(row);
+        double offset = 0.0;
+        for (size_t col = 0; col < 3; ++col)
         {
-            _bricksMem.push_back(cl::Image3D(_contextCL,
-                                             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS,
-                                             format,
-                                             bricksTexSize.at(0),
-                                             bricksTexSize.at(1),
-                                             bricksTexSize.at(2)));
-            // run aggregation kernel
-            setMemObjectsBrickGen(i);
-            size_t lDim = 4;    // local work group dimension: 4*4*4=64
-            cl::NDRange globalThreads(bricksTexSize.at(0) + (lDim - bricksTexSize.at(0) % lDim),
-                                      bricksTexSize.at(1) + (lDim - bricksTexSize.at(1) % lDim),
-                                      bricksTexSize.at(2) + (lDim - bricksTexSize.at(2) % lDim));
-            cl::NDRange localThreads(lDim, lDim, lDim);
-//            cl::Event ndrEvt;
-            _queueCL.enqueueNDRangeKernel(_genBricksKernel, cl::NullRange,
-                                          globalThreads, localThreads); //, nullptr, &ndrEvt);
-            _queueCL.finish();
-//            cl_ulong start = 0;
-//            cl_ulong end = 0;
-//            ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
-//            ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
-//            double execTime = static_cast<double>(end - start)*1e-9;
-//            std::cout << "Build up time: " << execTime << std::endl;
+            proxyView.clipMatrix.at(col*4 + row) =
+                    float(rowScale.at(row) * inv.at(k*3 + col) / double(_modelScale[col]));
+            offset -= inv.at(k*3 + col) * c.at(col);
         }
+        proxyView.clipMatrix.at(12 + row) = float(rowScale.at(row) * offset);
     }
-    catch (cl::Error err)
+    double camDistance = 0.0;
+    for (size_t i = 0; i < 3; ++i)
     {
-        throw std::runtime_error( "ERROR: " + std::string(err.what()) + "("
-                                  + getCLErrorString(err.err()) + ")");
+        proxyView.camPos.at(i) = float(c.at(i) * double(_modelScale[i]));
+        camDistance += double(proxyView.camPos.at(i)) * double(proxyView.camPos.at(i));
     }
+    // the volume lies within a sphere of radius sqrt(3) around the origin
+    proxyView.maxDistance = float(std::sqrt(camDistance) + std::sqrt(3.0));
+    proxyView.viewport = {{int(w), int(h)}};
+    proxyView.valid = true;
+    return proxyView;
 }
 
+
 /**
- * @brief VolumeRenderCL::volDataToCLmem
- * @param volumeData
+ * @brief VolumeRenderCL::getProxyGeometry
+ * @param version
+ * @param vertices
+ * @return
  */
-void VolumeRenderCL::volDataToCLmem(const std::vector<std::vector<char>> &volumeData)
+bool VolumeRenderCL::getProxyGeometry(size_t &version, std::vector<float> &vertices)
 {
-    if (!_dr.has_data())
-        return;
+    if (!_volLoaded || _bricksMem.empty())
+        return false;
     try
     {
-        cl::ImageFormat format;
-        auto co = _dr.properties().image_channel_order;
-        if (co == "R" || co == "" || co == "I" || co == "LUMINANCE")
-            format.image_channel_order = CL_R;
-        else if (co == "RG")
-            format.image_channel_order = CL_RG;
-//        else if (co == "RGB")   // This format can only be used if channel data type = CL_UNORM_SHORT_565, CL_UNORM_SHORT_555 or CL_UNORM_INT101010.
-//            format.image_channel_order = CL_RGB;
-        else if (co == "RGBA")
-            format.image_channel_order = CL_RGBA;
-        else if (co == "ARGB")
-            format.image_channel_order = CL_ARGB;
-        else if (co == "BGRA")
-            format.image_channel_order = CL_BGRA;
-        else
-            throw std::invalid_argument("Unknown or invalid volume color format.");
-
-        unsigned int formatMultiplier = sizeof(cl_uchar);
-        if (_dr.properties().format == DatRawReader::UCHAR)
-        {
-            format.image_channel_data_type = CL_UNORM_INT8;
-        }
-        else if (_dr.properties().format == DatRawReader::USHORT)
-        {
-            format.image_channel_data_type = CL_UNORM_INT16;
-            formatMultiplier = sizeof(cl_ushort);
-        }
-        else if (_dr.properties().format == DatRawReader::FLOAT)
-        {
-            format.image_channel_data_type = CL_FLOAT;
-            formatMultiplier = sizeof(cl_float);
-        }
-        else
+        const size_t slot = isStreaming() ? _stream.active : _timestep;
+        updateOccupancy(slot);
+        if (version == _proxy.version)
+            return false;
+
+        // level 0 of the occupancy hierarchy, one bit per brick
+        const cl::Image3D &bricks = _bricksMem.at(slot);
+        const std::array<int, 3> res = {{int(bricks.getImageInfo<CL_IMAGE_WIDTH>()),
+                                         int(bricks.getImageInfo<CL_IMAGE_HEIGHT>()),
+                                         int(bricks.getImageInfo<CL_IMAGE_DEPTH>())}};
+        const size_t numBricks = size_t(res[0]) * size_t(res[1]) * size_t(res[2]);
+        std::vector<cl_uint> occupancy((numBricks + 31) / 32);
+        _queueCL.enqueueReadBuffer(_occupancyMem, CL_TRUE, 0, occupancy.size()*sizeof(cl_uint),
+                                   occupancy.data());
+        const auto occupied = [&](const std::array<int, 3> &b) {
+            for (size_t i = 0; i < 3; ++i)
+                if (b[i] < 0 || b[i] >= res[i])
+                    return false;
+            const size_t bit = size_t(b[0]) + size_t(res[0])*(size_t(b[1])
+                                                              + size_t(res[1])*size_t(b[2]));
+            return ((occupancy.at(bit >> 5) >> (bit & 31u)) & 1u) != 0;
+        };
+
+        // brick borders in volume coordinates, same brick size as in generateBricks
+        std::array<std::vector<float>, 3> borders;
+        const auto &volRes = _dr.properties().volume_res;
+        for (size_t i = 0; i < 3; ++i)
         {
-            throw std::invalid_argument("Unknown or invalid volume data format.");
+            const size_t voxPerCell = (size_t(volRes.at(i)) + size_t(res[i]) - 1) / size_t(res[i]);
+            for (size_t n = 0; n <= size_t(res[i]); ++n)
+                borders.at(i).push_back(-1.f + 2.f*float(std::min(n*voxPerCell, size_t(volRes.at(i))))
+                                                / float(volRes.at(i)));
         }
 
-        if (!_volumesMem.empty())
-            _volumesMem.clear();
-
-        for (const auto &v : volumeData)
+        vertices.clear();
+        std::array<int, 3> b;
+        for (b[2] = 0; b[2] < res[2]; ++b[2])
+        for (b[1] = 0; b[1] < res[1]; ++b[1])
+        for (b[0] = 0; b[0] < res[0]; ++b[0])
         {
-            if(_dr.properties().volume_res[0] * _dr.properties().volume_res[1] *
-                     _dr.properties().volume_res[2] * formatMultiplier > v.size())
+            if (!occupied(b))
+                continue;
+            std::array<float, 3> lo;
+            std::array<float, 3> hi;
+            for (size_t i = 0; i < 3; ++i)
             {
-                _dr.clearData();
-                throw std::runtime_error("Volume size does not match size specified in dat file.");
+                lo[i] = borders[i].at(size_t(b[i]));
+                hi[i] = borders[i].at(size_t(b[i]) + 1);
+            }
+            // faces towards empty neighbors only, the others are hidden by the depth test
+            for (size_t axis = 0; axis < 3; ++axis)
+            {
+                for (int side = 0; side < 2; ++side)
+                {
+                    std::array<int, 3> neighbor = b;
+                    neighbor[axis] += side ? 1 : -1;
+                    if (occupied(neighbor))
+                        continue;
+                    const size_t u = (axis + 1) % 3;
+                    const size_t v = (axis + 2) % 3;
+                    const std::array<std::array<float, 2>, 6> quad = {{
+                        {{lo[u], lo[v]}}, {{hi[u], lo[v]}}, {{hi[u], hi[v]}},
+                        {{lo[u], lo[v]}}, {{hi[u], hi[v]}}, {{lo[u], hi[v]}}}};
+                    for (const auto &corner : quad)
+                    {
+                        std::array<float, 3> p;
+                        p[axis] = side ? hi[axis] : lo[axis];
+                        p[u] = corner[0];
+                        p[v] = corner[1];
+                        vertices.insert(vertices.end(), p.begin(), p.end());
+                    }
+                }
             }
-            _volumesMem.push_back(cl::Image3D(_contextCL,
-                                              CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                              format,
-                                              _dr.properties().volume_res[0],
-                                              _dr.properties().volume_res[1],
-                                              _dr.properties().volume_res[2],
-                                              0, 0,
-                                              const_cast<char*>(v.data())));
         }
+        version = _proxy.version;
+        return true;
     }
     catch (cl::Error err)
     {
-        throw std::runtime_error( "ERROR: " + std::string(err.what()) + "("
-                                  + getCLErrorString(err.err()) + ")");
+        logCLerror(err);
     }
+    return false;
 }
 
+
 /**
- * @brief VolumeRenderCL::loadVolumeData
- * @param fileName
+ * @brief VolumeRenderCL::preIntegrateTff
  */
-size_t VolumeRenderCL::loadVolumeData(const DatRawReader::Properties volumeFileProps)
+void VolumeRenderCL::preIntegrateTff()
 {
-    this->_volLoaded = false;
-
-    if (volumeFileProps.dat_file_name.empty())
-        std::cerr << "Loading raw volume data from " << volumeFileProps.raw_file_names.at(0)
-                  << std::endl;
-    else
-        std::cout << "Loading volume data defined in " << volumeFileProps.dat_file_name << std::endl;
-
+    // the opacity of a segment depends on its length in units of the reference step
+    const cl_float segmentLength = 1.f / _raycast_params.samplingRate;
+    if (_tffMem() == nullptr || (_preIntegration.table() != nullptr
+                                 && _preIntegration.segmentLength == segmentLength))
+        return;
     try
     {
-        _dr.read_files(volumeFileProps);
-        std::cout << _dr.data().front().size()*_dr.data().size() << " bytes have been read from "
-                  << _dr.data().size() << " file(s)." << std::endl;
-        std::cout << _dr.properties().to_string() << std::endl;
-        volDataToCLmem(_dr.data());
-        calcScaling();
+        // front and back density at the resolution of the transfer function itself
+        const size_t size = 256;
+        if (_preIntegration.table() == nullptr)
+            _preIntegration.table = cl::Image2D(_contextCL, CL_MEM_READ_WRITE,
+                                                cl::ImageFormat(CL_RGBA, CL_FLOAT), size, size);
+        _preIntegration.kernel.setArg(0, _tffMem);
+        _preIntegration.kernel.setArg(1, _preIntegration.table);
+        _preIntegration.kernel.setArg(2, segmentLength);
+        _queueCL.enqueueNDRangeKernel(_preIntegration.kernel, cl::NullRange,
+                                      cl::NDRange(size, size));
+        _preIntegration.segmentLength = segmentLength;
     }
-    catch (std::invalid_argument e)
+    catch (cl::Error err)
     {
-        throw std::runtime_error(e.what());
+        logCLerror(err);
     }
-
-    // initally, set a simple linear transfer function
-    std::vector<unsigned char> tff(1024*4, 0);
-    std::iota(tff.begin() + 3, tff.end(), 0);
-    // TODO: testing are there corner cases where this is necessary?
-//    setTransferFunction(tff);
-
-    std::vector<unsigned int> prefixSum(1024, 0);
-#pragma omp for
-    for (int i = 0; i < int(prefixSum.size()); ++i)
-        prefixSum.at(uint(i)) = uint(i)*4u;
-
-    std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
-    setTffPrefixSum(prefixSum);
-
-    this->_volLoaded = true;
-    return _dr.data().size();
 }
 
 
 /**
- * @brief VolumeRenderCL::hasData
- * @return
+ * @brief VolumeRenderCL::setConvergenceThreshold
+ * @param threshold
+ * @param minIterations
  */
-bool VolumeRenderCL::hasData() const
+void VolumeRenderCL::setConvergenceThreshold(const double threshold,
+                                             const unsigned int minIterations)
 {
-    return this->_volLoaded;
+    _rendering_params.errorThreshold = static_cast<cl_float>(std::max(0.0, threshold));
+    _rendering_params.minIterations = std::max(1u, minIterations);
+    _progressive.active = 1;
+    // the rendering parameters are passed to the kernel with the next frame
+    _rendering_params.iteration = 0;
 }
 
 
 /**
- * @brief VolumeRenderCL::getResolution
+ * @brief VolumeRenderCL::isConverged
  * @return
  */
-const std::array<unsigned int, 4> VolumeRenderCL::getResolution() const
+bool VolumeRenderCL::isConverged() const
 {
-    if (!_dr.has_data())
-        return std::array<unsigned int, 4> {{0, 0, 0, 1}};
-    return _dr.properties().volume_res;
+    // the active tiles are counted from the first iteration a tile may converge in
+    bool converged = _rendering_params.errorThreshold > 0.f
+            && _rendering_params.iteration > _rendering_params.minIterations
+            && _progressive.active == 0;
+    for (const auto &peer : _multiDevice.peers)
+        converged = converged && peer->_progressive.active == 0;
+    return converged;
 }
 
+
 /**
- * @brief VolumeRenderCL::setBBox
- * @param bl_x  Bottom left x coord
- * @param bl_y  Bottom left y coord
- * @param bl_z  Bottom left z coord
- * @param tr_x  Top right x coord
- * @param tr_y  Top right y coord
- * @param tr_z  Top right z coord
+ * @brief VolumeRenderCL::setTemporalReprojection
+ * @param reproject
+ * @param samplingRate
  */
-void VolumeRenderCL::setBBox(float bl_x, float bl_y, float bl_z,
-                             float tr_x, float tr_y, float tr_z)
+void VolumeRenderCL::setTemporalReprojection(bool reproject, double samplingRate)
 {
-    _camera_params.bbox_bl = {{bl_x, bl_y, bl_z}};
-    _camera_params.bbox_tr = {{tr_x, tr_y, tr_z}};
-    setCameraArgs();
+    _reprojection.enabled = reproject;
+    const double rate = std::min(1.0, std::max(0.05, samplingRate));
+    _rendering_params.reprojectionRate = static_cast<cl_float>(rate);
+    try
+    {
+        updateReprojectionImages(_multiDevice.outputSize.at(0), _multiDevice.outputSize.at(1));
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
     resetIteration();
 }
 
 
 /**
- * @brief VolumeRenderCL::getHistogram
- * @param timestep
+ * @brief VolumeRenderCL::usesTemporalReprojection
  * @return
  */
-const std::array<double, 256> & VolumeRenderCL::getHistogram(unsigned int timestep)
+bool VolumeRenderCL::usesTemporalReprojection() const
 {
-    if (!_dr.has_data())
-        throw std::invalid_argument("Invalid timestep for histogram data.");
-    return _dr.getHistogram(timestep);
+    // pipelined frames and peer bands are rendered without the resolve pass
+    return _reprojection.enabled && _reprojection.depth.at(0)() != nullptr
+            && _rendering_params.technique == TECH_RAYCAST && !_camera_params.ortho
+            && _multiDevice.peers.empty() && _outputRing.images.empty();
 }
 
+
 /**
- * @brief VolumeRenderCL::setTransferFunction
- * @param tff
+ * @brief VolumeRenderCL::setAutoTuning
+ * @param autoTune
  */
-void VolumeRenderCL::setTransferFunction(std::vector<unsigned char> &tff)
+void VolumeRenderCL::setAutoTuning(bool autoTune)
 {
-    if (!_dr.has_data())
-        return;
-    try
+    _tuning.enabled = autoTune;
     {
-        cl::ImageFormat format;
-        format.image_channel_order = CL_RGBA;
-        format.image_channel_data_type = CL_UNORM_INT8;
-
+        // the frame shape is applied with the next frame, the loader thread generates bricks
+        std::lock_guard<std::mutex> lock(_stream.uploadMutex);
+        _tuning.groups.volume = WorkGroups().volume;
+        _tuning.volumeTuned = false;
+    }
+    for (auto &peer : _multiDevice.peers)
+        peer->setAutoTuning(autoTune);
+}
+
+
+/**
+ * @brief VolumeRenderCL::getWorkGroups
+ * @return
+ */
+const VolumeRenderCL::WorkGroups &VolumeRenderCL::getWorkGroups() const
+{
+    return _tuning.groups;
+}
+
+
+/**
+ * @brief VolumeRenderCL::setRenderSize
+ * @param width
+ * @param height
+ */
+void VolumeRenderCL::setRenderSize(const size_t width, const size_t height)
+{
+    if (_renderSize.at(0) == width && _renderSize.at(1) == height)
+        return;
+    _renderSize = {{width, height}};
+    // the rays are set up in the padded frame, independent of the NDRange of a band
+    _rendering_params.frameSize = {{static_cast<cl_int>(width + (LOCAL_SIZE - width % LOCAL_SIZE)),
+                                    static_cast<cl_int>(height + (LOCAL_SIZE - height % LOCAL_SIZE))}};
+    if (_useImgESS)
+    {
+        std::array<size_t, 3> region = {{_inputHitMem.getImageInfo<CL_IMAGE_WIDTH>(),
+                                         _inputHitMem.getImageInfo<CL_IMAGE_HEIGHT>(), 1}};
+        _queueCL.enqueueFillImage(_inputHitMem, cl_uint4{{1u, 1u, 1u, 1u}}, {{0, 0, 0}}, region);
+    }
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCL::calcScaling
+ */
+void VolumeRenderCL::calcScaling()
+{
+    if (!_dr.has_data())
+        return;
+
+    _modelScale = { static_cast<float>(_dr.properties().volume_res.at(0)),
+                    static_cast<float>(_dr.properties().volume_res.at(1)),
+                    static_cast<float>(_dr.properties().volume_res.at(2)) };
+
+    std::valarray<float> thickness = { static_cast<float>(_dr.properties().slice_thickness.at(0)),
+                                       static_cast<float>(_dr.properties().slice_thickness.at(1)),
+                                       static_cast<float>(_dr.properties().slice_thickness.at(2)) };
+    _modelScale *= thickness*(1.f/thickness[0]);
+#undef max  // error here if we don't undef max
+    _modelScale = _modelScale.max() / _modelScale;
+}
+
+
+/**
+ * @brief VolumeRenderCL::scaleVolume
+ * @param scale
+ */
+void VolumeRenderCL::scaleVolume(std::valarray<float> scale)
+{
+    _modelScale *= scale;
+}
+
+
+/**
+ * @brief VolumeRenderCL::updateKernelArgs
+ * @param viewMat
+ */
+void VolumeRenderCL::updateView(const std::array<float, 16> viewMat)
+{
+    if (!_dr.has_data() || _modelScale.size() < 3)
+        return;
+
+    cl_float16 view;
+    for (size_t i = 0; i < 16; ++i)
+        view.s[i] = viewMat[i];
+    _camera_params.viewMat = view;
+    setCameraArgs();
+    // the last frame is reprojected instead of restarting the accumulation
+    const bool history = usesTemporalReprojection() && _rendering_params.iteration > 0;
+    resetIteration();
+    if (history)
+    {
+        _rendering_params.reproject = REPROJECT_HISTORY;
+        setRenderingArgs();
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::updateStepSize
+ * @param stepSize
+ */
+void VolumeRenderCL::updateSamplingRate(const double samplingRate)
+{
+    _raycast_params.samplingRate = static_cast<cl_float>(samplingRate);
+    setRaycastArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::setCameraArgs
+ */
+void VolumeRenderCL::setCameraArgs()
+{
+    try{
+        _raycastKernel.setArg(CAMERA, _camera_params);
+    } catch (cl::Error err) {
+        logCLerror(err);
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::setRenderingArgs
+ */
+void VolumeRenderCL::setRenderingArgs()
+{
+    try{
+        _raycastKernel.setArg(RENDERING, _rendering_params);
+    } catch (cl::Error err) {
+        logCLerror(err);
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::setRaycastArgs
+ */
+void VolumeRenderCL::setRaycastArgs()
+{
+    try{
+        _raycastKernel.setArg(RAYCAST, _raycast_params);
+    } catch (cl::Error err) {
+        logCLerror(err);
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::setPathtraceArgs
+ */
+void VolumeRenderCL::setPathtraceArgs()
+{
+    try{
+        _raycastKernel.setArg(PATHTRACE, _pathtrace_params);
+    } catch (cl::Error err) {
+        logCLerror(err);
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::resetIteration
+ */
+void VolumeRenderCL::resetIteration()
+{
+    _rendering_params.iteration = 0;
+    _rendering_params.reproject = usesTemporalReprojection() ? REPROJECT_DEPTH : REPROJECT_OFF;
+    setRenderingArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::updateOutputImg
+ * @param width
+ * @param height
+ */
+void VolumeRenderCL::updateOutputImg(const size_t width, const size_t height, GLuint texId)
+{
+    // peers render into full size images without context sharing, only their band is read
+    _multiDevice.outputSize = {{width, height}};
+    for (auto &peer : _multiDevice.peers)
+        peer->updateOutputImg(width, height, 0);
+
+    cl::ImageFormat format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_UNORM_INT8;
+    try
+    {
+        if (_useGL)
+        {
+            _outputMem = cl::ImageGL(_contextCL, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0, texId);
+        }
+        else
+        {
+            _outputMemNoGL = cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY, format, width, height);
+            _raycastKernel.setArg(OUTPUT, _outputMemNoGL);
+        }
+
+        // one entry per work-group, large enough for all tuned work-group shapes
+        const std::array<size_t, 2> groups = GroupTiles(width, height);
+        std::vector<unsigned int> initBuff(groups.at(0)*groups.at(1), 1u);
+        format = cl::ImageFormat(CL_R, CL_UNSIGNED_INT8);
+        _outputHitMem = cl::Image2D(_contextCL, CL_MEM_READ_WRITE, format,
+                                    groups.at(0), groups.at(1));
+        _inputHitMem = cl::Image2D(_contextCL, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, format,
+                                   groups.at(0), groups.at(1), 0,
+                                   const_cast<unsigned int*>(initBuff.data()));
+
+        // float precision for the running mean, both are read and written as they are swapped
+        format.image_channel_order = CL_RGBA;
+        format.image_channel_data_type = CL_FLOAT;
+        _inAccumulate = cl::Image2D(_contextCL, CL_MEM_READ_WRITE, format, width, height);
+        _outAccumulate = cl::Image2D(_contextCL, CL_MEM_READ_WRITE, format, width, height);
+
+        // unknown error (max uint) until the tiles have been rendered
+        std::vector<cl_uint> tileErrors(groups.at(0)*groups.at(1),
+                                        std::numeric_limits<cl_uint>::max());
+        _progressive.inTileError = cl::Buffer(_contextCL, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                              tileErrors.size()*sizeof(cl_uint),
+                                              tileErrors.data());
+        _progressive.outTileError = cl::Buffer(_contextCL, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                               tileErrors.size()*sizeof(cl_uint),
+                                               tileErrors.data());
+        _progressive.active = 1;
+        updateReprojectionImages(width, height);
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::setOutputTextures
+ * @param texIds
+ */
+void VolumeRenderCL::setOutputTextures(const std::vector<cl_GLuint> &texIds)
+{
+    _outputMemsGL.clear();
+    if (!_useGL)
+        return;
+    try
+    {
+        for (const cl_GLuint texId : texIds)
+            _outputMemsGL.push_back(cl::ImageGL(_contextCL, CL_MEM_WRITE_ONLY, GL_TEXTURE_2D, 0,
+                                                texId));
+        if (!_outputMemsGL.empty())
+            _outputMem = _outputMemsGL.front();
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::selectOutputImg
+ * @param index
+ */
+void VolumeRenderCL::selectOutputImg(const size_t index)
+{
+    if (index < _outputMemsGL.size())
+        _outputMem = _outputMemsGL.at(index);
+}
+
+
+/**
+ * @brief VolumeRenderCL::runRaycast
+ * @param imgSize
+ */
+void VolumeRenderCL::runRaycast(const size_t width, const size_t height)
+{
+    if (!this->_volLoaded)
+        return;
+    try // opencl scope
+    {
+        if (isStreaming() && swapStreamedTimestep())
+            resetIteration();
+        selectRaycastVariant();
+        setRenderSize(width, height);
+        cl::Event ndrEvt;
+        const std::array<size_t, 2> rows = enqueuePeerBands(width, height);
+        // empty if the timestep is owned by a peer
+        const bool renderBand = rows.at(1) > rows.at(0);
+        if (renderBand)
+            setMemObjectsRaycast(_timestep);
+
+        std::vector<cl::Memory> memObj;
+        memObj.push_back(_outputMem);
+        if (_rendering_params.proxy)
+            memObj.push_back(_proxy.image);
+        _queueCL.enqueueAcquireGLObjects(&memObj);
+        if (renderBand)
+            selectFrameGroups(width, height);
+        if (countsCosts())
+            _queueCL.enqueueFillBuffer(_stepCountersMem, cl_uint(0), 0,
+                                       2*NUM_COST_COUNTERS*sizeof(cl_uint));
+        clearTileErrors();
+        if (renderBand)
+        {
+            enqueueRaycastRows(width, rows, &ndrEvt);
+            if (cl::Event *evt = stageEvent(STAGE_RAYCAST))
+                *evt = ndrEvt;
+        }
+        compositePeerBands(_outputMem, width, height);
+        if (renderBand && _rendering_params.reproject == REPROJECT_HISTORY)
+            enqueueReprojection(_outputMem, width, height);
+
+        if (_useImgESS)
+        {
+            // swap hit test buffers
+            cl::Image2D tmp = _outputHitMem;
+            _outputHitMem = _inputHitMem;
+            _inputHitMem = tmp;
+        }
+
+        swapAccumulation();
+
+        _queueCL.enqueueReleaseGLObjects(&memObj);
+        if (_rendering_params.errorThreshold > 0.f)
+            _queueCL.enqueueReadBuffer(_progressive.activeTiles, CL_FALSE, 0, sizeof(cl_uint),
+                                       &_progressive.active);
+        _queueCL.finish();    // global sync
+        if (countsCosts())
+            readStepCounters();
+
+#ifdef CL_QUEUE_PROFILING_ENABLE
+        _lastExecTime = renderBand ? kernelTime(ndrEvt) : 0.0;
+//        std::cout << "Kernel time: " << _lastExecTime << std::endl << std::endl;
+#endif
+        finishPeerBands();
+        if (_useBricking)
+            updateBrickCache();
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::runRaycastNoGL
+ * @param width
+ * @param height
+ * @param t
+ * @param output
+ */
+void VolumeRenderCL::runRaycastNoGL(const size_t width, const size_t height,
+                                    std::vector<float> &output)
+{
+    if (!this->_volLoaded)
+        return;
+    try // opencl scope
+    {
+        if (isStreaming() && swapStreamedTimestep())
+            resetIteration();
+        selectRaycastVariant();
+        setRenderSize(width, height);
+        cl::Event ndrEvt;
+        const std::array<size_t, 2> rows = enqueuePeerBands(width, height);
+        // empty if the timestep is owned by a peer
+        const bool renderBand = rows.at(1) > rows.at(0);
+        if (renderBand)
+        {
+            setMemObjectsRaycast(_timestep);
+            selectFrameGroups(width, height);
+        }
+
+        if (countsCosts())
+            _queueCL.enqueueFillBuffer(_stepCountersMem, cl_uint(0), 0,
+                                       2*NUM_COST_COUNTERS*sizeof(cl_uint));
+        if (renderBand)
+        {
+            enqueueRaycastRows(width, rows, &ndrEvt);
+            if (cl::Event *evt = stageEvent(STAGE_RAYCAST))
+                *evt = ndrEvt;
+        }
+        compositePeerBands(_outputMemNoGL, width, height);
+        if (renderBand && _rendering_params.reproject == REPROJECT_HISTORY)
+            enqueueReprojection(_outputMemNoGL, width, height);
+        output.resize(width*height*4);
+        cl::Event readEvt;
+        std::array<size_t, 3> origin = {{0, 0, 0}};
+        std::array<size_t, 3> region = {{width, height, 1}};
+        _queueCL.enqueueReadImage(_outputMemNoGL,
+                                  CL_TRUE,
+                                  origin, region, 0, 0,
+                                  output.data(),
+                                  nullptr, &readEvt);
+        if (cl::Event *evt = stageEvent(STAGE_READBACK))
+            *evt = readEvt;
+        _queueCL.flush();    // global sync
+        if (countsCosts())
+            readStepCounters();
+
+#ifdef CL_QUEUE_PROFILING_ENABLE
+        _lastExecTime = renderBand ? kernelTime(ndrEvt) : 0.0;
+//        std::cout << "Kernel time: " << _lastExecTime << std::endl << std::endl;
+#endif
+        finishPeerBands();
+        if (_useBricking)
+            updateBrickCache();
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::initOutputRing
+ * @param width
+ * @param height
+ * @param count
+ */
+void VolumeRenderCL::initOutputRing(const size_t width, const size_t height, const size_t count)
+{
+    if (_useGL)
+        throw std::runtime_error("ERROR: The output ring requires rendering without OpenGL.");
+    releaseOutputRing();
+    // hit and accumulation images
+    updateOutputImg(width, height, 0);
+
+    const size_t frameSize = width*height*4*sizeof(unsigned char);
+    try
+    {
+        cl_command_queue_properties cqp = 0;
+#ifdef CL_QUEUE_PROFILING_ENABLE
+        cqp = CL_QUEUE_PROFILING_ENABLE;
+#endif
+        _outputRing.queue = cl::CommandQueue(_contextCL, cqp);
+        for (size_t i = 0; i < std::max(count, size_t(1)); ++i)
+        {
+            _outputRing.images.push_back(cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY,
+                                                     cl::ImageFormat(CL_RGBA, CL_UNORM_INT8),
+                                                     width, height));
+            // pinned staging memory: a driver allocated buffer that stays mapped
+            _outputRing.pinned.push_back(cl::Buffer(_contextCL, CL_MEM_ALLOC_HOST_PTR, frameSize));
+            void *ptr = _outputRing.queue.enqueueMapBuffer(_outputRing.pinned.back(), CL_TRUE,
+                                                           CL_MAP_READ | CL_MAP_WRITE, 0,
+                                                           frameSize);
+            _outputRing.hostPtrs.push_back(static_cast<unsigned char *>(ptr));
+        }
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+    _outputRing.kernelEvents.resize(_outputRing.images.size());
+    _outputRing.readEvents.resize(_outputRing.images.size());
+    _outputRing.busy.assign(_outputRing.images.size(), false);
+    _outputRing.width = width;
+    _outputRing.height = height;
+    _outputRing.next = 0;
+}
+
+
+/**
+ * @brief VolumeRenderCL::releaseOutputRing
+ */
+void VolumeRenderCL::releaseOutputRing()
+{
+    if (_outputRing.images.empty())
+        return;
+    try
+    {
+        _outputRing.queue.finish();
+        for (size_t i = 0; i < _outputRing.pinned.size(); ++i)
+            _outputRing.queue.enqueueUnmapMemObject(_outputRing.pinned.at(i),
+                                                    _outputRing.hostPtrs.at(i));
+        _outputRing.queue.finish();
+    }
+    catch (cl::Error err)
+    {
+        // also called on destruction, do not throw
+        std::cerr << "WARNING: Could not release the output ring: "
+                  << getCLErrorString(err.err()) << std::endl;
+    }
+    _outputRing.images.clear();
+    _outputRing.pinned.clear();
+    _outputRing.hostPtrs.clear();
+    _outputRing.kernelEvents.clear();
+    _outputRing.readEvents.clear();
+    _outputRing.busy.clear();
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueueRaycastNoGL
+ * @return
+ */
+size_t VolumeRenderCL::enqueueRaycastNoGL()
+{
+    if (!this->_volLoaded)
+        throw std::runtime_error("No volume data is loaded.");
+    if (_outputRing.images.empty())
+        throw std::runtime_error("ERROR: The output ring is not initialized.");
+
+    const size_t slot = _outputRing.next;
+    {
+        // wait for the consumer of the last frame rendered into this image
+        std::unique_lock<std::mutex> lock(_outputRing.mutex);
+        _outputRing.cv.wait(lock, [&]{ return !_outputRing.busy.at(slot); });
+        _outputRing.busy.at(slot) = true;
+    }
+    _outputRing.next = (slot + 1) % _outputRing.images.size();
+
+    try // opencl scope
+    {
+        if (isStreaming() && swapStreamedTimestep())
+            resetIteration();
+        const size_t width = _outputRing.width;
+        const size_t height = _outputRing.height;
+        const size_t owner = getTimestepDevice(_timestep);
+        if (owner > 0)
+        {
+            // read back directly from the owner of the timestep, frames of timesteps owned
+            // by different devices are rendered in parallel
+            VolumeRenderCL &peer = *_multiDevice.peers.at(owner - 1);
+            syncPeer(peer);
+            peer.enqueueBand(width, height, {{0, height + (LOCAL_SIZE - height % LOCAL_SIZE)}},
+                             _outputRing.hostPtrs.at(slot), _outputRing.readEvents.at(slot));
+            _outputRing.kernelEvents.at(slot) = peer._multiDevice.bandEvent;
+            if (cl::Event *evt = stageEvent(STAGE_RAYCAST))
+                *evt = _outputRing.kernelEvents.at(slot);
+            if (cl::Event *evt = stageEvent(STAGE_READBACK))
+                *evt = _outputRing.readEvents.at(slot);
+            swapAccumulation();
+            return slot;
+        }
+        selectRaycastVariant();
+        setRenderSize(width, height);
+        setMemObjectsRaycast(_timestep);
+        setOutputArg(_outputRing.images.at(slot));
+        selectFrameGroups(width, height);
+
+        // pipelined frames are rendered on this device only, or on the owner of the timestep
+        if (countsCosts())
+            _queueCL.enqueueFillBuffer(_stepCountersMem, cl_uint(0), 0,
+                                       2*NUM_COST_COUNTERS*sizeof(cl_uint));
+        clearTileErrors();
+        enqueueRaycastRows(width, {{0, height + (LOCAL_SIZE - height % LOCAL_SIZE)}},
+                           &_outputRing.kernelEvents.at(slot));
+        if (cl::Event *evt = stageEvent(STAGE_RAYCAST))
+            *evt = _outputRing.kernelEvents.at(slot);
+        if (_useImgESS)
+        {
+            // swap hit test buffers
+            cl::Image2D tmp = _outputHitMem;
+            _outputHitMem = _inputHitMem;
+            _inputHitMem = tmp;
+        }
+        // same accumulation as in runRaycast, for progressive techniques
+        swapAccumulation();
+        _queueCL.flush();
+
+        // the readback only depends on this frame's kernel, not on the next one
+        std::vector<cl::Event> waitKernel = {_outputRing.kernelEvents.at(slot)};
+        std::array<size_t, 3> origin = {{0, 0, 0}};
+        std::array<size_t, 3> region = {{width, height, 1}};
+        _outputRing.queue.enqueueReadImage(_outputRing.images.at(slot), CL_FALSE,
+                                           origin, region, 0, 0,
+                                           _outputRing.hostPtrs.at(slot),
+                                           &waitKernel, &_outputRing.readEvents.at(slot));
+        if (cl::Event *evt = stageEvent(STAGE_READBACK))
+            *evt = _outputRing.readEvents.at(slot);
+        _outputRing.queue.flush();
+
+        if (countsCosts())
+            readStepCounters();
+        if (_useBricking)
+            updateBrickCache();
+    }
+    catch (cl::Error err)
+    {
+        releaseFrame(slot);
+        logCLerror(err);
+    }
+    return slot;
+}
+
+
+/**
+ * @brief VolumeRenderCL::waitFrame
+ * @param slot
+ * @return
+ */
+const unsigned char *VolumeRenderCL::waitFrame(const size_t slot)
+{
+    try
+    {
+        _outputRing.readEvents.at(slot).wait();
+#ifdef CL_QUEUE_PROFILING_ENABLE
+        _lastExecTime = kernelTime(_outputRing.kernelEvents.at(slot));
+#endif
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+    return _outputRing.hostPtrs.at(slot);
+}
+
+
+/**
+ * @brief VolumeRenderCL::releaseFrame
+ * @param slot
+ */
+void VolumeRenderCL::releaseFrame(const size_t slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(_outputRing.mutex);
+        _outputRing.busy.at(slot) = false;
+    }
+    _outputRing.cv.notify_all();
+}
+
+
+/**
+ * @brief VolumeRenderCL::renderTiled
+ * @param width
+ * @param height
+ * @param settings
+ * @param tileDone
+ */
+void VolumeRenderCL::renderTiled(const size_t width, const size_t height,
+                                 const TileSettings &settings,
+                                 const std::function<void(const Tile &)> &tileDone)
+{
+    if (!this->_volLoaded)
+        throw std::runtime_error("No volume data is loaded.");
+    if (_useGL)
+        throw std::runtime_error("ERROR: Tiled rendering requires rendering without OpenGL.");
+    if (getTimestepDevice(_timestep) > 0)
+        throw std::runtime_error("ERROR: Tiled rendering of timesteps owned by a peer device "
+                                 "is not supported.");
+
+    // tiles are aligned to the work-groups, the images of one tile are reused for all tiles
+    const std::array<size_t, 2> frame = {{width + (LOCAL_SIZE - width % LOCAL_SIZE),
+                                          height + (LOCAL_SIZE - height % LOCAL_SIZE)}};
+    const size_t align = std::max(LOCAL_SIZE, std::max(_tuning.groups.frame.at(0),
+                                                       _tuning.groups.frame.at(1)));
+    const size_t maxTile = std::max(align, settings.maxTileSize - settings.maxTileSize % align);
+    // whole work-groups even for frames smaller than a group, the padding is not read back
+    const std::array<size_t, 2> imgSize = {{RoundUp(std::min(maxTile, frame.at(0)), align),
+                                            RoundUp(std::min(maxTile, frame.at(1)), align)}};
+    // the per-pixel cost image would cover the whole frame, tiles have no history
+    const cl_uint diagnostics = _raycast_params.diagnostics;
+    _raycast_params.diagnostics = 0;
+    setRaycastArgs();
+    const bool reprojection = _reprojection.enabled;
+    _reprojection.enabled = false;
+    _rendering_params.reproject = REPROJECT_OFF;
+    // the full frame images are restored afterwards
+    const std::array<size_t, 2> outputSize = _multiDevice.outputSize;
+    const std::array<size_t, 3> ring = {{_outputRing.width, _outputRing.height,
+                                         _outputRing.images.size()}};
+    releaseOutputRing();
+    updateOutputImg(imgSize.at(0), imgSize.at(1), 0);
+    std::vector<unsigned char> pixels(imgSize.at(0)*imgSize.at(1)*4);
+
+    // kernel time per pixel of the last tile, the first one has 16x16 work-groups
+    double pixelTime = 0.0;
+    const auto tilePixels = [&]()
+    {
+        const double initial = double(16*LOCAL_SIZE) * double(16*LOCAL_SIZE);
+        return pixelTime > 0.0 ? settings.dispatchBudget / pixelTime : initial;
+    };
+    const auto alignedEdge = [align](const double edge, const size_t limit)
+    {
+        const size_t e = size_t(std::min(double(limit), std::max(edge, 0.0)));
+        return std::max(align, e - e % align);
+    };
+    try // opencl scope
+    {
+        if (isStreaming() && swapStreamedTimestep())
+            resetIteration();
+        selectRaycastVariant();
+        setRenderSize(width, height);
+        // strips of tiles, the strip height is fixed when the strip is started
+        for (size_t y = 0; y < height;)
+        {
+            const size_t rows = alignedEdge(std::sqrt(tilePixels()),
+                                            std::min(imgSize.at(1), frame.at(1) - y));
+            for (size_t x = 0; x < width;)
+            {
+                const size_t cols = alignedEdge(tilePixels() / double(rows),
+                                                std::min(imgSize.at(0), frame.at(0) - x));
+                _rendering_params.tileOrigin = {{static_cast<cl_int>(x), static_cast<cl_int>(y)}};
+                _rendering_params.iteration = 0;
+                if (_useImgESS)
+                {
+                    std::array<size_t, 3> region = {{_inputHitMem.getImageInfo<CL_IMAGE_WIDTH>(),
+                                                     _inputHitMem.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                                     1}};
+                    _queueCL.enqueueFillImage(_inputHitMem, cl_uint4{{1u, 1u, 1u, 1u}},
+                                              {{0, 0, 0}}, region);
+                }
+
+                // one dispatch per iteration, converged tiles stop early
+                double kernelSeconds = 0.0;
+                size_t dispatches = 0;
+                for (size_t i = 0; i < std::max(settings.iterations, size_t(1)); ++i)
+                {
+                    setMemObjectsRaycast(_timestep);
+                    clearTileErrors();
+                    cl::Event ndrEvt;
+                    enqueueRaycastTile({{x, y}}, {{cols, rows}}, &ndrEvt);
+                    if (cl::Event *evt = stageEvent(STAGE_RAYCAST))
+                        *evt = ndrEvt;
+                    if (_useImgESS)
+                        std::swap(_inputHitMem, _outputHitMem);
+                    swapAccumulation();
+                    if (_rendering_params.errorThreshold > 0.f)
+                        _queueCL.enqueueReadBuffer(_progressive.activeTiles, CL_FALSE, 0,
+                                                   sizeof(cl_uint), &_progressive.active);
+                    _queueCL.finish();
+                    ++dispatches;
+#ifdef CL_QUEUE_PROFILING_ENABLE
+                    _lastExecTime = kernelTime(ndrEvt);
+                    kernelSeconds += _lastExecTime;
+#endif
+                    if (_useBricking)
+                        updateBrickCache();
+                    if (_rendering_params.errorThreshold > 0.f && _progressive.active == 0
+                            && _rendering_params.iteration > _rendering_params.minIterations)
+                        break;
+                }
+                if (kernelSeconds > 0.0)
+                    pixelTime = kernelSeconds / double(dispatches * cols * rows);
+
+                // the padding of the frame is not read back
+                Tile tile;
+                tile.x = x;
+                tile.y = y;
+                tile.width = std::min(cols, width - x);
+                tile.height = std::min(rows, height - y);
+                tile.pixels = pixels.data();
+                cl::Event readEvt;
+                std::array<size_t, 3> origin = {{0, 0, 0}};
+                std::array<size_t, 3> region = {{tile.width, tile.height, 1}};
+                _queueCL.enqueueReadImage(_outputMemNoGL, CL_TRUE, origin, region, 0, 0,
+                                          pixels.data(), nullptr, &readEvt);
+                if (cl::Event *evt = stageEvent(STAGE_READBACK))
+                    *evt = readEvt;
+                tileDone(tile);
+                x += cols;
+            }
+            y += rows;
+        }
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+    _rendering_params.tileOrigin = {{0, 0}};
+    _raycast_params.diagnostics = diagnostics;
+    setRaycastArgs();
+    if (ring.at(2) > 0)
+        initOutputRing(ring.at(0), ring.at(1), ring.at(2));
+    else if (outputSize.at(0) > 0 && outputSize.at(1) > 0)
+        updateOutputImg(outputSize.at(0), outputSize.at(1), 0);
+    // the reprojection images are created with the next full frame output
+    _reprojection.enabled = reprojection;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCL::generateBricks
+ * @param volumeData
+ */
+void VolumeRenderCL::generateBricks()
+{
+    if (!_dr.has_data())
+        return;
+    _occupancySlot = -1;
+    _wavefront.majorantSlot = -1;
+    try
+    {
+        if (_useBricking)
+        {
+            // the cells of the ESS grid are the bricks of the page table
+            cl_float3 brickResF = {{_dr.properties().volume_res.at(0) / float(BRICK_SIZE),
+                                    _dr.properties().volume_res.at(1) / float(BRICK_SIZE),
+                                    _dr.properties().volume_res.at(2) / float(BRICK_SIZE)}};
+            _raycast_params.brickRes = brickResF;
+            const auto &numBricks = _brickCache.numBricks;
+            _raycast_params.brickLevels = BrickLevels({{numBricks.at(0), numBricks.at(1),
+                                                        numBricks.at(2)}});
+            setRaycastArgs();
+            // min/max values do not depend on the transfer function, only generate once
+            if (_bricksMem.size() == _dr.properties().raw_file_names.size())
+                return;
+            _bricksMem.clear();
+            _brickMipsMem.clear();
+            for (size_t i = 0; i < _dr.properties().raw_file_names.size(); ++i)
+                generateBricksHost(i);
+            return;
+        }
+
+        // calculate brick size of the finest level, coarser levels are generated from it
+        std::array<uint, 3> brickRes = {1u, 1u, 1u};
+        for (size_t i = 0; i < 3; ++i)
+            brickRes.at(i) = std::max(ESS_CELL_SIZE,
+                                      RoundPow2(_dr.properties().volume_res.at(i) / ESS_MAX_CELLS));
+        _brickCellSize = brickRes;
+
+        cl_float3 brickResF = {{_dr.properties().volume_res.at(0) / float(brickRes.at(0)),
+                                _dr.properties().volume_res.at(1) / float(brickRes.at(1)),
+                                _dr.properties().volume_res.at(2) / float(brickRes.at(2))}};
+        _raycast_params.brickRes = brickResF;
+
+        std::array<uint, 3> bricksTexSize = {1u, 1u, 1u};
+        bricksTexSize.at(0) = uint(ceil(double(brickResF.x)));
+        bricksTexSize.at(1) = uint(ceil(double(brickResF.y)));
+        bricksTexSize.at(2) = uint(ceil(double(brickResF.z)));
+        _raycast_params.brickLevels = BrickLevels({{bricksTexSize.at(0), bricksTexSize.at(1),
+                                                    bricksTexSize.at(2)}});
+        setRaycastArgs();
+
+        // set memory object
+        cl::ImageFormat format;
+        format.image_channel_order = CL_RG;  // CL_RG for min+max
+        if (_dr.properties().format == DatRawReader::UCHAR)
+            format.image_channel_data_type = CL_UNORM_INT8;
+        else if (_dr.properties().format == DatRawReader::USHORT)
+            format.image_channel_data_type = CL_UNORM_INT16;
+        else if (_dr.properties().format == DatRawReader::FLOAT)
+            format.image_channel_data_type = CL_FLOAT;
+        else
+            throw std::invalid_argument("Unknown or invalid volume data format.");
+
+        // one brick volume per volume, i.e. per resident slot in streaming mode
+        std::lock_guard<std::mutex> lock(_stream.uploadMutex);
+        // use cached bricks when generating them for newly uploaded volumes
+        const bool useCache = _bricksMem.size() != _volumesMem.size();
+        if (!_bricksMem.empty())
+            _bricksMem.clear();
+        _brickMipsMem.clear();
+        for (size_t i = 0; i < _volumesMem.size(); ++i)
+        {
+            if (!isStreaming() && !ownsTimestep(i))
+            {
+                _bricksMem.push_back(cl::Image3D(_contextCL, CL_MEM_READ_WRITE, format, 1, 1, 1));
+                _brickMipsMem.push_back(createBrickMips(_bricksMem.at(i)));
+                continue;
+            }
+            _bricksMem.push_back(cl::Image3D(_contextCL,
+                                             CL_MEM_READ_WRITE,
+                                             format,
+                                             bricksTexSize.at(0),
+                                             bricksTexSize.at(1),
+                                             bricksTexSize.at(2)));
+            _brickMipsMem.push_back(createBrickMips(_bricksMem.at(i)));
+            selectVolumeGroups(_volumesMem.at(i), _bricksMem.at(i));
+            long t = long(i);
+            if (isStreaming())
+            {
+                std::lock_guard<std::mutex> streamLock(_stream.mutex);
+                t = _stream.slotTimestep.at(i);
+            }
+            if (!useCache || t < 0 || !readCachedBricks(_queueCL, size_t(t), _bricksMem.at(i)))
+            {
+                // run aggregation kernel
+//                cl::Event ndrEvt;
+                enqueueBrickGen(_queueCL, _genBricksKernel, _volumesMem.at(i), _bricksMem.at(i),
+                                nullptr, stageEvent(STAGE_BRICK_GEN));
+                _queueCL.finish();
+                if (useCache && t >= 0)
+                    writeCachedBricks(_queueCL, size_t(t), _bricksMem.at(i));
+            }
+            // the hierarchy is cheap to build from the finest level and is not cached
+            enqueueBrickMipGen(_queueCL, _genBrickMipsKernel, _bricksMem.at(i),
+                               _brickMipsMem.at(i), nullptr, stageEvent(STAGE_BRICK_GEN));
+//            cl_ulong start = 0;
+//            cl_ulong end = 0;
+//            ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+//            ndrEvt.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+//            double execTime = static_cast<double>(end - start)*1e-9;
+//            std::cout << "Build up time: " << execTime << std::endl;
+        }
+    }
+    catch (cl::Error err)
+    {
+        throw std::runtime_error( "ERROR: " + std::string(err.what()) + "("
+                                  + getCLErrorString(err.err()) + ")");
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::volDataToCLmem
+ */
+void VolumeRenderCL::volDataToCLmem()
+{
+    if (!_dr.has_data())
+        return;
+    stopStreaming();
+    try
+    {
+        cl::ImageFormat format;
+        auto co = _dr.properties().image_channel_order;
+        if (co == "R" || co == "" || co == "I" || co == "LUMINANCE")
+            format.image_channel_order = CL_R;
+        else if (co == "RG")
+            format.image_channel_order = CL_RG;
+//        else if (co == "RGB")   // This format can only be used if channel data type = CL_UNORM_SHORT_565, CL_UNORM_SHORT_555 or CL_UNORM_INT101010.
+//            format.image_channel_order = CL_RGB;
+        else if (co == "RGBA")
+            format.image_channel_order = CL_RGBA;
+        else if (co == "ARGB")
+            format.image_channel_order = CL_ARGB;
+        else if (co == "BGRA")
+            format.image_channel_order = CL_BGRA;
+        else
+            throw std::invalid_argument("Unknown or invalid volume color format.");
+        // channel orders with a specialized code path in the raycast kernel
+        if (format.image_channel_order == CL_R)
+            _channelOrderDefine = "CLK_R";
+        else if (format.image_channel_order == CL_RG)
+            _channelOrderDefine = "CLK_RG";
+        else if (format.image_channel_order == CL_RGBA)
+            _channelOrderDefine = "CLK_RGBA";
+        else
+            _channelOrderDefine.clear();
+
+        unsigned int formatMultiplier = sizeof(cl_uchar);
+        if (_dr.properties().format == DatRawReader::UCHAR)
+        {
+            format.image_channel_data_type = CL_UNORM_INT8;
+        }
+        else if (_dr.properties().format == DatRawReader::USHORT)
+        {
+            format.image_channel_data_type = CL_UNORM_INT16;
+            formatMultiplier = sizeof(cl_ushort);
+        }
+        else if (_dr.properties().format == DatRawReader::FLOAT)
+        {
+            format.image_channel_data_type = CL_FLOAT;
+            formatMultiplier = sizeof(cl_float);
+        }
+        else
+        {
+            throw std::invalid_argument("Unknown or invalid volume data format.");
+        }
+
+        if (!_volumesMem.empty())
+            _volumesMem.clear();
+        _lowRes.volumes.clear();
+
+        for (size_t t = 0; t < _dr.num_timesteps(); ++t)
+        {
+            if(_dr.properties().volume_res[0] * _dr.properties().volume_res[1] *
+                     _dr.properties().volume_res[2] * formatMultiplier > _dr.data_size(t))
+            {
+                _dr.clearData();
+                throw std::runtime_error("Volume size does not match size specified in dat file.");
+            }
+        }
+
+        // switch to bricked mode if the volume does not fit into device memory
+        const size_t numTimesteps = _dr.properties().raw_file_names.size();
+        const size_t ownedTimesteps = (numTimesteps + _ownership.count - 1 - _ownership.index)
+                                      / _ownership.count;
+        bool useBricking = _forceBricking || exceedsDeviceMemory(deviceVolumeSize(),
+                                                                 _stream.window ? 1
+                                                                                : ownedTimesteps);
+        if (useBricking && format.image_channel_order != CL_R)
+        {
+            std::cerr << "WARNING: Bricked mode is only supported for single channel volumes."
+                      << std::endl;
+            useBricking = false;
+        }
+        // the brick cache holds bricks of the native format, the kernel build depends on it
+        selectStorageFormat(format, !useBricking);
+
+        // gradients take 4 bytes per voxel in addition to each resident timestep
+        _gradients.volumes.clear();
+        _gradients.active = _gradients.requested;
+        if (_gradients.active && (useBricking || _stream.window
+                                  || format.image_channel_order != CL_R))
+        {
+            std::cerr << "WARNING: Precomputed gradients are only supported for single channel "
+                      << "volumes that are neither bricked nor streamed." << std::endl;
+            _gradients.active = false;
+        }
+        const auto &res = _dr.properties().volume_res;
+        const size_t gradientSize = size_t(res.at(0)) * res.at(1) * res.at(2) * 4;
+        if (_gradients.active && exceedsDeviceMemory(deviceVolumeSize() + gradientSize,
+                                                     ownedTimesteps))
+        {
+            std::cerr << "WARNING: Precomputed gradients do not fit into device memory, "
+                      << "computing them on the fly." << std::endl;
+            _gradients.active = false;
+        }
+        const bool modeChanged = useBricking != _useBricking;
+        _useBricking = useBricking;
+        if (kernelBuildFlags() != _buildFlags)
+            initKernel(KERNEL_FILE, kernelBuildFlags());
+
+        if (_useBricking)
+        {
+            if (_dr.num_timesteps() < numTimesteps)
+                std::cerr << "WARNING: Streaming is not supported in bricked mode, "
+                          << "only the first timestep is available." << std::endl;
+            _stream.window = 0;
+            initBrickCache(format, formatMultiplier);
+            // host side min/max grid, also used to skip empty bricks for streaming
+            _bricksMem.clear();
+            generateBricks();
+            return;
+        }
+        if (modeChanged)
+            _bricksMem.clear();
+
+        if (_stream.window)
+        {
+            // streaming mode: one image per slot, the first timestep is uploaded directly
+            for (size_t i = 0; i < _stream.window; ++i)
+            {
+                _volumesMem.push_back(cl::Image3D(_contextCL, CL_MEM_READ_ONLY, format,
+                                                  _dr.properties().volume_res[0],
+                                                  _dr.properties().volume_res[1],
+                                                  _dr.properties().volume_res[2]));
+            }
+            std::array<size_t, 3> origin = {{0, 0, 0}};
+            std::array<size_t, 3> region = {{_dr.properties().volume_res[0],
+                                             _dr.properties().volume_res[1],
+                                             _dr.properties().volume_res[2]}};
+            std::vector<char> staging;
+            {
+                std::lock_guard<std::mutex> lock(_stream.mutex);
+                _queueCL.enqueueWriteImage(_volumesMem.front(), CL_TRUE, origin, region, 0, 0,
+                                           storeVolume(_dr.data(0), staging), nullptr,
+                                           stageEvent(STAGE_UPLOAD));
+            }
+            {
+                std::lock_guard<std::mutex> lock(_stream.mutex);
+                _stream.slotTimestep.assign(_stream.window, -1);
+                _stream.slotTimestep.front() = 0;
+                _stream.active = 0;
+                _stream.requested = 0;
+                _stream.histograms.assign(numTimesteps, std::array<double, 256>());
+                _stream.histograms.front() = _dr.getHistogram(0);
+            }
+            reportQuantizationError();
+            _timestep = 0;
+            // slot count changed: regenerate bricks for all slots
+            generateBricks();
+            startStreaming();
+            return;
+        }
+
+        // the (mapped) raw data is copied directly into the image, host side staging is only
+        // used to convert it into a compact storage format
+        std::array<size_t, 3> origin = {{0, 0, 0}};
+        std::array<size_t, 3> region = {{_dr.properties().volume_res[0],
+                                         _dr.properties().volume_res[1],
+                                         _dr.properties().volume_res[2]}};
+        if (_ownership.count > 1)
+        {
+            uploadOwnedTimesteps(format);
+            generateGradients();
+            generateBricks();
+            return;
+        }
+        for (size_t t = 0; t < _dr.num_timesteps(); ++t)
+        {
+            _volumesMem.push_back(cl::Image3D(_contextCL, CL_MEM_READ_ONLY, format,
+                                              _dr.properties().volume_res[0],
+                                              _dr.properties().volume_res[1],
+                                              _dr.properties().volume_res[2]));
+            // an explicit write instead of CL_MEM_COPY_HOST_PTR, to be able to profile it
+            std::vector<char> staging;
+            std::lock_guard<std::mutex> lock(_stream.mutex);
+            _queueCL.enqueueWriteImage(_volumesMem.back(), CL_TRUE, origin, region, 0, 0,
+                                       storeVolume(_dr.data(t), staging), nullptr,
+                                       stageEvent(STAGE_UPLOAD));
+        }
+        reportQuantizationError();
+        generateGradients();
+        // bricks of previously uploaded volumes are stale
+        _bricksMem.clear();
+        generateBricks();
+    }
+    catch (cl::Error err)
+    {
+        throw std::runtime_error( "ERROR: " + std::string(err.what()) + "("
+                                  + getCLErrorString(err.err()) + ")");
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::uploadOwnedTimesteps
+ * @param format
+ */
+void VolumeRenderCL::uploadOwnedTimesteps(const cl::ImageFormat &format)
+{
+    const auto &res = _dr.properties().volume_res;
+    const size_t numTimesteps = _dr.properties().raw_file_names.size();
+    std::array<size_t, 3> origin = {{0, 0, 0}};
+    std::array<size_t, 3> region = {{res.at(0), res.at(1), res.at(2)}};
+    _ownership.histograms.assign(numTimesteps, std::array<double, 256>());
+    std::vector<size_t> pending;
+    std::vector<char> staging;
+    for (size_t t = 0; t < numTimesteps; ++t)
+    {
+        // keep the indices of the timesteps, other devices' timesteps are never bound
+        if (!ownsTimestep(t))
+        {
+            _volumesMem.push_back(cl::Image3D(_contextCL, CL_MEM_READ_ONLY, format, 1, 1, 1));
+            continue;
+        }
+        _volumesMem.push_back(cl::Image3D(_contextCL, CL_MEM_READ_ONLY, format,
+                                          res.at(0), res.at(1), res.at(2)));
+        if (t >= _dr.num_timesteps())
+        {
+            pending.push_back(t);
+            continue;
+        }
+        std::lock_guard<std::mutex> lock(_stream.mutex);
+        _queueCL.enqueueWriteImage(_volumesMem.back(), CL_TRUE, origin, region, 0, 0,
+                                   storeVolume(_dr.data(t), staging), nullptr,
+                                   stageEvent(STAGE_UPLOAD));
+        _ownership.histograms.at(t) = _dr.getHistogram(t);
+    }
+    // the remaining timesteps are read concurrently and uploaded as soon as they are ready,
+    // the staging buffers of the reader are reused after the blocking upload
+    _dr.read_timesteps(pending, [&](const size_t t, DatRawReader::RawData &raw)
+    {
+        if (raw.size() < _dr.data_size(0))
+            throw std::runtime_error("Volume size does not match size specified in dat file.");
+        std::lock_guard<std::mutex> lock(_stream.mutex);
+        _queueCL.enqueueWriteImage(_volumesMem.at(t), CL_TRUE, origin, region, 0, 0,
+                                   storeVolume(raw.data(), staging), nullptr,
+                                   stageEvent(STAGE_UPLOAD));
+        _ownership.histograms.at(t) = raw.histogram;
+    });
+    _bricksMem.clear();
+    reportQuantizationError();
+}
+
+
+/**
+ * @brief VolumeRenderCL::loadVolumeData
+ * @param fileName
+ */
+size_t VolumeRenderCL::loadVolumeData(const DatRawReader::Properties volumeFileProps)
+{
+    this->_volLoaded = false;
+
+    if (volumeFileProps.dat_file_name.empty())
+        std::cerr << "Loading raw volume data from " << volumeFileProps.raw_file_names.at(0)
+                  << std::endl;
+    else
+        std::cout << "Loading volume data defined in " << volumeFileProps.dat_file_name << std::endl;
+
+    stopStreaming();
+    try
+    {
+        // read only the first timestep until we know if the time series has to be streamed
+        _dr.read_files(volumeFileProps, 1);
+        const size_t numTimesteps = _dr.properties().raw_file_names.size();
+        _stream.window = 0;
+        // timesteps owned by this device are read in volDataToCLmem, one at a time
+        if (_ownership.count > 1)
+            std::cout << "Holding every " << _ownership.count << ". of " << numTimesteps
+                      << " timesteps on this device." << std::endl;
+        else if (numTimesteps > 1 && !exceedsDeviceMemory(deviceVolumeSize()))
+        {
+            if (_stream.windowSize > 0)
+                _stream.window = std::min(_stream.windowSize, numTimesteps);
+            else if (exceedsDeviceMemory(deviceVolumeSize(), numTimesteps))
+                _stream.window = std::min(STREAM_WINDOW, numTimesteps);
+        }
+        if (_stream.window)
+            std::cout << "Streaming time series with " << _stream.window
+                      << " resident timesteps." << std::endl;
+        else if (_ownership.count == 1)
+            _dr.read_remaining_timesteps();
+        _brickCache.minMax.clear();
+        std::cout << _dr.data_size()*_dr.num_timesteps() << " bytes have been read from "
+                  << _dr.num_timesteps() << " file(s)." << std::endl;
+        std::cout << _dr.properties().to_string() << std::endl;
+        volDataToCLmem();
+        calcScaling();
+    }
+    catch (std::invalid_argument e)
+    {
+        throw std::runtime_error(e.what());
+    }
+
+    // initally, set a simple linear transfer function
+    std::vector<unsigned char> tff(1024*4, 0);
+    std::iota(tff.begin() + 3, tff.end(), 0);
+    // TODO: testing are there corner cases where this is necessary?
+//    setTransferFunction(tff);
+
+    std::vector<unsigned int> prefixSum(1024, 0);
+#pragma omp for
+    for (int i = 0; i < int(prefixSum.size()); ++i)
+        prefixSum.at(uint(i)) = uint(i)*4u;
+
+    std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
+    setTffPrefixSum(prefixSum);
+
+    this->_volLoaded = true;
+    for (auto &peer : _multiDevice.peers)
+        peer->loadVolumeData(volumeFileProps);
+    if (isStreaming() || (_ownership.count > 1 && !_useBricking))
+        return _dr.properties().raw_file_names.size();
+    return _dr.num_timesteps();
+}
+
+
+/**
+ * @brief VolumeRenderCL::hasData
+ * @return
+ */
+bool VolumeRenderCL::hasData() const
+{
+    return this->_volLoaded;
+}
+
+
+/**
+ * @brief VolumeRenderCL::getResolution
+ * @return
+ */
+const std::array<unsigned int, 4> VolumeRenderCL::getResolution() const
+{
+    if (!_dr.has_data())
+        return std::array<unsigned int, 4> {{0, 0, 0, 1}};
+    return _dr.properties().volume_res;
+}
+
+/**
+ * @brief VolumeRenderCL::setBBox
+ * @param bl_x  Bottom left x coord
+ * @param bl_y  Bottom left y coord
+ * @param bl_z  Bottom left z coord
+ * @param tr_x  Top right x coord
+ * @param tr_y  Top right y coord
+ * @param tr_z  Top right z coord
+ */
+void VolumeRenderCL::setBBox(float bl_x, float bl_y, float bl_z,
+                             float tr_x, float tr_y, float tr_z)
+{
+    _camera_params.bbox_bl = {{bl_x, bl_y, bl_z}};
+    _camera_params.bbox_tr = {{tr_x, tr_y, tr_z}};
+    setCameraArgs();
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCL::getHistogram
+ * @param timestep
+ * @return
+ */
+const std::array<double, 256> & VolumeRenderCL::getHistogram(unsigned int timestep)
+{
+    if (!_dr.has_data())
+        throw std::invalid_argument("Invalid timestep for histogram data.");
+    if (isStreaming())
+    {
+        // zero until the timestep has been loaded
+        std::lock_guard<std::mutex> lock(_stream.mutex);
+        _stream.histogram = _stream.histograms.at(timestep);
+        return _stream.histogram;
+    }
+    if (_ownership.count > 1 && !_useBricking)
+    {
+        if (!ownsTimestep(timestep))
+            return _multiDevice.peers.at(getTimestepDevice(timestep) - 1)->getHistogram(timestep);
+        return _ownership.histograms.at(timestep);
+    }
+    return _dr.getHistogram(timestep);
+}
+
+/**
+ * @brief VolumeRenderCL::setTransferFunction
+ * @param tff
+ */
+void VolumeRenderCL::setTransferFunction(std::vector<unsigned char> &tff)
+{
+    _multiDevice.tff = tff;
+    for (auto &peer : _multiDevice.peers)
+        peer->setTransferFunction(tff);
+    if (!_dr.has_data())
+        return;
+    try
+    {
+        cl::ImageFormat format;
+        format.image_channel_order = CL_RGBA;
+        format.image_channel_data_type = CL_UNORM_INT8;
+
         cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
         // divide size by 4 because of RGBA channels
         _tffMem = cl::Image1D(_contextCL, flags, format, tff.size() / 4, tff.data());
-        generateBricks();
+        _preIntegration.segmentLength = 0.f;
+        // the min/max bricks do not depend on the transfer function, only the occupancy and
+        // the path tracing majorants do
+        _occupancySlot = -1;
+        _wavefront.majorantSlot = -1;
+
+        std::vector<unsigned int> prefixSum;
+        // copy only alpha values (every fourth element)
+        for (size_t i = 3; i < tff.size(); i += 4)
+            prefixSum.push_back(static_cast<unsigned int>(tff.at(i)));
+        std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
+        setTffPrefixSum(prefixSum);
+        resetIteration();
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::setTffPrefixSum
+ * @param tffPrefixSum
+ */
+void VolumeRenderCL::setTffPrefixSum(std::vector<unsigned int> &tffPrefixSum)
+{
+    if (!_dr.has_data())
+        return;
+    try
+    {
+        cl::ImageFormat format;
+        format.image_channel_order = CL_R;
+        format.image_channel_data_type = CL_UNSIGNED_INT32;
+
+        cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
+        _tffPrefixMem = cl::Image1D(_contextCL, flags, format, tffPrefixSum.size(),
+                                    tffPrefixSum.data());
+        // host copy to decide which bricks need to be streamed in bricked mode
+        _tffPrefixSum = tffPrefixSum;
+        _brickCache.dirty = _useBricking;
+        _occupancySlot = -1;
+        _wavefront.majorantSlot = -1;
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::setCamOrtho
+ * @param setCamOrtho
+ */
+void VolumeRenderCL::setCamOrtho(bool setCamOrtho)
+{
+    _camera_params.ortho = static_cast<cl_uint>(setCamOrtho);
+    setCameraArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::setIllumination
+ * @param illum
+ */
+void VolumeRenderCL::setIllumination(unsigned int illum)
+{
+    _rendering_params.illumType = static_cast<cl_uint>(illum);
+    setRenderingArgs();
+}
+
+
+/**
+ * @brief VolumeRenderCL::setAmbientOcclusion
+ * @param illum
+ */
+void VolumeRenderCL::setAmbientOcclusion(bool ao)
+{
+    _raycast_params.useAO = static_cast<cl_uint>(ao);
+    setRaycastArgs();
+}
+
+
+/**
+ * @brief VolumeRenderCL::setShowESS
+ * @param showESS
+ */
+void VolumeRenderCL::setShowESS(bool showESS)
+{
+    _rendering_params.showEss = static_cast<cl_uint>(showESS);
+    setRenderingArgs();
+}
+
+
+/**
+ * @brief VolumeRenderCL::setLinearSampling
+ * @param linearSampling
+ */
+void VolumeRenderCL::setLinearInterpolation(bool linearSampling)
+{
+    _rendering_params.useLinear = static_cast<cl_uint>(linearSampling);
+    setRenderingArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::setContours
+ * @param contours
+ */
+void VolumeRenderCL::setContours(bool contours)
+{
+    _raycast_params.contours = static_cast<cl_uint>(contours);
+    setRaycastArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::setAerial
+ * @param aerial
+ */
+void VolumeRenderCL::setAerial(bool aerial)
+{
+    _raycast_params.aerial = static_cast<cl_uint>(aerial);
+    setRaycastArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::setImgEss
+ * @param useEss
+ */
+void VolumeRenderCL::setImgEss(bool useEss)
+{
+    _rendering_params.imgEss = static_cast<cl_uint>(useEss);
+    setRenderingArgs();
+    _useImgESS = useEss;
+}
+
+/**
+ * @brief VolumeRenderCL::setImgEss
+ * @param useEss
+ */
+void VolumeRenderCL::setObjEss(bool useEss)
+{
+    _useObjEss = useEss;
+    if (_useBricking && !useEss)
+        std::cout << "Object order empty space skipping is always used in bricked mode."
+                  << std::endl;
+    initKernel(KERNEL_FILE, kernelBuildFlags());
+    // upload volume data if already loaded
+    if (_dr.has_data())
+    {
+        volDataToCLmem();
+    }
+}
+
+/**
+ * @brief VolumeRenderCL::setBackground
+ * @param color
+ */
+void VolumeRenderCL::setBackground(std::array<float, 4> color)
+{
+    cl_float3 bgColor = {{color[0], color[1], color[2]}};
+    _rendering_params.backgroundColor = bgColor;
+    setRenderingArgs();
+}
+
+/**
+ * @brief VolumeRenderCL::setUseGradient
+ * @param useGradient
+ */
+void VolumeRenderCL::setUseGradient(bool useGradient)
+{
+    _rendering_params.useGradient = static_cast<cl_uint>(useGradient);
+    setRenderingArgs();
+}
+
+void VolumeRenderCL::setTechnique(VolumeRenderCL::technique tech)
+{
+    _rendering_params.technique = static_cast<uint>(tech);
+    setRenderingArgs();
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCL::setWavefrontPathtracing
+ * @param wavefront
+ */
+void VolumeRenderCL::setWavefrontPathtracing(bool wavefront)
+{
+    for (auto &peer : _multiDevice.peers)
+        peer->setWavefrontPathtracing(wavefront);
+    _wavefront.enabled = wavefront;
+    resetIteration();
+}
+
+/**
+ * @brief VolumeRenderCL::getLastExecTime
+ * @return
+ */
+double VolumeRenderCL::getLastExecTime()
+{
+    return _lastExecTime;
+}
+
+
+/**
+ * @brief VolumeRenderCL::setStepCounting
+ * @param countSteps
+ */
+void VolumeRenderCL::setStepCounting(bool countSteps)
+{
+    _raycast_params.countSteps = static_cast<cl_uint>(countSteps);
+    _stepCounts = {};
+    setRaycastArgs();
+}
+
+
+/**
+ * @brief VolumeRenderCL::setDiagnostics
+ * @param diagnostics
+ */
+void VolumeRenderCL::setDiagnostics(bool diagnostics)
+{
+    for (auto &peer : _multiDevice.peers)
+        peer->setDiagnostics(diagnostics);
+    _raycast_params.diagnostics = static_cast<cl_uint>(diagnostics);
+    _stepCounts = {};
+    if (!diagnostics)
+        _diagnostics.image = cl::Image2D();
+    _diagnostics.rendered = false;
+    setRaycastArgs();
+}
+
+
+/**
+ * @brief VolumeRenderCL::getCostCounter
+ * @param counter
+ * @return
+ */
+cl_ulong VolumeRenderCL::getCostCounter(const cost_counter counter) const
+{
+    return _stepCounts.at(counter);
+}
+
+
+/**
+ * @brief VolumeRenderCL::getDiagnostics
+ * @param costs
+ * @param width
+ * @param height
+ * @return
+ */
+bool VolumeRenderCL::getDiagnostics(std::vector<cl_uint> &costs, size_t &width, size_t &height)
+{
+    // path tracing does not record the ray costs
+    if (!_raycast_params.diagnostics || !_diagnostics.rendered || _diagnostics.image() == nullptr
+            || _rendering_params.technique != TECH_RAYCAST)
+        return false;
+    try
+    {
+        width = _diagnostics.image.getImageInfo<CL_IMAGE_WIDTH>();
+        height = _diagnostics.image.getImageInfo<CL_IMAGE_HEIGHT>();
+        costs.resize(width * height * 4);
+        const std::array<size_t, 3> origin = {{0, 0, 0}};
+        const std::array<size_t, 3> region = {{width, height, 1}};
+        _queueCL.enqueueReadImage(_diagnostics.image, CL_TRUE, origin, region, 0, 0,
+                                  costs.data());
+        return true;
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+    return false;
+}
+
+
+/**
+ * @brief VolumeRenderCL::countsCosts
+ * @return
+ */
+bool VolumeRenderCL::countsCosts() const
+{
+    return _raycast_params.countSteps || _raycast_params.diagnostics;
+}
+
+
+/**
+ * @brief VolumeRenderCL::diagnosticImage
+ * @return
+ */
+const cl::Image2D &VolumeRenderCL::diagnosticImage()
+{
+    if (!_raycast_params.diagnostics)
+        return _diagnostics.placeholder;
+    const size_t width = std::max(size_t(1), _renderSize.at(0));
+    const size_t height = std::max(size_t(1), _renderSize.at(1));
+    if (_diagnostics.image() == nullptr
+            || _diagnostics.image.getImageInfo<CL_IMAGE_WIDTH>() != width
+            || _diagnostics.image.getImageInfo<CL_IMAGE_HEIGHT>() != height)
+    {
+        _diagnostics.image = cl::Image2D(_contextCL, CL_MEM_WRITE_ONLY,
+                                         cl::ImageFormat(CL_RGBA, CL_UNSIGNED_INT32),
+                                         width, height);
+    }
+    _diagnostics.rendered = true;
+    return _diagnostics.image;
+}
+
+
+/**
+ * @brief VolumeRenderCL::getSkippedSteps
+ * @return
+ */
+cl_ulong VolumeRenderCL::getSkippedSteps() const
+{
+    return _stepCounts.at(0);
+}
+
+
+/**
+ * @brief VolumeRenderCL::getSampledSteps
+ * @return
+ */
+cl_ulong VolumeRenderCL::getSampledSteps() const
+{
+    return _stepCounts.at(1);
+}
+
+
+/**
+ * @brief VolumeRenderCL::readStepCounters
+ */
+void VolumeRenderCL::readStepCounters()
+{
+    // 64 bit counters, each stored as low and high uint
+    std::array<cl_uint, 2*NUM_COST_COUNTERS> counters = {};
+    _queueCL.enqueueReadBuffer(_stepCountersMem, CL_TRUE, 0, counters.size()*sizeof(cl_uint),
+                               counters.data());
+    for (size_t c = 0; c < _stepCounts.size(); ++c)
+        _stepCounts.at(c) = (cl_ulong(counters.at(2*c + 1)) << 32) | counters.at(2*c);
+}
+
+
+/**
+ * @brief VolumeRenderCL::clearTileErrors
+ */
+void VolumeRenderCL::clearTileErrors()
+{
+    if (_rendering_params.errorThreshold <= 0.f)
+        return;
+    _queueCL.enqueueFillBuffer(_progressive.outTileError, cl_uint(0), 0,
+                               _progressive.outTileError.getInfo<CL_MEM_SIZE>());
+    _queueCL.enqueueFillBuffer(_progressive.activeTiles, cl_uint(0), 0, sizeof(cl_uint));
+}
+
+
+/**
+ * @brief VolumeRenderCL::swapAccumulation
+ */
+void VolumeRenderCL::swapAccumulation()
+{
+    // the kernel arguments are set again for the next frame in setMemObjectsRaycast
+    std::swap(_inAccumulate, _outAccumulate);
+    std::swap(_progressive.inTileError, _progressive.outTileError);
+    _rendering_params.iteration++;
+    if (_rendering_params.reproject != REPROJECT_OFF)
+    {
+        // the depth of this frame is the history of the next camera change
+        std::swap(_reprojection.depth.at(0), _reprojection.depth.at(1));
+        _reprojection.historyView = _camera_params.viewMat;
+        _rendering_params.reproject = REPROJECT_DEPTH;
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::setPeerDevices
+ * @param platformId
+ * @param deviceIds
+ * @param mode
+ */
+void VolumeRenderCL::setPeerDevices(const size_t platformId, const std::vector<size_t> &deviceIds,
+                                    const multi_device_mode mode)
+{
+    _multiDevice.peers.clear();
+    const size_t ownedBefore = _ownership.count;
+    _multiDevice.mode = mode;
+    _ownership.index = 0;
+    _ownership.count = 1;
+    try
+    {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        if (platformId >= platforms.size())
+            throw std::invalid_argument("Invalid OpenCL platform id.");
+        std::vector<cl::Device> devices;
+        platforms.at(platformId).getDevices(CL_DEVICE_TYPE_GPU, &devices);
+        for (const size_t id : deviceIds)
+        {
+            if (id >= devices.size())
+                throw std::invalid_argument("Invalid OpenCL device id.");
+            std::unique_ptr<VolumeRenderCL> peer(new VolumeRenderCL());
+            peer->_contextCL = createCLContext(std::vector<cl::Device>(1, devices.at(id)));
+            peer->_currentDevice = devices.at(id).getInfo<CL_DEVICE_NAME>();
+            peer->_useGL = false;
+            peer->_forceBricking = _forceBricking;
+            peer->_brickCacheSize = _brickCacheSize;
+            peer->_stream.windowSize = _stream.windowSize;
+            peer->_tuning.enabled = _tuning.enabled;
+            peer->initContextObjects();
+            _multiDevice.peers.push_back(std::move(peer));
+        }
+        if (mode == TIMESTEP_OWNERSHIP)
+        {
+            _ownership.count = _multiDevice.peers.size() + 1;
+            for (size_t i = 0; i < _multiDevice.peers.size(); ++i)
+            {
+                _multiDevice.peers.at(i)->_ownership.index = i + 1;
+                _multiDevice.peers.at(i)->_ownership.count = _ownership.count;
+            }
+        }
+    }
+    catch (cl::Error err)
+    {
+        _multiDevice.peers.clear();
+        logCLerror(err);
+    }
+    catch (std::invalid_argument)
+    {
+        _multiDevice.peers.clear();
+        throw;
+    }
+
+    // this device keeps only its own timesteps, reloading also loads the data on the peers
+    const bool reload = _dr.has_data() && _ownership.count != ownedBefore;
+    if (reload)
+        loadVolumeData(_dr.properties());
+
+    // replicate the data and state that lives in device memory
+    for (auto &peer : _multiDevice.peers)
+    {
+        if (_dr.has_data())
+        {
+            if (!reload)
+                peer->loadVolumeData(_dr.properties());
+            if (!_multiDevice.tff.empty())
+                peer->setTransferFunction(_multiDevice.tff);
+        }
+        if (!_multiDevice.environment.empty())
+            peer->createEnvironmentMap(_multiDevice.environment);
+        peer->setLowResVolume(_lowRes.enabled, _lowRes.factor);
+        if (_multiDevice.outputSize.at(0) > 0)
+            peer->updateOutputImg(_multiDevice.outputSize.at(0), _multiDevice.outputSize.at(1), 0);
+        std::cout << (mode == TIMESTEP_OWNERSHIP ? "Timestep ownership on "
+                                                 : "Sort-first rendering on ")
+                  << peer->_currentDevice << std::endl;
+    }
+    const size_t devices = _multiDevice.peers.size() + 1;
+    _multiDevice.shares.assign(devices, 1.0 / devices);
+    _multiDevice.rows.clear();
+    _multiDevice.bands.resize(devices - 1);
+    _multiDevice.readEvents.resize(devices - 1);
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCL::getDeviceCount
+ * @return
+ */
+size_t VolumeRenderCL::getDeviceCount() const
+{
+    return _multiDevice.peers.size() + 1;
+}
+
+
+/**
+ * @brief VolumeRenderCL::getTimestepDevice
+ * @param t
+ * @return
+ */
+size_t VolumeRenderCL::getTimestepDevice(const size_t t) const
+{
+    return t % _ownership.count;
+}
+
+
+/**
+ * @brief VolumeRenderCL::ownsTimestep
+ * @param t
+ * @return
+ */
+bool VolumeRenderCL::ownsTimestep(const size_t t) const
+{
+    return t % _ownership.count == _ownership.index;
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueueRaycastRows
+ * @param width
+ * @param rows
+ * @param evt
+ */
+void VolumeRenderCL::enqueueRaycastRows(const size_t width, const std::array<size_t, 2> &rows,
+                                        cl::Event *evt)
+{
+    enqueueRaycastTile({{0, rows.at(0)}},
+                       {{width + (LOCAL_SIZE - width % LOCAL_SIZE), rows.at(1) - rows.at(0)}}, evt);
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueueRaycastTile
+ * @param origin
+ * @param size
+ * @param evt
+ */
+void VolumeRenderCL::enqueueRaycastTile(const std::array<size_t, 2> &origin,
+                                        const std::array<size_t, 2> &size, cl::Event *evt)
+{
+    if (usesWavefront())
+    {
+        enqueueWavefrontTile(origin, size, evt);
+        return;
+    }
+    const std::array<size_t, 2> &shape = _tuning.groups.frame;
+    cl::NDRange globalThreads(RoundUp(size.at(0), shape.at(0)), RoundUp(size.at(1), shape.at(1)));
+    cl::NDRange localThreads(shape.at(0), shape.at(1));
+    _queueCL.enqueueNDRangeKernel(_raycastKernel, cl::NDRange(origin.at(0), origin.at(1)),
+                                  globalThreads, localThreads, nullptr, evt);
+}
+
+
+/**
+ * @brief VolumeRenderCL::usesWavefront
+ * @return
+ */
+bool VolumeRenderCL::usesWavefront() const
+{
+    return _wavefront.enabled && _rendering_params.technique == TECH_PATHTRACE;
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueueWavefrontTile
+ * @param origin
+ * @param size
+ * @param evt
+ */
+void VolumeRenderCL::enqueueWavefrontTile(const std::array<size_t, 2> &origin,
+                                          const std::array<size_t, 2> &size, cl::Event *evt)
+{
+    // ray generation and accumulation use the same NDRange as the raycasting kernel
+    cl::NDRange offset(origin.at(0), origin.at(1));
+    cl::NDRange globalThreads(size.at(0), size.at(1));
+    cl::NDRange localThreads(LOCAL_SIZE, LOCAL_SIZE);
+    const size_t numPaths = globalThreads[0] * globalThreads[1];
+    if (_wavefront.capacity < numPaths)
+    {
+        _wavefront.paths = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, numPaths*PATH_STATE_SIZE);
+        for (auto &queue : _wavefront.queues)
+            queue = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, numPaths*sizeof(cl_uint));
+        for (auto &count : _wavefront.counts)
+            count = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, sizeof(cl_uint));
+        _wavefront.capacity = numPaths;
+    }
+
+    cl::Event start;
+    _queueCL.enqueueFillBuffer(_wavefront.counts.at(0), cl_uint(0), 0, sizeof(cl_uint));
+    _wavefront.generate.setArg(0, _wavefront.output);
+    _wavefront.generate.setArg(1, _inAccumulate);
+    _wavefront.generate.setArg(2, _outAccumulate);
+    _wavefront.generate.setArg(3, _environmentMap);
+    _wavefront.generate.setArg(4, _camera_params);
+    _wavefront.generate.setArg(5, _rendering_params);
+    _wavefront.generate.setArg(6, _progressive.inTileError);
+    _wavefront.generate.setArg(7, _wavefront.paths);
+    _wavefront.generate.setArg(8, _wavefront.queues.at(0));
+    _wavefront.generate.setArg(9, _wavefront.counts.at(0));
+    _queueCL.enqueueNDRangeKernel(_wavefront.generate, offset, globalThreads, localThreads,
+                                  nullptr, &start);
+    // the live path count is never waited for: every segment is dispatched for the last count
+    // that already arrived on the host (all paths at first), the live paths only decrease
+    _wavefront.liveCounts.resize(PATH_SEGMENTS + 1);
+    _wavefront.liveCountReads.assign(PATH_SEGMENTS + 1, cl::Event());
+    _queueCL.enqueueReadBuffer(_wavefront.counts.at(0), CL_FALSE, 0, sizeof(cl_uint),
+                               &_wavefront.liveCounts.at(0), nullptr,
+                               &_wavefront.liveCountReads.at(0));
+    _queueCL.flush();
+    size_t bound = numPaths;
+
+    _wavefront.freeFlight.setArg(0, _wavefront.volume);
+    _wavefront.freeFlight.setArg(1, _wavefront.bricks);
+    _wavefront.freeFlight.setArg(2, _tffMem);
+    _wavefront.freeFlight.setArg(3, _brickCache.pageTable);
+    _wavefront.freeFlight.setArg(4, _pathtrace_params);
+    _wavefront.freeFlight.setArg(5, _wavefront.majorants);
+    _wavefront.freeFlight.setArg(6, _wavefront.paths);
+    _wavefront.scatter.setArg(0, _wavefront.volume);
+    _wavefront.scatter.setArg(1, _tffMem);
+    _wavefront.scatter.setArg(2, _brickCache.pageTable);
+    _wavefront.scatter.setArg(3, _wavefront.paths);
+    const size_t lSize = LOCAL_SIZE*LOCAL_SIZE;
+    size_t in = 0;
+    for (size_t segment = 0; segment < PATH_SEGMENTS; ++segment)
+    {
+        for (size_t s = segment + 1; s-- > 0;)
+        {
+            if (_wavefront.liveCountReads.at(s).getInfo<CL_EVENT_COMMAND_EXECUTION_STATUS>()
+                    == CL_COMPLETE)
+            {
+                bound = std::min(bound, size_t(_wavefront.liveCounts.at(s)));
+                break;
+            }
+        }
+        if (bound == 0)
+            break;
+        // paths beyond the live count of the last segment return immediately
+        const size_t out = 1 - in;
+        cl::NDRange pathThreads(RoundUp(bound, lSize));
+        _wavefront.freeFlight.setArg(7, _wavefront.queues.at(in));
+        _wavefront.freeFlight.setArg(8, _wavefront.counts.at(in));
+        _queueCL.enqueueNDRangeKernel(_wavefront.freeFlight, cl::NullRange, pathThreads,
+                                      cl::NDRange(lSize));
+        _queueCL.enqueueFillBuffer(_wavefront.counts.at(out), cl_uint(0), 0, sizeof(cl_uint));
+        _wavefront.scatter.setArg(4, _wavefront.queues.at(in));
+        _wavefront.scatter.setArg(5, _wavefront.counts.at(in));
+        _wavefront.scatter.setArg(6, _wavefront.queues.at(out));
+        _wavefront.scatter.setArg(7, _wavefront.counts.at(out));
+        _queueCL.enqueueNDRangeKernel(_wavefront.scatter, cl::NullRange, pathThreads,
+                                      cl::NDRange(lSize));
+        if (segment + 1 < PATH_SEGMENTS)
+            _queueCL.enqueueReadBuffer(_wavefront.counts.at(out), CL_FALSE, 0, sizeof(cl_uint),
+                                       &_wavefront.liveCounts.at(segment + 1), nullptr,
+                                       &_wavefront.liveCountReads.at(segment + 1));
+        in = out;
+    }
+
+    cl::Event end;
+    _wavefront.accumulate.setArg(0, _wavefront.output);
+    _wavefront.accumulate.setArg(1, _inAccumulate);
+    _wavefront.accumulate.setArg(2, _outAccumulate);
+    _wavefront.accumulate.setArg(3, _rendering_params);
+    _wavefront.accumulate.setArg(4, _progressive.outTileError);
+    _wavefront.accumulate.setArg(5, _progressive.activeTiles);
+    _wavefront.accumulate.setArg(6, _wavefront.paths);
+    _queueCL.enqueueNDRangeKernel(_wavefront.accumulate, offset, globalThreads, localThreads,
+                                  nullptr, &end);
+    if (evt != nullptr)
+        *evt = end;
+    _wavefront.spans.push_back(std::make_pair(start, end));
+    // without profiling only the frames in flight are timed
+    while (!_profile.enabled && _wavefront.spans.size() > _outputRing.images.size() + 1)
+        _wavefront.spans.pop_front();
+}
+
+
+/**
+ * @brief VolumeRenderCL::updateMajorants
+ * @param slot
+ */
+void VolumeRenderCL::updateMajorants(const size_t slot)
+{
+    if (_wavefront.majorantSlot == long(slot))
+        return;
+    const cl::Image3D &bricks = _bricksMem.at(slot);
+    const size_t numBricks = bricks.getImageInfo<CL_IMAGE_WIDTH>()
+                             * bricks.getImageInfo<CL_IMAGE_HEIGHT>()
+                             * bricks.getImageInfo<CL_IMAGE_DEPTH>();
+    if (_wavefront.majorants() == nullptr
+            || _wavefront.majorants.getInfo<CL_MEM_SIZE>() != numBricks*sizeof(cl_float))
+        _wavefront.majorants = cl::Buffer(_contextCL, CL_MEM_READ_WRITE,
+                                          numBricks*sizeof(cl_float));
+
+    _wavefront.genMajorants.setArg(0, bricks);
+    _wavefront.genMajorants.setArg(1, _tffMem);
+    _wavefront.genMajorants.setArg(2, _wavefront.majorants);
+    const size_t lSize = LOCAL_SIZE*LOCAL_SIZE;
+    cl::NDRange globalThreads(numBricks + (lSize - numBricks % lSize));
+    cl::NDRange localThreads(lSize);
+    _queueCL.enqueueNDRangeKernel(_wavefront.genMajorants, cl::NullRange, globalThreads,
+                                  localThreads, nullptr, stageEvent(STAGE_BRICK_GEN));
+    _wavefront.majorantSlot = long(slot);
+}
+
+
+/**
+ * @brief VolumeRenderCL::setOutputArg
+ * @param image
+ */
+void VolumeRenderCL::setOutputArg(const cl::Memory &image)
+{
+    _raycastKernel.setArg(OUTPUT, image);
+    _wavefront.output = image;
+}
+
+
+/**
+ * @brief VolumeRenderCL::updateReprojectionImages
+ * @param width
+ * @param height
+ */
+void VolumeRenderCL::updateReprojectionImages(const size_t width, const size_t height)
+{
+    _reprojection.depth = {{cl::Image2D(), cl::Image2D()}};
+    _reprojection.resolved = cl::Image2D();
+    _reprojection.mask = cl::Image2D();
+    if (!_reprojection.enabled || width == 0 || height == 0)
+        return;
+    for (auto &depth : _reprojection.depth)
+        depth = cl::Image2D(_contextCL, CL_MEM_READ_WRITE, cl::ImageFormat(CL_R, CL_FLOAT),
+                            width, height);
+    _reprojection.resolved = cl::Image2D(_contextCL, CL_MEM_READ_WRITE,
+                                         cl::ImageFormat(CL_RGBA, CL_FLOAT), width, height);
+    // no valid history: the first reprojected frame is traced at the full sampling rate
+    std::vector<cl_uchar> noHistory(width*height, 0);
+    _reprojection.mask = cl::Image2D(_contextCL, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                     cl::ImageFormat(CL_R, CL_UNSIGNED_INT8), width, height, 0,
+                                     noHistory.data());
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueueReprojection
+ * @param output
+ * @param width
+ * @param height
+ */
+void VolumeRenderCL::enqueueReprojection(const cl::Memory &output, const size_t width,
+                                         const size_t height)
+{
+    std::array<double, 9> inv;
+    if (!InvertRotation(_reprojection.historyView, inv))
+        return;
+    cl_float16 &m = _reprojection.params.historyInvView;
+    for (size_t row = 0; row < 3; ++row)
+    {
+        for (size_t col = 0; col < 3; ++col)
+            m.s[row*4 + col] = static_cast<cl_float>(inv.at(row*3 + col));
+        m.s[row*4 + 3] = _reprojection.historyView.s[row*4 + 3];
+    }
+    m.s[12] = m.s[13] = m.s[14] = 0.f;
+    m.s[15] = 1.f;
+
+    // the history is the accumulation of the last frame, the samples the one of this frame
+    cl::Kernel &kernel = _reprojection.kernel;
+    kernel.setArg(0, output);
+    kernel.setArg(1, _outAccumulate);
+    kernel.setArg(2, _reprojection.depth.at(0));
+    kernel.setArg(3, _inAccumulate);
+    kernel.setArg(4, _reprojection.depth.at(1));
+    kernel.setArg(5, _reprojection.resolved);
+    kernel.setArg(6, _reprojection.mask);
+    kernel.setArg(7, _camera_params);
+    kernel.setArg(8, _rendering_params);
+    kernel.setArg(9, _reprojection.params);
+    cl::NDRange globalThreads(width + (LOCAL_SIZE - width % LOCAL_SIZE),
+                              height + (LOCAL_SIZE - height % LOCAL_SIZE));
+    cl::NDRange localThreads(LOCAL_SIZE, LOCAL_SIZE);
+    _queueCL.enqueueNDRangeKernel(kernel, cl::NullRange, globalThreads, localThreads);
+    // the resolved color is accumulated by the next frames
+    std::swap(_outAccumulate, _reprojection.resolved);
+}
+
+
+/**
+ * @brief VolumeRenderCL::kernelTime
+ * @param evt
+ * @return
+ */
+double VolumeRenderCL::kernelTime(const cl::Event &evt) const
+{
+    cl_ulong start = 0;
+    cl_ulong end = 0;
+    evt.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+    evt.getProfilingInfo(CL_PROFILING_COMMAND_END, &end);
+    for (const auto &span : _wavefront.spans)
+    {
+        if (span.second() == evt())
+            span.first.getProfilingInfo(CL_PROFILING_COMMAND_START, &start);
+    }
+    return static_cast<double>(end - start)*1e-9;
+}
+
+
+/**
+ * @brief VolumeRenderCL::syncPeer
+ * @param peer
+ */
+void VolumeRenderCL::syncPeer(VolumeRenderCL &peer) const
+{
+    // the brick grid depends on the (bricked) mode of the peer's volume
+    const cl_float3 brickRes = peer._raycast_params.brickRes;
+    const cl_uint brickLevels = peer._raycast_params.brickLevels;
+    peer._camera_params = _camera_params;
+    peer._rendering_params = _rendering_params;
+    peer._raycast_params = _raycast_params;
+    peer._raycast_params.brickRes = brickRes;
+    peer._raycast_params.brickLevels = brickLevels;
+    peer._pathtrace_params = _pathtrace_params;
+    peer._modelScale = _modelScale;
+    peer._useImgESS = _useImgESS;
+    peer._useObjEss = _useObjEss;
+    peer.setCameraArgs();
+    peer.setRaycastArgs();
+    peer.setPathtraceArgs();
+}
+
+
+/**
+ * @brief VolumeRenderCL::splitRows
+ * @param globalHeight
+ */
+void VolumeRenderCL::splitRows(const size_t globalHeight)
+{
+    auto &rows = _multiDevice.rows;
+    if (_multiDevice.mode == TIMESTEP_OWNERSHIP)
+    {
+        // the whole frame is rendered on the owner of the timestep
+        rows.assign(_multiDevice.shares.size(), {{0, 0}});
+        rows.at(getTimestepDevice(_timestep)) = {{0, globalHeight}};
+        return;
+    }
+    if (!rows.empty() && rows.back().at(1) == globalHeight && _rendering_params.iteration > 0)
+        return;
+
+    // whole work-groups per band, at least one per device if possible
+    const size_t devices = _multiDevice.shares.size();
+    const size_t groups = globalHeight / LOCAL_SIZE;
+    rows.assign(devices, {{0, 0}});
+    size_t begin = 0;
+    for (size_t i = 0; i < devices; ++i)
+    {
+        const size_t remaining = groups - begin;
+        const size_t others = std::min(devices - 1 - i, remaining > 0 ? remaining - 1 : 0);
+        size_t count = remaining;
+        if (i + 1 < devices)
+            count = std::min(std::max(size_t(1), static_cast<size_t>(
+                                 std::round(_multiDevice.shares.at(i) * groups))),
+                             remaining - others);
+        rows.at(i) = {{begin*LOCAL_SIZE, (begin + count)*LOCAL_SIZE}};
+        begin += count;
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueuePeerBands
+ * @param width
+ * @param height
+ * @return
+ */
+std::array<size_t, 2> VolumeRenderCL::enqueuePeerBands(const size_t width, const size_t height)
+{
+    const size_t globalHeight = height + (LOCAL_SIZE - height % LOCAL_SIZE);
+    if (_multiDevice.peers.empty())
+        return {{0, globalHeight}};
+
+    splitRows(globalHeight);
+    for (size_t i = 0; i < _multiDevice.peers.size(); ++i)
+    {
+        VolumeRenderCL &peer = *_multiDevice.peers.at(i);
+        syncPeer(peer);
+        _multiDevice.bands.at(i).resize(width*height*4);
+        peer.enqueueBand(width, height, _multiDevice.rows.at(i + 1),
+                         _multiDevice.bands.at(i).data(), _multiDevice.readEvents.at(i));
+    }
+    return _multiDevice.rows.at(0);
+}
+
+
+/**
+ * @brief VolumeRenderCL::enqueueBand
+ * @param width
+ * @param height
+ * @param rows
+ * @param band
+ * @param readEvt
+ */
+void VolumeRenderCL::enqueueBand(const size_t width, const size_t height,
+                                 const std::array<size_t, 2> &rows,
+                                 unsigned char *band, cl::Event &readEvt)
+{
+    if (!this->_volLoaded)
+        return;
+    if (isStreaming() && swapStreamedTimestep())
+        resetIteration();
+    // the volume of the timestep may not be held by this device
+    if (rows.at(1) <= rows.at(0) || rows.at(0) >= height)
+    {
+        readEvt = cl::Event();
+        _progressive.active = 0;
+        return;
+    }
+    selectRaycastVariant();
+    setRenderSize(width, height);
+    setMemObjectsRaycast(_timestep);
+
+    if (countsCosts())
+        _queueCL.enqueueFillBuffer(_stepCountersMem, cl_uint(0), 0,
+                                       2*NUM_COST_COUNTERS*sizeof(cl_uint));
+    clearTileErrors();
+    enqueueRaycastRows(width, rows, &_multiDevice.bandEvent);
+    if (_useImgESS)
+    {
+        // swap hit test buffers
+        cl::Image2D tmp = _outputHitMem;
+        _outputHitMem = _inputHitMem;
+        _inputHitMem = tmp;
+    }
+    swapAccumulation();
+    if (_rendering_params.errorThreshold > 0.f)
+        _queueCL.enqueueReadBuffer(_progressive.activeTiles, CL_FALSE, 0, sizeof(cl_uint),
+                                   &_progressive.active);
+
+    const size_t bandHeight = std::min(rows.at(1), height) - rows.at(0);
+    std::array<size_t, 3> origin = {{0, rows.at(0), 0}};
+    std::array<size_t, 3> region = {{width, bandHeight, 1}};
+    _queueCL.enqueueReadImage(_outputMemNoGL, CL_FALSE, origin, region, 0, 0, band,
+                              nullptr, &readEvt);
+    _queueCL.flush();
+}
+
+
+/**
+ * @brief VolumeRenderCL::compositePeerBands
+ * @param output
+ * @param width
+ * @param height
+ */
+void VolumeRenderCL::compositePeerBands(const cl::Image &output, const size_t width,
+                                        const size_t height)
+{
+    if (_multiDevice.peers.empty())
+        return;
+    // start the own band before blocking on the peers
+    _queueCL.flush();
+    for (size_t i = 0; i < _multiDevice.peers.size(); ++i)
+    {
+        const std::array<size_t, 2> &rows = _multiDevice.rows.at(i + 1);
+        if (_multiDevice.readEvents.at(i)() == nullptr)
+            continue;
+        _multiDevice.readEvents.at(i).wait();
+        std::array<size_t, 3> origin = {{0, rows.at(0), 0}};
+        std::array<size_t, 3> region = {{width, std::min(rows.at(1), height) - rows.at(0), 1}};
+        _queueCL.enqueueWriteImage(output, CL_FALSE, origin, region, 0, 0,
+                                   _multiDevice.bands.at(i).data());
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::finishPeerBands
+ */
+void VolumeRenderCL::finishPeerBands()
+{
+    if (_multiDevice.peers.empty())
+        return;
+
+    // rows per second of all devices in the last frame, this device first
+    const size_t devices = _multiDevice.peers.size() + 1;
+    std::vector<double> rowsPerSecond(devices, 0.0);
+    double frameTime = _lastExecTime;
+    for (size_t i = 0; i < devices; ++i)
+    {
+        VolumeRenderCL &device = i == 0 ? *this : *_multiDevice.peers.at(i - 1);
+        if (i > 0 && _multiDevice.readEvents.at(i - 1)() != nullptr)
+        {
+#ifdef CL_QUEUE_PROFILING_ENABLE
+            device._lastExecTime = device.kernelTime(device._multiDevice.bandEvent);
+#endif
+            if (countsCosts())
+            {
+                device.readStepCounters();
+                for (size_t c = 0; c < _stepCounts.size(); ++c)
+                    _stepCounts.at(c) += device._stepCounts.at(c);
+            }
+            if (device._useBricking)
+                device.updateBrickCache();
+            frameTime = std::max(frameTime, device._lastExecTime);
+        }
+        const size_t rows = _multiDevice.rows.at(i).at(1) - _multiDevice.rows.at(i).at(0);
+        if (rows > 0 && device._lastExecTime > 0.0)
+            rowsPerSecond.at(i) = rows / device._lastExecTime;
+    }
+    _lastExecTime = frameTime;
+
+    // damped update of the shares, the split changes with the next first iteration
+    const double sum = std::accumulate(rowsPerSecond.begin(), rowsPerSecond.end(), 0.0);
+    if (std::find(rowsPerSecond.begin(), rowsPerSecond.end(), 0.0) != rowsPerSecond.end())
+        return;
+    for (size_t i = 0; i < devices; ++i)
+        _multiDevice.shares.at(i) = 0.5*_multiDevice.shares.at(i) + 0.5*rowsPerSecond.at(i)/sum;
+}
+
+
+/**
+ * @brief VolumeRenderCL::setProfiling
+ * @param profiling
+ */
+void VolumeRenderCL::setProfiling(bool profiling)
+{
+    _profile.enabled = profiling;
+    if (!profiling)
+        _profile.events.clear();
+}
+
+
+/**
+ * @brief VolumeRenderCL::stageEvent
+ * @param stage
+ * @return
+ */
+cl::Event *VolumeRenderCL::stageEvent(const profiling_stage stage)
+{
+    if (!_profile.enabled)
+        return nullptr;
+    _profile.events.push_back(std::make_pair(stage, cl::Event()));
+    return &_profile.events.back().second;
+}
+
+
+/**
+ * @brief VolumeRenderCL::takeStageTimings
+ * @return
+ */
+std::array<std::vector<double>, VolumeRenderCL::NUM_STAGES> VolumeRenderCL::takeStageTimings()
+{
+    std::array<std::vector<double>, NUM_STAGES> timings;
+    try
+    {
+        for (auto &e : _profile.events)
+        {
+            e.second.wait();
+            timings.at(e.first).push_back(kernelTime(e.second));
+        }
+    }
+    catch (cl::Error err)
+    {
+        _profile.events.clear();
+        _wavefront.spans.clear();
+        logCLerror(err);
+    }
+    _profile.events.clear();
+    _wavefront.spans.clear();
+    return timings;
+}
+
+
+/**
+ * @brief VolumeRenderCL::isKernelVariantPending
+ * @return
+ */
+bool VolumeRenderCL::isKernelVariantPending() const
+{
+    return _variants.active != _buildFlags + kernelVariantFlags();
+}
+
+
+/**
+ * @brief VolumeRenderCL::getPlatformNames
+ * @return
+ */
+const std::vector<std::string> VolumeRenderCL::getPlatformNames()
+{
+    std::vector<std::string> names;
+    try
+    {
+        std::vector<cl::Platform> platforms;
+
+        cl::Platform::get(&platforms);
+        for(unsigned int i = 0; i < platforms.size(); ++i)
+            names.push_back(platforms[i].getInfo<CL_PLATFORM_NAME>());
+    }
+    catch (cl::Error err) {
+        logCLerror(err);
+    }
+    return names;
+}
+
+/**
+ * @brief VolumeRenderCL::getDeviceNames
+ * @param platformId
+ * @param type
+ * @return
+ */
+const std::vector<std::string> VolumeRenderCL::getDeviceNames(size_t platformId,
+                                                              const std::string &type)
+{
+    std::vector<std::string> names;
+    cl_device_type t = CL_DEVICE_TYPE_ALL;
+    if (type == "GPU") t = CL_DEVICE_TYPE_GPU;
+    else if (type == "CPU") t = CL_DEVICE_TYPE_CPU;
+    try
+    {
+        std::vector<cl::Platform> platforms;
+        cl::Platform::get(&platforms);
+        std::vector<cl::Device> devices;
+        platforms[platformId].getDevices(t, &devices);
+
+        for(unsigned int i = 0; i < devices.size(); ++i)
+            names.push_back(devices[i].getInfo<CL_DEVICE_NAME>());
+    }
+    catch (cl::Error err) {
+        logCLerror(err);
+    }
+
+    return names;
+}
+
+/**
+ * @brief VolumeRenderCL::getCurrentDeviceName
+ * @return
+ */
+const std::string VolumeRenderCL::getCurrentDeviceName()
+{
+    // the name is only set when a context is created for a specific device
+    if (_currentDevice.empty() && _contextCL() != nullptr)
+        return _contextCL.getInfo<CL_CONTEXT_DEVICES>().front().getInfo<CL_DEVICE_NAME>();
+    return _currentDevice;
+}
+
+/**
+ * @brief VolumeRenderCL::getCurrentDriverVersion
+ * @return
+ */
+const std::string VolumeRenderCL::getCurrentDriverVersion()
+{
+    if (_contextCL() == nullptr)
+        return "";
+    return _contextCL.getInfo<CL_CONTEXT_DEVICES>().front().getInfo<CL_DRIVER_VERSION>();
+}
+
+/**
+ * @brief VolumeRenderCL::createEnvironmentMap
+ * @param file_name
+ */
+void VolumeRenderCL::createEnvironmentMap(const std::string &file_name)
+{
+    unsigned int width = 2048;
+    unsigned int height = 1024;
+    cl::ImageFormat format;
+    format.image_channel_order = CL_RGBA;
+    format.image_channel_data_type = CL_FLOAT;
+    if (file_name.empty()) // initialize with white
+    {
+        cl_float4 d = {{1,1,1,1}};
+        _environmentMap = cl::Image2D(_contextCL, CL_MEM_READ_ONLY, format, 1, 1, 0, &d);
+    }
+    else
+    {
+        float *pixels;
+        if (!load_hdr_float4(&pixels, &width, &height, file_name.c_str()))
+            throw std::runtime_error("Error loading environment map file.");
+        _environmentMap = cl::Image2D(_contextCL, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                      format, width, height, 0, pixels);
+        std::cout << "Loaded environment map " << file_name << std::endl;
+    }
+
+    try {
+        _raycastKernel.setArg(ENVIRONMENT, _environmentMap);
+    }
+    catch (cl::Error err) {
+        logCLerror(err);
+    }
+    _multiDevice.environment = file_name;
+    for (auto &peer : _multiDevice.peers)
+        peer->createEnvironmentMap(file_name);
+}
+
+/**
+ * @brief VolumeRenderCL::setExtinction
+ * @param maximum extinction factor for path tracing
+ */
+void VolumeRenderCL::setExtinction(const double extinction)
+{
+    _pathtrace_params.max_extinction = float(extinction);
+    setPathtraceArgs();
+}
 
-        std::vector<unsigned int> prefixSum;
-        // copy only alpha values (every fourth element)
-        for (size_t i = 3; i < tff.size(); i += 4)
-            prefixSum.push_back(static_cast<unsigned int>(tff.at(i)));
-        std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
-        setTffPrefixSum(prefixSum);
-        resetIteration();
+/**
+ * @brief VolumeRenderCL::setTimestep
+ * @param t
+ */
+void VolumeRenderCL::setTimestep(const size_t t)
+{
+    for (auto &peer : _multiDevice.peers)
+        peer->setTimestep(t);
+    if (_dr.has_data() && t >= _dr.properties().volume_res.at(3))
+        return;
+    if (_useBricking && t >= _dr.num_timesteps())
+        return;
+
+    if (isStreaming())
+    {
+        // never wait for the upload: keep rendering the current timestep until t is resident
+        {
+            std::lock_guard<std::mutex> lock(_stream.mutex);
+            _stream.requested = t;
+        }
+        _stream.cv.notify_one();
+        if (swapStreamedTimestep())
+            resetIteration();
+        return;
+    }
+
+    if (_useBricking && t != _timestep)
+        resetBrickCache();
+    this->_timestep = t;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCL::setBricking
+ * @param useBricking
+ */
+void VolumeRenderCL::setBricking(bool useBricking)
+{
+    if (_forceBricking == useBricking)
+        return;
+    for (auto &peer : _multiDevice.peers)
+        peer->setBricking(useBricking);
+    _forceBricking = useBricking;
+    if (_dr.has_data())
+        volDataToCLmem();
+}
+
+
+/**
+ * @brief VolumeRenderCL::isBricked
+ * @return
+ */
+bool VolumeRenderCL::isBricked() const
+{
+    return _useBricking;
+}
+
+
+/**
+ * @brief VolumeRenderCL::hasPendingBricks
+ * @return
+ */
+bool VolumeRenderCL::hasPendingBricks() const
+{
+    for (const auto &peer : _multiDevice.peers)
+        if (peer->hasPendingBricks())
+            return true;
+    return _useBricking && _brickCache.dirty;
+}
+
+
+/**
+ * @brief VolumeRenderCL::setBrickCacheSize
+ * @param bytes
+ */
+void VolumeRenderCL::setBrickCacheSize(const size_t bytes)
+{
+    _brickCacheSize = bytes;
+    for (auto &peer : _multiDevice.peers)
+        peer->setBrickCacheSize(bytes);
+    if (_useBricking && _dr.has_data())
+        volDataToCLmem();
+}
+
+
+/**
+ * @brief VolumeRenderCL::exceedsDeviceMemory
+ * @param bytesPerTimestep
+ * @return
+ */
+bool VolumeRenderCL::exceedsDeviceMemory(const size_t bytesPerTimestep,
+                                         const size_t numTimesteps) const
+{
+    try
+    {
+        const cl::Device device = _contextCL.getInfo<CL_CONTEXT_DEVICES>().front();
+        const auto &res = _dr.properties().volume_res;
+        if (res.at(0) > device.getInfo<CL_DEVICE_IMAGE3D_MAX_WIDTH>() ||
+            res.at(1) > device.getInfo<CL_DEVICE_IMAGE3D_MAX_HEIGHT>() ||
+            res.at(2) > device.getInfo<CL_DEVICE_IMAGE3D_MAX_DEPTH>())
+            return true;
+        if (bytesPerTimestep > device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>())
+            return true;
+        // leave some head room for output images, bricks and the transfer function
+        const cl_ulong globalMem = device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>();
+        return bytesPerTimestep * numTimesteps > globalMem / 10 * 8;
+    }
+    catch (cl::Error err)
+    {
+        std::cerr << "Could not query device memory limits: " << err.what() << std::endl;
+    }
+    return false;
+}
+
+
+/**
+ * @brief VolumeRenderCL::initBrickCache
+ * @param format
+ * @param bytesPerVoxel
+ */
+void VolumeRenderCL::initBrickCache(const cl::ImageFormat &format, const size_t bytesPerVoxel)
+{
+    const auto &res = _dr.properties().volume_res;
+    BrickCache &bc = _brickCache;
+    for (size_t i = 0; i < 3; ++i)
+        bc.numBricks.at(i) = (res.at(i) + BRICK_SIZE - 1) / BRICK_SIZE;
+    const size_t numBricks = size_t(bc.numBricks.at(0)) * bc.numBricks.at(1) * bc.numBricks.at(2);
+    const size_t slotSize = BRICK_SIZE + 2;
+    const size_t slotBytes = slotSize * slotSize * slotSize * bytesPerVoxel;
+    bc.bytesPerVoxel = bytesPerVoxel;
+
+    try
+    {
+        const cl::Device device = _contextCL.getInfo<CL_CONTEXT_DEVICES>().front();
+        size_t budget = _brickCacheSize;
+        if (budget == 0)
+            budget = size_t(std::min(device.getInfo<CL_DEVICE_MAX_MEM_ALLOC_SIZE>(),
+                                     device.getInfo<CL_DEVICE_GLOBAL_MEM_SIZE>() / 2));
+        const double slots = double(std::max(size_t(1), std::min(numBricks, budget / slotBytes)));
+
+        // layout slots in an approximately cubic atlas within the device image size limits
+        const std::array<size_t, 3> maxSlots = {{
+                std::max(size_t(1), device.getInfo<CL_DEVICE_IMAGE3D_MAX_WIDTH>() / slotSize),
+                std::max(size_t(1), device.getInfo<CL_DEVICE_IMAGE3D_MAX_HEIGHT>() / slotSize),
+                std::max(size_t(1), device.getInfo<CL_DEVICE_IMAGE3D_MAX_DEPTH>() / slotSize)}};
+        bc.numSlots.at(0) = uint(std::clamp(size_t(ceil(std::cbrt(slots))), size_t(1), maxSlots.at(0)));
+        bc.numSlots.at(1) = uint(std::clamp(size_t(ceil(sqrt(slots / bc.numSlots.at(0)))),
+                                            size_t(1), maxSlots.at(1)));
+        bc.numSlots.at(2) = uint(std::clamp(size_t(slots / (bc.numSlots.at(0) * bc.numSlots.at(1))),
+                                            size_t(1), maxSlots.at(2)));
+
+        bc.atlas = cl::Image3D(_contextCL, CL_MEM_READ_ONLY, format,
+                               bc.numSlots.at(0) * slotSize,
+                               bc.numSlots.at(1) * slotSize,
+                               bc.numSlots.at(2) * slotSize);
+        bc.pageTable = cl::Image3D(_contextCL, CL_MEM_READ_ONLY,
+                                   cl::ImageFormat(CL_R, CL_UNSIGNED_INT32),
+                                   bc.numBricks.at(0), bc.numBricks.at(1), bc.numBricks.at(2));
+        bc.requests = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, numBricks * sizeof(cl_uint));
+        bc.minMax.resize(_dr.properties().raw_file_names.size());
+
+        const size_t numSlots = size_t(bc.numSlots.at(0)) * bc.numSlots.at(1) * bc.numSlots.at(2);
+        std::cout << "Using bricked mode: " << numBricks << " bricks of " << BRICK_SIZE << "^3 voxels, "
+                  << "brick cache holds " << numSlots << " bricks ("
+                  << (numSlots * slotBytes) / (1024*1024) << " MB)." << std::endl;
     }
     catch (cl::Error err)
     {
         logCLerror(err);
     }
+    resetBrickCache();
 }
 
 
 /**
- * @brief VolumeRenderCL::setTffPrefixSum
- * @param tffPrefixSum
+ * @brief VolumeRenderCL::resetBrickCache
  */
-void VolumeRenderCL::setTffPrefixSum(std::vector<unsigned int> &tffPrefixSum)
+void VolumeRenderCL::resetBrickCache()
 {
-    if (!_dr.has_data())
+    BrickCache &bc = _brickCache;
+    const size_t numBricks = size_t(bc.numBricks.at(0)) * bc.numBricks.at(1) * bc.numBricks.at(2);
+    const size_t numSlots = size_t(bc.numSlots.at(0)) * bc.numSlots.at(1) * bc.numSlots.at(2);
+    bc.pageEntries.assign(numBricks, 0u);
+    bc.requestFlags.assign(numBricks, BRICK_UNUSED);
+    bc.slotBrick.assign(numSlots, -1);
+    bc.slotLastUsed.assign(numSlots, 0);
+    bc.dirty = true;
+    try
+    {
+        std::array<size_t, 3> origin = {{0, 0, 0}};
+        std::array<size_t, 3> region = {{bc.numBricks.at(0), bc.numBricks.at(1), bc.numBricks.at(2)}};
+        _queueCL.enqueueWriteImage(bc.pageTable, CL_TRUE, origin, region, 0, 0,
+                                   bc.pageEntries.data());
+        _queueCL.enqueueFillBuffer(bc.requests, cl_uint(BRICK_UNUSED), 0,
+                                   numBricks * sizeof(cl_uint));
+        _queueCL.finish();
+    }
+    catch (cl::Error err)
+    {
+        logCLerror(err);
+    }
+}
+
+
+/**
+ * @brief Normalized scalar value of a voxel.
+ */
+static float voxelValue(const char *data, const size_t id, const DatRawReader::data_format format)
+{
+    if (format == DatRawReader::USHORT)
+        return reinterpret_cast<const cl_ushort*>(data)[id] / 65535.f;
+    else if (format == DatRawReader::FLOAT)
+        return reinterpret_cast<const cl_float*>(data)[id];
+    return static_cast<cl_uchar>(data[id]) / 255.f;
+}
+
+
+/**
+ * @brief Store a normalized value in the given voxel format.
+ */
+static void storeValue(char *data, const size_t id, const float value,
+                       const DatRawReader::data_format format)
+{
+    if (format == DatRawReader::USHORT)
+        reinterpret_cast<cl_ushort*>(data)[id] = cl_ushort(std::round(std::clamp(value, 0.f, 1.f)
+                                                                      * 65535.f));
+    else if (format == DatRawReader::FLOAT)
+        reinterpret_cast<cl_float*>(data)[id] = value;
+    else
+        reinterpret_cast<cl_uchar*>(data)[id] = cl_uchar(std::round(std::clamp(value, 0.f, 1.f)
+                                                                    * 255.f));
+}
+
+
+/**
+ * @brief VolumeRenderCL::deviceVolumeSize
+ * @return
+ */
+size_t VolumeRenderCL::deviceVolumeSize() const
+{
+    const auto &res = _dr.properties().volume_res;
+    const size_t voxels = size_t(res.at(0)) * res.at(1) * res.at(2);
+    const auto &co = _dr.properties().image_channel_order;
+    const bool singleChannel = co == "R" || co == "" || co == "I" || co == "LUMINANCE";
+    if (_quantization.requested == STORAGE_NATIVE || !singleChannel
+            || _dr.properties().format == DatRawReader::UCHAR)
+        return _dr.data_size(0);
+    return voxels * (_quantization.requested == STORAGE_UNORM8 ? 1 : 2);
+}
+
+
+/**
+ * @brief VolumeRenderCL::selectStorageFormat
+ * @param format
+ * @param compact
+ */
+void VolumeRenderCL::selectStorageFormat(cl::ImageFormat &format, const bool compact)
+{
+    Quantization &q = _quantization;
+    q.active = STORAGE_NATIVE;
+    q.scale = 1.f;
+    q.offset = 0.f;
+    {
+        std::lock_guard<std::mutex> lock(_stream.mutex);
+        q.maxError = 0.0;
+        q.squaredError = 0.0;
+        q.voxels = 0;
+        q.timesteps = 0;
+    }
+    if (q.requested == STORAGE_NATIVE)
+        return;
+    if (!compact || format.image_channel_order != CL_R
+            || _dr.properties().format == DatRawReader::UCHAR)
+    {
+        std::cerr << "WARNING: Compact storage formats are only supported for single channel "
+                  << "USHORT and FLOAT volumes in non-bricked mode, using the native format."
+                  << std::endl;
+        return;
+    }
+
+    q.active = q.requested;
+    if (q.active == STORAGE_HALF)
+    {
+        // single channel half float images are not in the minimum set of OpenCL 1.2
+        std::vector<cl::ImageFormat> formats;
+        _contextCL.getSupportedImageFormats(CL_MEM_READ_ONLY, CL_MEM_OBJECT_IMAGE3D, &formats);
+        const bool supported = std::any_of(formats.begin(), formats.end(),
+                                           [](const cl::ImageFormat &f) {
+            return f.image_channel_order == CL_R && f.image_channel_data_type == CL_HALF_FLOAT; });
+        if (supported)
+        {
+            format.image_channel_data_type = CL_HALF_FLOAT;
+            return;
+        }
+        std::cerr << "WARNING: Half float volumes are not supported by the device, "
+                  << "using 16 bit normalized storage instead." << std::endl;
+        q.active = STORAGE_UNORM16;
+    }
+    format.image_channel_data_type = q.active == STORAGE_UNORM16 ? CL_UNORM_INT16
+                                                                 : CL_UNORM_INT8;
+
+    // value range of the non-empty histogram bins of all timesteps that have been read,
+    // widened by one bin to cover the rounding of the binning
+    size_t first = 255;
+    size_t last = 0;
+    for (size_t t = 0; t < _dr.num_timesteps(); ++t)
+    {
+        const std::array<double, 256> &histogram = _dr.getHistogram(t);
+        for (size_t b = 0; b < histogram.size(); ++b)
+        {
+            if (histogram.at(b) > 0.0)
+            {
+                first = std::min(first, b);
+                last = std::max(last, b);
+            }
+        }
+    }
+    if (first > last)
+    {
+        first = 0;
+        last = 255;
+    }
+    q.offset = std::max(0.f, (float(first) - 1.f) / 255.f);
+    q.scale = std::min(1.f, (float(last) + 1.f) / 255.f) - q.offset;
+}
+
+
+/**
+ * @brief VolumeRenderCL::reportQuantizationError
+ */
+void VolumeRenderCL::reportQuantizationError() const
+{
+    if (_quantization.active == STORAGE_NATIVE)
+        return;
+    const QuantizationError error = getQuantizationError();
+    std::cout << "Quantization error of " << error.timesteps << " timestep(s): max "
+              << error.max << ", RMS " << error.rms << " (value range ["
+              << _quantization.offset << ".." << _quantization.offset + _quantization.scale
+              << "])" << std::endl;
+}
+
+
+/**
+ * @brief VolumeRenderCL::storeVolume
+ * @param data
+ * @param staging
+ * @return
+ */
+const char *VolumeRenderCL::storeVolume(const char *data, std::vector<char> &staging)
+{
+    const Quantization &q = _quantization;
+    if (q.active == STORAGE_NATIVE)
+        return data;
+
+    const auto &res = _dr.properties().volume_res;
+    const size_t voxels = size_t(res.at(0)) * res.at(1) * res.at(2);
+    const DatRawReader::data_format f = _dr.properties().format;
+    const float levels = q.active == STORAGE_UNORM8 ? 255.f : 65535.f;
+    staging.resize(voxels * (q.active == STORAGE_UNORM8 ? 1 : 2));
+    double maxError = 0.0;
+    double squaredError = 0.0;
+#if _OPENMP >= 201107
+    #pragma omp parallel for reduction(max:maxError) reduction(+:squaredError)
+#endif
+    for (size_t i = 0; i < voxels; ++i)
+    {
+        const float value = voxelValue(data, i, f);
+        float stored = 0.f;
+        if (q.active == STORAGE_HALF)
+        {
+            const cl_half h = float_to_half(std::max(value, 0.f));
+            reinterpret_cast<cl_half*>(staging.data())[i] = h;
+            stored = half_to_float(h);
+        }
+        else
+        {
+            // values outside of the range, e.g. of timesteps streamed later, are clamped
+            const float quantized = std::round(std::clamp((value - q.offset) / q.scale, 0.f, 1.f)
+                                               * levels);
+            if (q.active == STORAGE_UNORM16)
+                reinterpret_cast<cl_ushort*>(staging.data())[i] = cl_ushort(quantized);
+            else
+                reinterpret_cast<cl_uchar*>(staging.data())[i] = cl_uchar(quantized);
+            stored = quantized / levels * q.scale + q.offset;
+        }
+        const double error = std::abs(double(stored) - double(value));
+        maxError = std::max(maxError, error);
+        squaredError += error * error;
+    }
+    _quantization.maxError = std::max(_quantization.maxError, maxError);
+    _quantization.squaredError += squaredError;
+    _quantization.voxels += voxels;
+    _quantization.timesteps++;
+    return staging.data();
+}
+
+
+/**
+ * @brief VolumeRenderCL::generateBricksHost
+ * @param t
+ */
+void VolumeRenderCL::generateBricksHost(const size_t t)
+{
+    BrickCache &bc = _brickCache;
+    const auto &res = _dr.properties().volume_res;
+    const DatRawReader::data_format f = _dr.properties().format;
+    const size_t numBricks = size_t(bc.numBricks.at(0)) * bc.numBricks.at(1) * bc.numBricks.at(2);
+    if (bc.minMax.size() <= t)
+        bc.minMax.resize(t + 1);
+    std::vector<std::array<float, 2> > &minMax = bc.minMax.at(t);
+
+    // the cached grid is stored in the volume format, grid type 1: bricks including the apron
+    const std::array<uint32_t, 4> gridType = {{1u, BRICK_SIZE, BRICK_SIZE, BRICK_SIZE}};
+    const std::array<uint32_t, 3> gridRes = {{bc.numBricks.at(0), bc.numBricks.at(1),
+                                              bc.numBricks.at(2)}};
+    std::vector<char> bricks;
+    // the chunks of a chunked volume with matching size are the bricks including the apron
+    if (minMax.size() != numBricks && _dr.chunk_size() == BRICK_SIZE)
+    {
+        minMax.resize(numBricks);
+        for (size_t b = 0; b < numBricks; ++b)
+            minMax.at(b) = _dr.chunk_range(t, b);
+    }
+    if (minMax.size() != numBricks && _dr.read_brick_grid(t, gridType, gridRes, bricks)
+            && bricks.size() == numBricks * 2 * bc.bytesPerVoxel)
+    {
+        minMax.resize(numBricks);
+        for (size_t b = 0; b < numBricks; ++b)
+            minMax.at(b) = {{voxelValue(bricks.data(), b*2, f),
+                             voxelValue(bricks.data(), b*2 + 1, f)}};
+    }
+    const bool computed = minMax.size() != numBricks;
+    if (computed)
+    {
+        const char *data = _dr.data(t);
+        minMax.resize(numBricks);
+#pragma omp parallel for schedule(dynamic)
+        for (long long b = 0; b < static_cast<long long>(numBricks); ++b)
+        {
+            const std::array<size_t, 3> brick = {{
+                    size_t(b) % bc.numBricks.at(0),
+                    (size_t(b) / bc.numBricks.at(0)) % bc.numBricks.at(1),
+                    size_t(b) / (size_t(bc.numBricks.at(0)) * bc.numBricks.at(1))}};
+            // include the apron that is used for interpolation at the brick borders
+            std::array<size_t, 3> lower;
+            std::array<size_t, 3> upper;
+            for (size_t i = 0; i < 3; ++i)
+            {
+                lower.at(i) = brick.at(i) * BRICK_SIZE > 0 ? brick.at(i) * BRICK_SIZE - 1 : 0;
+                upper.at(i) = std::min(size_t(res.at(i)), (brick.at(i) + 1) * BRICK_SIZE + 1);
+            }
+            float minVal = std::numeric_limits<float>::max();
+            float maxVal = std::numeric_limits<float>::lowest();
+            for (size_t z = lower.at(2); z < upper.at(2); ++z)
+            {
+                for (size_t y = lower.at(1); y < upper.at(1); ++y)
+                {
+                    const size_t row = (z * res.at(1) + y) * res.at(0);
+                    for (size_t x = lower.at(0); x < upper.at(0); ++x)
+                    {
+                        const float v = voxelValue(data, row + x, f);
+                        minVal = std::min(minVal, v);
+                        maxVal = std::max(maxVal, v);
+                    }
+                }
+            }
+            minMax.at(size_t(b)) = {{minVal, maxVal}};
+        }
+    }
+
+    // upload as CL_RG min/max brick volume in the format of the volume data
+    cl::ImageFormat format;
+    format.image_channel_order = CL_RG;
+    if (f == DatRawReader::UCHAR)
+        format.image_channel_data_type = CL_UNORM_INT8;
+    else if (f == DatRawReader::USHORT)
+        format.image_channel_data_type = CL_UNORM_INT16;
+    else if (f == DatRawReader::FLOAT)
+        format.image_channel_data_type = CL_FLOAT;
+    else
+        throw std::invalid_argument("Unknown or invalid volume data format.");
+
+    bricks.resize(numBricks * 2 * bc.bytesPerVoxel);
+    for (size_t b = 0; b < numBricks; ++b)
+    {
+        storeValue(bricks.data(), b*2    , minMax.at(b).at(0), f);
+        storeValue(bricks.data(), b*2 + 1, minMax.at(b).at(1), f);
+    }
+    if (computed)
+        _dr.write_brick_grid(t, gridType, gridRes, bricks);
+    _bricksMem.push_back(cl::Image3D(_contextCL,
+                                     CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                                     format,
+                                     bc.numBricks.at(0),
+                                     bc.numBricks.at(1),
+                                     bc.numBricks.at(2),
+                                     0, 0, bricks.data()));
+    _brickMipsMem.push_back(createBrickMips(_bricksMem.back()));
+    enqueueBrickMipGen(_queueCL, _genBrickMipsKernel, _bricksMem.back(), _brickMipsMem.back());
+}
+
+
+/**
+ * @brief VolumeRenderCL::extractBrick
+ * @param t
+ * @param brickId
+ * @param dst
+ */
+void VolumeRenderCL::extractBrick(const size_t t, const size_t brickId, char *dst) const
+{
+    // decompress only the requested brick, the chunk layout is the layout of a slot
+    if (_dr.chunk_size() == BRICK_SIZE)
+    {
+        _dr.read_chunk(t, brickId, dst);
         return;
+    }
+    const BrickCache &bc = _brickCache;
+    const auto &res = _dr.properties().volume_res;
+    const size_t bpv = bc.bytesPerVoxel;
+    const long slotSize = BRICK_SIZE + 2;
+    const std::array<long, 3> origin = {{
+            long(brickId % bc.numBricks.at(0)) * BRICK_SIZE - 1,
+            long((brickId / bc.numBricks.at(0)) % bc.numBricks.at(1)) * BRICK_SIZE - 1,
+            long(brickId / (size_t(bc.numBricks.at(0)) * bc.numBricks.at(1))) * BRICK_SIZE - 1}};
+    const char *src = _dr.data(t);
+
+    // clamp to edge at the volume borders, equivalent to the sampler of a monolithic volume
+    for (long z = 0; z < slotSize; ++z)
+    {
+        const size_t vz = size_t(std::clamp(origin.at(2) + z, 0l, long(res.at(2)) - 1));
+        for (long y = 0; y < slotSize; ++y)
+        {
+            const size_t vy = size_t(std::clamp(origin.at(1) + y, 0l, long(res.at(1)) - 1));
+            const char *srcRow = src + (vz * res.at(1) + vy) * res.at(0) * bpv;
+            char *dstRow = dst + size_t((z * slotSize + y) * slotSize) * bpv;
+            for (long x = 0; x < slotSize; ++x)
+            {
+                const size_t vx = size_t(std::clamp(origin.at(0) + x, 0l, long(res.at(0)) - 1));
+                std::memcpy(dstRow + size_t(x) * bpv, srcRow + vx * bpv, bpv);
+            }
+        }
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCL::isBrickEmpty
+ * @param brickId
+ * @return
+ */
+bool VolumeRenderCL::isBrickEmpty(const size_t brickId) const
+{
+    if (_tffPrefixSum.empty() || _brickCache.minMax.size() <= _timestep
+            || _brickCache.minMax.at(_timestep).size() <= brickId)
+        return false;
+    // conservative: all transfer function entries covering [min,max] have zero opacity
+    const std::array<float, 2> &minMax = _brickCache.minMax.at(_timestep).at(brickId);
+    const float n = float(_tffPrefixSum.size());
+    const size_t lo = size_t(std::clamp(std::floor(minMax.at(0) * n) - 1.f, 0.f, n - 1.f));
+    const size_t hi = size_t(std::clamp(std::ceil(minMax.at(1) * n) + 1.f, 0.f, n - 1.f));
+    const unsigned int before = lo > 0 ? _tffPrefixSum.at(lo - 1) : 0u;
+    return _tffPrefixSum.at(hi) == before;
+}
+
+
+/**
+ * @brief VolumeRenderCL::updateBrickCache
+ */
+void VolumeRenderCL::updateBrickCache()
+{
+    BrickCache &bc = _brickCache;
+    const size_t numBricks = bc.pageEntries.size();
+    const size_t slotSize = BRICK_SIZE + 2;
+    const size_t slotBytes = slotSize * slotSize * slotSize * bc.bytesPerVoxel;
     try
     {
-        cl::ImageFormat format;
-        format.image_channel_order = CL_R;
-        format.image_channel_data_type = CL_UNSIGNED_INT32;
+        _queueCL.enqueueReadBuffer(bc.requests, CL_TRUE, 0, numBricks * sizeof(cl_uint),
+                                   bc.requestFlags.data());
+        ++bc.frame;
+
+        // update LRU time stamps and collect missing bricks,
+        // the path tracer does not emit requests, so stream all non-empty bricks
+        std::vector<size_t> missing;
+        const bool streamAll = _rendering_params.technique == TECH_PATHTRACE;
+        for (size_t i = 0; i < numBricks; ++i)
+        {
+            if (bc.pageEntries.at(i) > 0)
+            {
+                if (bc.requestFlags.at(i) == BRICK_USED)
+                    bc.slotLastUsed.at(bc.pageEntries.at(i) - 1) = bc.frame;
+            }
+            else if ((streamAll || bc.requestFlags.at(i) != BRICK_UNUSED) && !isBrickEmpty(i))
+            {
+                missing.push_back(i);
+            }
+        }
+        // bricks requested by the most rays cover the largest part of the image, upload them
+        // first, ties in brick order
+        std::sort(missing.begin(), missing.end(), [&bc](size_t a, size_t b)
+                  { return bc.requestFlags.at(a) != bc.requestFlags.at(b)
+                           ? bc.requestFlags.at(a) > bc.requestFlags.at(b) : a < b; });
+        // limit the upload size per frame to keep the frame time bounded
+        const size_t maxUploads = std::max(size_t(1), BRICK_UPLOAD_BYTES / slotBytes);
+
+        // assign slots: free slots first, then least recently used ones that
+        // have not been used in the current frame
+        std::vector<size_t> candidates(bc.slotBrick.size());
+        std::iota(candidates.begin(), candidates.end(), 0);
+        std::sort(candidates.begin(), candidates.end(), [&bc](size_t a, size_t b)
+                  { return bc.slotLastUsed.at(a) < bc.slotLastUsed.at(b); });
+        std::vector<std::pair<size_t, size_t> > uploads;    // brick id, slot
+        bool cacheFull = false;
+        for (size_t i = 0; i < missing.size() && uploads.size() < maxUploads; ++i)
+        {
+            if (uploads.size() >= candidates.size()
+                    || bc.slotLastUsed.at(candidates.at(uploads.size())) >= bc.frame)
+            {
+                cacheFull = true;
+                break;
+            }
+            const size_t slot = candidates.at(uploads.size());
+            if (bc.slotBrick.at(slot) >= 0)    // evict
+                bc.pageEntries.at(size_t(bc.slotBrick.at(slot))) = 0;
+            bc.slotBrick.at(slot) = long(missing.at(i));
+            bc.slotLastUsed.at(slot) = bc.frame;
+            bc.pageEntries.at(missing.at(i)) = cl_uint(slot + 1);
+            uploads.push_back(std::make_pair(missing.at(i), slot));
+        }
 
-        cl_mem_flags flags = CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR;
-        _tffPrefixMem = cl::Image1D(_contextCL, flags, format, tffPrefixSum.size(),
-                                    tffPrefixSum.data());
+        std::vector<char> staging(uploads.size() * slotBytes);
+#pragma omp parallel for
+        for (long long i = 0; i < static_cast<long long>(uploads.size()); ++i)
+            extractBrick(_timestep, uploads.at(size_t(i)).first, staging.data() + size_t(i)*slotBytes);
+
+        for (size_t i = 0; i < uploads.size(); ++i)
+        {
+            const size_t slot = uploads.at(i).second;
+            std::array<size_t, 3> origin = {{(slot % bc.numSlots.at(0)) * slotSize,
+                                             ((slot / bc.numSlots.at(0)) % bc.numSlots.at(1)) * slotSize,
+                                             (slot / (size_t(bc.numSlots.at(0)) * bc.numSlots.at(1)))
+                                             * slotSize}};
+            std::array<size_t, 3> region = {{slotSize, slotSize, slotSize}};
+            _queueCL.enqueueWriteImage(bc.atlas, CL_FALSE, origin, region, 0, 0,
+                                       staging.data() + i*slotBytes, nullptr,
+                                       stageEvent(STAGE_UPLOAD));
+        }
+        if (!uploads.empty())
+        {
+            std::array<size_t, 3> origin = {{0, 0, 0}};
+            std::array<size_t, 3> region = {{bc.numBricks.at(0), bc.numBricks.at(1),
+                                             bc.numBricks.at(2)}};
+            _queueCL.enqueueWriteImage(bc.pageTable, CL_FALSE, origin, region, 0, 0,
+                                       bc.pageEntries.data());
+        }
+        // clear requests for the next frame
+        _queueCL.enqueueFillBuffer(bc.requests, cl_uint(BRICK_UNUSED), 0,
+                                   numBricks * sizeof(cl_uint));
+        _queueCL.finish();
+
+        // keep rendering while bricks arrive, stop if the cache cannot hold the current view
+        bc.dirty = !uploads.empty() || (missing.size() > uploads.size() && !cacheFull);
+        if (!uploads.empty())
+            resetIteration();
     }
     catch (cl::Error err)
     {
@@ -915,260 +4395,662 @@ void VolumeRenderCL::setTffPrefixSum(std::vector<unsigned int> &tffPrefixSum)
     }
 }
 
+
 /**
- * @brief VolumeRenderCL::setCamOrtho
- * @param setCamOrtho
+ * @brief VolumeRenderCL::enqueueBrickGen
+ * @param queue
+ * @param kernel
+ * @param volume
+ * @param bricks
+ * @param waitEvents
+ * @param event
  */
-void VolumeRenderCL::setCamOrtho(bool setCamOrtho)
+void VolumeRenderCL::enqueueBrickGen(cl::CommandQueue &queue, cl::Kernel &kernel,
+                                     const cl::Image3D &volume, const cl::Image3D &bricks,
+                                     const std::vector<cl::Event> *waitEvents, cl::Event *event)
 {
-    _camera_params.ortho = static_cast<cl_uint>(setCamOrtho);
-    setCameraArgs();
+    kernel.setArg(VOLUME, volume);
+    kernel.setArg(BRICKS, bricks);
+    const size_t bricksTexSize[3] = {bricks.getImageInfo<CL_IMAGE_WIDTH>(),
+                                     bricks.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                     bricks.getImageInfo<CL_IMAGE_DEPTH>()};
+    // tuned per device, see selectVolumeGroups
+    const std::array<size_t, 3> &lDim = _tuning.groups.volume;
+    cl::NDRange globalThreads(RoundUp(bricksTexSize[0], lDim.at(0)),
+                              RoundUp(bricksTexSize[1], lDim.at(1)),
+                              RoundUp(bricksTexSize[2], lDim.at(2)));
+    cl::NDRange localThreads(lDim.at(0), lDim.at(1), lDim.at(2));
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalThreads, localThreads,
+                               waitEvents, event);
 }
 
+
 /**
- * @brief VolumeRenderCL::setIllumination
- * @param illum
+ * @brief VolumeRenderCL::createBrickMips
+ * @param bricks
+ * @return
  */
-void VolumeRenderCL::setIllumination(unsigned int illum)
+cl::Image3D VolumeRenderCL::createBrickMips(const cl::Image3D &bricks)
 {
-    _rendering_params.illumType = static_cast<cl_uint>(illum);
-    setRenderingArgs();
+    const std::array<size_t, 3> bricksRes = {{bricks.getImageInfo<CL_IMAGE_WIDTH>(),
+                                              bricks.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                              bricks.getImageInfo<CL_IMAGE_DEPTH>()}};
+    // levels 1..n are packed along x, OpenCL 1.2 has no mipmapped images
+    size_t width = 0;
+    for (cl_uint level = 1; level < BrickLevels(bricksRes); ++level)
+        width += (bricksRes.at(0) + (size_t(1) << level) - 1) >> level;
+    const cl_image_format f = bricks.getImageInfo<CL_IMAGE_FORMAT>();
+    return cl::Image3D(_contextCL, CL_MEM_READ_WRITE,
+                       cl::ImageFormat(f.image_channel_order, f.image_channel_data_type),
+                       std::max(width, size_t(1)),
+                       std::max((bricksRes.at(1) + 1) / 2, size_t(1)),
+                       std::max((bricksRes.at(2) + 1) / 2, size_t(1)));
 }
 
 
 /**
- * @brief VolumeRenderCL::setAmbientOcclusion
- * @param illum
+ * @brief VolumeRenderCL::enqueueBrickMipGen
+ * @param queue
+ * @param kernel
+ * @param bricks
+ * @param brickMips
+ * @param waitEvents
+ * @param event
  */
-void VolumeRenderCL::setAmbientOcclusion(bool ao)
+void VolumeRenderCL::enqueueBrickMipGen(cl::CommandQueue &queue, cl::Kernel &kernel,
+                                        const cl::Image3D &bricks, const cl::Image3D &brickMips,
+                                        const std::vector<cl::Event> *waitEvents, cl::Event *event)
 {
-    _raycast_params.useAO = static_cast<cl_uint>(ao);
-    setRaycastArgs();
+    const std::array<size_t, 3> bricksRes = {{bricks.getImageInfo<CL_IMAGE_WIDTH>(),
+                                              bricks.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                              bricks.getImageInfo<CL_IMAGE_DEPTH>()}};
+    kernel.setArg(0, bricks);
+    kernel.setArg(1, brickMips);
+    kernel.setArg(2, BrickLevels(bricksRes));
+    const size_t mipsTexSize[3] = {brickMips.getImageInfo<CL_IMAGE_WIDTH>(),
+                                   brickMips.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                   brickMips.getImageInfo<CL_IMAGE_DEPTH>()};
+    const std::array<size_t, 3> &lDim = _tuning.groups.volume;
+    cl::NDRange globalThreads(RoundUp(mipsTexSize[0], lDim.at(0)),
+                              RoundUp(mipsTexSize[1], lDim.at(1)),
+                              RoundUp(mipsTexSize[2], lDim.at(2)));
+    cl::NDRange localThreads(lDim.at(0), lDim.at(1), lDim.at(2));
+    queue.enqueueNDRangeKernel(kernel, cl::NullRange, globalThreads, localThreads,
+                               waitEvents, event);
 }
 
 
 /**
- * @brief VolumeRenderCL::setShowESS
- * @param showESS
+ * @brief VolumeRenderCL::updateOccupancy
+ * @param slot
  */
-void VolumeRenderCL::setShowESS(bool showESS)
+void VolumeRenderCL::updateOccupancy(const size_t slot)
 {
-    _rendering_params.showEss = static_cast<cl_uint>(showESS);
-    setRenderingArgs();
+    if (_occupancySlot == long(slot))
+        return;
+    const cl::Image3D &bricks = _bricksMem.at(slot);
+    const std::array<size_t, 3> bricksRes = {{bricks.getImageInfo<CL_IMAGE_WIDTH>(),
+                                              bricks.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                              bricks.getImageInfo<CL_IMAGE_DEPTH>()}};
+    const cl_uint levels = BrickLevels(bricksRes);
+    size_t numNodes = 0;
+    for (cl_uint level = 0; level < levels; ++level)
+    {
+        size_t levelNodes = 1;
+        for (size_t i = 0; i < 3; ++i)
+            levelNodes *= (bricksRes.at(i) + (size_t(1) << level) - 1) >> level;
+        numNodes += levelNodes;
+    }
+    // one bit per node
+    const size_t numWords = (numNodes + 31) / 32;
+    if (_occupancyMem() == nullptr
+            || _occupancyMem.getInfo<CL_MEM_SIZE>() != numWords*sizeof(cl_uint))
+        _occupancyMem = cl::Buffer(_contextCL, CL_MEM_READ_WRITE, numWords*sizeof(cl_uint));
+
+    _occupancyKernel.setArg(0, bricks);
+    _occupancyKernel.setArg(1, _brickMipsMem.at(slot));
+    _occupancyKernel.setArg(2, _tffMem);
+    _occupancyKernel.setArg(3, _tffPrefixMem);
+    _occupancyKernel.setArg(4, _occupancyMem);
+    _occupancyKernel.setArg(5, levels);
+    _occupancyKernel.setArg(6, static_cast<cl_uint>(numNodes));
+    const size_t lSize = LOCAL_SIZE*LOCAL_SIZE;
+    cl::NDRange globalThreads(numWords + (lSize - numWords % lSize));
+    cl::NDRange localThreads(lSize);
+    _queueCL.enqueueNDRangeKernel(_occupancyKernel, cl::NullRange, globalThreads, localThreads,
+                                  nullptr, stageEvent(STAGE_BRICK_GEN));
+    _occupancySlot = long(slot);
+    ++_proxy.version;
 }
 
 
 /**
- * @brief VolumeRenderCL::setLinearSampling
- * @param linearSampling
+ * @brief VolumeRenderCL::tuningKey
+ * @param kernel
+ * @return
  */
-void VolumeRenderCL::setLinearInterpolation(bool linearSampling)
+std::string VolumeRenderCL::tuningKey(const std::string &kernel) const
 {
-    _rendering_params.useLinear = static_cast<cl_uint>(linearSampling);
-    setRenderingArgs();
+    return _tuning.device + "|" + kernel;
 }
 
+
 /**
- * @brief VolumeRenderCL::setContours
- * @param contours
+ * @brief VolumeRenderCL::selectFrameGroups
+ * @param width
+ * @param height
  */
-void VolumeRenderCL::setContours(bool contours)
+void VolumeRenderCL::selectFrameGroups(const size_t width, const size_t height)
 {
-    _raycast_params.contours = static_cast<cl_uint>(contours);
-    setRaycastArgs();
+    // the bands of the peer devices are split in rows of the default work-groups
+    if (!_tuning.enabled || !_multiDevice.peers.empty())
+    {
+        if (!_tuning.frameKey.empty())
+        {
+            _tuning.frameKey.clear();
+            setFrameGroups(WorkGroups().frame, 0);
+        }
+        return;
+    }
+    // the wavefront kernels use the default shape, the generic kernel is not tuned while
+    // its specialized variant is built
+    if (usesWavefront() || isKernelVariantPending())
+        return;
+    const std::string key = tuningKey("volumeRender|" + _variants.active);
+    if (key == _tuning.frameKey)
+        return;
+    _tuning.frameKey = key;
+
+    const cl::Device device = _contextCL.getInfo<CL_CONTEXT_DEVICES>().front();
+    const size_t maxGroup = _raycastKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    std::vector<size_t> values;
+    if (ReadTunedGroups(key, values) && values.size() == 3 && values.at(0) > 0
+            && values.at(1) > 0 && values.at(0)*values.at(1) <= maxGroup)
+    {
+        setFrameGroups({{values.at(0), values.at(1)}}, cl_uint(values.at(2)));
+        return;
+    }
+#ifdef CL_QUEUE_PROFILING_ENABLE
+    const std::array<size_t, 3> best = tuneFrameGroups(width, height);
+    StoreTunedGroups(key, std::vector<size_t>(best.begin(), best.end()));
+    std::cout << "Work-groups of " << getCurrentDeviceName() << ": " << best.at(0) << "x"
+              << best.at(1) << (best.at(2) > 0 ? ", strips of " + std::to_string(best.at(2))
+                                                 + " groups" : ", rows") << std::endl;
+    setFrameGroups({{best.at(0), best.at(1)}}, cl_uint(best.at(2)));
+#else
+    (void)width;
+    (void)height;
+#endif
 }
 
+
 /**
- * @brief VolumeRenderCL::setAerial
- * @param aerial
+ * @brief VolumeRenderCL::tuneFrameGroups
+ * @param width
+ * @param height
+ * @return
  */
-void VolumeRenderCL::setAerial(bool aerial)
+std::array<size_t, 3> VolumeRenderCL::tuneFrameGroups(const size_t width, const size_t height)
 {
-    _raycast_params.aerial = static_cast<cl_uint>(aerial);
-    setRaycastArgs();
+    const cl::Device device = _contextCL.getInfo<CL_CONTEXT_DEVICES>().front();
+    const size_t maxGroup = _raycastKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    const std::vector<size_t> maxItems = device.getInfo<CL_DEVICE_MAX_WORK_ITEM_SIZES>();
+
+    // centered window of the padded frame, in whole work-groups of all candidates
+    size_t maxEdge = 1;
+    for (const auto &shape : FRAME_GROUPS)
+        maxEdge = std::max(maxEdge, std::max(shape.at(0), shape.at(1)));
+    const std::array<size_t, 2> frame = {{width + (LOCAL_SIZE - width % LOCAL_SIZE),
+                                          height + (LOCAL_SIZE - height % LOCAL_SIZE)}};
+    std::array<size_t, 2> origin = {{0, 0}};
+    std::array<size_t, 2> window = {{0, 0}};
+    for (size_t i = 0; i < 2; ++i)
+    {
+        window.at(i) = RoundUp(std::min(frame.at(i), TUNING_WINDOW), maxEdge);
+        if (frame.at(i) > window.at(i))
+            origin.at(i) = (frame.at(i) - window.at(i)) / 2 / maxEdge * maxEdge;
+    }
+
+    // the candidates read the hits and tile errors of the unknown state, only written
+    // results are overwritten by the next frame
+    resetGroupResults();
+    const auto timeCandidate = [&](const std::array<size_t, 2> &shape, const cl_uint traversal)
+    {
+        double fastest = std::numeric_limits<double>::max();
+        if (shape.at(0)*shape.at(1) > maxGroup || shape.at(0) > maxItems.at(0)
+                || shape.at(1) > maxItems.at(1))
+            return fastest;
+        _rendering_params.traversal = traversal;
+        setRenderingArgs();
+        try
+        {
+            for (size_t run = 0; run <= TUNING_RUNS; ++run)
+            {
+                cl::Event evt;
+                _queueCL.enqueueNDRangeKernel(_raycastKernel,
+                                              cl::NDRange(origin.at(0), origin.at(1)),
+                                              cl::NDRange(window.at(0), window.at(1)),
+                                              cl::NDRange(shape.at(0), shape.at(1)),
+                                              nullptr, &evt);
+                evt.wait();
+                if (run > 0)
+                    fastest = std::min(fastest, kernelTime(evt));
+            }
+        }
+        catch (cl::Error err)
+        {
+            // e.g. out of resources, the shape is not used on this device
+            return std::numeric_limits<double>::max();
+        }
+        return fastest;
+    };
+
+    // shapes in row order first, then the traversal orders of the fastest shape
+    std::array<size_t, 3> best = {{FRAME_GROUPS.front().at(0), FRAME_GROUPS.front().at(1), 0}};
+    double bestTime = timeCandidate(FRAME_GROUPS.front(), 0);
+    for (size_t i = 1; i < FRAME_GROUPS.size(); ++i)
+    {
+        const double time = timeCandidate(FRAME_GROUPS.at(i), 0);
+        if (time < bestTime * TUNING_MARGIN)
+        {
+            bestTime = time;
+            best = {{FRAME_GROUPS.at(i).at(0), FRAME_GROUPS.at(i).at(1), 0}};
+        }
+    }
+    for (const cl_uint traversal : TRAVERSALS)
+    {
+        if (traversal == 0)
+            continue;
+        const double time = timeCandidate({{best.at(0), best.at(1)}}, traversal);
+        if (time < bestTime * TUNING_MARGIN)
+        {
+            bestTime = time;
+            best.at(2) = traversal;
+        }
+    }
+    _rendering_params.traversal = _tuning.groups.traversal;
+    setRenderingArgs();
+    return best;
 }
 
+
 /**
- * @brief VolumeRenderCL::setImgEss
- * @param useEss
+ * @brief VolumeRenderCL::setFrameGroups
+ * @param shape
+ * @param traversal
  */
-void VolumeRenderCL::setImgEss(bool useEss)
+void VolumeRenderCL::setFrameGroups(const std::array<size_t, 2> &shape, const cl_uint traversal)
 {
-    _rendering_params.imgEss = static_cast<cl_uint>(useEss);
+    _tuning.groups.traversal = traversal;
+    _rendering_params.traversal = traversal;
     setRenderingArgs();
-    _useImgESS = useEss;
+    if (shape == _tuning.groups.frame)
+        return;
+    _tuning.groups.frame = shape;
+    resetGroupResults();
 }
 
+
 /**
- * @brief VolumeRenderCL::setImgEss
- * @param useEss
+ * @brief VolumeRenderCL::resetGroupResults
  */
-void VolumeRenderCL::setObjEss(bool useEss)
+void VolumeRenderCL::resetGroupResults()
 {
-    std::string ess = useEss ? "-DESS" : "";
-#ifdef _WIN32
-    initKernel("kernels//volumeraycast.cl", "-DCL_STD=CL1.2 -DWIN32 " + ess);
-#else
-    initKernel("kernels/volumeraycast.cl", "-DCL_STD=CL1.2 " + ess);
-#endif // _WIN32
-    // upload volume data if already loaded
-    if (_dr.has_data())
+    // all groups are rendered: hit, unknown error (max uint)
+    if (_inputHitMem() != nullptr)
     {
-        volDataToCLmem(_dr.data());
+        std::array<size_t, 3> region = {{_inputHitMem.getImageInfo<CL_IMAGE_WIDTH>(),
+                                         _inputHitMem.getImageInfo<CL_IMAGE_HEIGHT>(), 1}};
+        _queueCL.enqueueFillImage(_inputHitMem, cl_uint4{{1u, 1u, 1u, 1u}}, {{0, 0, 0}}, region);
     }
+    if (_progressive.inTileError() != nullptr)
+        _queueCL.enqueueFillBuffer(_progressive.inTileError, std::numeric_limits<cl_uint>::max(),
+                                   0, _progressive.inTileError.getInfo<CL_MEM_SIZE>());
 }
 
+
 /**
- * @brief VolumeRenderCL::setBackground
- * @param color
+ * @brief VolumeRenderCL::selectVolumeGroups
+ * @param volume
+ * @param bricks
  */
-void VolumeRenderCL::setBackground(std::array<float, 4> color)
+void VolumeRenderCL::selectVolumeGroups(const cl::Image3D &volume, const cl::Image3D &bricks)
 {
-    cl_float3 bgColor = {{color[0], color[1], color[2]}};
-    _rendering_params.backgroundColor = bgColor;
-    setRenderingArgs();
+    if (_tuning.volumeTuned)
+        return;
+    _tuning.volumeTuned = true;
+    _tuning.groups.volume = WorkGroups().volume;
+    if (!_tuning.enabled)
+        return;
+
+    const cl::Device device = _contextCL.getInfo<CL_CONTEXT_DEVICES>().front();
+    const size_t maxGroup = _genBricksKernel.getWorkGroupInfo<CL_KERNEL_WORK_GROUP_SIZE>(device);
+    const std::string key = tuningKey("generateBricks");
+    std::vector<size_t> values;
+    if (ReadTunedGroups(key, values) && values.size() == 3
+            && values.at(0)*values.at(1)*values.at(2) > 0
+            && values.at(0)*values.at(1)*values.at(2) <= maxGroup)
+    {
+        _tuning.groups.volume = {{values.at(0), values.at(1), values.at(2)}};
+        return;
+    }
+#ifdef CL_QUEUE_PROFILING_ENABLE
+    // every candidate writes the same bricks
+    std::array<size_t, 3> best = _tuning.groups.volume;
+    double bestTime = std::numeric_limits<double>::max();
+    for (const auto &shape : VOLUME_GROUPS)
+    {
+        if (shape.at(0)*shape.at(1)*shape.at(2) > maxGroup)
+            continue;
+        _tuning.groups.volume = shape;
+        double fastest = std::numeric_limits<double>::max();
+        try
+        {
+            for (size_t run = 0; run <= TUNING_RUNS; ++run)
+            {
+                cl::Event evt;
+                enqueueBrickGen(_queueCL, _genBricksKernel, volume, bricks, nullptr, &evt);
+                evt.wait();
+                if (run > 0)
+                    fastest = std::min(fastest, kernelTime(evt));
+            }
+        }
+        catch (cl::Error err)
+        {
+            continue;
+        }
+        if (fastest < bestTime * TUNING_MARGIN)
+        {
+            bestTime = fastest;
+            best = shape;
+        }
+    }
+    _tuning.groups.volume = best;
+    StoreTunedGroups(key, std::vector<size_t>(best.begin(), best.end()));
+#else
+    (void)volume;
+    (void)bricks;
+#endif
 }
 
+
 /**
- * @brief VolumeRenderCL::setUseGradient
- * @param useGradient
+ * @brief VolumeRenderCL::setStreamingWindow
+ * @param timesteps
  */
-void VolumeRenderCL::setUseGradient(bool useGradient)
+void VolumeRenderCL::setStreamingWindow(const size_t timesteps)
 {
-    _rendering_params.useGradient = static_cast<cl_uint>(useGradient);
-    setRenderingArgs();
+    _stream.windowSize = timesteps > 0 ? std::max(timesteps, size_t(2)) : 0;
+    for (auto &peer : _multiDevice.peers)
+        peer->setStreamingWindow(timesteps);
 }
 
-void VolumeRenderCL::setTechnique(VolumeRenderCL::technique tech)
+
+/**
+ * @brief VolumeRenderCL::isStreaming
+ * @return
+ */
+bool VolumeRenderCL::isStreaming() const
 {
-    _rendering_params.technique = static_cast<uint>(tech);
-    setRenderingArgs();
-    resetIteration();
+    return _stream.window > 0;
 }
 
+
 /**
- * @brief VolumeRenderCL::getLastExecTime
+ * @brief VolumeRenderCL::hasPendingTimestep
  * @return
  */
-double VolumeRenderCL::getLastExecTime()
+bool VolumeRenderCL::hasPendingTimestep() const
 {
-    return _lastExecTime;
+    for (const auto &peer : _multiDevice.peers)
+        if (peer->hasPendingTimestep())
+            return true;
+    if (!isStreaming())
+        return false;
+    std::lock_guard<std::mutex> lock(_stream.mutex);
+    return !_stream.stop && _stream.requested != _timestep;
 }
 
 
 /**
- * @brief VolumeRenderCL::getPlatformNames
- * @return
+ * @brief VolumeRenderCL::startStreaming
  */
-const std::vector<std::string> VolumeRenderCL::getPlatformNames()
+void VolumeRenderCL::startStreaming()
 {
-    std::vector<std::string> names;
+    if (!isStreaming() || _stream.loader.joinable())
+        return;
     try
     {
-        std::vector<cl::Platform> platforms;
-
-        cl::Platform::get(&platforms);
-        for(unsigned int i = 0; i < platforms.size(); ++i)
-            names.push_back(platforms[i].getInfo<CL_PLATFORM_NAME>());
+        // separate queue and kernel object, the kernel args are set by the loader thread only
+        _stream.queue = cl::CommandQueue(_contextCL);
+        _stream.genBricksKernel = cl::Kernel(_genBricksKernel.getInfo<CL_KERNEL_PROGRAM>(),
+                                             "generateBricks");
+        _stream.genBrickMipsKernel = cl::Kernel(_genBricksKernel.getInfo<CL_KERNEL_PROGRAM>(),
+                                                "generateBrickMips");
     }
-    catch (cl::Error err) {
+    catch (cl::Error err)
+    {
         logCLerror(err);
     }
-    return names;
+    _stream.stop = false;
+    _stream.loader = std::thread(&VolumeRenderCL::streamTimesteps, this);
 }
 
+
 /**
- * @brief VolumeRenderCL::getDeviceNames
- * @param platformId
- * @param type
- * @return
+ * @brief VolumeRenderCL::stopStreaming
  */
-const std::vector<std::string> VolumeRenderCL::getDeviceNames(size_t platformId,
-                                                              const std::string &type)
+void VolumeRenderCL::stopStreaming()
 {
-    std::vector<std::string> names;
-    cl_device_type t = CL_DEVICE_TYPE_ALL;
-    if (type == "GPU") t = CL_DEVICE_TYPE_GPU;
-    else if (type == "CPU") t = CL_DEVICE_TYPE_CPU;
-    try
     {
-        std::vector<cl::Platform> platforms;
-        cl::Platform::get(&platforms);
-        std::vector<cl::Device> devices;
-        platforms[platformId].getDevices(t, &devices);
-
-        for(unsigned int i = 0; i < devices.size(); ++i)
-            names.push_back(devices[i].getInfo<CL_DEVICE_NAME>());
-    }
-    catch (cl::Error err) {
-        logCLerror(err);
+        std::lock_guard<std::mutex> lock(_stream.mutex);
+        _stream.stop = true;
     }
-
-    return names;
+    _stream.cv.notify_all();
+    if (_stream.loader.joinable())
+        _stream.loader.join();
 }
 
+
 /**
- * @brief VolumeRenderCL::getCurrentDeviceName
+ * @brief VolumeRenderCL::nextStreamJob
+ * @param t
+ * @param slot
  * @return
  */
-const std::string VolumeRenderCL::getCurrentDeviceName()
+bool VolumeRenderCL::nextStreamJob(size_t &t, size_t &slot) const
 {
-    return _currentDevice;
+    const size_t numTimesteps = _stream.histograms.size();
+    const auto &st = _stream.slotTimestep;
+    auto inWindow = [&](long timestep) {
+        return timestep >= 0 &&
+               (size_t(timestep) + numTimesteps - _stream.requested) % numTimesteps < _stream.window;
+    };
+    // load upcoming timesteps in playback order, wrapping around at the end of the series
+    for (size_t i = 0; i < _stream.window; ++i)
+    {
+        const long candidate = long((_stream.requested + i) % numTimesteps);
+        if (std::find(st.begin(), st.end(), candidate) != st.end())
+            continue;
+        // evict a timestep outside of the window, but never the one that is rendered
+        for (size_t s = 0; s < st.size(); ++s)
+        {
+            if (s != _stream.active && !inWindow(st.at(s)))
+            {
+                t = size_t(candidate);
+                slot = s;
+                return true;
+            }
+        }
+        return false;
+    }
+    return false;
 }
 
+
 /**
- * @brief VolumeRenderCL::createEnvironmentMap
- * @param file_name
+ * @brief VolumeRenderCL::streamTimesteps
  */
-void VolumeRenderCL::createEnvironmentMap(const std::string &file_name)
+void VolumeRenderCL::streamTimesteps()
 {
-    unsigned int width = 2048;
-    unsigned int height = 1024;
-    cl::ImageFormat format;
-    format.image_channel_order = CL_RGBA;
-    format.image_channel_data_type = CL_FLOAT;
-    if (file_name.empty()) // initialize with white
-    {
-        cl_float4 d = {{1,1,1,1}};
-        _environmentMap = cl::Image2D(_contextCL, CL_MEM_READ_ONLY, format, 1, 1, 0, &d);
-    }
-    else
+    const auto &res = _dr.properties().volume_res;
+    const std::array<size_t, 3> origin = {{0, 0, 0}};
+    const std::array<size_t, 3> region = {{res.at(0), res.at(1), res.at(2)}};
+
+    while (true)
     {
-        float *pixels;
-        if (!load_hdr_float4(&pixels, &width, &height, file_name.c_str()))
-            throw std::runtime_error("Error loading environment map file.");
-        _environmentMap = cl::Image2D(_contextCL, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
-                                      format, width, height, 0, pixels);
-        std::cout << "Loaded environment map " << file_name << std::endl;
-    }
+        size_t t = 0;
+        size_t slot = 0;
+        {
+            std::unique_lock<std::mutex> lock(_stream.mutex);
+            _stream.cv.wait(lock, [&]{ return _stream.stop || nextStreamJob(t, slot); });
+            if (_stream.stop)
+                return;
+            _stream.slotTimestep.at(slot) = -1;
+        }
 
-    try {
-        _raycastKernel.setArg(ENVIRONMENT, _environmentMap);
+        try
+        {
+            DatRawReader::RawData raw = _dr.read_timestep(t);
+            if (raw.size() < region.at(0) * region.at(1) * region.at(2))
+                throw std::runtime_error("Volume size does not match size specified in dat file.");
+
+            std::vector<char> staging;
+            const char *upload = raw.data();
+            if (_quantization.active != STORAGE_NATIVE)
+            {
+                std::lock_guard<std::mutex> lock(_stream.mutex);
+                upload = storeVolume(raw.data(), staging);
+            }
+            {
+                std::lock_guard<std::mutex> lock(_stream.uploadMutex);
+                std::vector<cl::Event> uploadEvt(1);
+                std::vector<cl::Event> bricksEvt(1);
+                cl::Event mipsEvt;
+                _stream.queue.enqueueWriteImage(_volumesMem.at(slot), CL_FALSE, origin, region,
+                                                0, 0, upload, nullptr, &uploadEvt.front());
+                const bool cached = readCachedBricks(_stream.queue, t, _bricksMem.at(slot));
+                if (!cached)
+                    enqueueBrickGen(_stream.queue, _stream.genBricksKernel, _volumesMem.at(slot),
+                                    _bricksMem.at(slot), &uploadEvt, &bricksEvt.front());
+                enqueueBrickMipGen(_stream.queue, _stream.genBrickMipsKernel, _bricksMem.at(slot),
+                                   _brickMipsMem.at(slot), cached ? nullptr : &bricksEvt,
+                                   &mipsEvt);
+                _stream.queue.flush();
+                // the host data has to stay valid until the upload is complete, and bricks
+                // must not be regenerated on the render queue from a partial upload
+                uploadEvt.front().wait();
+                mipsEvt.wait();
+                if (!cached)
+                    writeCachedBricks(_stream.queue, t, _bricksMem.at(slot));
+            }
+
+            std::lock_guard<std::mutex> lock(_stream.mutex);
+            _stream.slotTimestep.at(slot) = long(t);
+            _stream.histograms.at(t) = raw.histogram;
+        }
+        catch (cl::Error err)
+        {
+            std::cerr << "ERROR: Streaming timestep " << t << " failed: " << err.what() << " ("
+                      << getCLErrorString(err.err()) << ")" << std::endl;
+            std::lock_guard<std::mutex> lock(_stream.mutex);
+            _stream.stop = true;
+        }
+        catch (std::runtime_error e)
+        {
+            std::cerr << "ERROR: Streaming timestep " << t << " failed: " << e.what() << std::endl;
+            std::lock_guard<std::mutex> lock(_stream.mutex);
+            _stream.stop = true;
+        }
     }
-    catch (cl::Error err) {
-        logCLerror(err);
+}
+
+
+/**
+ * @brief VolumeRenderCL::swapStreamedTimestep
+ * @return
+ */
+bool VolumeRenderCL::swapStreamedTimestep()
+{
+    bool swapped = false;
+    {
+        std::lock_guard<std::mutex> lock(_stream.mutex);
+        if (_stream.requested == _timestep)
+            return false;
+        const auto &st = _stream.slotTimestep;
+        const auto slot = std::find(st.begin(), st.end(), long(_stream.requested));
+        if (slot != st.end())
+        {
+            _stream.active = size_t(std::distance(st.begin(), slot));
+            _timestep = _stream.requested;
+            swapped = true;
+        }
     }
+    // the previously active slot may be reused now
+    if (swapped)
+        _stream.cv.notify_one();
+    return swapped;
 }
 
+
 /**
- * @brief VolumeRenderCL::setExtinction
- * @param maximum extinction factor for path tracing
+ * @brief VolumeRenderCL::cachedBrickGridType
+ * @return
  */
-void VolumeRenderCL::setExtinction(const double extinction)
+std::array<uint32_t, 4> VolumeRenderCL::cachedBrickGridType() const
 {
-    _pathtrace_params.max_extinction = float(extinction);
-    setPathtraceArgs();
+    // grid type 2: ESS grid generated on the device, including the interpolation apron. The
+    // grid holds the normalized values of the storage format (the quantization range and the
+    // rounding of half floats differ), so the format is part of the type.
+    return {{2u | (uint32_t(_quantization.active) << 8), _brickCellSize.at(0),
+             _brickCellSize.at(1), _brickCellSize.at(2)}};
 }
 
+
 /**
- * @brief VolumeRenderCL::setTimestep
+ * @brief VolumeRenderCL::readCachedBricks
+ * @param queue
  * @param t
+ * @param bricks
+ * @return
  */
-void VolumeRenderCL::setTimestep(const size_t t)
+bool VolumeRenderCL::readCachedBricks(cl::CommandQueue &queue, const size_t t,
+                                      const cl::Image3D &bricks)
 {
-    if (_dr.has_data() && t >= _dr.properties().volume_res.at(3))
-        return;
+    const std::array<uint32_t, 4> gridType = cachedBrickGridType();
+    const std::array<size_t, 3> region = {{bricks.getImageInfo<CL_IMAGE_WIDTH>(),
+                                           bricks.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                           bricks.getImageInfo<CL_IMAGE_DEPTH>()}};
+    const std::array<uint32_t, 3> gridRes = {{uint32_t(region.at(0)), uint32_t(region.at(1)),
+                                              uint32_t(region.at(2))}};
+    std::vector<char> grid;
+    if (!_dr.read_brick_grid(t, gridType, gridRes, grid) || grid.size() !=
+            region.at(0) * region.at(1) * region.at(2) * bricks.getImageInfo<CL_IMAGE_ELEMENT_SIZE>())
+        return false;
+    const std::array<size_t, 3> origin = {{0, 0, 0}};
+    queue.enqueueWriteImage(bricks, CL_TRUE, origin, region, 0, 0, grid.data());
+    return true;
+}
 
-    this->_timestep = t;
-    resetIteration();
+
+/**
+ * @brief VolumeRenderCL::writeCachedBricks
+ * @param queue
+ * @param t
+ * @param bricks
+ */
+void VolumeRenderCL::writeCachedBricks(cl::CommandQueue &queue, const size_t t,
+                                       const cl::Image3D &bricks)
+{
+    const std::array<uint32_t, 4> gridType = cachedBrickGridType();
+    const std::array<size_t, 3> region = {{bricks.getImageInfo<CL_IMAGE_WIDTH>(),
+                                           bricks.getImageInfo<CL_IMAGE_HEIGHT>(),
+                                           bricks.getImageInfo<CL_IMAGE_DEPTH>()}};
+    const std::array<uint32_t, 3> gridRes = {{uint32_t(region.at(0)), uint32_t(region.at(1)),
+                                              uint32_t(region.at(2))}};
+    std::vector<char> grid(region.at(0) * region.at(1) * region.at(2)
+                           * bricks.getImageInfo<CL_IMAGE_ELEMENT_SIZE>());
+    const std::array<size_t, 3> origin = {{0, 0, 0}};
+    queue.enqueueReadImage(bricks, CL_TRUE, origin, region, 0, 0, grid.data());
+    _dr.write_brick_grid(t, gridType, gridRes, grid);
 }
@@ -30,6 +30,14 @@
 
 #include <valarray>
 #include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <map>
+#include <deque>
+#include <memory>
+#include <functional>
 
 typedef unsigned int uint;
 
@@ -39,6 +47,9 @@ typedef unsigned int uint;
 class VolumeRenderCL
 {
 public:
+    // work-group edge: 8*8=64 is wavefront size or 2*warp size, the frame is padded to it
+    static constexpr size_t LOCAL_SIZE = 8;
+
     // OpenCL kernel structs
     typedef struct tag_camera_params
     {
@@ -63,6 +74,15 @@ public:
         cl_uint technique = 0;     // ray cast (0) or path tracing (1)
         cl_uint seed = 42;
         cl_uint iteration = 0;
+
+        cl_float errorThreshold = 0.f;  // progressive refinement, 0: off
+        cl_uint minIterations = 8;      // iterations before a tile may converge
+        cl_int2 frameSize = {{8, 8}};   // padded size of the whole frame
+        cl_int2 tileOrigin = {{0, 0}};  // frame pixel at the image origin, see renderTiled
+        cl_uint proxy = 0;              // ray intervals: 0 off, 1 exit only, 2 entry and exit
+        cl_uint reproject = 0;          // temporal reprojection, see reprojection_mode
+        cl_float reprojectionRate = 0.5f;   // sampling rate factor of pixels with history
+        cl_uint traversal = 0;          // work-group order: 0 rows, n strips of n groups
     } rendering_params;
 
     typedef struct tag_raycast_params
@@ -71,6 +91,10 @@ public:
         cl_uint useAO = 0;         // bool
         cl_uint contours = 0;      // bool
         cl_uint aerial = 0;        // bool
+        cl_uint brickLevels = 1;   // levels of the min/max brick hierarchy
+        cl_uint countSteps = 0;    // bool
+        cl_uint preIntegrated = 0; // bool
+        cl_uint diagnostics = 0;   // bool, per-pixel ray cost output
 
         cl_float3 brickRes = {{1,1,1}};
     } raycast_params;
@@ -80,6 +104,30 @@ public:
         cl_float max_extinction = 100.f;
     } pathtrace_params;
 
+    typedef struct tag_reprojection_params
+    {
+        // inverse rotation (rows) and camera position (s3, s7, s11) of the history view
+        cl_float16 historyInvView = {{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}};
+        cl_float blend = 0.25f;         // weight of the samples of the current frame
+        cl_float depthTolerance = 0.03f;    // relative depth difference of valid history
+    } reprojection_params;
+
+    // temporal reprojection state of a frame
+    enum reprojection_mode
+    {
+          REPROJECT_OFF = 0
+        , REPROJECT_DEPTH   // the kernel writes the representative depth for the next frame
+        , REPROJECT_HISTORY // the last frame is reprojected into this one
+    };
+
+    // state of a resident brick in the brick request buffer, non-resident bricks hold
+    // the number of rays that requested them in the last frame instead
+    enum brick_request
+    {
+          BRICK_UNUSED  = 0
+        , BRICK_USED    = 1 // resident brick that has been sampled in the last frame
+    };
+
     /**
      * @brief The OpenCL kernel argument enum.
      */
@@ -99,6 +147,31 @@ public:
         , RENDERING
         , RAYCAST
         , PATHTRACE
+        , PAGE_TABLE     // brick id to atlas slot mapping (bricked)   image3d_t (UINT)
+        , BRICK_REQUESTS // ray request count per brick (bricked)      global uint*
+        , BRICK_MIPS     // coarser levels of the brick hierarchy      image3d_t
+        , ESS_COUNTERS   // ray cost counters (64 bit each)            global uint*
+        , OCCUPANCY      // tff occupancy bit per brick hierarchy node  global uint*
+        , IN_TILE_ERROR  // error estimate per tile of the last frame   global uint*
+        , OUT_TILE_ERROR // error estimate per tile of this frame       global uint*
+        , ACTIVE_TILES   // number of tiles above the error threshold   global uint*
+        , GRADIENTS      // precomputed normal and gradient magnitude   image3d_t (RGBA8)
+        , PREINTEGRATION // pre-integrated tff of front/back density    image2d_t (RGBA32F)
+        , PROXY          // rasterized entry/exit distance per pixel    image2d_t (RGBA32F)
+        , DIAGNOSTICS    // ray cost per pixel, see setDiagnostics      image2d_t (RGBA32UI)
+        , DEPTH          // representative depth for the reprojection   image2d_t (R32F)
+        , HISTORY_MASK   // valid reprojected history per pixel         image2d_t (R8UI)
+    };
+
+    // counters of the ray costs of a frame, see getCostCounter
+    enum cost_counter
+    {
+          COST_SKIPPED_STEPS = 0 // ray steps skipped by empty space skipping
+        , COST_SAMPLED_STEPS     // volume samples
+        , COST_SKIPPED_BRICKS    // empty nodes of the brick hierarchy and missing bricks
+        , COST_GRADIENTS         // gradient evaluations
+        , COST_TERMINATED_RAYS   // rays stopped by early ray termination
+        , NUM_COST_COUNTERS
     };
 
     // mipmap down-scaling metric
@@ -117,6 +190,58 @@ public:
         , TECH_PATHTRACE = 1
     };
 
+    // distribution of the work on multiple devices, see setPeerDevices
+    enum multi_device_mode
+    {
+          SORT_FIRST = 0        // every device renders a band of image rows of each frame
+        , TIMESTEP_OWNERSHIP    // every device holds and renders a subset of the timesteps
+    };
+
+    // stages of the OpenCL profiling events collected with setProfiling
+    enum profiling_stage
+    {
+          STAGE_UPLOAD = 0
+        , STAGE_BRICK_GEN
+        , STAGE_RAYCAST
+        , STAGE_READBACK
+        , NUM_STAGES
+    };
+
+    // precision of the volume images in device memory, see setStorageFormat
+    enum storage_format
+    {
+          STORAGE_NATIVE = 0    // format of the data set
+        , STORAGE_HALF          // 16 bit floating point
+        , STORAGE_UNORM16       // 16 bit normalized, quantized in the value range of the data
+        , STORAGE_UNORM8        // 8 bit normalized, quantized in the value range of the data
+    };
+
+    // error of the values stored in a compact format, relative to the normalized data [0;1]
+    struct QuantizationError
+    {
+        double max = 0.0;
+        double rms = 0.0;
+        size_t timesteps = 0;   // number of uploaded timesteps the error is measured on
+    };
+
+    // camera of the raycasting kernel for the rasterization of the proxy geometry
+    struct ProxyView
+    {
+        std::array<float, 16> clipMatrix;   // volume coordinates to clip space, column major
+        std::array<float, 3> camPos;        // ray origin in volume coordinates
+        std::array<int, 2> viewport;        // padded frame size in pixels
+        float maxDistance = 0.f;            // upper bound of the ray distances in the volume
+        bool valid = false;                 // perspective camera and volume loaded
+    };
+
+    // work-group shapes selected by the auto-tuning, see setAutoTuning
+    struct WorkGroups
+    {
+        std::array<size_t, 2> frame = {{8, 8}};     // raycasting kernel
+        cl_uint traversal = 0;                      // see rendering_params::traversal
+        std::array<size_t, 3> volume = {{4, 4, 4}}; // brick and downsampling kernels
+    };
+
     /**
      * @brief Ctor
      */
@@ -155,6 +280,19 @@ public:
      */
     void updateOutputImg(const size_t width, const size_t height, cl_GLuint texId);
 
+    /**
+     * @brief Share several output textures of the size set with updateOutputImg, e.g. for
+     *        triple buffering. runRaycast renders into the one selected with selectOutputImg.
+     * @param texIds The OpenGL texture ids, the first one is selected.
+     */
+    void setOutputTextures(const std::vector<cl_GLuint> &texIds);
+
+    /**
+     * @brief Select the output texture of the next frames.
+     * @param index Index into the textures set with setOutputTextures.
+     */
+    void selectOutputImg(const size_t index);
+
     /**
      * @brief Run the actual OpenCL volume raycasting kernel.
      * @param width The image width in pixels, used as one dimension of the global thread size.
@@ -172,6 +310,75 @@ public:
       */
      void runRaycastNoGL(const size_t width, const size_t height, std::vector<float> &output);
 
+     /**
+      * @brief Create a ring of output images with pinned host buffers for pipelined rendering
+      *        without OpenGL context sharing (see enqueueRaycastNoGL).
+      * @param width The image width in pixels.
+      * @param height The image height in pixels.
+      * @param count Number of output images, i.e. the maximum number of frames in flight.
+      * @throws Runtime error if OpenGL context sharing is used.
+      */
+     void initOutputRing(const size_t width, const size_t height, const size_t count = 3);
+
+     /**
+      * @brief Enqueue the raycasting kernel into the next output image of the ring, followed
+      *        by a non-blocking readback into its pinned host buffer on a separate queue.
+      *        Blocks only if the frame previously rendered into that image is not released.
+      * @return The ring slot of the frame, used for waitFrame and releaseFrame.
+      */
+     size_t enqueueRaycastNoGL();
+
+     /**
+      * @brief Wait for the readback of a frame enqueued with enqueueRaycastNoGL.
+      * @param slot The ring slot of the frame.
+      * @return RGBA8 pixel data of the frame, bottom row first. Valid until releaseFrame.
+      */
+     const unsigned char *waitFrame(const size_t slot);
+
+     /**
+      * @brief Return a frame to the ring once its pixel data was consumed. May be called from
+      *        any thread, e.g. an image encoding worker.
+      * @param slot The ring slot of the frame.
+      */
+     void releaseFrame(const size_t slot);
+
+    /**
+     * @brief Settings of a tiled render, see renderTiled.
+     */
+    struct TileSettings
+    {
+        size_t maxTileSize = 2048;      // maximum edge length of a tile, bounds device memory
+        double dispatchBudget = 0.1;    // kernel time per dispatch in seconds
+        size_t iterations = 1;          // accumulated iterations per tile, e.g. path tracing
+    };
+
+    /**
+     * @brief A finished tile of a tiled render.
+     */
+    struct Tile
+    {
+        size_t x = 0;                   // origin in the frame, the bottom row is 0
+        size_t y = 0;
+        size_t width = 0;
+        size_t height = 0;
+        const unsigned char *pixels = nullptr;  // RGBA8, bottom row first, tightly packed
+    };
+
+    /**
+     * @brief Render a frame of arbitrary size without OpenGL context sharing as a sequence of
+     *        tiles, dispatched with the global offset. Only the output, accumulation and hit
+     *        images of one tile reside on the device. The tile size adapts to the kernel time
+     *        of the last tile to stay within the dispatch budget, e.g. for driver timeouts.
+     *        The output images and the output ring are restored to their previous size.
+     * @param width The frame width in pixels.
+     * @param height The frame height in pixels.
+     * @param settings Tile size limit, dispatch budget and iterations.
+     * @param tileDone Called with each finished tile, its pixels are only valid during the call.
+     * @throws Runtime error if OpenGL context sharing is used or no data is loaded.
+     */
+    void renderTiled(const size_t width, const size_t height, const TileSettings &settings,
+                     const std::function<void(const Tile &)> &tileDone);
+
     /**
      * @brief Load volume data from a given .dat file name.
      * @param fileName The full path to the volume data file.
@@ -273,6 +480,69 @@ public:
      */
     double getLastExecTime();
 
+    /**
+     * @brief Enable counting of skipped and sampled ray steps per frame.
+     * @param countSteps
+     */
+    void setStepCounting(bool countSteps);
+
+    /**
+     * @brief Get the number of ray steps skipped by empty space skipping in the last frame.
+     * @return The number of skipped steps, 0 if step counting is disabled.
+     */
+    cl_ulong getSkippedSteps() const;
+
+    /**
+     * @brief Get the number of ray steps sampled in the last frame.
+     * @return The number of sampled steps, 0 if step counting is disabled.
+     */
+    cl_ulong getSampledSteps() const;
+
+    /**
+     * @brief Get a ray cost counter of the last frame, including the rows of peer devices.
+     * @param counter The counter.
+     * @return The counter value, 0 if neither step counting nor diagnostics are enabled.
+     */
+    cl_ulong getCostCounter(cost_counter counter) const;
+
+    /**
+     * @brief Enable the per-pixel ray cost output of the ray casting kernel. Also enables
+     *        the cost counters.
+     * @param diagnostics
+     */
+    void setDiagnostics(bool diagnostics);
+
+    /**
+     * @brief Read back the per-pixel ray costs of the last frame rendered on this device.
+     * @param costs Four values per pixel, bottom row first: samples, skipped bricks,
+     *        gradient evaluations and the sample that terminated the ray (0: not terminated).
+     * @param width Width of the frame in pixels.
+     * @param height Height of the frame in pixels.
+     * @return false if diagnostics are disabled or no frame was rendered.
+     */
+    bool getDiagnostics(std::vector<cl_uint> &costs, size_t &width, size_t &height);
+
+    /**
+     * @brief Enable recording of OpenCL profiling events of volume and brick uploads, brick
+     *        generation, raycasting, accumulation and readback.
+     * @param profiling
+     */
+    void setProfiling(bool profiling);
+
+    /**
+     * @brief Get the device execution times of all stage events recorded since the last call.
+     *        Waits for pending events and clears the records.
+     * @return The execution times in seconds per stage.
+     */
+    std::array<std::vector<double>, NUM_STAGES> takeStageTimings();
+
+    /**
+     * @brief Check if the raycast kernel specialized for the current parameters is still
+     *        being built in the background, i.e. if the generic kernel is used.
+     * @return true if the kernel variant is not yet bound.
+     */
+    bool isKernelVariantPending() const;
+
     /**
      * @brief getPlatformNames
      * @return platform names
@@ -294,6 +564,12 @@ public:
      */
     const std::string getCurrentDeviceName();
 
+    /**
+     * @brief Get the driver version of the OpenCL device that is currently in use.
+     * @return The driver version, empty if no device is currently used.
+     */
+    const std::string getCurrentDriverVersion();
+
     /**
      * @brief setAmbientOcclusion
      * @param ao
@@ -307,6 +583,181 @@ public:
      */
     const std::string volumeDownsampling(const size_t t, const int factor);
 
+    /**
+     * @brief Render from a GPU resident down-sampled copy of the volume, e.g. while the
+     *        camera is moving. The copy of a timestep is built with the downsampling kernel
+     *        on first use and kept until the volume data changes. Only supported for single
+     *        channel volumes that are neither bricked nor streamed, ignored otherwise.
+     * @param lowRes true to render from the down-sampled copy, false for the full volume.
+     * @param factor Downsampling factor, uniform for all 3 dimensions.
+     */
+    void setLowResVolume(bool lowRes, unsigned int factor = 2);
+
+    /**
+     * @brief Check whether rendering from a down-sampled volume is supported for the
+     *        currently loaded data.
+     */
+    bool isLowResVolumeSupported() const;
+
+    /**
+     * @brief Set the precision of the volume images in device memory, the volume is uploaded
+     *        again if data is loaded. UNORM formats are quantized in the value range of the
+     *        histogram and mapped back with a scale and offset in the kernel. Only supported
+     *        for single channel USHORT and FLOAT volumes that are not bricked, the native
+     *        format is used otherwise.
+     * @param format Storage format of the following uploads.
+     */
+    void setStorageFormat(const storage_format format);
+
+    /**
+     * @brief Get the storage format of the uploaded volume data.
+     */
+    storage_format getStorageFormat() const;
+
+    /**
+     * @brief Get the quantization error of the compact storage format, zero for the native
+     *        format.
+     */
+    QuantizationError getQuantizationError() const;
+
+    /**
+     * @brief Set the number of threads that read the timesteps of a time series concurrently.
+     *        Timesteps held by this device only are uploaded as soon as they have been read.
+     * @param workers Number of I/O workers, 0: depending on the number of cores.
+     */
+    void setIoWorkers(const size_t workers);
+
+    /**
+     * @brief Precompute a gradient volume (RGBA8: packed normal and magnitude) per timestep
+     *        when the data is uploaded, to replace the gradient stencils of the illumination,
+     *        contours and ambient occlusion with a single texture fetch. Falls back to on the
+     *        fly gradients if the volumes do not fit into device memory, in bricked and in
+     *        streaming mode. The gradient of the transfer function (illumination type 2) is
+     *        always computed on the fly.
+     * @param precompute true to use precomputed gradients.
+     */
+    void setGradientVolume(bool precompute);
+
+    /**
+     * @brief Check whether precomputed gradients are used for the loaded data.
+     */
+    bool hasGradientVolume() const;
+
+    /**
+     * @brief Use a pre-integrated transfer function table for the color and opacity of the
+     *        ray segments between two samples instead of point samples of the transfer
+     *        function. Avoids artifacts of high frequency transfer functions at low sampling
+     *        rates. Only used for single channel data and not for path tracing.
+     * @param preIntegrate true to use pre-integration.
+     */
+    void setPreIntegration(bool preIntegrate);
+
+    /**
+     * @brief Set the OpenGL texture the proxy geometry is rasterized into, RGBA32F with the
+     *        ray entry distance in r and the exit distance in g, negative if not covered.
+     *        Must be at least as large as the padded frame.
+     * @param texId Texture name, 0 to disable the proxy geometry.
+     */
+    void setProxyTex(cl_GLuint texId);
+
+    /**
+     * @brief Get the camera of the raycasting kernel for a frame size, the rasterized
+     *        distances are measured along the rays of the kernel.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     */
+    ProxyView getProxyView(const size_t width, const size_t height) const;
+
+    /**
+     * @brief Get the faces of the bricks that are not empty under the current transfer
+     *        function and border an empty brick or the volume boundary.
+     * @param version Version of the geometry of the caller, updated if it changed.
+     * @param vertices Triangles in volume coordinates [-1,1], three floats per vertex.
+     * @return true if the geometry changed since version.
+     */
+    bool getProxyGeometry(size_t &version, std::vector<float> &vertices);
+
+    /**
+     * @brief Use the rasterized proxy distances in the next frames.
+     * @param active true if the proxy texture holds the distances of the current camera.
+     */
+    void setProxyActive(bool active);
+
+    /**
+     * @brief Set the error threshold of the progressive refinement. The kernel estimates the
+     *        standard error of the accumulated mean per work-group tile, tiles below the
+     *        threshold stop tracing rays and only pass on their accumulated color.
+     * @param threshold Maximum standard error of the pixel luminance, 0 to disable.
+     * @param minIterations Number of accumulated frames before a tile may converge.
+     */
+    void setConvergenceThreshold(double threshold, unsigned int minIterations = 8);
+
+    /**
+     * @brief Reproject the last frame into the next one on camera changes instead of
+     *        restarting the accumulation. The kernel writes the depth where the ray opacity
+     *        passes one half, the history is rejected on depth mismatch (disocclusion), clamped
+     *        to the neighborhood of the new samples and blended with them. Pixels with a valid
+     *        history in the last frame are traced at a reduced sampling rate. Only used for
+     *        perspective ray casting on a single device.
+     * @param reproject true to enable the reprojection.
+     * @param samplingRate Factor of the sampling rate of pixels with a valid history (0,1].
+     */
+    void setTemporalReprojection(bool reproject, double samplingRate = 0.5);
+
+    /**
+     * @brief Check whether the next camera change is reprojected, see setTemporalReprojection.
+     */
+    bool usesTemporalReprojection() const;
+
+    /**
+     * @brief Check whether all tiles of the last frame rendered with runRaycast have
+     *        converged, i.e. further frames would not change the image.
+     */
+    bool isConverged() const;
+
+    /**
+     * @brief Tune the work-group shapes per device. On first use of a device and raycasting
+     *        kernel variant, the candidate shapes and pixel traversal orders are timed with the
+     *        profiling events on the first frame, the brick kernel shapes on the first brick
+     *        generation. The winners are stored in the user cache directory. Frames rendered
+     *        on several devices use the default 8x8 work-groups.
+     * @param autoTune true to enable the tuning, false to use the default shapes.
+     */
+    void setAutoTuning(bool autoTune);
+
+    /**
+     * @brief Get the work-group shapes that are currently used.
+     */
+    const WorkGroups &getWorkGroups() const;
+
+    /**
+     * @brief Render with additional OpenCL devices.
+     *        SORT_FIRST: Every device holds its own copy of the volume, or its own brick cache
+     *        in bricked mode, and renders a band of image rows. The bands are balanced with the
+     *        kernel times of the previous frame and composited into the output image of this
+     *        renderer.
+     *        TIMESTEP_OWNERSHIP: Timestep t is only uploaded to device t % getDeviceCount(),
+     *        with this renderer as device 0, and frames of t are rendered there. The length of
+     *        a time series is limited by the aggregate device memory and frames of different
+     *        timesteps enqueued with enqueueRaycastNoGL are rendered in parallel.
+     * @param platformId OpenCL platform of the additional devices.
+     * @param deviceIds Indices of the GPU devices on the platform (see getDeviceNames),
+     *        excluding the device of this renderer. Empty to render on this device only.
+     * @param mode Distribution of the work on the devices.
+     */
+    void setPeerDevices(const size_t platformId, const std::vector<size_t> &deviceIds,
+                        const multi_device_mode mode = SORT_FIRST);
+
+    /**
+     * @brief Get the number of devices that render a frame.
+     */
+    size_t getDeviceCount() const;
+
+    /**
+     * @brief Get the index of the device that renders frames of a timestep, 0 for this device.
+     */
+    size_t getTimestepDevice(const size_t t) const;
+
     /**
      * @brief Return the 256-bin-histogram of the loaded volume data (scalar values).
      * @param timestep of the volume.
@@ -332,6 +783,15 @@ public:
      */
     void setTechnique(technique tech);
 
+    /**
+     * @brief Render path tracing as a wavefront: separate kernels for ray generation, free
+     *        flight, scattering and accumulation, with the live paths compacted between the
+     *        segments. The free flights use the maximum opacity of each brick as majorant.
+     *        Otherwise the paths are traced by the raycasting kernel, one per work-item.
+     * @param wavefront true to use the wavefront path tracer (default).
+     */
+    void setWavefrontPathtracing(bool wavefront);
+
     /**
      * @brief setExtinction
      * @param extinction
@@ -355,6 +815,54 @@ public:
      */
     void setTimestep(const size_t t);
 
+    /**
+     * @brief Force the bricked out-of-core volume mode.
+     *        The bricked mode is enabled automatically for single channel volumes that
+     *        exceed the available device memory.
+     * @param useBricking Always use the bricked mode if true, only if necessary otherwise.
+     */
+    void setBricking(bool useBricking);
+
+    /**
+     * @brief Answers if the volume is rendered in bricked out-of-core mode.
+     * @return true, if the volume is split into bricks that are streamed into a brick cache.
+     */
+    bool isBricked() const;
+
+    /**
+     * @brief Answers if bricks that are visible in the last frame are still missing
+     *        in the brick cache, i.e. if further frames should be rendered to stream them in.
+     * @return true, if the brick cache changed or there are pending brick requests.
+     */
+    bool hasPendingBricks() const;
+
+    /**
+     * @brief Set the memory budget of the brick cache (atlas) in bricked mode.
+     * @param bytes Maximum size of the brick atlas in bytes, 0 to choose automatically.
+     */
+    void setBrickCacheSize(const size_t bytes);
+
+    /**
+     * @brief Set the number of time steps of a time series that are resident on the device.
+     *        In streaming mode, upcoming time steps are read and uploaded in the background
+     *        while the current one is rendered. Takes effect with the next loadVolumeData.
+     * @param timesteps Number of resident time steps (at least 2) to always stream time series,
+     *        0 to stream only time series that exceed the available device memory.
+     */
+    void setStreamingWindow(const size_t timesteps);
+
+    /**
+     * @brief Answers if the time series is streamed to the device.
+     * @return true, if only a window of time steps is resident on the device.
+     */
+    bool isStreaming() const;
+
+    /**
+     * @brief Answers if the time step set last is still being loaded in streaming mode.
+     * @return true, if an older time step is rendered until the requested one is resident.
+     */
+    bool hasPendingTimestep() const;
+
 private:
     /**
      * @brief Generate coarse grained volume bricks that can be used for ESS.
@@ -368,10 +876,54 @@ private:
     void calcScaling();
 
     /**
-     * @brief volDataToCLmem
-     * @param volumeData
+     * @brief Upload all time steps of the volume data read by the reader to the device.
+     */
+    void volDataToCLmem();
+
+    /**
+     * @brief Upload the timesteps owned by this device, read one at a time, and placeholders
+     *        for the timesteps of the other devices (TIMESTEP_OWNERSHIP mode).
+     * @param format Image format of the volume.
+     */
+    void uploadOwnedTimesteps(const cl::ImageFormat &format);
+
+    /**
+     * @brief Get the size of a timestep in device memory with the requested storage format.
+     */
+    size_t deviceVolumeSize() const;
+
+    /**
+     * @brief Select the storage format of the volume images and its value range.
+     * @param format Image format of the data set, changed to the storage format.
+     * @param compact false to use the native format, e.g. in bricked mode.
+     */
+    void selectStorageFormat(cl::ImageFormat &format, const bool compact);
+
+    /**
+     * @brief Convert the data of a timestep into the storage format and add its error to
+     *        the quantization error. Requires the stream mutex.
+     * @param data Volume data read by the reader.
+     * @param staging Host memory of the converted data.
+     * @return The data to upload, either data or staging.
+     */
+    const char *storeVolume(const char *data, std::vector<char> &staging);
+
+    /**
+     * @brief Print the quantization error of the uploaded timesteps.
+     */
+    void reportQuantizationError() const;
+
+    /**
+     * @brief Generate the gradient volumes of all uploaded timesteps, with the stencil of the
+     *        current illumination type.
+     */
+    void generateGradients();
+
+    /**
+     * @brief Generate the pre-integration table of the current transfer function and sampling
+     *        rate if it is outdated.
      */
-    void volDataToCLmem(const std::vector<std::vector<char> > &volumeData);
+    void preIntegrateTff();
 
     /**
      * @brief Convert volume data to UCHAR format and generate OpenCL image textue memory object.
@@ -413,14 +965,6 @@ private:
      */
     void setMemObjectsRaycast(const size_t t);
 
-    /**
-     * @brief Set OpenCL memory objects for brick generation kernel.
-     * @param t number of volume timesteps.
-     * @throws runtime_error when the number of volume timesteps
-     *         is not equal to number of brick timesteps
-     */
-    void setMemObjectsBrickGen(const size_t t);
-
     /**
      * @brief Initialize OpenCL kernel with default paramters.
      * @param fileName File name of the kernel source file.
@@ -428,6 +972,399 @@ private:
      */
     void initKernel(const std::string fileName, const std::string buildFlags = "");
 
+    /**
+     * @brief Assemble the kernel build flags from the current rendering mode.
+     * @return The compiler flags for the volume raycast kernel.
+     */
+    const std::string kernelBuildFlags() const;
+
+    /**
+     * @brief Assemble the defines of a raycast kernel variant that is specialized for the
+     *        current rendering parameters.
+     * @return The compiler flags in addition to the kernel build flags.
+     */
+    const std::string kernelVariantFlags() const;
+
+    /**
+     * @brief Bind the raycast kernel variant for the current rendering parameters.
+     *        Variants are built in the background on first use, the generic kernel is used
+     *        until the build is finished.
+     */
+    void selectRaycastVariant();
+
+    /**
+     * @brief Bind a built raycast kernel variant and set its parameter arguments.
+     * @param flags Build flags of the variant.
+     */
+    void bindRaycastKernel(const std::string &flags);
+
+    /**
+     * @brief Check if the volume data has to be rendered in bricked mode because
+     *        it exceeds the image size or memory limits of the current device.
+     * @param bytesPerTimestep Size of one timestep in bytes.
+     * @param numTimesteps Number of timesteps that have to be resident.
+     * @return true if the volume does not fit into device memory.
+     */
+    bool exceedsDeviceMemory(const size_t bytesPerTimestep, const size_t numTimesteps = 1) const;
+
+    /**
+     * @brief Create the brick atlas, page table and request buffer for bricked mode.
+     * @param format Image format of the volume data.
+     * @param bytesPerVoxel Number of bytes of one voxel.
+     */
+    void initBrickCache(const cl::ImageFormat &format, const size_t bytesPerVoxel);
+
+    /**
+     * @brief Evict all bricks from the brick cache, e.g. on timestep change.
+     */
+    void resetBrickCache();
+
+    /**
+     * @brief Calculate min/max values of all bricks of a given timestep on the host.
+     *        Used in bricked mode where the volume is not resident on the device.
+     * @param t The timestep.
+     */
+    void generateBricksHost(const size_t t);
+
+    /**
+     * @brief Copy a brick including its one voxel apron from host memory.
+     * @param t The timestep.
+     * @param brickId Linear index of the brick in the page table.
+     * @param dst Destination memory of (BRICK_SIZE+2)^3 voxels.
+     */
+    void extractBrick(const size_t t, const size_t brickId, char *dst) const;
+
+    /**
+     * @brief Check if a brick contains only fully transparent voxels given the current
+     *        transfer function.
+     * @param brickId Linear index of the brick in the page table.
+     * @return true if the brick can be skipped.
+     */
+    bool isBrickEmpty(const size_t brickId) const;
+
+    /**
+     * @brief Read back brick requests of the last frame and stream missing bricks
+     *        into the brick cache.
+     */
+    void updateBrickCache();
+
+    /**
+     * @brief Enqueue the generation of the min/max bricks of one volume.
+     * @param queue Command queue to use.
+     * @param kernel Brick generation kernel.
+     * @param volume The volume data.
+     * @param bricks The brick volume that is written.
+     * @param waitEvents Events to wait for before the kernel is executed, may be null.
+     * @param event Event of the kernel execution, may be null.
+     */
+    void enqueueBrickGen(cl::CommandQueue &queue, cl::Kernel &kernel,
+                         const cl::Image3D &volume, const cl::Image3D &bricks,
+                         const std::vector<cl::Event> *waitEvents = nullptr,
+                         cl::Event *event = nullptr);
+
+    /**
+     * @brief Create the image for the coarser levels of the min/max brick hierarchy.
+     * @param bricks The finest level of the hierarchy.
+     * @return Image with all levels > 0 packed along x.
+     */
+    cl::Image3D createBrickMips(const cl::Image3D &bricks);
+
+    /**
+     * @brief Enqueue the generation of the coarser levels of the min/max brick hierarchy.
+     * @param queue Command queue to use.
+     * @param kernel Brick hierarchy generation kernel.
+     * @param bricks The finest level of the hierarchy.
+     * @param brickMips The coarser levels that are written.
+     * @param waitEvents Events to wait for before the kernel is executed, may be null.
+     * @param event Event of the kernel execution, may be null.
+     */
+    void enqueueBrickMipGen(cl::CommandQueue &queue, cl::Kernel &kernel,
+                            const cl::Image3D &bricks, const cl::Image3D &brickMips,
+                            const std::vector<cl::Event> *waitEvents = nullptr,
+                            cl::Event *event = nullptr);
+
+    /**
+     * @brief Regenerate the transfer function occupancy of the brick hierarchy of a slot,
+     *        if it is stale.
+     * @param slot The volume slot that is rendered.
+     */
+    void updateOccupancy(const size_t slot);
+
+    /**
+     * @brief Key of the persisted work-group shapes of a kernel on this device.
+     * @param kernel Kernel name and build flags.
+     */
+    std::string tuningKey(const std::string &kernel) const;
+
+    /**
+     * @brief Apply the tuned work-group shape of the bound raycasting kernel, timing the
+     *        candidates if this device and variant have not been tuned. Must be called with
+     *        the kernel arguments of the frame bound and the output acquired.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     */
+    void selectFrameGroups(const size_t width, const size_t height);
+
+    /**
+     * @brief Time the candidate work-group shapes and traversal orders of the raycasting
+     *        kernel on a window of the frame. The outputs are overwritten by the next frame.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     * @return The fastest shape (x, y) and traversal order.
+     */
+    std::array<size_t, 3> tuneFrameGroups(const size_t width, const size_t height);
+
+    /**
+     * @brief Set the work-group shape and traversal order of the raycasting kernel. The image
+     *        order ESS hits and tile errors are indexed by work-group and reset on changes.
+     */
+    void setFrameGroups(const std::array<size_t, 2> &shape, const cl_uint traversal);
+
+    /**
+     * @brief Reset the image order ESS hits and tile errors of the last frame to the state
+     *        of a new frame, for a frame with a different work-group layout.
+     */
+    void resetGroupResults();
+
+    /**
+     * @brief Apply the tuned work-group shape of the brick and downsampling kernels, timing
+     *        the candidates with the brick generation of a volume if this device has not been
+     *        tuned. The bricks are written by every candidate.
+     * @param volume The volume data.
+     * @param bricks The brick volume that is written.
+     */
+    void selectVolumeGroups(const cl::Image3D &volume, const cl::Image3D &bricks);
+
+    /**
+     * @brief Read back the step counters of the last frame.
+     */
+    void readStepCounters();
+
+    /**
+     * @return true if the kernel counts the ray costs.
+     */
+    bool countsCosts() const;
+
+    /**
+     * @brief Get the diagnostic image of the render size, created on first use.
+     */
+    const cl::Image2D &diagnosticImage();
+
+    /**
+     * @brief Reset the tile error estimates of the next frame if progressive refinement
+     *        is enabled.
+     */
+    void clearTileErrors();
+
+    /**
+     * @brief Swap the accumulation buffers and tile error estimates by handle after a frame
+     *        has been enqueued.
+     */
+    void swapAccumulation();
+
+    /**
+     * @brief Create the command queue, placeholder objects and kernels of a new context and
+     *        upload the volume data if already loaded.
+     */
+    void initContextObjects();
+
+    /**
+     * @brief Enqueue the raycasting kernel for a band of image rows using the global offset.
+     * @param width Render width in pixels.
+     * @param rows First and last (exclusive) row of the band in the padded frame.
+     * @param evt Event of the kernel.
+     */
+    void enqueueRaycastRows(const size_t width, const std::array<size_t, 2> &rows,
+                            cl::Event *evt);
+
+    /**
+     * @brief Enqueue the raycasting kernel for a tile of the padded frame.
+     * @param origin Global offset of the tile, a multiple of the work-group size.
+     * @param size Global size of the tile, rounded up to a multiple of the work-group size.
+     * @param evt Event of the (last) kernel.
+     */
+    void enqueueRaycastTile(const std::array<size_t, 2> &origin,
+                            const std::array<size_t, 2> &size, cl::Event *evt);
+
+    /**
+     * @brief Check whether the wavefront path tracer is used instead of the raycasting kernel.
+     */
+    bool usesWavefront() const;
+
+    /**
+     * @brief Enqueue the wavefront path tracer for a tile or band of the padded frame. Waits
+     *        for the number of live paths after each segment to launch only the compacted paths.
+     * @param origin Global offset of the tile.
+     * @param size Global size of the tile.
+     * @param evt Event of the last kernel, see kernelTime.
+     */
+    void enqueueWavefrontTile(const std::array<size_t, 2> &origin,
+                              const std::array<size_t, 2> &size, cl::Event *evt);
+
+    /**
+     * @brief Generate the path tracing majorants of the bricks of a slot if they are stale.
+     */
+    void updateMajorants(const size_t slot);
+
+    /**
+     * @brief (Re)create the images of the temporal reprojection for a frame size.
+     */
+    void updateReprojectionImages(const size_t width, const size_t height);
+
+    /**
+     * @brief Enqueue the reprojection of the history into the samples of this frame, the
+     *        resolved color replaces the output accumulation image.
+     * @param output The output image of the frame.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     */
+    void enqueueReprojection(const cl::Memory &output, const size_t width, const size_t height);
+
+    /**
+     * @brief Bind the output image of the raycasting and the wavefront kernels.
+     */
+    void setOutputArg(const cl::Memory &image);
+
+    /**
+     * @brief Get the execution time of a kernel event, wavefront frames are measured from
+     *        their first kernel.
+     * @param evt Completed event of a raycasting or wavefront frame.
+     * @return Time in seconds.
+     */
+    double kernelTime(const cl::Event &evt) const;
+
+    /**
+     * @brief Copy the render parameters to a peer device.
+     */
+    void syncPeer(VolumeRenderCL &peer) const;
+
+    /**
+     * @brief Split the padded frame into bands of rows according to the device shares.
+     *        The split is only changed at the first iteration, since the accumulated frames
+     *        of a band are only valid on the device that rendered them.
+     * @param globalHeight Padded height of the frame.
+     */
+    void splitRows(const size_t globalHeight);
+
+    /**
+     * @brief Render the bands of all peer devices and read them back asynchronously.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     * @return The band of rows of this device.
+     */
+    std::array<size_t, 2> enqueuePeerBands(const size_t width, const size_t height);
+
+    /**
+     * @brief Render a band of rows on this (peer) device and enqueue the readback.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     * @param rows Band of rows in the padded frame.
+     * @param band RGBA8 host memory of the band, at least width*height*4 bytes.
+     * @param readEvt Event of the readback.
+     */
+    void enqueueBand(const size_t width, const size_t height, const std::array<size_t, 2> &rows,
+                     unsigned char *band, cl::Event &readEvt);
+
+    /**
+     * @brief Check if the volume of a timestep is held in the memory of this device.
+     */
+    bool ownsTimestep(const size_t t) const;
+
+    /**
+     * @brief Wait for the peer bands and write them into an output image of this renderer.
+     * @param output The output image.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     */
+    void compositePeerBands(const cl::Image &output, const size_t width, const size_t height);
+
+    /**
+     * @brief Collect the kernel times, step counters and brick requests of the peer devices
+     *        after a frame and rebalance the bands to equalize the kernel times.
+     */
+    void finishPeerBands();
+
+    /**
+     * @brief Wait for all frames in flight and release the output ring.
+     */
+    void releaseOutputRing();
+
+    /**
+     * @brief Down-sample a volume on the device.
+     * @param volume Single channel volume image.
+     * @param factor Downsampling factor, uniform for all 3 dimensions.
+     * @return The down-sampled volume image in the same format.
+     */
+    cl::Image3D downsampleVolume(const cl::Image3D &volume, const unsigned int factor);
+
+    /**
+     * @brief Prepare rendering at a (possibly different) image size. Image order ESS hit
+     *        results and the accumulated frames are only valid for the same ray geometry,
+     *        so they are reset if the size changed.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     */
+    void setRenderSize(const size_t width, const size_t height);
+
+    /**
+     * @brief Record the event of a stage if profiling is enabled.
+     * @param stage The profiling stage.
+     * @return The event to pass to the enqueue call, nullptr if profiling is disabled.
+     */
+    cl::Event *stageEvent(const profiling_stage stage);
+
+    /**
+     * @brief Get the cache key of the device generated min/max brick grid, it depends on
+     *        the cell size and the storage format of the volume.
+     */
+    std::array<uint32_t, 4> cachedBrickGridType() const;
+
+    /**
+     * @brief Upload the cached min/max brick grid of a time step, if available.
+     * @param queue Command queue to use.
+     * @param t The time step.
+     * @param bricks The brick volume that is written.
+     * @return true on a cache hit.
+     */
+    bool readCachedBricks(cl::CommandQueue &queue, const size_t t, const cl::Image3D &bricks);
+
+    /**
+     * @brief Read back the min/max brick grid of a time step and store it in the cache.
+     * @param queue Command queue to use.
+     * @param t The time step.
+     * @param bricks The brick volume.
+     */
+    void writeCachedBricks(cl::CommandQueue &queue, const size_t t, const cl::Image3D &bricks);
+
+    /**
+     * @brief Start the background loader thread for streaming time series.
+     */
+    void startStreaming();
+
+    /**
+     * @brief Stop the background loader thread and wait for pending uploads.
+     */
+    void stopStreaming();
+
+    /**
+     * @brief Background loader: reads and uploads the time steps within the streaming window.
+     */
+    void streamTimesteps();
+
+    /**
+     * @brief Select the next time step to load and a free slot. Requires the stream mutex.
+     * @param t Time step to load.
+     * @param slot Slot to upload the time step to.
+     * @return true if there is a time step in the window that is not yet resident.
+     */
+    bool nextStreamJob(size_t &t, size_t &slot) const;
+
+    /**
+     * @brief Switch to the requested time step if it is resident in streaming mode.
+     * @return true if the rendered time step changed.
+     */
+    bool swapStreamedTimestep();
+
     // set kernel args
     void setCameraArgs();
     void setRenderingArgs();
@@ -447,11 +1384,18 @@ private:
     cl::CommandQueue _queueCL;
     cl::Kernel _raycastKernel;
     cl::Kernel _genBricksKernel;
+    cl::Kernel _genBrickMipsKernel;
+    cl::Kernel _occupancyKernel;
     cl::Kernel _downsamplingKernel;
 
     std::vector<cl::Image3D> _volumesMem;
     std::vector<cl::Image3D> _bricksMem;
+    std::vector<cl::Image3D> _brickMipsMem;
+    cl::Buffer _occupancyMem;
+    long _occupancySlot = -1;   // slot the occupancy is valid for, -1 if stale
+    std::array<uint, 3> _brickCellSize = {{1u, 1u, 1u}};   // voxels per brick of the ESS grid
     cl::ImageGL _outputMem;
+    std::vector<cl::ImageGL> _outputMemsGL;     // see setOutputTextures
     cl::ImageGL _overlayMem;
     cl::Image1D _tffMem;
     cl::Image1D _tffPrefixMem;
@@ -461,6 +1405,8 @@ private:
     cl::Image2D _inAccumulate;
     cl::Image2D _outAccumulate;
     cl::Image2D _environmentMap;
+    cl::Buffer _stepCountersMem;
+    std::array<cl_ulong, NUM_COST_COUNTERS> _stepCounts = {};  // ray costs of the last frame
 
     bool _volLoaded = false;
     size_t _timestep = 0;
@@ -478,5 +1424,225 @@ private:
     raycast_params _raycast_params;
     pathtrace_params _pathtrace_params;
 
+    // bricked out-of-core mode
+    struct BrickCache
+    {
+        cl::Image3D atlas;                      // brick slots incl. one voxel apron
+        cl::Image3D pageTable;                  // atlas slot + 1 per brick, 0 if not resident
+        cl::Buffer requests;                    // brick_request flag or request count per brick
+        std::array<uint, 3> numBricks = {{1u, 1u, 1u}};
+        std::array<uint, 3> numSlots = {{0u, 0u, 0u}};
+        size_t bytesPerVoxel = 1;
+        std::vector<cl_uint> pageEntries;       // host copy of the page table
+        std::vector<long> slotBrick;            // brick id per atlas slot, -1 if free
+        std::vector<unsigned long> slotLastUsed;
+        std::vector<cl_uint> requestFlags;
+        std::vector<std::vector<std::array<float, 2> > > minMax; // per timestep and brick
+        unsigned long frame = 0;
+        bool dirty = false;
+    } _brickCache;
+    bool _useBricking = false;
+    bool _forceBricking = false;
+    bool _useObjEss = true;
+    size_t _brickCacheSize = 0;
+    std::vector<unsigned int> _tffPrefixSum;
+    std::string _buildFlags;
+
+    // raycast kernel variants with compile time rendering parameters
+    struct KernelVariants
+    {
+        std::map<std::string, cl::Kernel> kernels;      // by build flags, incl. the generic one
+        std::map<std::string, std::future<cl::Kernel> > pending;
+        std::vector<std::future<cl::Kernel> > stale;    // builds for an outdated program
+        std::string active;                             // build flags of the bound kernel
+    } _variants;
+    std::string _channelOrderDefine;                    // e.g. CLK_R, empty if not specialized
+
+    // streaming time series playback
+    struct TimestepStream
+    {
+        std::thread loader;
+        mutable std::mutex mutex;               // guards the slot state
+        std::mutex uploadMutex;                 // guards the slot volume and brick images
+        std::condition_variable cv;
+        cl::CommandQueue queue;                 // upload queue of the loader thread
+        cl::Kernel genBricksKernel;             // brick generation on the upload queue
+        cl::Kernel genBrickMipsKernel;
+        size_t windowSize = 0;                  // requested window, 0: only if necessary
+        size_t window = 0;                      // resident time steps, 0: not streaming
+        std::vector<long> slotTimestep;         // time step per slot, -1 if empty or loading
+        size_t active = 0;                      // slot used for rendering
+        size_t requested = 0;                   // time step set by the user
+        std::vector<std::array<double, 256> > histograms;
+        std::array<double, 256> histogram;      // copy returned by getHistogram
+        bool stop = true;
+    } _stream;
+
+    // recorded events of profiled stages, a deque keeps references to events valid
+    struct StageProfile
+    {
+        bool enabled = false;
+        std::deque<std::pair<profiling_stage, cl::Event> > events;
+    } _profile;
+
+    // wavefront path tracer
+    struct Wavefront
+    {
+        bool enabled = true;
+        cl::Kernel generate;
+        cl::Kernel freeFlight;
+        cl::Kernel scatter;
+        cl::Kernel accumulate;
+        cl::Kernel genMajorants;
+        cl::Buffer paths;                       // path state per pixel of the band
+        std::array<cl::Buffer, 2> queues;       // ids of live paths, swapped per segment
+        std::array<cl::Buffer, 2> counts;       // number of paths in the queues
+        // non-blocking copies of the count after each segment, only used to shrink later
+        // dispatches once they arrived (the kernels exit early on the device side count)
+        std::vector<cl_uint> liveCounts;
+        std::vector<cl::Event> liveCountReads;
+        size_t capacity = 0;                    // paths per band
+        cl::Buffer majorants;                   // maximum opacity per brick
+        long majorantSlot = -1;                 // slot the majorants are valid for
+        cl::Image3D volume;                     // bound by setMemObjectsRaycast
+        cl::Image3D bricks;
+        cl::Memory output;
+        // first and last kernel of recent frames, kept for profiling
+        std::deque<std::pair<cl::Event, cl::Event> > spans;
+    } _wavefront;
+
+    // pipelined rendering without OpenGL context sharing
+    struct OutputRing
+    {
+        cl::CommandQueue queue;                 // readback queue, overlaps with the kernels
+        std::vector<cl::Image2D> images;
+        std::vector<cl::Buffer> pinned;         // CL_MEM_ALLOC_HOST_PTR staging buffers
+        std::vector<unsigned char *> hostPtrs;  // persistently mapped pinned buffers
+        std::vector<cl::Event> kernelEvents;
+        std::vector<cl::Event> readEvents;
+        std::vector<bool> busy;                 // in flight or not yet released
+        std::mutex mutex;                       // guards busy
+        std::condition_variable cv;
+        size_t width = 0;
+        size_t height = 0;
+        size_t next = 0;
+    } _outputRing;
+
+    // down-sampled volumes for interactive rendering
+    struct LowResVolume
+    {
+        bool enabled = false;
+        unsigned int factor = 2;
+        std::vector<cl::Image3D> volumes;       // one per timestep, built on first use
+    } _lowRes;
+
+    // compact storage of the volume images: value = stored * scale + offset
+    struct Quantization
+    {
+        storage_format requested = STORAGE_NATIVE;
+        storage_format active = STORAGE_NATIVE;
+        cl_float scale = 1.f;
+        cl_float offset = 0.f;
+        double maxError = 0.0;
+        double squaredError = 0.0;              // sum over all converted voxels
+        size_t voxels = 0;
+        size_t timesteps = 0;
+    } _quantization;
+
+    // precomputed gradients, one per volume in _volumesMem
+    struct GradientVolume
+    {
+        bool requested = false;
+        bool active = false;                    // requested and supported for the loaded data
+        bool sobel = false;                     // filter of the generated volumes
+        std::vector<cl::Image3D> volumes;
+        cl::Image3D placeholder;                // bound without gradient volume
+        cl::Kernel kernel;
+    } _gradients;
+
+    // pre-integrated transfer function, indexed by front and back density of a segment
+    struct PreIntegration
+    {
+        cl::Image2D table;
+        cl::Image2D placeholder;                // bound without pre-integration
+        cl::Kernel kernel;
+        cl_float segmentLength = 0.f;           // of the table, 0: outdated
+    } _preIntegration;
+
+    // rasterized ray intervals of the occupied bricks, see setProxyTex
+    struct Proxy
+    {
+        cl::ImageGL image;
+        cl::Image2D placeholder;                // bound without proxy geometry
+        bool active = false;
+        size_t version = 1;                     // incremented when the occupancy changes
+    } _proxy;
+
+    // per-pixel ray costs, see setDiagnostics
+    struct Diagnostics
+    {
+        cl::Image2D image;
+        cl::Image2D placeholder;                // bound while disabled
+        bool rendered = false;                  // image holds the costs of the last frame
+    } _diagnostics;
+    std::array<size_t, 2> _renderSize = {{0, 0}};
+
+    // work-group shapes per device and kernel, see setAutoTuning
+    struct AutoTuning
+    {
+        bool enabled = true;
+        WorkGroups groups;
+        std::string device;                     // device and driver part of the tuning keys
+        std::string frameKey;                   // of the applied frame shape, empty: default
+        bool volumeTuned = false;               // volume shape applied for this device
+    } _tuning;
+
+    // temporal reprojection, see setTemporalReprojection
+    struct Reprojection
+    {
+        bool enabled = false;
+        cl::Kernel kernel;
+        std::array<cl::Image2D, 2> depth;       // this frame (kernel output) and the last frame
+        cl::Image2D resolved;                   // reprojected color, becomes the accumulation
+        cl::Image2D mask;                       // valid history per pixel of the last frame
+        cl::Image2D depthPlaceholder;           // bound while disabled
+        cl::Image2D maskPlaceholder;
+        // view of the last rendered frame
+        cl_float16 historyView = {{1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1}};
+        reprojection_params params;
+    } _reprojection;
+
+    // per tile error estimates of the progressive refinement
+    struct Progressive
+    {
+        cl::Buffer inTileError;     // last frame, read by the kernel
+        cl::Buffer outTileError;    // this frame, atomic max of the pixel errors
+        cl::Buffer activeTiles;     // counter of tiles above the threshold
+        cl_uint active = 1;         // active tiles of the last frame
+    } _progressive;
+
+    // additional devices of the sort-first rendering, each renders a band of image rows
+    struct MultiDevice
+    {
+        std::vector<std::unique_ptr<VolumeRenderCL> > peers;
+        std::vector<double> shares;                     // share of the rows, this device first
+        std::vector<std::array<size_t, 2> > rows;       // bands of the current frame
+        std::vector<std::vector<unsigned char> > bands; // RGBA8 readback of the peer bands
+        std::vector<cl::Event> readEvents;
+        cl::Event bandEvent;                            // kernel of the band (on a peer)
+        std::vector<unsigned char> tff;                 // replayed on peers added later
+        std::string environment;
+        std::array<size_t, 2> outputSize = {{0, 0}};
+        multi_device_mode mode = SORT_FIRST;
+    } _multiDevice;
+
+    // timesteps held by this device in the TIMESTEP_OWNERSHIP mode: t % count == index
+    struct TimestepOwnership
+    {
+        size_t index = 0;
+        size_t count = 1;
+        std::vector<std::array<double, 256> > histograms;   // of owned timesteps not in _dr
+    } _ownership;
+
     DatRawReader _dr;
 };
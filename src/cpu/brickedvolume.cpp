@@ -0,0 +1,201 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "src/cpu/brickedvolume.h"
+
+#include <numeric>
+#include <limits>
+#include <stdexcept>
+
+/**
+ * @brief Interleave the bits of three 10 bit brick coordinates.
+ */
+static uint32_t mortonCode(const uint32_t x, const uint32_t y, const uint32_t z)
+{
+    auto spread = [](uint32_t v)
+    {
+        v &= 0x3ffu;
+        v = (v | (v << 16)) & 0x30000ffu;
+        v = (v | (v << 8)) & 0x300f00fu;
+        v = (v | (v << 4)) & 0x30c30c3u;
+        v = (v | (v << 2)) & 0x9249249u;
+        return v;
+    };
+    return spread(x) | (spread(y) << 1) | (spread(z) << 2);
+}
+
+/**
+ * @brief Read a raw voxel value and normalize it as the image formats of the kernel:
+ *        UCHAR and USHORT as normalized integers, FLOAT as is.
+ */
+static float readVoxel(const char *data, const size_t id, DatRawReader::data_format format)
+{
+    switch (format)
+    {
+    case DatRawReader::UCHAR:
+        return reinterpret_cast<const unsigned char *>(data)[id] * (1.f / 255.f);
+    case DatRawReader::USHORT:
+        return reinterpret_cast<const uint16_t *>(data)[id] * (1.f / 65535.f);
+    case DatRawReader::FLOAT:
+        return reinterpret_cast<const float *>(data)[id];
+    default:
+        return 0.f;
+    }
+}
+
+
+/**
+ * @brief BrickedVolume::build
+ * @param data
+ * @param res
+ * @param format
+ */
+void BrickedVolume::build(const char *data, const std::array<unsigned int, 3> &res,
+                          DatRawReader::data_format format)
+{
+    if (format != DatRawReader::UCHAR && format != DatRawReader::USHORT
+            && format != DatRawReader::FLOAT)
+        throw std::invalid_argument("Unsupported volume data format for the CPU renderer.");
+    if (std::max(res[0], std::max(res[1], res[2])) > (1u << 10)*BRICK_SIZE)
+        throw std::invalid_argument("Volume resolution too large for the CPU renderer.");
+
+    for (size_t i = 0; i < 3; ++i)
+    {
+        _res[i] = int(res[i]);
+        _bricks[i] = (_res[i] + BRICK_SIZE - 1) / BRICK_SIZE;
+    }
+    const size_t numBricks = size_t(_bricks[0]) * size_t(_bricks[1]) * size_t(_bricks[2]);
+    const size_t brickVoxels = size_t(BRICK_SIZE*BRICK_SIZE*BRICK_SIZE);
+
+    // sort the bricks along the Morton curve
+    std::vector<std::pair<uint32_t, size_t> > order(numBricks);
+    for (int z = 0; z < _bricks[2]; ++z)
+        for (int y = 0; y < _bricks[1]; ++y)
+            for (int x = 0; x < _bricks[0]; ++x)
+            {
+                const size_t id = size_t((z*_bricks[1] + y)*_bricks[0] + x);
+                order[id] = {mortonCode(uint32_t(x), uint32_t(y), uint32_t(z)), id};
+            }
+    std::sort(order.begin(), order.end());
+    _brickOffsets.assign(numBricks, 0);
+    for (size_t i = 0; i < numBricks; ++i)
+        _brickOffsets[order[i].second] = i * brickVoxels;
+
+    _data.assign(numBricks * brickVoxels, 0.f);
+#pragma omp parallel for schedule(dynamic)
+    for (int z = 0; z < _res[2]; ++z)
+    {
+        for (int y = 0; y < _res[1]; ++y)
+        {
+            const size_t line = (size_t(z)*size_t(_res[1]) + size_t(y)) * size_t(_res[0]);
+            for (int x = 0; x < _res[0]; ++x)
+            {
+                const size_t brick = size_t(((z >> BRICK_BITS)*_bricks[1] + (y >> BRICK_BITS))
+                                            *_bricks[0] + (x >> BRICK_BITS));
+                const size_t local = size_t((((z & (BRICK_SIZE - 1)) << BRICK_BITS)
+                                            | (y & (BRICK_SIZE - 1))) << BRICK_BITS)
+                                     | size_t(x & (BRICK_SIZE - 1));
+                _data[_brickOffsets[brick] + local] = readVoxel(data, line + size_t(x), format);
+            }
+        }
+    }
+
+    // min/max per brick, including the one voxel apron read by trilinear interpolation
+    _minMax.assign(numBricks, {{0.f, 0.f}});
+#pragma omp parallel for schedule(dynamic)
+    for (int b = 0; b < int(numBricks); ++b)
+    {
+        const int bx = b % _bricks[0];
+        const int by = (b / _bricks[0]) % _bricks[1];
+        const int bz = b / (_bricks[0]*_bricks[1]);
+        float lo = std::numeric_limits<float>::max();
+        float hi = std::numeric_limits<float>::lowest();
+        for (int z = bz*BRICK_SIZE - 1; z <= (bz + 1)*BRICK_SIZE; ++z)
+            for (int y = by*BRICK_SIZE - 1; y <= (by + 1)*BRICK_SIZE; ++y)
+                for (int x = bx*BRICK_SIZE - 1; x <= (bx + 1)*BRICK_SIZE; ++x)
+                {
+                    const int cx = clampX(x);
+                    const int cy = clampY(y);
+                    const int cz = clampZ(z);
+                    const size_t brick = size_t(((cz >> BRICK_BITS)*_bricks[1]
+                                                 + (cy >> BRICK_BITS))*_bricks[0]
+                                                + (cx >> BRICK_BITS));
+                    const size_t local = size_t((((cz & (BRICK_SIZE - 1)) << BRICK_BITS)
+                                                | (cy & (BRICK_SIZE - 1))) << BRICK_BITS)
+                                         | size_t(cx & (BRICK_SIZE - 1));
+                    const float v = _data[_brickOffsets[brick] + local];
+                    lo = std::min(lo, v);
+                    hi = std::max(hi, v);
+                }
+        _minMax[size_t(b)] = {{lo, hi}};
+    }
+    _emptyBricks.assign(numBricks, 0);
+}
+
+
+/**
+ * @brief BrickedVolume::updateEmptyBricks
+ * @param tff
+ */
+void BrickedVolume::updateEmptyBricks(const std::vector<unsigned char> &tff)
+{
+    const int tffSize = int(tff.size() / 4);
+    if (tffSize == 0)
+    {
+        _emptyBricks.assign(_minMax.size(), 0);
+        return;
+    }
+    std::vector<unsigned int> prefixSum(static_cast<size_t>(tffSize));
+    for (size_t i = 0; i < prefixSum.size(); ++i)
+        prefixSum[i] = tff[i*4 + 3];
+    std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
+
+    _emptyBricks.resize(_minMax.size());
+#pragma omp parallel for
+    for (int b = 0; b < int(_minMax.size()); ++b)
+    {
+        // transfer function texels touched by linear filtering of the density range
+        const float lo = std::min(std::max(_minMax[size_t(b)][0], 0.f), 1.f) * tffSize - 0.5f;
+        const float hi = std::min(std::max(_minMax[size_t(b)][1], 0.f), 1.f) * tffSize - 0.5f;
+        const int first = std::min(std::max(int(std::floor(lo)), 0), tffSize - 1);
+        const int last = std::min(std::max(int(std::floor(hi)) + 1, 0), tffSize - 1);
+        const unsigned int before = first > 0 ? prefixSum[size_t(first - 1)] : 0u;
+        _emptyBricks[size_t(b)] = prefixSum[size_t(last)] == before ? 1 : 0;
+    }
+}
+
+
+/**
+ * @brief BrickedVolume::sampler
+ * @return
+ */
+BrickedVolume::Sampler BrickedVolume::sampler() const
+{
+    Sampler s;
+    s.data = _data.data();
+    s.brickOffsets = _brickOffsets.data();
+    s.emptyBricks = _emptyBricks.data();
+    s.res = _res;
+    s.bricks = _bricks;
+    return s;
+}
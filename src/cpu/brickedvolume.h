@@ -0,0 +1,192 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+#include "src/io/datrawreader.h"
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <cmath>
+
+// the accessors of the sampler must be inlined into the lane loops to vectorize
+#if defined(_MSC_VER)
+#define LANE_INLINE __forceinline
+#elif defined(__GNUC__)
+#define LANE_INLINE inline __attribute__((always_inline))
+#else
+#define LANE_INLINE inline
+#endif
+
+/**
+ * @brief Scalar volume in a cache friendly bricked layout for the CPU renderer.
+ *
+ * The volume is split into bricks of 8^3 voxels. Voxels are stored contiguously per brick
+ * and the bricks are ordered along a Morton (Z-order) curve, so neighboring samples of a ray
+ * packet share cache lines and pages. Values are stored as normalized floats, as read by the
+ * samplers of the OpenCL kernel, so that the lanes of a ray packet can gather them directly.
+ */
+class BrickedVolume
+{
+public:
+    static const int BRICK_BITS = 3;
+    static const int BRICK_SIZE = 1 << BRICK_BITS;
+
+    /**
+     * @brief Read-only view of the volume for the ray packets. It only holds pointers and
+     *        values and its accessors are branch free, so they vectorize when they are called
+     *        from the lane loops of the renderer. Coordinates are not checked.
+     */
+    struct Sampler
+    {
+        const float *data = nullptr;
+        const size_t *brickOffsets = nullptr;     // linear brick index to Morton order
+        const uint32_t *emptyBricks = nullptr;
+        std::array<int, 3> res = {{0, 0, 0}};
+        std::array<int, 3> bricks = {{0, 0, 0}};
+
+        /**
+         * @brief Round towards negative infinity, std::floor does not vectorize.
+         */
+        static LANE_INLINE int floorInt(const float v)
+        {
+            const int i = int(v);
+            return i - int(float(i) > v);
+        }
+
+        LANE_INLINE int clampAxis(const int v, const size_t axis) const
+        {
+            return std::min(std::max(v, 0), res[axis] - 1);
+        }
+
+        /**
+         * @brief Get a voxel value, the coordinates must be inside the volume.
+         */
+        LANE_INLINE float voxel(const int x, const int y, const int z) const
+        {
+            const size_t brick = size_t((z >> BRICK_BITS)*bricks[1] + (y >> BRICK_BITS))
+                                 *size_t(bricks[0]) + size_t(x >> BRICK_BITS);
+            const size_t local = size_t((((z & (BRICK_SIZE - 1)) << BRICK_BITS)
+                                        | (y & (BRICK_SIZE - 1))) << BRICK_BITS)
+                                 | size_t(x & (BRICK_SIZE - 1));
+            return data[brickOffsets[brick] + local];
+        }
+
+        /**
+         * @brief Sample at a normalized position with trilinear interpolation, clamped to
+         *        the edge (the linear sampler of the OpenCL kernel).
+         */
+        LANE_INLINE float linear(const float px, const float py, const float pz) const
+        {
+            const float u = px*res[0] - 0.5f;
+            const float v = py*res[1] - 0.5f;
+            const float w = pz*res[2] - 0.5f;
+            const int iu = floorInt(u);
+            const int iv = floorInt(v);
+            const int iw = floorInt(w);
+            const float a = u - float(iu);
+            const float b = v - float(iv);
+            const float c = w - float(iw);
+            const int x0 = clampAxis(iu, 0);
+            const int y0 = clampAxis(iv, 1);
+            const int z0 = clampAxis(iw, 2);
+            const int x1 = clampAxis(iu + 1, 0);
+            const int y1 = clampAxis(iv + 1, 1);
+            const int z1 = clampAxis(iw + 1, 2);
+
+            const float c00 = voxel(x0, y0, z0)*(1.f - a) + voxel(x1, y0, z0)*a;
+            const float c10 = voxel(x0, y1, z0)*(1.f - a) + voxel(x1, y1, z0)*a;
+            const float c01 = voxel(x0, y0, z1)*(1.f - a) + voxel(x1, y0, z1)*a;
+            const float c11 = voxel(x0, y1, z1)*(1.f - a) + voxel(x1, y1, z1)*a;
+            const float c0 = c00*(1.f - b) + c10*b;
+            const float c1 = c01*(1.f - b) + c11*b;
+            return c0*(1.f - c) + c1*c;
+        }
+
+        /**
+         * @brief Sample at a normalized position with nearest neighbor lookup, zero outside
+         *        the volume (the nearest sampler of the OpenCL kernel).
+         */
+        LANE_INLINE float nearest(const float px, const float py, const float pz) const
+        {
+            const int x = floorInt(px*res[0]);
+            const int y = floorInt(py*res[1]);
+            const int z = floorInt(pz*res[2]);
+            const bool inside = x >= 0 && y >= 0 && z >= 0
+                                && x < res[0] && y < res[1] && z < res[2];
+            const float v = voxel(clampAxis(x, 0), clampAxis(y, 1), clampAxis(z, 2));
+            return inside ? v : 0.f;
+        }
+
+        /**
+         * @brief Check whether the brick at a normalized position can be skipped.
+         */
+        LANE_INLINE bool empty(const float px, const float py, const float pz) const
+        {
+            const int bx = clampAxis(floorInt(px*res[0]), 0) >> BRICK_BITS;
+            const int by = clampAxis(floorInt(py*res[1]), 1) >> BRICK_BITS;
+            const int bz = clampAxis(floorInt(pz*res[2]), 2) >> BRICK_BITS;
+            return emptyBricks[size_t((bz*bricks[1] + by)*bricks[0] + bx)] != 0;
+        }
+    };
+
+    /**
+     * @brief Convert the raw data of one timestep into the bricked layout.
+     * @param data Raw voxel data in linear (x fastest) order.
+     * @param res Volume resolution.
+     * @param format Data format of the raw data, double is not supported.
+     * @throws If the format is not supported.
+     */
+    void build(const char *data, const std::array<unsigned int, 3> &res,
+               DatRawReader::data_format format);
+
+    /**
+     * @brief Mark the bricks that only contain values mapped to zero opacity by the transfer
+     *        function, including the neighboring voxels used for interpolation.
+     * @param tff RGBA8 transfer function.
+     */
+    void updateEmptyBricks(const std::vector<unsigned char> &tff);
+
+    bool empty() const { return _data.empty(); }
+    const std::array<int, 3> &resolution() const { return _res; }
+    const std::array<int, 3> &bricks() const { return _bricks; }
+
+    /**
+     * @brief Get the sampler of the volume, valid until the volume or the empty bricks change.
+     */
+    Sampler sampler() const;
+
+private:
+    inline int clampX(const int x) const { return std::min(std::max(x, 0), _res[0] - 1); }
+    inline int clampY(const int y) const { return std::min(std::max(y, 0), _res[1] - 1); }
+    inline int clampZ(const int z) const { return std::min(std::max(z, 0), _res[2] - 1); }
+
+    std::array<int, 3> _res = {{0, 0, 0}};
+    std::array<int, 3> _bricks = {{0, 0, 0}};
+    std::vector<float> _data;
+    std::vector<size_t> _brickOffsets;                  // linear brick index to Morton order
+    std::vector<std::array<float, 2> > _minMax;         // including the interpolation apron
+    std::vector<uint32_t> _emptyBricks;
+};
@@ -0,0 +1,185 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "src/cpu/tilepool.h"
+
+#include <algorithm>
+
+static uint64_t packRange(const uint32_t begin, const uint32_t end)
+{
+    return uint64_t(begin) | (uint64_t(end) << 32);
+}
+
+
+/**
+ * @brief TilePool::TilePool
+ * @param threads
+ */
+TilePool::TilePool(size_t threads)
+{
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    _ranges.reset(new Range[threads]);
+    for (size_t i = 0; i < threads; ++i)
+        _workers.push_back(std::thread(&TilePool::work, this, i));
+}
+
+
+/**
+ * @brief TilePool::~TilePool
+ */
+TilePool::~TilePool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _cvStart.notify_all();
+    for (auto &w : _workers)
+        w.join();
+}
+
+
+/**
+ * @brief TilePool::run
+ * @param tiles
+ * @param fn
+ */
+void TilePool::run(size_t tiles, const std::function<void(size_t, size_t)> &fn)
+{
+    if (tiles == 0)
+        return;
+    const size_t n = _workers.size();
+    std::unique_lock<std::mutex> lock(_mutex);
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint32_t begin = uint32_t(tiles * i / n);
+        const uint32_t end = uint32_t(tiles * (i + 1) / n);
+        _ranges[i].range.store(packRange(begin, end), std::memory_order_relaxed);
+    }
+    _fn = &fn;
+    _error = nullptr;
+    _running = n;
+    ++_generation;
+    _cvStart.notify_all();
+    _cvDone.wait(lock, [&]{ return _running == 0; });
+    _fn = nullptr;
+    if (_error)
+        std::rethrow_exception(_error);
+}
+
+
+/**
+ * @brief TilePool::pop Take the next tile from the front of the own range.
+ */
+bool TilePool::pop(size_t worker, uint32_t &tile)
+{
+    std::atomic<uint64_t> &r = _ranges[worker].range;
+    uint64_t cur = r.load(std::memory_order_acquire);
+    while (true)
+    {
+        const uint32_t begin = uint32_t(cur);
+        const uint32_t end = uint32_t(cur >> 32);
+        if (begin >= end)
+            return false;
+        if (r.compare_exchange_weak(cur, packRange(begin + 1, end), std::memory_order_acq_rel))
+        {
+            tile = begin;
+            return true;
+        }
+    }
+}
+
+
+/**
+ * @brief TilePool::steal Take the upper half of the range of another worker.
+ */
+bool TilePool::steal(size_t worker, uint32_t &tile)
+{
+    const size_t n = _workers.size();
+    for (size_t i = 1; i < n; ++i)
+    {
+        std::atomic<uint64_t> &victim = _ranges[(worker + i) % n].range;
+        uint64_t cur = victim.load(std::memory_order_acquire);
+        while (true)
+        {
+            const uint32_t begin = uint32_t(cur);
+            const uint32_t end = uint32_t(cur >> 32);
+            if (begin >= end)
+                break;
+            const uint32_t mid = begin + (end - begin) / 2;
+            if (victim.compare_exchange_weak(cur, packRange(begin, mid),
+                                             std::memory_order_acq_rel))
+            {
+                // the own range is empty, nobody else modifies it
+                _ranges[worker].range.store(packRange(mid + 1, end), std::memory_order_release);
+                tile = mid;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+
+/**
+ * @brief TilePool::work
+ * @param worker
+ */
+void TilePool::work(size_t worker)
+{
+    size_t generation = 0;
+    while (true)
+    {
+        const std::function<void(size_t, size_t)> *fn = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cvStart.wait(lock, [&]{ return _stop || _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+            fn = _fn;
+        }
+
+        uint32_t tile = 0;
+        while (pop(worker, tile) || steal(worker, tile))
+        {
+            try
+            {
+                (*fn)(tile, worker);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                if (!_error)
+                    _error = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_running;
+        }
+        _cvDone.notify_one();
+    }
+}
@@ -0,0 +1,91 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+/**
+ * @brief Persistent thread pool that processes image tiles with work stealing.
+ *
+ * Each worker starts with a contiguous range of tiles, so neighboring tiles (and the volume
+ * bricks they touch) stay on the same core. A worker that runs out of tiles steals the upper
+ * half of the remaining range of another worker. Ranges are packed into a single atomic
+ * word (begin in the lower, end in the upper 32 bits) and updated lock-free.
+ */
+class TilePool
+{
+public:
+    /**
+     * @brief Start the worker threads.
+     * @param threads Number of worker threads, 0: one per hardware thread.
+     */
+    explicit TilePool(size_t threads = 0);
+
+    /**
+     * @brief Stop the worker threads.
+     */
+    ~TilePool();
+
+    TilePool(const TilePool &) = delete;
+    TilePool &operator=(const TilePool &) = delete;
+
+    /**
+     * @brief Process all tiles and wait until they are done. The first exception thrown
+     *        by a tile is rethrown.
+     * @param tiles Number of tiles.
+     * @param fn Called for each tile with the tile index and the worker index.
+     */
+    void run(size_t tiles, const std::function<void(size_t tile, size_t worker)> &fn);
+
+    size_t threads() const { return _workers.size(); }
+
+private:
+    void work(size_t worker);
+    bool pop(size_t worker, uint32_t &tile);
+    bool steal(size_t worker, uint32_t &tile);
+
+    // own cache line per range to avoid false sharing
+    struct alignas(64) Range
+    {
+        std::atomic<uint64_t> range{0};
+    };
+
+    std::vector<std::thread> _workers;
+    std::unique_ptr<Range[]> _ranges;
+    const std::function<void(size_t, size_t)> *_fn = nullptr;
+    std::exception_ptr _error;
+    std::mutex _mutex;
+    std::condition_variable _cvStart;
+    std::condition_variable _cvDone;
+    size_t _generation = 0;
+    size_t _running = 0;
+    bool _stop = false;
+};
@@ -0,0 +1,1066 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#include "src/cpu/volumerendercpu.h"
+
+#include <iostream>
+#include <chrono>
+#include <cmath>
+#include <climits>
+#include <cfloat>
+#include <cstring>
+
+static const float ERT_THRESHOLD = 0.98f;
+static const int AO_RAYS = 16;
+
+namespace
+{
+struct float3
+{
+    float x, y, z;
+};
+LANE_INLINE float3 operator+(const float3 a, const float3 b)
+{ return {a.x + b.x, a.y + b.y, a.z + b.z}; }
+LANE_INLINE float3 operator-(const float3 a, const float3 b)
+{ return {a.x - b.x, a.y - b.y, a.z - b.z}; }
+LANE_INLINE float3 operator*(const float3 a, const float3 b)
+{ return {a.x * b.x, a.y * b.y, a.z * b.z}; }
+LANE_INLINE float3 operator*(const float3 a, const float s) { return {a.x * s, a.y * s, a.z * s}; }
+LANE_INLINE float dot(const float3 a, const float3 b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+LANE_INLINE float length(const float3 a) { return std::sqrt(dot(a, a)); }
+LANE_INLINE float3 normalize(const float3 a) { return a * (1.f / length(a)); }
+
+struct float4
+{
+    float x, y, z, w;
+};
+
+// bit casts as in the kernel, memcpy keeps the lane loops from vectorizing
+#if defined(__has_builtin)
+#if __has_builtin(__builtin_bit_cast)
+#define HAS_BUILTIN_BIT_CAST
+#endif
+#endif
+LANE_INLINE unsigned int asUint(const float v)
+{
+#ifdef HAS_BUILTIN_BIT_CAST
+    return __builtin_bit_cast(unsigned int, v);
+#else
+    unsigned int u;
+    std::memcpy(&u, &v, sizeof(u));
+    return u;
+#endif
+}
+LANE_INLINE float asFloat(const unsigned int u)
+{
+#ifdef HAS_BUILTIN_BIT_CAST
+    return __builtin_bit_cast(float, u);
+#else
+    float v;
+    std::memcpy(&v, &u, sizeof(v));
+    return v;
+#endif
+}
+
+LANE_INLINE int ceilInt(const float v) { return -BrickedVolume::Sampler::floorInt(-v); }
+
+// by value: std::min/max bind the bounds by reference, lane private temporaries do not vectorize
+LANE_INLINE float minSel(const float a, const float b) { return b < a ? b : a; }
+LANE_INLINE float maxSel(const float a, const float b) { return a < b ? b : a; }
+
+/**
+ * @brief x^y for x >= 0 as exp2(y*log2(x)), branch free in contrast to std::pow. The relative
+ *        error is below 1e-6, native_powr of the kernel is not exact either.
+ */
+LANE_INLINE float powr(const float x, const float y)
+{
+    // x = m*2^e with m in [sqrt(0.5), sqrt(2)), ln(m) = 2*atanh(s) with s = (m - 1)/(m + 1)
+    const unsigned int bits = asUint(std::max(x, FLT_MIN));
+    const unsigned int adjust = (bits & 0x7fffffu) > 0x3504f3u ? 1u : 0u;
+    const float e = float(int(bits >> 23) - 127 + int(adjust));
+    const float m = asFloat((bits & 0x7fffffu) | ((127u - adjust) << 23));
+    const float s = (m - 1.f) / (m + 1.f);
+    const float s2 = s*s;
+    const float lnM = 2.f*s*(1.f + s2*(1.f/3.f + s2*(1.f/5.f + s2*(1.f/7.f + s2*(1.f/9.f)))));
+    const float z = std::min(std::max(y*(e + lnM*1.44269504f), -126.f), 126.f);
+
+    // 2^z = 2^n * e^(f*ln(2)) with f in [-0.5, 0.5]
+    const int n = BrickedVolume::Sampler::floorInt(z + 0.5f);
+    const float f = (z - float(n)) * 0.693147181f;
+    const float p = 1.f + f*(1.f + f*(0.5f + f*(1.f/6.f + f*(1.f/24.f + f*(1.f/120.f
+                                                                        + f*(1.f/720.f))))));
+    const float result = p * asFloat(unsigned(n + 127) << 23);
+    return x > 0.f ? result : 0.f;
+}
+
+// random number generator of the kernel (random.cl)
+LANE_INLINE unsigned int parallelRNG(unsigned int value)
+{
+    value = (value ^ 61u) ^ (value >> 16);
+    value *= 9u;
+    value ^= value << 4;
+    value *= 0x27d4eb2du;
+    value ^= value >> 15;
+    return value;
+}
+LANE_INLINE unsigned int parallelRNG3(const unsigned int x, const unsigned int y,
+                                      const unsigned int z)
+{
+    unsigned int value = parallelRNG(x);
+    value = parallelRNG(y ^ value);
+    value = parallelRNG(z ^ value);
+    return value;
+}
+
+// hybrid Tausworthe generator of the kernel (hybridui_rand)
+inline unsigned int tausStep(unsigned int &z, const int s1, const int s2, const int s3,
+                             const unsigned int m)
+{
+    const unsigned int b = ((z << s1) ^ z) >> s2;
+    z = ((z & m) << s3) ^ b;
+    return z;
+}
+inline float hybridTaus(std::array<unsigned int, 4> &state)
+{
+    const unsigned int lcg = state[3];
+    state[3] = 1664525u*state[3] + 1013904223u;
+    return 2.3283064365387e-10f * float(tausStep(state[0], 13, 19, 12, 4294967294u)
+                                        ^ tausStep(state[1], 2, 25, 4, 4294967288u)
+                                        ^ tausStep(state[2], 3, 11, 17, 4294967280u) ^ lcg);
+}
+
+// transfer function lookup in RGBA float texels, linear filtering clamped to the edge
+LANE_INLINE float4 sampleTff(const float *tff, const int n, const float density)
+{
+    const float u = std::min(std::max(-1.f, density*n - 0.5f), float(n));
+    const int iu = BrickedVolume::Sampler::floorInt(u);
+    const float a = u - float(iu);
+    // indices instead of texel pointers: gathers need an invariant base
+    const int i0 = 4*std::min(std::max(iu, 0), n - 1);
+    const int i1 = 4*std::min(std::max(iu + 1, 0), n - 1);
+    return {tff[i0]*(1.f - a) + tff[i1]*a, tff[i0 + 1]*(1.f - a) + tff[i1 + 1]*a,
+            tff[i0 + 2]*(1.f - a) + tff[i1 + 2]*a, tff[i0 + 3]*(1.f - a) + tff[i1 + 3]*a};
+}
+
+// normalized gradient and its magnitude, see gradientCentralDiff
+LANE_INLINE float4 normalAndLength(const float3 d)
+{
+    const float len = length(d);
+    const float inv = 1.f / std::max(len, FLT_MIN);
+    return {len > 0.f ? d.x*inv : 0.57735f, len > 0.f ? d.y*inv : 0.57735f,
+            len > 0.f ? d.z*inv : 0.57735f, len};
+}
+
+// central differences of the volume, see gradientCentralDiff
+LANE_INLINE float4 gradientCentralDiff(const BrickedVolume::Sampler &vol, const float3 pos)
+{
+    const float3 o = {1.f / vol.res[0], 1.f / vol.res[1], 1.f / vol.res[2]};
+    const float3 s1 = {vol.linear(pos.x - o.x, pos.y, pos.z), vol.linear(pos.x, pos.y - o.y, pos.z),
+                       vol.linear(pos.x, pos.y, pos.z - o.z)};
+    const float3 s2 = {vol.linear(pos.x + o.x, pos.y, pos.z), vol.linear(pos.x, pos.y + o.y, pos.z),
+                       vol.linear(pos.x, pos.y, pos.z + o.z)};
+    return normalAndLength(s2 - s1);
+}
+
+// ray parameter (without offset) where the ray leaves the brick around p along one axis
+LANE_INLINE float brickExit(const BrickedVolume::Sampler &vol, const size_t axis, const float p,
+                            const float o, const float d)
+{
+    const int bits = BrickedVolume::BRICK_BITS;
+    const int lo = (vol.clampAxis(int(p*vol.res[axis]), axis) >> bits) << bits;
+    const int hi = std::min(lo + BrickedVolume::BRICK_SIZE, vol.res[axis]);
+    // arithmetic selects, branches around conversions and divisions prevent if-conversion
+    const float w = float(lo + int(d > 0.f)*(hi - lo)) / vol.res[axis] * 2.f - 1.f;
+    const bool parallel = d == 0.f;
+    return (w - o) / (parallel ? 1.f : d) + float(int(parallel)) * FLT_MAX;
+}
+
+// opacity of the linearly interpolated sample
+LANE_INLINE float opacity(const BrickedVolume::Sampler &vol, const float *tff, const int n,
+                          const float3 pos)
+{
+    return sampleTff(tff, n, vol.linear(pos.x, pos.y, pos.z)).w;
+}
+
+// central differences of the opacity, see gradientCentralDiffTff
+LANE_INLINE float4 gradientCentralDiffTff(const BrickedVolume::Sampler &vol, const float *tff,
+                                     const int n, const float3 pos)
+{
+    const float3 o = {1.f / vol.res[0], 1.f / vol.res[1], 1.f / vol.res[2]};
+    const float3 s1 = {opacity(vol, tff, n, {pos.x - o.x, pos.y, pos.z}),
+                       opacity(vol, tff, n, {pos.x, pos.y - o.y, pos.z}),
+                       opacity(vol, tff, n, {pos.x, pos.y, pos.z - o.z})};
+    const float3 s2 = {opacity(vol, tff, n, {pos.x + o.x, pos.y, pos.z}),
+                       opacity(vol, tff, n, {pos.x, pos.y + o.y, pos.z}),
+                       opacity(vol, tff, n, {pos.x, pos.y, pos.z + o.z})};
+    return normalAndLength(s2 - s1);
+}
+
+// one x row of the separable Sobel filter at offset (j, k), accumulated into the gradient
+LANE_INLINE float3 sobelRow(const BrickedVolume::Sampler &vol, const float3 pos, const float3 o,
+                            const int j, const int k)
+{
+    const float y = pos.y + o.y*j;
+    const float z = pos.z + o.z*k;
+    const float v0 = vol.linear(pos.x - o.x, y, z);
+    const float v1 = vol.linear(pos.x, y, z);
+    const float v2 = vol.linear(pos.x + o.x, y, z);
+    const float sj = float(2 - j*j);
+    const float sk = float(2 - k*k);
+    // smoothing (1,2,1) and derivative (-1,0,1) along x
+    return {(v2 - v0)*sj*sk, (v0 + 2.f*v1 + v2)*j*sk, (v0 + 2.f*v1 + v2)*sj*k};
+}
+
+// separable Sobel filter (1,2,1) x (-1,0,1), same weights as gradientSobel, written out
+// without loops: a loop nest inside the lane loop does not vectorize
+LANE_INLINE float4 gradientSobel(const BrickedVolume::Sampler &vol, const float3 pos)
+{
+    const float3 o = {1.f / vol.res[0], 1.f / vol.res[1], 1.f / vol.res[2]};
+    const float3 g = sobelRow(vol, pos, o, -1, -1) + sobelRow(vol, pos, o, 0, -1)
+                     + sobelRow(vol, pos, o, 1, -1) + sobelRow(vol, pos, o, -1, 0)
+                     + sobelRow(vol, pos, o, 0, 0) + sobelRow(vol, pos, o, 1, 0)
+                     + sobelRow(vol, pos, o, -1, 1) + sobelRow(vol, pos, o, 0, 1)
+                     + sobelRow(vol, pos, o, 1, 1);
+    return normalAndLength(g * (1.f / 27.f));
+}
+
+// blinn phong illumination, see illumination (the light is at the camera)
+LANE_INLINE float3 illumination(const float3 color, const float3 toLightDir, const float3 n)
+{
+    const float3 l = normalize(toLightDir);
+    const float3 amb = color * 0.15f;
+    const float3 diff = color * (std::max(0.f, dot(n, l)) * 0.7f);
+    const float3 h = toLightDir + l;
+    const float hh = dot(h, h);
+    const float cosH = dot(n, h) * (1.f / std::sqrt(std::max(hh, 1.e-6f)));
+    const float spec = hh >= 1.e-6f ? powr(std::max(cosH, 0.f), 40.f) * 0.15f : 0.f;
+    return amb + diff + float3{spec, spec, spec};
+}
+
+LANE_INLINE float3 celShading(const float3 color, const float3 toLightDir, const float3 n)
+{
+    const float intensity = std::max(0.f, dot(n, normalize(toLightDir)));
+    const float scale = intensity > 0.95f ? 1.f : intensity > 0.5f ? 0.6f
+                                                : intensity > 0.25f ? 0.4f : 0.2f;
+    return color*scale;
+}
+
+// object space ambient occlusion with monte carlo sampling of the hemisphere, see calcAO
+inline float ambientOcclusion(const BrickedVolume::Sampler &vol, const float *tff, const int n,
+                              const float3 normal, const float3 pos, const float stepSize,
+                              const float radius, std::array<unsigned int, 4> &rng)
+{
+    float ao = 0.f;
+    for (int i = 0; i < AO_RAYS; ++i)
+    {
+        const float z = hybridTaus(rng) * 2.f - 1.f;
+        const float phi = hybridTaus(rng) * 2.f * 3.14159265f;
+        const float r = std::sqrt(1.f - z*z);
+        float3 dir = {r * std::sin(phi), r * std::cos(phi), z};
+        if (dot(normal, dir) < 0.f)
+            dir = dir * -1.f;
+        float sample = 0.f;
+        int cnt = 0;
+        while (cnt*stepSize < radius)
+        {
+            ++cnt;
+            const float3 p = pos + dir*(cnt*stepSize);
+            sample += sampleTff(tff, n, vol.linear(p.x, p.y, p.z)).w;
+            if (sample > 0.98f)
+                break;
+        }
+        ao += sample / float(cnt);
+    }
+    return ao / float(AO_RAYS);
+}
+
+inline unsigned char toUnorm8(const float v)
+{
+    return static_cast<unsigned char>(std::lrint(std::min(std::max(v, 0.f), 1.f) * 255.f));
+}
+} // namespace
+
+
+/**
+ * @brief VolumeRenderCPU::VolumeRenderCPU
+ */
+VolumeRenderCPU::VolumeRenderCPU()
+{
+}
+
+
+/**
+ * @brief VolumeRenderCPU::~VolumeRenderCPU
+ */
+VolumeRenderCPU::~VolumeRenderCPU()
+{
+}
+
+
+/**
+ * @brief VolumeRenderCPU::initialize
+ * @param threads
+ */
+void VolumeRenderCPU::initialize(size_t threads)
+{
+    _pool.reset(new TilePool(threads));
+}
+
+
+/**
+ * @brief VolumeRenderCPU::loadVolumeData
+ * @param volumeFileProps
+ * @return
+ */
+size_t VolumeRenderCPU::loadVolumeData(const DatRawReader::Properties volumeFileProps)
+{
+    std::cout << "Loading volume data defined in " << volumeFileProps.dat_file_name << std::endl;
+    _volumes.clear();
+    try
+    {
+        // the raw data is released after the conversion into the bricked layout
+        DatRawReader dr;
+        dr.read_files(volumeFileProps);
+        _props = dr.properties();
+        std::cout << _props.to_string() << std::endl;
+        const auto co = _props.image_channel_order;
+        if (!(co == "R" || co == "" || co == "I" || co == "LUMINANCE"))
+            throw std::invalid_argument("The CPU renderer only supports single channel volumes.");
+
+        const std::array<unsigned int, 3> res = {{_props.volume_res[0], _props.volume_res[1],
+                                                  _props.volume_res[2]}};
+        _volumes.resize(dr.num_timesteps());
+        for (size_t t = 0; t < dr.num_timesteps(); ++t)
+        {
+            if (size_t(res[0])*res[1]*res[2] > dr.data_size(t))
+                throw std::runtime_error("Volume size does not match size specified in dat file.");
+            _volumes.at(t).build(dr.data(t), res, _props.format);
+        }
+    }
+    catch (std::invalid_argument e)
+    {
+        _volumes.clear();
+        throw std::runtime_error(e.what());
+    }
+    catch (...)
+    {
+        _volumes.clear();
+        throw;
+    }
+    calcScaling();
+    _timestep = 0;
+
+    // initially, a linear ramp transfer function
+    std::vector<unsigned char> tff(1024*4, 0);
+    for (size_t i = 0; i < 1024; ++i)
+        tff.at(i*4 + 3) = static_cast<unsigned char>(i / 4);
+    setTransferFunction(tff);
+    return _volumes.size();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::hasData
+ * @return
+ */
+bool VolumeRenderCPU::hasData() const
+{
+    return !_volumes.empty();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::getResolution
+ * @return
+ */
+const std::array<unsigned int, 4> VolumeRenderCPU::getResolution() const
+{
+    if (!hasData())
+        return std::array<unsigned int, 4> {{0, 0, 0, 1}};
+    return _props.volume_res;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::calcScaling Same as VolumeRenderCL::calcScaling.
+ */
+void VolumeRenderCPU::calcScaling()
+{
+    std::array<float, 3> scale;
+    for (size_t i = 0; i < 3; ++i)
+        scale[i] = static_cast<float>(_props.volume_res.at(i))
+                   * static_cast<float>(_props.slice_thickness.at(i)
+                                        / _props.slice_thickness.at(0));
+    const float maxScale = std::max(scale[0], std::max(scale[1], scale[2]));
+    for (size_t i = 0; i < 3; ++i)
+        _modelScale[i] = maxScale / scale[i];
+    _rendering_params.modelScale = {{_modelScale[0], _modelScale[1], _modelScale[2]}};
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setTransferFunction
+ * @param tff
+ */
+void VolumeRenderCPU::setTransferFunction(std::vector<unsigned char> &tff)
+{
+    if (tff.size() < 4)
+        return;
+    _tff = tff;
+    // float texels, the lanes of a ray packet gather them
+    _tffFloat.resize(_tff.size());
+    for (size_t i = 0; i < _tff.size(); ++i)
+        _tffFloat[i] = _tff[i] * (1.f / 255.f);
+    for (auto &v : _volumes)
+        v.updateEmptyBricks(_tff);
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setTffPrefixSum
+ */
+void VolumeRenderCPU::setTffPrefixSum(std::vector<unsigned int> &)
+{
+}
+
+
+/**
+ * @brief VolumeRenderCPU::updateView
+ * @param viewMat
+ */
+void VolumeRenderCPU::updateView(const std::array<float, 16> viewMat)
+{
+    for (size_t i = 0; i < 16; ++i)
+        _camera_params.viewMat.s[i] = viewMat[i];
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::updateSamplingRate
+ * @param samplingRate
+ */
+void VolumeRenderCPU::updateSamplingRate(const double samplingRate)
+{
+    _raycast_params.samplingRate = static_cast<cl_float>(samplingRate);
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setCamOrtho
+ * @param setCamOrtho
+ */
+void VolumeRenderCPU::setCamOrtho(bool setCamOrtho)
+{
+    _camera_params.ortho = setCamOrtho;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setIllumination
+ * @param illum
+ */
+void VolumeRenderCPU::setIllumination(unsigned int illum)
+{
+    _rendering_params.illumType = static_cast<cl_uint>(illum);
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setAmbientOcclusion
+ * @param ao
+ */
+void VolumeRenderCPU::setAmbientOcclusion(bool ao)
+{
+    _raycast_params.useAO = ao;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setLinearInterpolation
+ * @param linearSampling
+ */
+void VolumeRenderCPU::setLinearInterpolation(bool linearSampling)
+{
+    _rendering_params.useLinear = linearSampling;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setContours
+ * @param contours
+ */
+void VolumeRenderCPU::setContours(bool contours)
+{
+    _raycast_params.contours = contours;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setAerial
+ * @param aerial
+ */
+void VolumeRenderCPU::setAerial(bool aerial)
+{
+    _raycast_params.aerial = aerial;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setObjEss
+ * @param useEss
+ */
+void VolumeRenderCPU::setObjEss(bool useEss)
+{
+    _useObjEss = useEss;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setBackground
+ * @param color
+ */
+void VolumeRenderCPU::setBackground(std::array<float, 4> color)
+{
+    cl_float3 bgColor = {{color[0], color[1], color[2]}};
+    _rendering_params.backgroundColor = bgColor;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setUseGradient
+ * @param useGradient
+ */
+void VolumeRenderCPU::setUseGradient(bool useGradient)
+{
+    _rendering_params.useGradient = useGradient;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setTechnique
+ * @param tech
+ */
+void VolumeRenderCPU::setTechnique(VolumeRenderCL::technique tech)
+{
+    if (tech != VolumeRenderCL::TECH_RAYCAST)
+        throw std::invalid_argument("The CPU renderer only supports ray casting.");
+    _rendering_params.technique = VolumeRenderCL::TECH_RAYCAST;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setBBox
+ */
+void VolumeRenderCPU::setBBox(float bl_x, float bl_y, float bl_z,
+                              float tr_x, float tr_y, float tr_z)
+{
+    _camera_params.bbox_bl = {{bl_x, bl_y, bl_z}};
+    _camera_params.bbox_tr = {{tr_x, tr_y, tr_z}};
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::setTimestep
+ * @param t
+ */
+void VolumeRenderCPU::setTimestep(const size_t t)
+{
+    if (t >= _volumes.size())
+        return;
+    _timestep = t;
+    resetIteration();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::resetIteration
+ */
+void VolumeRenderCPU::resetIteration()
+{
+    _rendering_params.iteration = 0;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::initOutputRing
+ * @param width
+ * @param height
+ * @param count
+ */
+void VolumeRenderCPU::initOutputRing(const size_t width, const size_t height, const size_t count)
+{
+    std::lock_guard<std::mutex> lock(_outputRing.mutex);
+    _outputRing.images.assign(std::max(size_t(1), count),
+                              std::vector<unsigned char>(width*height*4, 0));
+    _outputRing.busy.assign(_outputRing.images.size(), false);
+    _outputRing.width = width;
+    _outputRing.height = height;
+    _outputRing.next = 0;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::enqueueRaycastNoGL
+ * @return
+ */
+size_t VolumeRenderCPU::enqueueRaycastNoGL()
+{
+    if (_outputRing.images.empty())
+        throw std::runtime_error("ERROR: The output ring has not been initialized.");
+    size_t slot = 0;
+    {
+        std::unique_lock<std::mutex> lock(_outputRing.mutex);
+        slot = _outputRing.next;
+        _outputRing.cv.wait(lock, [&]{ return !_outputRing.busy.at(slot); });
+        _outputRing.busy.at(slot) = true;
+        _outputRing.next = (slot + 1) % _outputRing.images.size();
+    }
+    std::vector<unsigned char> &img = _outputRing.images.at(slot);
+    runRaycast(_outputRing.width, _outputRing.height, img);
+    return slot;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::waitFrame
+ * @param slot
+ * @return
+ */
+const unsigned char *VolumeRenderCPU::waitFrame(const size_t slot)
+{
+    return _outputRing.images.at(slot).data();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::releaseFrame
+ * @param slot
+ */
+void VolumeRenderCPU::releaseFrame(const size_t slot)
+{
+    {
+        std::lock_guard<std::mutex> lock(_outputRing.mutex);
+        _outputRing.busy.at(slot) = false;
+    }
+    _outputRing.cv.notify_all();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::runRaycast
+ * @param width
+ * @param height
+ * @param output
+ */
+void VolumeRenderCPU::runRaycast(const size_t width, const size_t height,
+                                 std::vector<unsigned char> &output)
+{
+    if (!hasData() || width == 0 || height == 0)
+        return;
+    if (!_pool)
+        initialize();
+    const auto start = std::chrono::steady_clock::now();
+
+    output.resize(width*height*4);
+    if (_accWidth != width || _accHeight != height)
+    {
+        _accumulate.assign(width*height*4, 0.f);
+        _accWidth = width;
+        _accHeight = height;
+        resetIteration();
+    }
+    _rendering_params.seed = static_cast<cl_uint>(_generator());
+
+    const size_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const size_t tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    _pool->run(tilesX * tilesY, [&](size_t tile, size_t)
+    {
+        renderTile(tile, width, height, output.data());
+    });
+    _rendering_params.iteration++;
+
+    _lastExecTime = std::chrono::duration<double>(std::chrono::steady_clock::now()
+                                                  - start).count();
+}
+
+
+/**
+ * @brief VolumeRenderCPU::renderTile
+ * @param tile
+ * @param width
+ * @param height
+ * @param output
+ */
+void VolumeRenderCPU::renderTile(const size_t tile, const size_t width, const size_t height,
+                                 unsigned char *output)
+{
+    const size_t tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    const int x0 = int((tile % tilesX) * TILE_SIZE);
+    const int y0 = int((tile / tilesX) * TILE_SIZE);
+    for (int y = y0; y < std::min(y0 + TILE_SIZE, int(height)); y += PACKET_DIM)
+        for (int x = x0; x < std::min(x0 + TILE_SIZE, int(width)); x += PACKET_DIM)
+            renderPacket(x, y, width, height, output);
+}
+
+
+/**
+ * @brief VolumeRenderCPU::renderPacket Trace a packet of 4x4 rays, equivalent to the
+ *        volumeRender kernel without path tracing. The lanes advance in lock-step: each
+ *        phase of a step is a branch free loop over all lanes, finished or skipping lanes
+ *        are masked out of the results, so the loops vectorize to one lane per SIMD element.
+ * @param x0
+ * @param y0
+ * @param width
+ * @param height
+ * @param output
+ */
+void VolumeRenderCPU::renderPacket(const int x0, const int y0, const size_t width,
+                                   const size_t height, unsigned char *output)
+{
+    const BrickedVolume::Sampler vol = _volumes.at(_timestep).sampler();
+    const float *tff = _tffFloat.data();
+    const int tffSize = int(_tffFloat.size() / 4);
+    const VolumeRenderCL::camera_params &camera = _camera_params;
+    const VolumeRenderCL::rendering_params &render = _rendering_params;
+    const VolumeRenderCL::raycast_params &raycast = _raycast_params;
+    const cl_float *m = camera.viewMat.s;
+    const float3 modelScale = {render.modelScale.s[0], render.modelScale.s[1],
+                               render.modelScale.s[2]};
+    const float3 volRes = {float(vol.res[0]), float(vol.res[1]), float(vol.res[2])};
+    const float3 voxLen = {1.f / volRes.x, 1.f / volRes.y, 1.f / volRes.z};
+    const float refSamplingInterval = 1.f / raycast.samplingRate;
+    const unsigned int illumType = render.illumType;
+    const bool skipEmpty = _useObjEss && illumType != 4;
+    const bool contours = raycast.contours != 0;
+    const bool aerial = raycast.aerial != 0;
+    const bool useAO = raycast.useAO != 0;
+
+    // global size of the kernel, padded to the work group size
+    const size_t ls = VolumeRenderCL::LOCAL_SIZE;
+    const float globalX = float(width + (ls - width % ls));
+    const float globalY = float(height + (ls - height % ls));
+    const float aspectRatio = std::min(globalY / globalX, globalX / globalY);
+    const float maxImgSize = std::max(globalX, globalY);
+
+    // ray packet state (structure of arrays)
+    alignas(64) float ox[PACKET_SIZE], oy[PACKET_SIZE], oz[PACKET_SIZE];
+    alignas(64) float dx[PACKET_SIZE], dy[PACKET_SIZE], dz[PACKET_SIZE];
+    alignas(64) float t[PACKET_SIZE], tnear[PACKET_SIZE], tfar[PACKET_SIZE];
+    alignas(64) float step[PACKET_SIZE], offset[PACKET_SIZE], sampleDist[PACKET_SIZE];
+    alignas(64) float env[4][PACKET_SIZE];
+    alignas(64) float res[4][PACKET_SIZE];
+    alignas(64) int active[PACKET_SIZE];
+    // state of one step
+    alignas(64) float px[PACKET_SIZE], py[PACKET_SIZE], pz[PACKET_SIZE];
+    alignas(64) float density[PACKET_SIZE];
+    alignas(64) float color[4][PACKET_SIZE];
+    alignas(64) float normal[3][PACKET_SIZE] = {};
+    alignas(64) int sampling[PACKET_SIZE];
+    // position of the early ray termination for ambient occlusion
+    alignas(64) float term[3][PACKET_SIZE] = {};
+    alignas(64) int terminated[PACKET_SIZE] = {};
+
+    // ---- ray setup, same as the kernel ----
+    int anyActive = 0;
+#pragma omp simd reduction(|:anyActive)
+    for (int l = 0; l < PACKET_SIZE; ++l)
+    {
+        const int x = x0 + l % PACKET_DIM;
+        const int y = y0 + l / PACKET_DIM;
+        const bool valid = x < int(width) && y < int(height);
+
+        const float rand = float(parallelRNG3(unsigned(x), unsigned(y), render.seed))
+                           / float(UINT_MAX);
+        const float rand2 = float(parallelRNG3(unsigned(y), unsigned(x), 2*render.seed))
+                            / float(UINT_MAX);
+        float imgX = x / maxImgSize * 2.f;
+        float imgY = y / maxImgSize * 2.f;
+        imgX -= globalX > globalY ? 1.f : aspectRatio;
+        imgY -= globalX > globalY ? aspectRatio : 1.f;
+        imgY *= -1.f;
+        imgX += rand2 * 2.f / globalX;
+        imgY += -rand * 2.f / globalY;
+
+        float3 nearPlanePos = {imgX, imgY, -1.f};
+        float3 rayDir = {m[0]*nearPlanePos.x + m[1]*nearPlanePos.y + m[2]*nearPlanePos.z,
+                         m[4]*nearPlanePos.x + m[5]*nearPlanePos.y + m[6]*nearPlanePos.z,
+                         m[8]*nearPlanePos.x + m[9]*nearPlanePos.y + m[10]*nearPlanePos.z};
+        float3 camPos = float3{m[3], m[7], m[11]} * modelScale;
+        if (camera.ortho)
+        {
+            camPos = {m[3], m[7], m[11]};
+            rayDir = float3{-m[2], -m[6], -m[10]};
+            nearPlanePos = camPos + float3{m[0], m[4], m[8]} * imgX
+                                  + float3{m[1], m[5], m[9]} * imgY;
+            nearPlanePos = nearPlanePos * length(camPos);
+            camPos = nearPlanePos * modelScale;
+        }
+        rayDir = normalize(rayDir * modelScale);
+        ox[l] = camPos.x;  oy[l] = camPos.y;  oz[l] = camPos.z;
+        dx[l] = rayDir.x;  dy[l] = rayDir.y;  dz[l] = rayDir.z;
+
+        const float gradient = render.useGradient ? 0.7f + 0.5f*rayDir.y : 1.f;
+        for (int c = 0; c < 4; ++c)
+            env[c][l] = render.backgroundColor.s[c] * gradient;
+
+        // intersection with the bounding box
+        const float3 inv = {1.f / rayDir.x, 1.f / rayDir.y, 1.f / rayDir.z};
+        const float3 bl = {camera.bbox_bl.s[0], camera.bbox_bl.s[1], camera.bbox_bl.s[2]};
+        const float3 tr = {camera.bbox_tr.s[0], camera.bbox_tr.s[1], camera.bbox_tr.s[2]};
+        const float3 tBot = inv * (bl - camPos);
+        const float3 tTop = inv * (tr - camPos);
+        const float tMin = std::max(std::max(std::min(tTop.x, tBot.x), std::min(tTop.y, tBot.y)),
+                                    std::max(std::min(tTop.x, tBot.x), std::min(tTop.z, tBot.z)));
+        const float tMax = std::min(std::min(std::max(tTop.x, tBot.x), std::max(tTop.y, tBot.y)),
+                                    std::min(std::max(tTop.x, tBot.x), std::max(tTop.z, tBot.z)));
+        const bool hit = valid && tMax > tMin && tMax >= 0.f;
+
+        // missed rays get a unit interval, they are masked out
+        const float dist = hit ? tMax - tMin : 1.f;
+        const float3 distVox = rayDir * volRes * dist;
+        const float stepSize = std::min(dist, dist / (raycast.samplingRate * length(distVox)));
+        const float samples = float(ceilInt(std::min(dist / stepSize, 1.e9f)));
+        sampleDist[l] = dist;
+        step[l] = dist / samples;
+        tnear[l] = hit ? std::max(0.f, tMin) : 0.f;
+        tfar[l] = hit ? tMax : 0.f;
+        t[l] = tnear[l];
+        offset[l] = length(voxLen) * rand * 2.f;
+        for (int c = 0; c < 4; ++c)
+            res[c][l] = env[c][l];
+        res[3][l] = hit ? 0.f : env[3][l];
+        active[l] = hit && t[l] < tfar[l];
+        anyActive |= active[l];
+    }
+
+    // ---- lock-step ray marching of all active lanes ----
+    while (anyActive)
+    {
+#pragma omp simd
+        for (int l = 0; l < PACKET_SIZE; ++l)
+        {
+            px[l] = (ox[l] + dx[l] * (t[l] - offset[l])) * 0.5f + 0.5f;
+            py[l] = (oy[l] + dy[l] * (t[l] - offset[l])) * 0.5f + 0.5f;
+            pz[l] = (oz[l] + dz[l] * (t[l] - offset[l])) * 0.5f + 0.5f;
+            sampling[l] = active[l];
+        }
+
+        if (skipEmpty)
+        {
+            // advance over empty bricks in whole steps: the sample positions stay the same
+            // as without skipping, all skipped samples are fully transparent
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+            {
+                const float cx = minSel(maxSel(px[l], 0.f), 1.f);
+                const float cy = minSel(maxSel(py[l], 0.f), 1.f);
+                const float cz = minSel(maxSel(pz[l], 0.f), 1.f);
+                // no short-circuit: the brick lookup reads a clamped position in every lane
+                const bool inside = (cx == px[l]) & (cy == py[l]) & (cz == pz[l]);
+                const bool skip = bool(sampling[l]) & inside & vol.empty(cx, cy, cz);
+                const float tExit = minSel(minSel(brickExit(vol, 0, cx, ox[l], dx[l]),
+                                                  brickExit(vol, 1, cy, oy[l], dy[l])),
+                                           brickExit(vol, 2, cz, oz[l], dz[l])) + offset[l];
+                // whole steps (at least one) up to the brick exit, zero for lanes that do not skip
+                const int n = ceilInt((minSel(tExit, tfar[l]) - t[l]) / step[l]);
+                const int steps = (n > 1 ? n : 1) * int(skip);
+                t[l] += float(steps) * step[l];
+                active[l] &= int(t[l] < tfar[l]);
+                sampling[l] = sampling[l] && !skip;
+            }
+        }
+
+        // samples and their colors, lanes that do not sample read clamped positions
+        if (illumType == 4)     // gradient magnitude based shading
+        {
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+                density[l] = gradientCentralDiff(vol, {px[l], py[l], pz[l]}).w;
+        }
+        else if (render.useLinear)
+        {
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+                density[l] = vol.linear(px[l], py[l], pz[l]);
+        }
+        else
+        {
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+                density[l] = vol.nearest(px[l], py[l], pz[l]);
+        }
+        int anyGradient = 0;
+#pragma omp simd reduction(|:anyGradient)
+        for (int l = 0; l < PACKET_SIZE; ++l)
+        {
+            const float4 c = sampleTff(tff, tffSize, density[l]);
+            color[0][l] = c.x;  color[1][l] = c.y;  color[2][l] = c.z;  color[3][l] = c.w;
+            anyGradient |= sampling[l] && c.w > 0.1f;
+        }
+
+        // gradients for illumination and contours, only if a lane needs one
+        if (!anyGradient || illumType == 4 || (illumType == 0 && !contours))
+        {
+            // no normals needed
+        }
+        else if (illumType == 2)
+        {
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+            {
+                const float4 g = gradientCentralDiffTff(vol, tff, tffSize, {px[l], py[l], pz[l]});
+                normal[0][l] = -g.x;  normal[1][l] = -g.y;  normal[2][l] = -g.z;
+            }
+        }
+        else if (illumType == 3)
+        {
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+            {
+                const float4 g = gradientSobel(vol, {px[l], py[l], pz[l]});
+                normal[0][l] = -g.x;  normal[1][l] = -g.y;  normal[2][l] = -g.z;
+            }
+        }
+        else
+        {
+#pragma omp simd
+            for (int l = 0; l < PACKET_SIZE; ++l)
+            {
+                const float4 g = gradientCentralDiff(vol, {px[l], py[l], pz[l]});
+                normal[0][l] = -g.x;  normal[1][l] = -g.y;  normal[2][l] = -g.z;
+            }
+        }
+
+        // shading and front-to-back compositing
+        anyActive = 0;
+#pragma omp simd reduction(|:anyActive)
+        for (int l = 0; l < PACKET_SIZE; ++l)
+        {
+            const float3 rayDir = {dx[l], dy[l], dz[l]};
+            float3 c = {color[0][l], color[1][l], color[2][l]};
+            float alphaSample = color[3][l];
+            if (illumType != 4)
+            {
+                const bool shaded = alphaSample > 0.1f;
+                const float3 n = {normal[0][l], normal[1][l], normal[2][l]};
+                const float3 toLight = rayDir * -1.f;
+                if (illumType == 5)
+                    c = shaded ? celShading(c, toLight, n) : c;
+                else if (illumType != 0)
+                    c = shaded ? illumination(c, toLight, n) : c;
+                if (contours)       // edge enhancement
+                    c = shaded ? c * std::fabs(dot(rayDir, n)) : c;
+            }
+            c = float3{env[0][l], env[1][l], env[2][l]} - c;
+            if (aerial)     // depth cue as aerial perspective
+                alphaSample *= 1.f - (t[l] - tnear[l]) / sampleDist[l];
+
+            const float opacity = 1.f - powr(1.f - alphaSample, refSamplingInterval);
+            const float alpha = res[3][l];
+            const float weight = opacity * (1.f - alpha);
+            const float alphaNew = alpha + weight;
+            const bool s = sampling[l];
+            res[0][l] = s ? res[0][l] - c.x * weight : res[0][l];
+            res[1][l] = s ? res[1][l] - c.y * weight : res[1][l];
+            res[2][l] = s ? res[2][l] - c.z * weight : res[2][l];
+            res[3][l] = s ? alphaNew : alpha;
+
+            // early ray termination
+            const float tNext = t[l] + step[l];
+            const bool stop = s && alphaNew > ERT_THRESHOLD;
+            term[0][l] = stop ? px[l] : term[0][l];
+            term[1][l] = stop ? py[l] : term[1][l];
+            term[2][l] = stop ? pz[l] : term[2][l];
+            terminated[l] |= stop;
+            t[l] = s ? tNext : t[l];
+            active[l] = s ? int(alphaNew <= ERT_THRESHOLD && tNext < tfar[l]) : active[l];
+            anyActive |= active[l];
+        }
+    }
+
+    // ---- ambient occlusion on solid surfaces, accumulation and output ----
+    for (int l = 0; l < PACKET_SIZE; ++l)
+    {
+        const int x = x0 + l % PACKET_DIM;
+        const int y = y0 + l / PACKET_DIM;
+        if (x >= int(width) || y >= int(height))
+            continue;
+        if (useAO && terminated[l])
+        {
+            const float3 pos = {term[0][l], term[1][l], term[2][l]};
+            const float4 g = gradientCentralDiff(vol, pos);
+            const unsigned int seed = parallelRNG3(unsigned(x), unsigned(y), render.seed);
+            std::array<unsigned int, 4> rng = {{seed, seed, seed, seed}};
+            const float ao = ambientOcclusion(vol, tff, tffSize, {-g.x, -g.y, -g.z}, pos,
+                                              length(voxLen)*0.9f, length(voxLen)*5.f, rng);
+            for (int c = 0; c < 3; ++c)
+                res[c][l] *= 1.f - 0.5f*ao;
+        }
+
+        const size_t id = (size_t(y) * width + size_t(x)) * 4;
+        float *acc = _accumulate.data() + id;
+        float pixel[4] = {res[0][l], res[1][l], res[2][l], res[3][l]};
+        if (render.iteration != 0)
+            for (int c = 0; c < 3; ++c)
+                pixel[c] = acc[c] + (pixel[c] - acc[c]) / float(render.iteration + 1);
+        for (int c = 0; c < 4; ++c)
+        {
+            acc[c] = pixel[c];
+            output[id + size_t(c)] = toUnorm8(pixel[c]);
+        }
+    }
+}
+
+
+/**
+ * @brief VolumeRenderCPU::getLastExecTime
+ * @return
+ */
+double VolumeRenderCPU::getLastExecTime()
+{
+    return _lastExecTime;
+}
+
+
+/**
+ * @brief VolumeRenderCPU::getCurrentDeviceName
+ * @return
+ */
+const std::string VolumeRenderCPU::getCurrentDeviceName()
+{
+    return "Native CPU renderer (" + std::to_string(_pool ? _pool->threads()
+                                    : std::max(1u, std::thread::hardware_concurrency()))
+           + " threads)";
+}
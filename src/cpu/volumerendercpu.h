@@ -0,0 +1,188 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+
+#pragma once
+
+#include "src/core/volumerendercl.h"
+#include "src/cpu/brickedvolume.h"
+#include "src/cpu/tilepool.h"
+
+#include <array>
+#include <vector>
+#include <string>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+/**
+ * @brief Native multithreaded volume ray caster for machines without a (fast) OpenCL device.
+ *
+ * Mirrors the interface of VolumeRenderCL for offscreen rendering and uses the same camera,
+ * rendering and raycast parameter structs, so it can be used as a drop-in replacement and
+ * produces the same images as the ray casting kernel. Rays are traced in packets of 4x4
+ * pixels in lock-step, one lane per float of a 512 bit SIMD register: the phases of a step
+ * are branch free OpenMP SIMD loops over the lanes, with finished lanes masked out. Image
+ * tiles are distributed over a work stealing thread pool and the volume is stored in a
+ * Morton ordered bricked layout.
+ *
+ * Supported are single channel volumes and ray casting with all illumination types, ambient
+ * occlusion, contours, aerial perspective, orthographic cameras and object order empty space
+ * skipping. Path tracing is rejected by setTechnique, environment maps are only available
+ * with VolumeRenderCL. The backend is selected at runtime by the batch renderer (CLI), the
+ * interactive widget always renders with VolumeRenderCL.
+ */
+class VolumeRenderCPU
+{
+public:
+    static const int TILE_SIZE = 32;
+    static const int PACKET_DIM = 4;
+    static const int PACKET_SIZE = PACKET_DIM*PACKET_DIM;
+
+    VolumeRenderCPU();
+    ~VolumeRenderCPU();
+
+    /**
+     * @brief Initialize the renderer.
+     * @param threads Number of render threads, 0: one per hardware thread.
+     */
+    void initialize(size_t threads = 0);
+
+    /**
+     * @brief Load volume data and convert all timesteps into the bricked layout.
+     * @param volumeFileProps Properties of the volume data set.
+     * @return The number of timesteps.
+     * @throws If the data could not be read or its format is not supported.
+     */
+    size_t loadVolumeData(const DatRawReader::Properties volumeFileProps);
+
+    bool hasData() const;
+    const std::array<unsigned int, 4> getResolution() const;
+
+    /**
+     * @brief Set the RGBA8 transfer function.
+     */
+    void setTransferFunction(std::vector<unsigned char> &tff);
+    /**
+     * @brief Only for interface compatibility, empty bricks are derived from the transfer
+     *        function itself.
+     */
+    void setTffPrefixSum(std::vector<unsigned int> &tffPrefixSum);
+
+    void updateView(const std::array<float, 16> viewMat);
+    void updateSamplingRate(const double samplingRate);
+    void setCamOrtho(bool setCamOrtho);
+    void setIllumination(unsigned int illum);
+    void setAmbientOcclusion(bool ao);
+    void setLinearInterpolation(bool linearSampling);
+    void setContours(bool contours);
+    void setAerial(bool aerial);
+    void setObjEss(bool useEss);
+    void setBackground(std::array<float, 4> color);
+    void setUseGradient(bool useGradient);
+    /**
+     * @brief Set the rendering technique.
+     * @throws If the technique is not ray casting.
+     */
+    void setTechnique(VolumeRenderCL::technique tech);
+    void setBBox(float bl_x, float bl_y, float bl_z, float tr_x, float tr_y, float tr_z);
+    void setTimestep(const size_t t);
+
+    /**
+     * @brief Create the output images for rendering (see enqueueRaycastNoGL).
+     * @param width Image width in pixels.
+     * @param height Image height in pixels.
+     * @param count Number of output images.
+     */
+    void initOutputRing(const size_t width, const size_t height, const size_t count = 3);
+
+    /**
+     * @brief Render a frame into the next free output image. Rendering is synchronous,
+     *        the encoding of previous frames continues in parallel.
+     * @return The ring slot of the frame, used for waitFrame and releaseFrame.
+     */
+    size_t enqueueRaycastNoGL();
+
+    /**
+     * @brief Get a rendered frame.
+     * @return RGBA8 pixel data of the frame, same row order as VolumeRenderCL::waitFrame.
+     *         Valid until releaseFrame.
+     */
+    const unsigned char *waitFrame(const size_t slot);
+
+    /**
+     * @brief Hand an output image back to the ring, can be called from any thread.
+     */
+    void releaseFrame(const size_t slot);
+
+    /**
+     * @brief Render a frame into a host buffer.
+     * @param width Image width in pixels.
+     * @param height Image height in pixels.
+     * @param output RGBA8 pixel data.
+     */
+    void runRaycast(const size_t width, const size_t height, std::vector<unsigned char> &output);
+
+    double getLastExecTime();
+    const std::string getCurrentDeviceName();
+
+private:
+    void calcScaling();
+    void resetIteration();
+    void renderTile(const size_t tile, const size_t width, const size_t height,
+                    unsigned char *output);
+    void renderPacket(const int x0, const int y0, const size_t width, const size_t height,
+                      unsigned char *output);
+
+    VolumeRenderCL::camera_params _camera_params;
+    VolumeRenderCL::rendering_params _rendering_params;
+    VolumeRenderCL::raycast_params _raycast_params;
+
+    DatRawReader::Properties _props;
+    std::vector<BrickedVolume> _volumes;
+    std::vector<unsigned char> _tff;
+    std::vector<float> _tffFloat;       // RGBA in [0,1]
+    std::array<float, 3> _modelScale = {{1.f, 1.f, 1.f}};
+    bool _useObjEss = false;
+    size_t _timestep = 0;
+
+    std::unique_ptr<TilePool> _pool;
+    std::mt19937 _generator;
+    std::vector<float> _accumulate;     // RGBA of the previous iterations
+    size_t _accWidth = 0;
+    size_t _accHeight = 0;
+    double _lastExecTime = 0.0;
+
+    // output images, rendering is synchronous so only the release needs synchronization
+    struct OutputRing
+    {
+        std::vector<std::vector<unsigned char> > images;
+        std::vector<bool> busy;
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t width = 0;
+        size_t height = 0;
+        size_t next = 0;
+    } _outputRing;
+};
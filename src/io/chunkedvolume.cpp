@@ -0,0 +1,531 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/io/chunkedvolume.h"
+
+#include <iostream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <limits>
+
+static const uint32_t CONTAINER_VERSION = 1;
+static const char CONTAINER_MAGIC[8] = {'V', 'R', 'C', 'L', 'C', 'V', 'O', 'L'};
+// chunks that are compressed at the same time, bounds the memory of the writer
+static const size_t WRITE_BATCH = 256;
+
+/**
+ * @brief On-disk header of a container, the index starts at index_offset.
+ */
+struct ContainerHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t bytes_per_voxel;
+    uint32_t volume_res[3];
+    uint32_t timesteps;
+    uint32_t chunk_size;
+    uint32_t codec;
+    uint32_t reserved;
+    double slice_thickness[3];
+    uint64_t index_offset;
+};
+
+/**
+ * @brief On-disk index entry of a time step, followed by the chunk entries of all time steps.
+ */
+struct TimestepEntry
+{
+    float min_value;
+    float max_value;
+    double histogram[256];
+};
+
+/**
+ * @brief On-disk index entry of a chunk.
+ */
+struct ChunkEntry
+{
+    uint64_t offset;
+    uint32_t size;
+    float min_value;
+    float max_value;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(ContainerHeader) == 80, "Unexpected padding of the container header.");
+static_assert(sizeof(TimestepEntry) == 2056, "Unexpected padding of the time step entry.");
+static_assert(sizeof(ChunkEntry) == 24, "Unexpected padding of the chunk entry.");
+
+/**
+ * @brief Read four bytes for the match search of the compressor.
+ */
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(uint32_t));
+    return v;
+}
+
+/**
+ * @brief Append a length in the LZ4 format: runs of 255 terminated by a smaller byte.
+ */
+static void putLength(std::vector<char> &out, size_t length)
+{
+    while (length >= 255)
+    {
+        out.push_back(char(255));
+        length -= 255;
+    }
+    out.push_back(char(length));
+}
+
+/**
+ * @brief Greedy LZ4 block compression with a hash table of the last positions of 4 byte
+ *        sequences. The output can be decompressed by any LZ4 block decoder.
+ */
+static void lz4Compress(const char *src, const size_t size, std::vector<char> &out)
+{
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(src);
+    const size_t hashBits = 16;
+    std::vector<int64_t> table(size_t(1) << hashBits, -1);
+    out.clear();
+    out.reserve(size + size / 255 + 16);
+
+    const auto emit = [&](const size_t anchor, const size_t literals, const size_t offset,
+                          const size_t match)
+    {
+        const size_t matchCode = match >= 4 ? match - 4 : 0;
+        out.push_back(char((std::min(literals, size_t(15)) << 4)
+                           | (match ? std::min(matchCode, size_t(15)) : 0)));
+        if (literals >= 15)
+            putLength(out, literals - 15);
+        out.insert(out.end(), src + anchor, src + anchor + literals);
+        if (!match)
+            return;
+        out.push_back(char(offset & 0xffu));
+        out.push_back(char(offset >> 8));
+        if (matchCode >= 15)
+            putLength(out, matchCode - 15);
+    };
+
+    // the last match must start 12 bytes and end 5 bytes before the end of the block
+    const size_t matchLimit = size > 12 ? size - 12 : 0;
+    size_t anchor = 0;
+    size_t i = 0;
+    while (i < matchLimit)
+    {
+        const uint32_t sequence = read32(in + i);
+        const size_t h = (sequence * 2654435761u) >> (32 - hashBits);
+        const int64_t candidate = table.at(h);
+        table.at(h) = int64_t(i);
+        if (candidate < 0 || i - size_t(candidate) > 65535
+                || read32(in + candidate) != sequence)
+        {
+            ++i;
+            continue;
+        }
+        size_t length = 4;
+        const size_t maxLength = size - 5 - i;
+        while (length < maxLength && in[size_t(candidate) + length] == in[i + length])
+            ++length;
+        emit(anchor, i - anchor, i - size_t(candidate), length);
+        i += length;
+        anchor = i;
+    }
+    emit(anchor, size - anchor, 0, 0);
+}
+
+/**
+ * @brief Decompress an LZ4 block of known decompressed size.
+ * @return false if the block is corrupt.
+ */
+static bool lz4Decompress(const char *src, const size_t size, char *dst, const size_t dstSize)
+{
+    const uint8_t *in = reinterpret_cast<const uint8_t *>(src);
+    size_t ip = 0;
+    size_t op = 0;
+    const auto readLength = [&](size_t &length)
+    {
+        uint8_t b = 255;
+        while (b == 255)
+        {
+            if (ip >= size)
+                return false;
+            b = in[ip++];
+            length += b;
+        }
+        return true;
+    };
+    while (ip < size)
+    {
+        const uint8_t token = in[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15 && !readLength(literals))
+            return false;
+        if (ip + literals > size || op + literals > dstSize)
+            return false;
+        std::memcpy(dst + op, in + ip, literals);
+        ip += literals;
+        op += literals;
+        if (ip >= size)     // the last sequence has no match
+            break;
+        if (ip + 2 > size)
+            return false;
+        const size_t offset = size_t(in[ip]) | (size_t(in[ip + 1]) << 8);
+        ip += 2;
+        size_t match = token & 15u;
+        if (match == 15 && !readLength(match))
+            return false;
+        match += 4;
+        if (offset == 0 || offset > op || op + match > dstSize)
+            return false;
+        if (offset >= match)
+            std::memcpy(dst + op, dst + op - offset, match);
+        else    // overlapping copy repeats the last offset bytes
+            for (size_t k = 0; k < match; ++k)
+                dst[op + k] = dst[op - offset + k];
+        op += match;
+    }
+    return op == dstSize;
+}
+
+/**
+ * @brief Normalized value of a voxel, see DatRawReader::convert_raw.
+ */
+static float normalizedValue(const char *data, const size_t id, const uint32_t bytesPerVoxel)
+{
+    if (bytesPerVoxel == 1)
+        return uint8_t(data[id]) / 255.f;
+    if (bytesPerVoxel == 2)
+    {
+        uint16_t v;
+        std::memcpy(&v, data + id * 2, sizeof(uint16_t));
+        return v / 65535.f;
+    }
+    float v;
+    std::memcpy(&v, data + id * 4, sizeof(float));
+    return v;
+}
+
+/*
+ * ChunkedVolume::Header::chunk_res
+ */
+std::array<uint32_t, 3> ChunkedVolume::Header::chunk_res() const
+{
+    std::array<uint32_t, 3> res;
+    for (size_t i = 0; i < 3; ++i)
+        res.at(i) = (volume_res.at(i) + chunk_size - 1) / chunk_size;
+    return res;
+}
+
+/*
+ * ChunkedVolume::Header::chunk_bytes
+ */
+size_t ChunkedVolume::Header::chunk_bytes() const
+{
+    const size_t slot = chunk_size + 2;
+    return slot * slot * slot * bytes_per_voxel;
+}
+
+/*
+ * ChunkedVolume::num_chunks
+ */
+size_t ChunkedVolume::num_chunks() const
+{
+    const std::array<uint32_t, 3> res = _header.chunk_res();
+    return size_t(res.at(0)) * res.at(1) * res.at(2);
+}
+
+/*
+ * ChunkedVolume::Writer::Writer
+ */
+ChunkedVolume::Writer::Writer(const std::string &file_name, const Header &header)
+    : _file_name(file_name)
+    , _os(file_name, std::ios::out | std::ios::trunc | std::ofstream::binary)
+    , _header(header)
+{
+    if (!_os)
+        throw std::runtime_error("Could not create " + file_name);
+    if (header.chunk_size == 0 || (header.bytes_per_voxel != 1 && header.bytes_per_voxel != 2
+                                   && header.bytes_per_voxel != 4))
+        throw std::invalid_argument("Invalid chunk size or voxel format.");
+    // the header is written last, when the index offset is known
+    const ContainerHeader placeholder = {};
+    _os.write(reinterpret_cast<const char *>(&placeholder), sizeof(ContainerHeader));
+    _offset = sizeof(ContainerHeader);
+}
+
+/*
+ * ChunkedVolume::Writer::append
+ */
+void ChunkedVolume::Writer::append(const char *volume, const Timestep &timestep)
+{
+    const std::array<uint32_t, 3> res = _header.chunk_res();
+    const std::array<uint32_t, 3> &volRes = _header.volume_res;
+    const size_t numChunks = size_t(res.at(0)) * res.at(1) * res.at(2);
+    const size_t chunkBytes = _header.chunk_bytes();
+    const uint32_t bpv = _header.bytes_per_voxel;
+    const long slot = long(_header.chunk_size) + 2;
+
+    std::vector<std::vector<char> > compressed(WRITE_BATCH);
+    std::vector<Chunk> chunks(WRITE_BATCH);
+    for (size_t first = 0; first < numChunks; first += WRITE_BATCH)
+    {
+        const size_t count = std::min(WRITE_BATCH, numChunks - first);
+#pragma omp parallel for schedule(dynamic)
+        for (long long i = 0; i < static_cast<long long>(count); ++i)
+        {
+            const size_t c = first + size_t(i);
+            const std::array<long, 3> origin = {{
+                    long(c % res.at(0)) * long(_header.chunk_size) - 1,
+                    long((c / res.at(0)) % res.at(1)) * long(_header.chunk_size) - 1,
+                    long(c / (size_t(res.at(0)) * res.at(1))) * long(_header.chunk_size) - 1}};
+            // chunk with apron, clamped to edge as the sampler of a monolithic volume
+            std::vector<char> chunk(chunkBytes);
+            float minVal = std::numeric_limits<float>::max();
+            float maxVal = std::numeric_limits<float>::lowest();
+            for (long z = 0; z < slot; ++z)
+            {
+                const size_t vz = size_t(std::clamp(origin.at(2) + z, 0l, long(volRes.at(2)) - 1));
+                for (long y = 0; y < slot; ++y)
+                {
+                    const size_t vy = size_t(std::clamp(origin.at(1) + y, 0l,
+                                                        long(volRes.at(1)) - 1));
+                    const size_t row = (vz * volRes.at(1) + vy) * volRes.at(0);
+                    const size_t dstRow = size_t((z * slot + y) * slot);
+                    for (long x = 0; x < slot; ++x)
+                    {
+                        const size_t vx = size_t(std::clamp(origin.at(0) + x, 0l,
+                                                            long(volRes.at(0)) - 1));
+                        std::memcpy(chunk.data() + (dstRow + size_t(x)) * bpv,
+                                    volume + (row + vx) * bpv, bpv);
+                        const float v = normalizedValue(volume, row + vx, bpv);
+                        minVal = std::min(minVal, v);
+                        maxVal = std::max(maxVal, v);
+                    }
+                }
+            }
+            chunks.at(size_t(i)).min_value = minVal;
+            chunks.at(size_t(i)).max_value = maxVal;
+            std::vector<char> &out = compressed.at(size_t(i));
+            if (_header.codec == CODEC_LZ4)
+                lz4Compress(chunk.data(), chunk.size(), out);
+            // chunks that do not compress are stored, recognized by their size
+            if (_header.codec != CODEC_LZ4 || out.size() >= chunkBytes)
+                out.swap(chunk);
+        }
+        for (size_t i = 0; i < count; ++i)
+        {
+            const std::vector<char> &out = compressed.at(i);
+            chunks.at(i).offset = _offset;
+            chunks.at(i).size = uint32_t(out.size());
+            _os.write(out.data(), std::streamsize(out.size()));
+            _offset += out.size();
+            _chunks.push_back(chunks.at(i));
+        }
+        if (!_os)
+            throw std::runtime_error("Error writing " + _file_name);
+    }
+    _timesteps.push_back(timestep);
+}
+
+/*
+ * ChunkedVolume::Writer::finish
+ */
+void ChunkedVolume::Writer::finish()
+{
+    for (const Timestep &t : _timesteps)
+    {
+        TimestepEntry entry;
+        entry.min_value = t.min_value;
+        entry.max_value = t.max_value;
+        std::copy(t.histogram.begin(), t.histogram.end(), std::begin(entry.histogram));
+        _os.write(reinterpret_cast<const char *>(&entry), sizeof(TimestepEntry));
+    }
+    for (const Chunk &c : _chunks)
+    {
+        const ChunkEntry entry = {c.offset, c.size, c.min_value, c.max_value, 0};
+        _os.write(reinterpret_cast<const char *>(&entry), sizeof(ChunkEntry));
+    }
+
+    ContainerHeader header;
+    std::memset(&header, 0, sizeof(ContainerHeader));
+    std::memcpy(header.magic, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC));
+    header.version = CONTAINER_VERSION;
+    header.format = _header.format;
+    header.bytes_per_voxel = _header.bytes_per_voxel;
+    std::copy(_header.volume_res.begin(), _header.volume_res.end(), std::begin(header.volume_res));
+    header.timesteps = uint32_t(_timesteps.size());
+    header.chunk_size = _header.chunk_size;
+    header.codec = _header.codec;
+    std::copy(_header.slice_thickness.begin(), _header.slice_thickness.end(),
+              std::begin(header.slice_thickness));
+    header.index_offset = _offset;
+    _os.seekp(0);
+    _os.write(reinterpret_cast<const char *>(&header), sizeof(ContainerHeader));
+    _os.close();
+    if (!_os)
+        throw std::runtime_error("Error writing " + _file_name);
+}
+
+/*
+ * ChunkedVolume::open
+ */
+void ChunkedVolume::open(const std::string &file_name)
+{
+    close();
+    _mapping = MappedFile(file_name);
+    ContainerHeader header;
+    if (_mapping.size() < sizeof(ContainerHeader))
+        throw std::runtime_error("Invalid chunked volume " + file_name);
+    std::memcpy(&header, _mapping.data(), sizeof(ContainerHeader));
+    if (std::memcmp(header.magic, CONTAINER_MAGIC, sizeof(CONTAINER_MAGIC)) != 0
+            || header.version != CONTAINER_VERSION || header.chunk_size == 0
+            || (header.bytes_per_voxel != 1 && header.bytes_per_voxel != 2
+                && header.bytes_per_voxel != 4))
+    {
+        close();
+        throw std::runtime_error("Invalid chunked volume " + file_name);
+    }
+    _header.format = header.format;
+    _header.bytes_per_voxel = header.bytes_per_voxel;
+    std::copy(std::begin(header.volume_res), std::end(header.volume_res),
+              _header.volume_res.begin());
+    std::copy(std::begin(header.slice_thickness), std::end(header.slice_thickness),
+              _header.slice_thickness.begin());
+    _header.timesteps = header.timesteps;
+    _header.chunk_size = header.chunk_size;
+    _header.codec = header.codec;
+
+    const size_t indexSize = size_t(header.timesteps) * (sizeof(TimestepEntry)
+                                                         + num_chunks() * sizeof(ChunkEntry));
+    if (header.index_offset + indexSize > _mapping.size())
+    {
+        close();
+        throw std::runtime_error("Truncated chunked volume " + file_name);
+    }
+    const char *index = _mapping.data() + header.index_offset;
+    _timesteps.resize(header.timesteps);
+    for (Timestep &t : _timesteps)
+    {
+        TimestepEntry entry;
+        std::memcpy(&entry, index, sizeof(TimestepEntry));
+        index += sizeof(TimestepEntry);
+        t.min_value = entry.min_value;
+        t.max_value = entry.max_value;
+        std::copy(std::begin(entry.histogram), std::end(entry.histogram), t.histogram.begin());
+    }
+    _chunks.resize(size_t(header.timesteps) * num_chunks());
+    for (Chunk &c : _chunks)
+    {
+        ChunkEntry entry;
+        std::memcpy(&entry, index, sizeof(ChunkEntry));
+        index += sizeof(ChunkEntry);
+        if (entry.offset + entry.size > header.index_offset)
+        {
+            close();
+            throw std::runtime_error("Invalid chunk index in " + file_name);
+        }
+        c.offset = entry.offset;
+        c.size = entry.size;
+        c.min_value = entry.min_value;
+        c.max_value = entry.max_value;
+    }
+    std::cout << "Opened chunked volume with " << _chunks.size() << " chunks of "
+              << _header.chunk_size << "^3 voxels." << std::endl;
+}
+
+/*
+ * ChunkedVolume::close
+ */
+void ChunkedVolume::close()
+{
+    _mapping.close();
+    _timesteps.clear();
+    _chunks.clear();
+}
+
+/*
+ * ChunkedVolume::read_chunk
+ */
+void ChunkedVolume::read_chunk(const size_t t, const size_t c, char *dst) const
+{
+    const Chunk &entry = chunk(t, c);
+    const size_t chunkBytes = _header.chunk_bytes();
+    const char *src = _mapping.data() + entry.offset;
+    if (entry.size == chunkBytes)
+        std::memcpy(dst, src, chunkBytes);
+    else if (!lz4Decompress(src, entry.size, dst, chunkBytes))
+        throw std::runtime_error("Corrupt chunk " + std::to_string(c) + " of timestep "
+                                 + std::to_string(t));
+}
+
+/*
+ * ChunkedVolume::read_volume
+ */
+void ChunkedVolume::read_volume(const size_t t, char *dst) const
+{
+    const std::array<uint32_t, 3> res = _header.chunk_res();
+    const std::array<uint32_t, 3> &volRes = _header.volume_res;
+    const size_t cs = _header.chunk_size;
+    const size_t slot = cs + 2;
+    const size_t bpv = _header.bytes_per_voxel;
+    const long long numChunks = static_cast<long long>(num_chunks());
+    bool corrupt = false;
+#pragma omp parallel
+    {
+        std::vector<char> chunk(_header.chunk_bytes());
+#pragma omp for schedule(dynamic)
+        for (long long c = 0; c < numChunks; ++c)
+        {
+            try
+            {
+                read_chunk(t, size_t(c), chunk.data());
+            }
+            catch (const std::runtime_error &)
+            {
+                corrupt = true;
+                continue;
+            }
+            const std::array<size_t, 3> origin = {{
+                    (size_t(c) % res.at(0)) * cs,
+                    ((size_t(c) / res.at(0)) % res.at(1)) * cs,
+                    (size_t(c) / (size_t(res.at(0)) * res.at(1))) * cs}};
+            // copy the rows of the chunk without the apron, clipped at the volume borders
+            const size_t width = std::min(cs, volRes.at(0) - origin.at(0));
+            for (size_t z = 0; z < std::min(cs, volRes.at(2) - origin.at(2)); ++z)
+            {
+                for (size_t y = 0; y < std::min(cs, volRes.at(1) - origin.at(1)); ++y)
+                {
+                    const size_t src = (((z + 1) * slot + y + 1) * slot + 1) * bpv;
+                    const size_t dstRow = ((origin.at(2) + z) * volRes.at(1) + origin.at(1) + y)
+                                          * volRes.at(0) + origin.at(0);
+                    std::memcpy(dst + dstRow * bpv, chunk.data() + src, width * bpv);
+                }
+            }
+        }
+    }
+    if (corrupt)
+        throw std::runtime_error("Corrupt chunks in timestep " + std::to_string(t));
+}
@@ -0,0 +1,179 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+#include "src/io/mappedfile.h"
+
+/// <summary>
+/// Chunked and compressed volume container (".cvol").
+/// Each time step is split into cubic chunks that are stored independently, so they can be
+/// decompressed in parallel and read selectively. A chunk holds chunk_size^3 voxels and a
+/// one voxel apron (clamped to edge at the volume borders), i.e. exactly the slot of a brick
+/// in the bricked mode of the renderer if chunk_size equals its brick size. The voxels are
+/// stored normalized as in the preprocessing of DatRawReader, in little endian byte order
+/// and x fastest. Chunks are compressed in the LZ4 block format, chunks that do not compress
+/// are stored as is. An index at the end of the file holds the data range and histogram of
+/// each time step and the offset, size and value range of each chunk.
+/// </summary>
+class ChunkedVolume
+{
+public:
+    enum codec
+    {
+          CODEC_STORED = 0
+        , CODEC_LZ4
+    };
+
+    /// <summary>
+    /// Layout of the container.
+    /// </summary>
+    struct Header
+    {
+        uint32_t format = 0;                // DatRawReader::data_format of the voxels
+        uint32_t bytes_per_voxel = 1;
+        std::array<uint32_t, 3> volume_res = {{0, 0, 0}};
+        std::array<double, 3> slice_thickness = {{1.0, 1.0, 1.0}};
+        uint32_t timesteps = 0;
+        uint32_t chunk_size = 32;           // voxels per chunk edge without the apron
+        uint32_t codec = CODEC_LZ4;
+
+        /// <summary>
+        /// Get the number of chunks in each dimension.
+        /// </summary>
+        std::array<uint32_t, 3> chunk_res() const;
+
+        /// <summary>
+        /// Get the size in bytes of a decompressed chunk including the apron.
+        /// </summary>
+        size_t chunk_bytes() const;
+    };
+
+    /// <summary>
+    /// Data range and histogram of a time step.
+    /// </summary>
+    struct Timestep
+    {
+        float min_value = 0.f;              // range of the raw values before normalization
+        float max_value = 1.f;
+        std::array<double, 256> histogram = {{0}};
+    };
+
+    /// <summary>
+    /// Location and normalized value range (including the apron) of a chunk.
+    /// </summary>
+    struct Chunk
+    {
+        uint64_t offset = 0;
+        uint32_t size = 0;                  // compressed size, chunk_bytes if stored
+        float min_value = 0.f;
+        float max_value = 0.f;
+    };
+
+    /// <summary>
+    /// Writes a container one time step after the other.
+    /// </summary>
+    class Writer
+    {
+    public:
+        /// <summary>
+        /// Create the container file.
+        /// </summary>
+        /// <param name="file_name">Name and full path of the container.</param>
+        /// <param name="header">Layout of the container.</param>
+        /// <throws>If the file could not be created.</throws>
+        Writer(const std::string &file_name, const Header &header);
+
+        /// <summary>
+        /// Split, compress and append a time step.
+        /// </summary>
+        /// <param name="volume">Normalized voxel data of the whole volume.</param>
+        /// <param name="timestep">Data range and histogram of the time step.</param>
+        /// <throws>If the time step could not be written.</throws>
+        void append(const char *volume, const Timestep &timestep);
+
+        /// <summary>
+        /// Write the index and the header, all time steps must have been appended.
+        /// </summary>
+        /// <throws>If the file could not be written.</throws>
+        void finish();
+
+    private:
+        std::string _file_name;
+        std::ofstream _os;
+        Header _header;
+        std::vector<Timestep> _timesteps;
+        std::vector<Chunk> _chunks;
+        uint64_t _offset = 0;
+    };
+
+    /// <summary>
+    /// Map a container and read its index.
+    /// </summary>
+    /// <param name="file_name">Name and full path of the container.</param>
+    /// <throws>If the file could not be mapped or is not a valid container.</throws>
+    void open(const std::string &file_name);
+
+    /// <summary>
+    /// Get the status of the container.
+    /// </summary>
+    bool is_open() const { return _mapping.is_open(); }
+
+    /// <summary>
+    /// Unmap the container.
+    /// </summary>
+    void close();
+
+    const Header &header() const { return _header; }
+    const Timestep &timestep(size_t t) const { return _timesteps.at(t); }
+    const Chunk &chunk(size_t t, size_t c) const { return _chunks.at(t * num_chunks() + c); }
+    size_t num_chunks() const;
+
+    /// <summary>
+    /// Decompress a chunk including its apron. Can be called from any thread.
+    /// </summary>
+    /// <param name="t">Index of the time step.</param>
+    /// <param name="c">Index of the chunk, x fastest.</param>
+    /// <param name="dst">Destination of chunk_bytes bytes.</param>
+    /// <throws>If the chunk is corrupt.</throws>
+    void read_chunk(size_t t, size_t c, char *dst) const;
+
+    /// <summary>
+    /// Decompress all chunks of a time step in parallel into a dense volume.
+    /// </summary>
+    /// <param name="t">Index of the time step.</param>
+    /// <param name="dst">Destination of volume_res^3 * bytes_per_voxel bytes.</param>
+    /// <throws>If a chunk is corrupt.</throws>
+    void read_volume(size_t t, char *dst) const;
+
+private:
+    MappedFile _mapping;
+    Header _header;
+    std::vector<Timestep> _timesteps;
+    std::vector<Chunk> _chunks;
+};
@@ -29,9 +29,17 @@
 #include <array>
 #include <algorithm>
 #include <iterator>
+#include <numeric>
 #include <cassert>
 #include <math.h>
 #include <chrono>
+#include <cstring>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <exception>
 
 // OpenMP 3.1 is required (_OPENMP >= 201107) for parallel reductions with min/max.
 #include <omp.h>
@@ -41,7 +49,7 @@ typedef unsigned char uchar;
 /*
  * DatRawReader::read_files
  */
-void DatRawReader::read_files(Properties volume_properties)
+void DatRawReader::read_files(Properties volume_properties, const size_t max_timesteps)
 {
     // check file
     if (volume_properties.dat_file_name.empty() && volume_properties.raw_file_names.empty())
@@ -50,15 +58,24 @@ void DatRawReader::read_files(Properties volume_properties)
     try
     {
         this->_prop = volume_properties;
-        // check if we have a dat file where the binary files are specified
-        if (volume_properties.raw_file_names.empty())
+        _chunked.close();
+        const std::string &name = _prop.dat_file_name;
+        // check if we have a chunked volume or a dat file where the binary files are specified
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".cvol") == 0)
+            this->read_chunked(name);
+        else if (volume_properties.raw_file_names.empty())
             this->read_dat(_prop.dat_file_name);
 
         this->_raw_data.clear();
         this->_histograms.clear();
-        for (size_t i = 0; i < _prop.raw_file_names.size(); ++i)
+        const size_t num_files = std::min(_prop.raw_file_names.size(), std::max(max_timesteps,
+                                                                                 size_t(1)));
+        for (size_t i = 0; i < num_files; ++i)
         {
-            read_raw(_prop.raw_file_names.at(i));
+            if (_chunked.is_open())
+                store_timestep(chunked_timestep(i));
+            else
+                read_raw(_prop.raw_file_names.at(i));
             std::cout << "Read " << i+1 << "/" << _prop.raw_file_names.size() << std::endl;
         }
     }
@@ -81,13 +98,268 @@ bool DatRawReader::has_data() const
 /*
  * DatRawReader::data
  */
-const std::vector<std::vector<char> > & DatRawReader::data() const
+const char *DatRawReader::data(const size_t timestep) const
 {
     if (!has_data())
     {
         throw std::runtime_error("No data available.");
     }
-    return _raw_data;
+    RawData &raw_timestep = _raw_data.at(timestep);
+    if (_chunked.is_open() && raw_timestep.buffer.empty())
+    {
+        raw_timestep.buffer.resize(_prop.raw_file_size);
+        _chunked.read_volume(timestep, raw_timestep.buffer.data());
+    }
+    return raw_timestep.data();
+}
+
+
+/*
+ * DatRawReader::data_size
+ */
+size_t DatRawReader::data_size(const size_t timestep) const
+{
+    if (!has_data())
+    {
+        throw std::runtime_error("No data available.");
+    }
+    if (_chunked.is_open())
+        return _prop.raw_file_size;
+    return _raw_data.at(timestep).size();
+}
+
+
+/*
+ * DatRawReader::num_timesteps
+ */
+size_t DatRawReader::num_timesteps() const
+{
+    return _raw_data.size();
+}
+
+
+/*
+ * DatRawReader::read_remaining_timesteps
+ */
+void DatRawReader::read_remaining_timesteps()
+{
+    // only the index of a chunked volume is read, the data is decompressed on first access
+    if (_chunked.is_open())
+    {
+        for (size_t i = _raw_data.size(); i < _prop.raw_file_names.size(); ++i)
+            store_timestep(chunked_timestep(i));
+        return;
+    }
+    if (_raw_data.empty())
+    {
+        read_raw(_prop.raw_file_names.at(0));
+        std::cout << "Read 1/" << _prop.raw_file_names.size() << std::endl;
+    }
+    // the time steps complete in any order, keep them until they can be appended
+    const size_t first = _raw_data.size();
+    std::vector<size_t> timesteps(_prop.raw_file_names.size() - first);
+    std::iota(timesteps.begin(), timesteps.end(), first);
+    std::vector<RawData> remaining(timesteps.size());
+    size_t count = first;
+    read_timesteps(timesteps, [&](size_t t, RawData &raw_timestep)
+    {
+        remaining.at(t - first) = std::move(raw_timestep);
+        std::cout << "Read " << ++count << "/" << _prop.raw_file_names.size() << std::endl;
+    });
+    for (auto &raw_timestep : remaining)
+        store_timestep(std::move(raw_timestep));
+}
+
+
+/*
+ * DatRawReader::read_timesteps
+ */
+void DatRawReader::read_timesteps(const std::vector<size_t> &timesteps,
+                                  const timestep_consumer &consumer) const
+{
+    for (const size_t t : timesteps)
+        if (t >= _prop.raw_file_names.size())
+            throw std::invalid_argument("Invalid timestep.");
+    if (timesteps.empty())
+        return;
+
+    size_t workers = _io_workers;
+    if (workers == 0)
+        workers = std::min(4u, std::max(1u, std::thread::hardware_concurrency()));
+    workers = std::min(workers, timesteps.size());
+    const size_t buffers = _staging_buffers ? _staging_buffers : workers + 1;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    // staging buffers that are not in use, and the number of time steps that may be read
+    std::deque<std::vector<char> > pool(buffers);
+    size_t freeSlots = buffers;
+    std::deque<std::pair<size_t, RawData> > ready;
+    size_t next = 0;
+    size_t running = workers;
+    std::exception_ptr error;
+
+    const auto read = [&]()
+    {
+#ifdef _OPENMP
+        // share the cores among the conversions of concurrent workers
+        omp_set_num_threads(std::max(1, omp_get_num_procs() / int(workers)));
+#endif
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            cv.wait(lock, [&]{ return freeSlots > 0 || error; });
+            if (error || next >= timesteps.size())
+                break;
+            const size_t t = timesteps.at(next++);
+            --freeSlots;
+            std::vector<char> buffer = std::move(pool.front());
+            pool.pop_front();
+            lock.unlock();
+            try
+            {
+                RawData raw_timestep = load_timestep(t, std::move(buffer));
+                lock.lock();
+                ready.push_back(std::make_pair(t, std::move(raw_timestep)));
+            }
+            catch (...)
+            {
+                lock.lock();
+                error = std::current_exception();
+            }
+            cv.notify_all();
+        }
+        --running;
+        cv.notify_all();
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers; ++i)
+        threads.push_back(std::thread(read));
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (size_t consumed = 0; consumed < timesteps.size(); ++consumed)
+    {
+        cv.wait(lock, [&]{ return !ready.empty() || error || running == 0; });
+        if (error || ready.empty())
+            break;
+        std::pair<size_t, RawData> item = std::move(ready.front());
+        ready.pop_front();
+        lock.unlock();
+        try
+        {
+            consumer(item.first, item.second);
+        }
+        catch (...)
+        {
+            lock.lock();
+            error = std::current_exception();
+            cv.notify_all();
+            break;
+        }
+        lock.lock();
+        // the data is released (or kept by the consumer), the buffer is reused
+        pool.push_back(std::move(item.second.buffer));
+        ++freeSlots;
+        cv.notify_all();
+    }
+    lock.unlock();
+    for (auto &thread : threads)
+        thread.join();
+    if (error)
+        std::rethrow_exception(error);
+}
+
+
+/*
+ * DatRawReader::read_timestep
+ */
+DatRawReader::RawData DatRawReader::read_timestep(const size_t timestep) const
+{
+    if (timestep >= _prop.raw_file_names.size())
+        throw std::invalid_argument("Invalid timestep.");
+    return load_timestep(timestep, std::vector<char>());
+}
+
+
+/*
+ * DatRawReader::load_timestep
+ */
+DatRawReader::RawData DatRawReader::load_timestep(const size_t timestep,
+                                                  std::vector<char> buffer) const
+{
+    if (!_chunked.is_open())
+        return load_raw(_prop.raw_file_names.at(timestep), std::move(buffer));
+    RawData raw_timestep = chunked_timestep(timestep);
+    raw_timestep.buffer = std::move(buffer);
+    raw_timestep.buffer.resize(_prop.raw_file_size);
+    _chunked.read_volume(timestep, raw_timestep.buffer.data());
+    return raw_timestep;
+}
+
+
+/*
+ * DatRawReader::set_memory_mapping
+ */
+void DatRawReader::set_memory_mapping(const bool use_mapping)
+{
+    _use_mapping = use_mapping;
+}
+
+
+/*
+ * DatRawReader::set_cache
+ */
+void DatRawReader::set_cache(const bool use_cache)
+{
+    _use_cache = use_cache;
+}
+
+
+/*
+ * DatRawReader::set_io_workers
+ */
+void DatRawReader::set_io_workers(const size_t workers)
+{
+    _io_workers = workers;
+}
+
+
+/*
+ * DatRawReader::set_staging_buffers
+ */
+void DatRawReader::set_staging_buffers(const size_t buffers)
+{
+    _staging_buffers = buffers;
+}
+
+
+/*
+ * DatRawReader::read_brick_grid
+ */
+bool DatRawReader::read_brick_grid(const size_t timestep, const std::array<uint32_t, 4> &grid_type,
+                                   const std::array<uint32_t, 3> &grid_res,
+                                   std::vector<char> &grid) const
+{
+    VolumeCache::Key key;
+    const std::string name_with_path = raw_path(_prop.raw_file_names.at(timestep));
+    // all time steps of a chunked volume share one file, its chunks hold the value ranges
+    if (_chunked.is_open() || !cache_key(name_with_path, key))
+        return false;
+    return VolumeCache::load_bricks(name_with_path, key, grid_type, grid_res, grid);
+}
+
+
+/*
+ * DatRawReader::write_brick_grid
+ */
+void DatRawReader::write_brick_grid(const size_t timestep, const std::array<uint32_t, 4> &grid_type,
+                                    const std::array<uint32_t, 3> &grid_res,
+                                    const std::vector<char> &grid) const
+{
+    VolumeCache::Key key;
+    const std::string name_with_path = raw_path(_prop.raw_file_names.at(timestep));
+    if (!_chunked.is_open() && cache_key(name_with_path, key))
+        VolumeCache::store_bricks(name_with_path, key, grid_type, grid_res, grid);
 }
 
 /**
@@ -110,6 +382,114 @@ void DatRawReader::clearData()
 {
     _raw_data.clear();
     _histograms.clear();
+    _chunked.close();
+}
+
+
+/*
+ * DatRawReader::chunk_size
+ */
+size_t DatRawReader::chunk_size() const
+{
+    return _chunked.is_open() ? _chunked.header().chunk_size : 0;
+}
+
+
+/*
+ * DatRawReader::read_chunk
+ */
+void DatRawReader::read_chunk(const size_t timestep, const size_t chunk, char *dst) const
+{
+    if (!_chunked.is_open())
+        throw std::runtime_error("No chunked volume available.");
+    _chunked.read_chunk(timestep, chunk, dst);
+}
+
+
+/*
+ * DatRawReader::chunk_range
+ */
+std::array<float, 2> DatRawReader::chunk_range(const size_t timestep, const size_t chunk) const
+{
+    const ChunkedVolume::Chunk &c = _chunked.chunk(timestep, chunk);
+    return {{c.min_value, c.max_value}};
+}
+
+
+/*
+ * DatRawReader::write_chunked
+ */
+void DatRawReader::write_chunked(const std::string &file_name, const uint32_t chunk_size) const
+{
+    if (!has_data())
+        throw std::runtime_error("No data available.");
+    const std::string &co = _prop.image_channel_order;
+    if (_prop.format == DOUBLE || !(co == "R" || co == "" || co == "I" || co == "LUMINANCE"))
+        throw std::invalid_argument("Only single channel UCHAR, USHORT and FLOAT data can be "
+                                    "written as chunked volume.");
+    ChunkedVolume::Header header;
+    header.format = static_cast<uint32_t>(_prop.format);
+    header.bytes_per_voxel = _prop.format == FLOAT ? 4 : (_prop.format == USHORT ? 2 : 1);
+    std::copy(_prop.volume_res.begin(), _prop.volume_res.begin() + 3, header.volume_res.begin());
+    header.slice_thickness = _prop.slice_thickness;
+    header.chunk_size = chunk_size;
+    header.codec = ChunkedVolume::CODEC_LZ4;
+
+    ChunkedVolume::Writer writer(file_name, header);
+    const size_t num_files = _prop.raw_file_names.size();
+    for (size_t t = 0; t < num_files; ++t)
+    {
+        RawData raw_timestep;
+        const RawData &src = t < _raw_data.size() ? _raw_data.at(t)
+                                                  : (raw_timestep = read_timestep(t));
+        const char *volume = t < _raw_data.size() ? data(t) : raw_timestep.data();
+        if (src.size() < _prop.raw_file_size)
+            throw std::runtime_error("Volume size does not match size specified in dat file.");
+        ChunkedVolume::Timestep info;
+        info.min_value = src.min_value;
+        info.max_value = src.max_value;
+        info.histogram = src.histogram;
+        writer.append(volume, info);
+        std::cout << "Wrote " << t + 1 << "/" << num_files << std::endl;
+    }
+    writer.finish();
+}
+
+
+/*
+ * DatRawReader::read_chunked
+ */
+void DatRawReader::read_chunked(const std::string &file_name)
+{
+    _chunked.open(file_name);
+    const ChunkedVolume::Header &header = _chunked.header();
+    if (header.timesteps == 0 || header.format >= DOUBLE)
+        throw std::runtime_error("Empty or invalid chunked volume " + file_name);
+    _prop.format = static_cast<data_format>(header.format);
+    _prop.endianness = LITTLE;
+    _prop.image_channel_order = "R";
+    std::copy(header.volume_res.begin(), header.volume_res.end(), _prop.volume_res.begin());
+    _prop.volume_res.at(3) = header.timesteps;
+    _prop.slice_thickness = header.slice_thickness;
+    _prop.time_series = header.timesteps;
+    // one entry per time step to count them, all refer to the container
+    _prop.raw_file_names.assign(header.timesteps, file_name);
+    _prop.raw_file_size = size_t(header.volume_res.at(0)) * header.volume_res.at(1)
+                          * header.volume_res.at(2) * header.bytes_per_voxel;
+}
+
+
+/*
+ * DatRawReader::chunked_timestep
+ */
+DatRawReader::RawData DatRawReader::chunked_timestep(const size_t timestep) const
+{
+    RawData raw_timestep;
+    const ChunkedVolume::Timestep &info = _chunked.timestep(timestep);
+    raw_timestep.histogram = info.histogram;
+    raw_timestep.min_value = info.min_value;
+    raw_timestep.max_value = info.max_value;
+    return raw_timestep;
 }
 
 
@@ -268,174 +648,123 @@ inline static void endswap(T *objp)
     std::reverse(memp, memp + sizeof(T));
 }
 
-/**
- * @brief Parallelly determine maximum value from a vector of chars.
- * @param dataset
- * @return minimum
+/*
+ * DatRawReader::raw_path
  */
-static float getMaximumUshort(const std::vector<unsigned short> &dataset)
+std::string DatRawReader::raw_path(const std::string &raw_file_name) const
 {
-    float maximum = std::numeric_limits<float>::min();
-#if _OPENMP >= 201107
-    #pragma omp parallel for reduction(max:maximum)
-#endif
-    for (size_t i = 0; i < dataset.size(); ++i)
-        maximum = std::max(maximum, float(dataset.at(i)));
-    return maximum;
+    // append .raw file name to .dat file name path
+    std::size_t found = _prop.dat_file_name.find_last_of("/\\");
+    if (found != std::string::npos && _prop.dat_file_name.size() >= found)
+        return _prop.dat_file_name.substr(0, found + 1) + raw_file_name;
+    return raw_file_name;
 }
 
-/**
- * @brief Parallelly determine minimum value from a vector of chars.
- * @param dataset
- * @return minimum
+/*
+ * DatRawReader::cache_key
  */
-static float getMinimum(const std::vector<char> &dataset)
+bool DatRawReader::cache_key(const std::string &name_with_path, VolumeCache::Key &key) const
 {
-    float minimum = std::numeric_limits<float>::max();
-#if _OPENMP >= 201107
-    #pragma omp parallel for reduction(min:minimum)
-#endif
-    for (size_t i = 0; i < dataset.size(); ++i)
-        minimum = std::min(minimum, float(static_cast<unsigned char>(dataset.at(i))));
-    return minimum;
+    if (!_use_cache)
+        return false;
+    key.format = static_cast<uint32_t>(_prop.format);
+    key.endianness = static_cast<uint32_t>(_prop.endianness);
+    std::copy(_prop.volume_res.begin(), _prop.volume_res.begin() + 3, key.volume_res.begin());
+    return VolumeCache::stat_key(name_with_path, key);
 }
 
 /*
- * DatRawReader::read_raw
+ * DatRawReader::load_raw
  */
-void DatRawReader::read_raw(const std::string &raw_file_name)
+DatRawReader::RawData DatRawReader::load_raw(const std::string &raw_file_name,
+                                             std::vector<char> buffer) const
 {
     if (raw_file_name.empty())
         throw std::invalid_argument("Raw file name must not be empty.");
+    const std::string name_with_path = raw_path(raw_file_name);
 
-    // append .raw file name to .dat file name path
-    std::size_t found = _prop.dat_file_name.find_last_of("/\\");
-    std::string name_with_path;
-    if (found != std::string::npos && _prop.dat_file_name.size() >= found)
-        name_with_path = _prop.dat_file_name.substr(0, found + 1) + raw_file_name;
-    else
-        name_with_path = raw_file_name;
-
-    // use plain old C++ method for file read here that is much faster than iterator
-    // based approaches according to:
-    // http://insanecoding.blogspot.de/2011/11/how-to-read-in-file-in-c.html
-    std::ifstream is(name_with_path, std::ios::in | std::ifstream::binary);
-    if (is)
+    RawData raw_timestep;
+    VolumeCache::Key key;
+    const bool use_cache = cache_key(name_with_path, key);
+    VolumeCache::Entry entry;
+    const bool cached = use_cache && VolumeCache::load(name_with_path, key,
+                                                       raw_timestep.mapping, entry);
+    if (cached)
     {
-        // get length of file:
-        is.seekg(0, is.end);
-        _prop.raw_file_size = static_cast<size_t>(is.tellg());
-        is.seekg(0, is.beg);
-
-        // read data as a block:
-        std::vector<char> raw_timestep;
-        raw_timestep.resize(_prop.raw_file_size);
-
-        size_t histo[256] = {0};
-//        float minimum = std::numeric_limits<float>::max();
-        float maximum = std::numeric_limits<float>::min();
-
-        // assume UCHAR if no format is given
-        if (_prop.format == UNKNOWN_FORMAT)
-        {
-            std::cout << "WARNING: Format could not be determined, assuming UCHAR" << std::endl;
-            _prop.format = UCHAR;
-        }
-        else if (_prop.format == FLOAT)
+        raw_timestep.histogram = entry.histogram;
+        raw_timestep.min_value = entry.min_value;
+        raw_timestep.max_value = entry.max_value;
+        if (entry.payload_size > 0)
         {
-            std::vector<float> floatdata(_prop.raw_file_size / sizeof(float));
-            is.read(reinterpret_cast<char*>(floatdata.data()),
-                    static_cast<std::streamsize>(_prop.raw_file_size));
-#if _OPENMP >= 201107
-            #pragma omp parallel for reduction(max:maximum)
-#endif
-            for (size_t i = 0; i < floatdata.size(); ++i)
-            {
-                // change endianness to big endian if needed
-                if (_prop.endianness == BIG)
-                    endswap(&floatdata.at(i));
-                maximum = std::max(maximum, floatdata.at(i));
-            }
-            _prop.max_value = maximum;
-#if _OPENMP >= 201107
-            #pragma omp parallel for reduction(+:histo)
-#endif
-            for (size_t i = 0; i < floatdata.size(); ++i)
-            {
-                floatdata.at(i) /= maximum;
-                size_t bin = static_cast<size_t>(round(floatdata.at(i) * 255.f));
-                bin = std::min(bin, 255ul);
-                histo[bin]++;
-                char *memp = reinterpret_cast<char*>(&floatdata.at(i));
-                for (size_t j = 0; j < 4; ++j)
-                    raw_timestep[i*4 + j] = (*(memp + j));
-            }
-//            #pragma omp parallel for reduction(min:minimum)
-//            for (size_t i = 0; i < floatdata.size(); ++i)
-//                minimum = std::min(minimum, floatdata.at(i));
-            _prop.min_value = 0.f; //minimum;
-            std::cout << "Data range: [" << _prop.min_value << ".." << _prop.max_value
-                      << "]" << std::endl;
+            // preprocessed voxel data is mapped from the cache file
+            raw_timestep.offset = static_cast<size_t>(entry.payload_offset);
+            raw_timestep.length = static_cast<size_t>(entry.payload_size);
+            return raw_timestep;
         }
-        else if (_prop.format == UCHAR)
+        // otherwise no conversion is necessary and the raw file itself is used
+    }
+
+    if (_use_mapping)
+    {
+        try
         {
-            is.read(reinterpret_cast<char*>(raw_timestep.data()),
-                    static_cast<std::streamsize>(_prop.raw_file_size));
-            _prop.min_value = 0.f;
-            _prop.max_value = 255.f;
-#if _OPENMP >= 201107
-            #pragma omp parallel for reduction(+:histo)
-#endif
-            for (size_t i = 0; i < raw_timestep.size(); ++i)
-            {
-                float value = float(uchar(raw_timestep[i]));
-                histo[size_t(std::clamp(value, 0.f, 255.f))]++;
-            }
+            raw_timestep.mapping = MappedFile(name_with_path);
+            raw_timestep.length = raw_timestep.mapping.size();
         }
-        else if (_prop.format == USHORT)
+        catch (std::runtime_error e)
         {
-            std::vector<unsigned short> ushortdata(_prop.raw_file_size / sizeof(unsigned short));
-            is.read(reinterpret_cast<char*>(ushortdata.data()),
-                    static_cast<std::streamsize>(_prop.raw_file_size));
-            _prop.min_value = 0.f;      // getMinimum(raw_timestep);
-            _prop.max_value = getMaximumUshort(ushortdata);
-            std::cout << "Data range: [" << _prop.min_value << ".." << _prop.max_value
-                      << "]" << std::endl;
-#if _OPENMP >= 201107
-            #pragma omp parallel for reduction(+:histo)
-#endif
-            for (size_t i = 0; i < ushortdata.size(); ++i)
-            {
-                float stretch = std::numeric_limits<unsigned short>::max()/float(_prop.max_value);
-                ushortdata.at(i) = static_cast<unsigned short>(round(ushortdata.at(i)*stretch));
-                histo[size_t(std::clamp(ushortdata.at(i)/256.f, 0.f, 255.f))]++;
-                char *memp = reinterpret_cast<char*>(&ushortdata.at(i));
-
-                if (_prop.endianness == BIG)
-                {
-                    raw_timestep[i*2 + 1] = (*(memp + 0));
-                    raw_timestep[i*2 + 0] = (*(memp + 1));
-                }
-                else    // default is little endian
-                {
-                    raw_timestep[i*2 + 0] = (*(memp + 0));
-                    raw_timestep[i*2 + 1] = (*(memp + 1));
-                }
-            }
+            std::cerr << "WARNING: " << e.what() << ", reading file instead." << std::endl;
         }
-
-        std::array<double, 256> a;
-        std::copy(std::begin(histo), std::end(histo), std::begin(a));
-        _histograms.push_back(std::move(a));
-        _raw_data.push_back(std::move(raw_timestep));
+    }
+    if (!raw_timestep.mapping.is_open())
+    {
+        // use plain old C++ method for file read here that is much faster than iterator
+        // based approaches according to:
+        // http://insanecoding.blogspot.de/2011/11/how-to-read-in-file-in-c.html
+        std::ifstream is(name_with_path, std::ios::in | std::ifstream::binary);
+        if (!is)
+            throw std::runtime_error("Could not open " + raw_file_name);
+        // get length of file:
+        is.seekg(0, is.end);
+        raw_timestep.buffer = std::move(buffer);
+        raw_timestep.buffer.resize(static_cast<size_t>(is.tellg()));
+        is.seekg(0, is.beg);
+        // read data as a block:
+        is.read(raw_timestep.buffer.data(),
+                static_cast<std::streamsize>(raw_timestep.buffer.size()));
         if (!is)
             throw std::runtime_error("Error reading " + raw_file_name);
         is.close();
     }
-    else
+    if (cached)
+        return raw_timestep;
+    convert_raw(raw_timestep);
+
+    if (use_cache)
+    {
+        entry.histogram = raw_timestep.histogram;
+        entry.min_value = raw_timestep.min_value;
+        entry.max_value = raw_timestep.max_value;
+        entry.payload_size = raw_timestep.size();
+        // UCHAR data is not modified, only cache its histogram
+        VolumeCache::store(name_with_path, key, entry,
+                           _prop.format == UCHAR ? nullptr : raw_timestep.data());
+    }
+    return raw_timestep;
+}
+
+/*
+ * DatRawReader::read_raw
+ */
+void DatRawReader::read_raw(const std::string &raw_file_name)
+{
+    // assume UCHAR if no format is given
+    if (_prop.format == UNKNOWN_FORMAT)
     {
-        throw std::runtime_error("Could not open " + raw_file_name);
+        std::cout << "WARNING: Format could not be determined, assuming UCHAR" << std::endl;
+        _prop.format = UCHAR;
     }
+    store_timestep(load_raw(raw_file_name));
 
     // if resolution was not specified, try to calculate from file size
     if (!_raw_data.empty() && std::any_of(std::begin(_prop.volume_res),
@@ -476,6 +805,239 @@ void DatRawReader::read_raw(const std::string &raw_file_name)
     }
 }
 
+/*
+ * DatRawReader::store_timestep
+ */
+void DatRawReader::store_timestep(RawData raw_timestep)
+{
+    // time steps of a chunked volume are stored without data, see read_chunked
+    if (!_chunked.is_open())
+        _prop.raw_file_size = raw_timestep.size();
+    _prop.min_value = std::min(_prop.min_value, raw_timestep.min_value);
+    _prop.max_value = std::max(_prop.max_value, raw_timestep.max_value);
+    _histograms.push_back(raw_timestep.histogram);
+    _raw_data.push_back(std::move(raw_timestep));
+}
+
+// voxels per block of the preprocessing sweeps, a block of FLOAT data fits into the L2 cache
+static const size_t BLOCK_SIZE = size_t(1) << 16;
+
+/**
+ * @brief Swap the byte order of a two or four byte value with shifts only, so that the loops
+ *        over a block can be vectorized.
+ */
+inline static uint16_t byteswap(const uint16_t v)
+{
+    return uint16_t((v >> 8) | (v << 8));
+}
+
+inline static uint32_t byteswap(const uint32_t v)
+{
+    return (v >> 24) | ((v >> 8) & 0xff00u) | ((v << 8) & 0xff0000u) | (v << 24);
+}
+
+/**
+ * @brief Swap the byte order of all values of a block in place.
+ */
+template <class T, class U>
+static void swapBlock(T *values, const size_t count)
+{
+    static_assert(sizeof(T) == sizeof(U), "Swapped type must have the same size.");
+    // memcpy instead of reinterpret_cast to respect strict aliasing, optimized away
+#if _OPENMP >= 201307
+    #pragma omp simd
+#endif
+    for (size_t i = 0; i < count; ++i)
+    {
+        U u;
+        std::memcpy(&u, values + i, sizeof(U));
+        u = byteswap(u);
+        std::memcpy(values + i, &u, sizeof(U));
+    }
+}
+
+static void swapBlock(unsigned short *values, const size_t count)
+{
+    swapBlock<unsigned short, uint16_t>(values, count);
+}
+
+static void swapBlock(uchar *, const size_t)
+{
+}
+
+/**
+ * @brief Map a USHORT value from [0, max] to the full range of the data type.
+ */
+inline static unsigned short stretchUshort(const unsigned short v, const float stretch)
+{
+    return static_cast<unsigned short>(std::min(float(v) * stretch + 0.5f, 65535.f));
+}
+
+/**
+ * @brief First sweep over the blocks of FLOAT data: swap the byte order and determine the
+ *        data range.
+ */
+static void sweepFloat(float *values, const size_t count, const bool swap,
+                       float &minimum, float &maximum)
+{
+    const size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    float lo = std::numeric_limits<float>::max();
+    float hi = std::numeric_limits<float>::lowest();
+#if _OPENMP >= 201107
+    #pragma omp parallel for schedule(static) reduction(min:lo) reduction(max:hi)
+#endif
+    for (size_t b = 0; b < blocks; ++b)
+    {
+        float *block = values + b * BLOCK_SIZE;
+        const size_t n = std::min(BLOCK_SIZE, count - b * BLOCK_SIZE);
+        if (swap)
+            swapBlock<float, uint32_t>(block, n);
+        float blockLo = lo;
+        float blockHi = hi;
+        // NaNs are skipped: the comparisons are false
+#if _OPENMP >= 201307
+        #pragma omp simd reduction(min:blockLo) reduction(max:blockHi)
+#endif
+        for (size_t i = 0; i < n; ++i)
+        {
+            blockLo = block[i] < blockLo ? block[i] : blockLo;
+            blockHi = block[i] > blockHi ? block[i] : blockHi;
+        }
+        lo = std::min(lo, blockLo);
+        hi = std::max(hi, blockHi);
+    }
+    minimum = lo;
+    maximum = hi;
+}
+
+/**
+ * @brief First sweep over the blocks of integer data: swap the byte order and count the
+ *        values in thread-local histograms with one bin per value.
+ */
+template <class T>
+static std::vector<size_t> sweepInteger(T *values, const size_t count, const bool swap)
+{
+    const size_t bins = size_t(std::numeric_limits<T>::max()) + 1;
+    const size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    std::vector<size_t> histo(bins, 0);
+#if _OPENMP >= 201107
+    #pragma omp parallel
+#endif
+    {
+        std::vector<size_t> local(bins, 0);
+#if _OPENMP >= 201107
+        #pragma omp for schedule(static) nowait
+#endif
+        for (size_t b = 0; b < blocks; ++b)
+        {
+            T *block = values + b * BLOCK_SIZE;
+            const size_t n = std::min(BLOCK_SIZE, count - b * BLOCK_SIZE);
+            if (swap)
+                swapBlock(block, n);
+            for (size_t i = 0; i < n; ++i)
+                local[block[i]]++;
+        }
+#if _OPENMP >= 201107
+        #pragma omp critical
+#endif
+        for (size_t i = 0; i < bins; ++i)
+            histo[i] += local[i];
+    }
+    return histo;
+}
+
+/**
+ * @brief Data range of integer data from its histogram.
+ */
+static void histogramRange(const std::vector<size_t> &histo, float &minimum, float &maximum)
+{
+    const auto first = std::find_if(histo.begin(), histo.end(), [](size_t c){ return c > 0; });
+    const auto last = std::find_if(histo.rbegin(), histo.rend(), [](size_t c){ return c > 0; });
+    minimum = first == histo.end() ? 0.f : float(first - histo.begin());
+    maximum = last == histo.rend() ? 0.f : float(histo.rend() - last - 1);
+}
+
+/*
+ * DatRawReader::convert_raw
+ */
+void DatRawReader::convert_raw(RawData &raw_timestep) const
+{
+    char *raw = raw_timestep.data();
+    const size_t size = raw_timestep.size();
+    std::array<size_t, 256> histo = {{0}};
+    const bool swap = _prop.endianness == BIG;
+
+    if (_prop.format == FLOAT)
+    {
+        float *floatdata = reinterpret_cast<float*>(raw);
+        const size_t count = size / sizeof(float);
+        sweepFloat(floatdata, count, swap, raw_timestep.min_value, raw_timestep.max_value);
+        // the data is mapped from [0, max] as before, the minimum is reported only
+        const float maximum = raw_timestep.max_value;
+        const float scale = maximum > 0.f ? 1.f / maximum : 0.f;
+        // second sweep: normalize in place and bin, while the block is in cache
+        const size_t blocks = (count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+#if _OPENMP >= 201107
+        #pragma omp parallel
+#endif
+        {
+            std::array<size_t, 256> local = {{0}};
+#if _OPENMP >= 201107
+            #pragma omp for schedule(static) nowait
+#endif
+            for (size_t b = 0; b < blocks; ++b)
+            {
+                float *block = floatdata + b * BLOCK_SIZE;
+                const size_t n = std::min(BLOCK_SIZE, count - b * BLOCK_SIZE);
+#if _OPENMP >= 201307
+                #pragma omp simd
+#endif
+                for (size_t i = 0; i < n; ++i)
+                    block[i] *= scale;
+                // NaNs end up in the first bin
+                for (size_t i = 0; i < n; ++i)
+                    local[size_t(std::min(255.f, std::max(0.f, block[i] * 255.f + 0.5f)))]++;
+            }
+#if _OPENMP >= 201107
+            #pragma omp critical
+#endif
+            for (size_t i = 0; i < local.size(); ++i)
+                histo[i] += local[i];
+        }
+    }
+    else if (_prop.format == UCHAR)
+    {
+        // no conversion necessary, the raw data is handed to the device as is
+        const std::vector<size_t> counts = sweepInteger(reinterpret_cast<uchar*>(raw), size,
+                                                        false);
+        histogramRange(counts, raw_timestep.min_value, raw_timestep.max_value);
+        std::copy(counts.begin(), counts.end(), histo.begin());
+    }
+    else if (_prop.format == USHORT)
+    {
+        unsigned short *ushortdata = reinterpret_cast<unsigned short*>(raw);
+        const size_t count = size / sizeof(unsigned short);
+        // the histogram and range follow from the counts of all values
+        const std::vector<size_t> counts = sweepInteger(ushortdata, count, swap);
+        histogramRange(counts, raw_timestep.min_value, raw_timestep.max_value);
+        const float maximum = raw_timestep.max_value;
+        const float stretch = maximum > 0.f ? 65535.f / maximum : 0.f;
+        for (size_t v = 0; v < counts.size(); ++v)
+            histo[stretchUshort(static_cast<unsigned short>(v), stretch) / 256] += counts[v];
+        // second sweep: stretch to the full range of the data type in place
+#if _OPENMP >= 201107
+        #pragma omp parallel for schedule(static)
+#endif
+        for (size_t i = 0; i < count; ++i)
+            ushortdata[i] = stretchUshort(ushortdata[i], stretch);
+    }
+
+    if (_prop.format != UCHAR)
+        std::cout << "Data range: [" << raw_timestep.min_value << ".." << raw_timestep.max_value
+                  << "]" << std::endl;
+    std::copy(histo.begin(), histo.end(), raw_timestep.histogram.begin());
+}
+
 /**
  * DatRawReader::infer_volume_resolution
  */
@@ -26,6 +26,11 @@
 #include <string>
 #include <array>
 #include <limits>
+#include <functional>
+
+#include "src/io/mappedfile.h"
+#include "src/io/volumecache.h"
+#include "src/io/chunkedvolume.h"
 
 /// <summary>
 /// Dat-raw volume data file reader.
@@ -33,7 +38,11 @@
 /// binary file ".raw". The dat-file should contain information on the file name of the
 /// raw-file, the resolution of the volume, the data format of the scalar data and possibly
 /// the slice thickness (default is 1.0 in each dimension).
-/// The raw data is stored in a vector of chars.
+/// The raw data is memory mapped (default) or read into a vector of chars. In both cases,
+/// USHORT and FLOAT data is normalized in place, UCHAR data is passed on without copying.
+/// Alternatively, a chunked volume container (".cvol", see ChunkedVolume) is read instead
+/// of the dat file. Its time steps are only decompressed when their data is accessed, and
+/// single chunks can be read without decompressing the whole volume.
 /// </summary>
 class DatRawReader
 {
@@ -69,9 +78,9 @@ public:
         std::string node_file_name = "";
         std::string image_channel_order = "R";  // TODO: change to enum?
         unsigned int time_series = {1u};
-        // data range for float normalization: TODO: add to kernel
+        // range of the raw voxel values of all time steps read, before normalization
         float min_value = std::numeric_limits<float>::max();
-        float max_value = std::numeric_limits<float>::min();
+        float max_value = std::numeric_limits<float>::lowest();
 
         const std::string to_string() const
         {
@@ -102,15 +111,71 @@ public:
         }
     };
 
+    /// <summary>
+    /// Raw voxel data of one time step, either memory mapped or read into a vector,
+    /// and its histogram.
+    /// <summary>
+    struct RawData
+    {
+        MappedFile mapping;             // raw file or cache file
+        size_t offset = 0;              // offset of the voxel data in the mapping
+        size_t length = 0;              // size of the voxel data in the mapping
+        std::vector<char> buffer;
+        std::array<double, 256> histogram = {{0}};
+        float min_value = 0.f;          // range of the raw values, [0, max] is mapped to [0,1]
+        float max_value = 1.f;
+
+        char *data() { return mapping.is_open() ? mapping.data() + offset : buffer.data(); }
+        const char *data() const
+        {
+            return mapping.is_open() ? mapping.data() + offset : buffer.data();
+        }
+        size_t size() const { return mapping.is_open() ? length : buffer.size(); }
+    };
+
     /// <summary>
     /// Read the dat file of the given name and based on the content, the raw data.
     /// Saves volume data set properties and scalar data in member variables.
     /// </summary>
     /// <param name="dat_file_name">Name and full path of the dat file</param>
-    /// <param name="raw_data">Reference to a vector where the read raw data
-    /// is stored in.</param>
+    /// <param name="max_timesteps">Maximum number of time steps to read (at least one),
+    /// remaining time steps can be read with read_timestep.</param>
     /// <throws>If one of the files could not be found or read.</throws
-    void read_files(Properties volume_properties);
+    void read_files(Properties volume_properties,
+                    size_t max_timesteps = std::numeric_limits<size_t>::max());
+
+    /// <summary>
+    /// Read the raw data of the time steps that have been skipped by read_files.
+    /// </summary>
+    /// <throws>If one of the files could not be found or read.</throws>
+    void read_remaining_timesteps();
+
+    /// <summary>
+    /// Read and convert the raw data of a single time step without storing it in the reader.
+    /// Only depends on the properties read before and can be called from any thread.
+    /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <throws>If the file could not be opened or read.</throws>
+    RawData read_timestep(size_t timestep) const;
+
+    /// <summary>
+    /// Consumer of time steps read by read_timesteps, called with the index of the time step.
+    /// A buffer that is not moved out of the raw data is reused for the next time steps.
+    /// </summary>
+    typedef std::function<void(size_t, RawData &)> timestep_consumer;
+
+    /// <summary>
+    /// Read and convert time steps concurrently with the I/O workers, without storing them
+    /// in the reader. Each time step is handed to the consumer as soon as it is ready, in the
+    /// order of completion and on the calling thread. At most the number of staging buffers
+    /// of time steps are read but not consumed at any time.
+    /// </summary>
+    /// <param name="timesteps">Indices of the time steps.</param>
+    /// <param name="consumer">Called for every time step, e.g. to upload it.</param>
+    /// <throws>If one of the files could not be opened or read, or the consumer threw.
+    /// </throws>
+    void read_timesteps(const std::vector<size_t> &timesteps,
+                        const timestep_consumer &consumer) const;
 
     /// <summary>
     /// Get the read status of hte objects.
@@ -119,10 +184,108 @@ public:
     bool has_data() const;
 
     /// <summary>
-    /// Get a constant reference to the raw data that has been read.
+    /// Get a pointer to the raw data of a time step that has been read. The time steps of a
+    /// chunked volume are decompressed on first access (not thread safe).
+    /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <throws>If no raw data has been read before.</throws>
+    const char *data(size_t timestep = 0) const;
+
+    /// <summary>
+    /// Get the size in bytes of the raw data of a time step that has been read.
     /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
     /// <throws>If no raw data has been read before.</throws>
-    const std::vector<std::vector<char> > &data() const;
+    size_t data_size(size_t timestep = 0) const;
+
+    /// <summary>
+    /// Get the number of time steps that have been read.
+    /// </summary>
+    size_t num_timesteps() const;
+
+    /// <summary>
+    /// Enable or disable memory mapping of raw files for subsequent reads.
+    /// </summary>
+    /// <param name="use_mapping"><c>true</c> to map raw files (default),
+    /// <c>false</c> to read them into host memory.</param>
+    void set_memory_mapping(bool use_mapping);
+
+    /// <summary>
+    /// Enable or disable the persistent cache of preprocessed raw data for subsequent reads.
+    /// </summary>
+    /// <param name="use_cache"><c>true</c> to read and write cache files (default),
+    /// <c>false</c> to always process the raw files.</param>
+    void set_cache(bool use_cache);
+
+    /// <summary>
+    /// Set the number of concurrent readers of time series.
+    /// </summary>
+    /// <param name="workers">Number of I/O worker threads, 0: up to four, depending on the
+    /// number of cores (default).</param>
+    void set_io_workers(size_t workers);
+
+    /// <summary>
+    /// Set the number of staging buffers of concurrent reads, i.e. the maximum number of time
+    /// steps held in host memory that have been read but not consumed yet.
+    /// </summary>
+    /// <param name="buffers">Number of buffers, 0: one more than the I/O workers (default).
+    /// </param>
+    void set_staging_buffers(size_t buffers);
+
+    /// <summary>
+    /// Read a cached min/max brick grid of a time step.
+    /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <param name="grid_type">User defined type of the grid, e.g. voxels per brick.</param>
+    /// <param name="grid_res">Resolution of the grid.</param>
+    /// <param name="grid">The grid data.</param>
+    /// <returns><c>true</c> if a matching grid is cached.</returns>
+    bool read_brick_grid(size_t timestep, const std::array<uint32_t, 4> &grid_type,
+                         const std::array<uint32_t, 3> &grid_res, std::vector<char> &grid) const;
+
+    /// <summary>
+    /// Store the min/max brick grid of a time step in the cache.
+    /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <param name="grid_type">User defined type of the grid, e.g. voxels per brick.</param>
+    /// <param name="grid_res">Resolution of the grid.</param>
+    /// <param name="grid">The grid data.</param>
+    void write_brick_grid(size_t timestep, const std::array<uint32_t, 4> &grid_type,
+                          const std::array<uint32_t, 3> &grid_res,
+                          const std::vector<char> &grid) const;
+
+    /// <summary>
+    /// Get the edge length of the chunks of a chunked volume.
+    /// </summary>
+    /// <returns>Voxels per chunk edge without the apron, 0 if the data is not chunked.
+    /// </returns>
+    size_t chunk_size() const;
+
+    /// <summary>
+    /// Read a single chunk of a chunked volume. Can be called from any thread.
+    /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <param name="chunk">Index of the chunk, x fastest.</param>
+    /// <param name="dst">Destination of (chunk_size + 2)^3 voxels: the chunk and a one voxel
+    /// apron, clamped to edge at the volume borders.</param>
+    /// <throws>If the chunk is corrupt.</throws>
+    void read_chunk(size_t timestep, size_t chunk, char *dst) const;
+
+    /// <summary>
+    /// Get the range of the normalized values of a chunk including its apron.
+    /// </summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <param name="chunk">Index of the chunk, x fastest.</param>
+    std::array<float, 2> chunk_range(size_t timestep, size_t chunk) const;
+
+    /// <summary>
+    /// Write all time steps as a chunked volume container, compressed in parallel.
+    /// </summary>
+    /// <param name="file_name">Name and full path of the container.</param>
+    /// <param name="chunk_size">Voxels per chunk edge, the brick size of the bricked mode
+    /// (32) allows to read exactly one chunk per brick.</param>
+    /// <throws>If the data cannot be chunked or the file could not be written.</throws>
+    void write_chunked(const std::string &file_name, uint32_t chunk_size = 32) const;
 
     /// <summary>
     /// Get a constant reference to the volume data set properties that have been read.
@@ -167,15 +330,98 @@ private:
     /// <throws>If the given file could not be opened or read.</throws>
     void read_raw(const std::string &raw_file_name);
 
+    /// <summary>
+    /// Open a chunked volume container and set the properties from its header.
+    /// <summary>
+    /// <param name="file_name"> Name and full path of the container.</param>
+    /// <throws>If the container could not be opened or is invalid.</throws>
+    void read_chunked(const std::string &file_name);
+
+    /// <summary>
+    /// Get the histogram and data range of a time step of the chunked volume, without data.
+    /// <summary>
+    RawData chunked_timestep(size_t timestep) const;
+
+    /// <summary>
+    /// Read and convert a time step from its raw file or the chunked volume.
+    /// <summary>
+    /// <param name="timestep">Index of the time step.</param>
+    /// <param name="buffer"> Buffer to read the data into, see load_raw.</param>
+    RawData load_timestep(size_t timestep, std::vector<char> buffer) const;
+
+    /// <summary>
+    /// Get the full path of a raw file, relative to the dat file.
+    /// <summary>
+    /// <param name="raw_file_name"> Name of the raw data file without the path.</param>
+    std::string raw_path(const std::string &raw_file_name) const;
+
+    /// <summary>
+    /// Create the cache key of a raw file.
+    /// <summary>
+    /// <param name="name_with_path"> Name and full path of the raw data file.</param>
+    /// <param name="key"> The key.</param>
+    /// <returns><c>true</c> if caching is enabled and the file status could be determined.
+    /// </returns>
+    bool cache_key(const std::string &name_with_path, VolumeCache::Key &key) const;
+
+    /// <summary>
+    /// Map or read scalar voxel data from a given raw file and convert it.
+    /// Uses the cached preprocessed data if available.
+    /// <summary>
+    /// <param name="raw_file_name"> Name of the raw data file without the path.</param>
+    /// <throws>If the given file could not be opened or read.</throws>
+    /// <param name="buffer"> Buffer to read the data into if it is not mapped, its memory is
+    /// reused if it is large enough.</param>
+    RawData load_raw(const std::string &raw_file_name, std::vector<char> buffer = {}) const;
+
+    /// <summary>
+    /// Append a time step that has been read to the raw data and update the properties.
+    /// <summary>
+    void store_timestep(RawData raw_timestep);
+
+    /// <summary>
+    /// Convert the raw data of one time step in place: swap endianness if needed, normalize
+    /// USHORT and FLOAT data from [0, max], and calculate the value range and histogram.
+    /// The data is processed in blocks, one sweep determines the range (and the histogram of
+    /// integer data) and a second sweep normalizes while the block is in the cache.
+    /// <summary>
+    /// <param name="raw_timestep">The raw data of the time step.</param>
+    void convert_raw(RawData &raw_timestep) const;
+
     /// <summary>
     /// Properties of the volume data set.
     /// <summary>
     Properties _prop;
 
     /// <summary>
-    /// The raw voxel data.
+    /// The raw voxel data, time steps of a chunked volume are decompressed on first access.
+    /// <summary>
+    mutable std::vector<RawData> _raw_data;
+
+    /// <summary>
+    /// The chunked volume container, if one is read.
+    /// <summary>
+    ChunkedVolume _chunked;
+
+    /// <summary>
+    /// Map raw files instead of reading them.
+    /// <summary>
+    bool _use_mapping = true;
+
+    /// <summary>
+    /// Use the persistent cache of preprocessed data.
+    /// <summary>
+    bool _use_cache = true;
+
+    /// <summary>
+    /// Concurrent readers of time series, 0: depending on the number of cores.
+    /// <summary>
+    size_t _io_workers = 0;
+
+    /// <summary>
+    /// Staging buffers of concurrent reads, 0: one more than the workers.
     /// <summary>
-    std::vector<std::vector<char> > _raw_data;
+    size_t _staging_buffers = 0;
 
     ///
     /// \brief Histograms for each timestep
@@ -0,0 +1,70 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+
+/// <summary>
+/// Convert a float to an IEEE 754 half float, rounding to nearest. Values out of the half
+/// range become infinity, NaN is not preserved. Used for half float volumes and EXR images.
+/// </summary>
+inline uint16_t float_to_half(const float f)
+{
+    uint32_t x = 0;
+    std::memcpy(&x, &f, sizeof(float));
+    const uint32_t sign = (x >> 16) & 0x8000u;
+    const int exponent = int((x >> 23) & 0xffu) - 127 + 15;
+    uint32_t mantissa = x & 0x7fffffu;
+    if (exponent <= 0)
+    {
+        // subnormal half
+        if (exponent < -10)
+            return uint16_t(sign);
+        mantissa |= 0x800000u;
+        const uint32_t shift = uint32_t(14 - exponent);
+        uint32_t h = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1u)
+            ++h;
+        return uint16_t(sign | h);
+    }
+    if (exponent >= 31)
+        return uint16_t(sign | 0x7c00u);
+    uint32_t h = sign | (uint32_t(exponent) << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000u)
+        ++h;
+    return uint16_t(h);
+}
+
+/// <summary>
+/// Convert a finite IEEE 754 half float to a float.
+/// </summary>
+inline float half_to_float(const uint16_t h)
+{
+    const int exponent = (h >> 10) & 0x1f;
+    const float mantissa = float(h & 0x3ffu);
+    const float value = exponent == 0 ? std::ldexp(mantissa, -24)
+                                      : std::ldexp(1024.f + mantissa, exponent - 25);
+    return (h & 0x8000u) ? -value : value;
+}
@@ -0,0 +1,147 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/io/mappedfile.h"
+
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+/*
+ * MappedFile::MappedFile
+ */
+MappedFile::MappedFile(const std::string &file_name)
+{
+#ifdef _WIN32
+    // allow writers, e.g. appending to a mapped cache file
+    HANDLE file = CreateFileA(file_name.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Could not open " + file_name);
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0)
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Could not determine size of " + file_name);
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+    if (mapping == nullptr)
+    {
+        CloseHandle(file);
+        throw std::runtime_error("Could not map " + file_name);
+    }
+    void *view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+    if (view == nullptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw std::runtime_error("Could not map " + file_name);
+    }
+    _file = file;
+    _mapping = mapping;
+    _data = static_cast<char *>(view);
+    _size = static_cast<size_t>(file_size.QuadPart);
+#else
+    int fd = ::open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Could not open " + file_name);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        ::close(fd);
+        throw std::runtime_error("Could not determine size of " + file_name);
+    }
+    // private mapping: in place modifications are copy-on-write and never reach the file
+    void *addr = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after closing the file descriptor
+    ::close(fd);
+    if (addr == MAP_FAILED)
+        throw std::runtime_error("Could not map " + file_name);
+    madvise(addr, static_cast<size_t>(st.st_size), MADV_SEQUENTIAL);
+    _data = static_cast<char *>(addr);
+    _size = static_cast<size_t>(st.st_size);
+#endif
+}
+
+/*
+ * MappedFile::~MappedFile
+ */
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+/*
+ * MappedFile::MappedFile
+ */
+MappedFile::MappedFile(MappedFile &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+/*
+ * MappedFile::operator=
+ */
+MappedFile &MappedFile::operator=(MappedFile &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+        std::swap(_data, other._data);
+        std::swap(_size, other._size);
+#ifdef _WIN32
+        std::swap(_file, other._file);
+        std::swap(_mapping, other._mapping);
+#endif
+    }
+    return *this;
+}
+
+/*
+ * MappedFile::close
+ */
+void MappedFile::close()
+{
+    if (_data == nullptr)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+    CloseHandle(static_cast<HANDLE>(_mapping));
+    CloseHandle(static_cast<HANDLE>(_file));
+    _file = nullptr;
+    _mapping = nullptr;
+#else
+    munmap(_data, _size);
+#endif
+    _data = nullptr;
+    _size = 0;
+}
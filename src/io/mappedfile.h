@@ -0,0 +1,81 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+
+/// <summary>
+/// Read-only memory mapping of a whole file (POSIX mmap / Windows file mapping).
+/// The mapping is private (copy-on-write): the mapped memory may be modified in place,
+/// e.g. for data conversion, without writing back to the file.
+/// The mapping is released on destruction.
+/// </summary>
+class MappedFile
+{
+public:
+    MappedFile() = default;
+
+    /// <summary>
+    /// Map the file with the given name.
+    /// </summary>
+    /// <param name="file_name">Name and full path of the file.</param>
+    /// <throws>If the file could not be opened or mapped.</throws>
+    explicit MappedFile(const std::string &file_name);
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    MappedFile(MappedFile &&other) noexcept;
+    MappedFile &operator=(MappedFile &&other) noexcept;
+
+    /// <summary>
+    /// Get the status of the mapping.
+    /// </summary>
+    /// <returns><c>true</c> if a file is mapped, <c>false</c> otherwise.</returns>
+    bool is_open() const { return _data != nullptr; }
+
+    /// <summary>
+    /// Get a pointer to the first byte of the mapped file.
+    /// </summary>
+    char *data() const { return _data; }
+
+    /// <summary>
+    /// Get the size of the mapped file in bytes.
+    /// </summary>
+    size_t size() const { return _size; }
+
+    /// <summary>
+    /// Unmap the file.
+    /// </summary>
+    void close();
+
+private:
+    char *_data = nullptr;
+    size_t _size = 0;
+#ifdef _WIN32
+    void *_file = nullptr;
+    void *_mapping = nullptr;
+#endif
+};
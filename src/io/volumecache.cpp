@@ -0,0 +1,331 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/io/volumecache.h"
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+  #include <direct.h>
+#endif
+
+// increment on any change of the file layout or the preprocessing of the payload
+static const uint32_t CACHE_VERSION = 3;
+static const char CACHE_MAGIC[8] = {'V', 'R', 'C', 'L', 'C', 'A', 'C', 'H'};
+// payload alignment, so that mapped payloads are page aligned
+static const uint64_t CACHE_ALIGNMENT = 4096;
+
+/**
+ * @brief On-disk header of a cache file.
+ */
+struct CacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t format;
+    uint32_t endianness;
+    uint32_t volume_res[3];
+    uint64_t raw_size;
+    int64_t raw_mtime;
+    float min_value;
+    float max_value;
+    double histogram[256];
+    uint64_t payload_offset;
+    uint64_t payload_size;
+    uint32_t grid_type[4];
+    uint32_t grid_res[3];
+    uint32_t reserved;
+    uint64_t grid_offset;
+    uint64_t grid_size;
+};
+
+/**
+ * @brief Align an offset to the cache alignment.
+ */
+static uint64_t align(const uint64_t offset)
+{
+    return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+/**
+ * @brief Check if a cache header is valid for the given key.
+ */
+static bool matches(const CacheHeader &header, const VolumeCache::Key &key)
+{
+    return std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0
+            && header.version == CACHE_VERSION
+            && header.raw_size == key.raw_size
+            && header.raw_mtime == key.raw_mtime
+            && header.format == key.format
+            && header.endianness == key.endianness
+            && header.volume_res[0] == key.volume_res.at(0)
+            && header.volume_res[1] == key.volume_res.at(1)
+            && header.volume_res[2] == key.volume_res.at(2);
+}
+
+/**
+ * @brief Read the header of a cache file and check it against the key.
+ */
+static bool read_header(std::istream &is, const VolumeCache::Key &key, CacheHeader &header)
+{
+    is.read(reinterpret_cast<char *>(&header), sizeof(CacheHeader));
+    return is && matches(header, key);
+}
+
+/*
+ * VolumeCache::user_cache_dir
+ */
+std::string VolumeCache::user_cache_dir()
+{
+#ifdef _WIN32
+    const char *base = std::getenv("LOCALAPPDATA");
+    if (base == nullptr)
+        return "";
+    std::string dir = std::string(base) + "\\VolumeRendererCL";
+    _mkdir(dir.c_str());
+    return dir + "\\";
+#else
+    std::string base;
+    if (std::getenv("XDG_CACHE_HOME") != nullptr)
+        base = std::getenv("XDG_CACHE_HOME");
+    else if (std::getenv("HOME") != nullptr)
+        base = std::string(std::getenv("HOME")) + "/.cache";
+    else
+        return "";
+    mkdir(base.c_str(), 0755);
+    std::string dir = base + "/VolumeRendererCL";
+    mkdir(dir.c_str(), 0755);
+    return dir + "/";
+#endif
+}
+
+/*
+ * VolumeCache::cache_file_names
+ */
+std::array<std::string, 2> VolumeCache::cache_file_names(const std::string &raw_path)
+{
+    std::array<std::string, 2> names;
+    names.at(0) = raw_path + ".vrcache";
+
+    // unique name in the user cache directory based on the full path of the raw file
+    std::size_t found = raw_path.find_last_of("/\\");
+    std::string base = found == std::string::npos ? raw_path : raw_path.substr(found + 1);
+    std::stringstream ss;
+    ss << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(raw_path);
+    std::string dir = user_cache_dir();
+    if (!dir.empty())
+        names.at(1) = dir + ss.str() + "_" + base + ".vrcache";
+    return names;
+}
+
+/*
+ * VolumeCache::stat_key
+ */
+bool VolumeCache::stat_key(const std::string &raw_path, Key &key)
+{
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(raw_path.c_str(), &st) != 0)
+        return false;
+#else
+    struct stat st;
+    if (stat(raw_path.c_str(), &st) != 0)
+        return false;
+#endif
+    key.raw_size = static_cast<uint64_t>(st.st_size);
+    key.raw_mtime = static_cast<int64_t>(st.st_mtime);
+    return true;
+}
+
+/*
+ * VolumeCache::load
+ */
+bool VolumeCache::load(const std::string &raw_path, const Key &key,
+                       MappedFile &mapping, Entry &entry)
+{
+    for (const auto &name : cache_file_names(raw_path))
+    {
+        if (name.empty())
+            continue;
+        std::ifstream is(name, std::ios::in | std::ifstream::binary);
+        CacheHeader header;
+        if (!is || !read_header(is, key, header))
+            continue;
+        is.seekg(0, is.end);
+        if (static_cast<uint64_t>(is.tellg()) < header.payload_offset + header.payload_size)
+            continue;
+        is.close();
+
+        try
+        {
+            if (header.payload_size > 0)
+                mapping = MappedFile(name);
+        }
+        catch (std::runtime_error e)
+        {
+            std::cerr << "WARNING: " << e.what() << std::endl;
+            continue;
+        }
+        std::copy(std::begin(header.histogram), std::end(header.histogram),
+                  entry.histogram.begin());
+        entry.min_value = header.min_value;
+        entry.max_value = header.max_value;
+        entry.payload_offset = header.payload_offset;
+        entry.payload_size = header.payload_size;
+        std::cout << "Using cache file " << name << std::endl;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * VolumeCache::store
+ */
+void VolumeCache::store(const std::string &raw_path, const Key &key, const Entry &entry,
+                        const char *payload)
+{
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(CacheHeader));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.format = key.format;
+    header.endianness = key.endianness;
+    std::copy(key.volume_res.begin(), key.volume_res.end(), std::begin(header.volume_res));
+    header.raw_size = key.raw_size;
+    header.raw_mtime = key.raw_mtime;
+    header.min_value = entry.min_value;
+    header.max_value = entry.max_value;
+    std::copy(entry.histogram.begin(), entry.histogram.end(), std::begin(header.histogram));
+    header.payload_offset = align(sizeof(CacheHeader));
+    header.payload_size = payload == nullptr ? 0 : entry.payload_size;
+    header.grid_offset = header.payload_offset + header.payload_size;
+
+    for (const auto &name : cache_file_names(raw_path))
+    {
+        if (name.empty())
+            continue;
+        // write to a temporary file first, so that no partial cache file is ever read
+        const std::string tmp_name = name + ".tmp";
+        {
+            std::ofstream os(tmp_name, std::ios::out | std::ios::trunc | std::ofstream::binary);
+            if (!os)
+                continue;
+            os.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+            std::vector<char> padding(header.payload_offset - sizeof(CacheHeader), 0);
+            os.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+            if (header.payload_size > 0)
+                os.write(payload, static_cast<std::streamsize>(header.payload_size));
+            if (!os)
+            {
+                os.close();
+                std::remove(tmp_name.c_str());
+                std::cerr << "WARNING: Could not write cache file " << name << std::endl;
+                continue;
+            }
+        }
+        std::remove(name.c_str());
+        if (std::rename(tmp_name.c_str(), name.c_str()) == 0)
+        {
+            std::cout << "Wrote cache file " << name << std::endl;
+            return;
+        }
+        std::remove(tmp_name.c_str());
+    }
+    std::cerr << "WARNING: Could not write a cache file for " << raw_path << std::endl;
+}
+
+/*
+ * VolumeCache::load_bricks
+ */
+bool VolumeCache::load_bricks(const std::string &raw_path, const Key &key,
+                              const std::array<uint32_t, 4> &grid_type,
+                              const std::array<uint32_t, 3> &grid_res, std::vector<char> &grid)
+{
+    for (const auto &name : cache_file_names(raw_path))
+    {
+        if (name.empty())
+            continue;
+        std::ifstream is(name, std::ios::in | std::ifstream::binary);
+        CacheHeader header;
+        if (!is || !read_header(is, key, header))
+            continue;
+        if (header.grid_size == 0
+                || !std::equal(grid_type.begin(), grid_type.end(), std::begin(header.grid_type))
+                || !std::equal(grid_res.begin(), grid_res.end(), std::begin(header.grid_res)))
+            return false;
+        grid.resize(header.grid_size);
+        is.seekg(static_cast<std::streamoff>(header.grid_offset), is.beg);
+        is.read(grid.data(), static_cast<std::streamsize>(grid.size()));
+        return static_cast<bool>(is);
+    }
+    return false;
+}
+
+/*
+ * VolumeCache::store_bricks
+ */
+void VolumeCache::store_bricks(const std::string &raw_path, const Key &key,
+                               const std::array<uint32_t, 4> &grid_type,
+                               const std::array<uint32_t, 3> &grid_res,
+                               const std::vector<char> &grid)
+{
+    for (const auto &name : cache_file_names(raw_path))
+    {
+        if (name.empty())
+            continue;
+        CacheHeader header;
+        {
+            std::ifstream is(name, std::ios::in | std::ifstream::binary);
+            if (!is || !read_header(is, key, header))
+                continue;
+        }
+        // the grid is stored behind the payload, the payload itself is never touched
+        std::fstream fs(name, std::ios::in | std::ios::out | std::fstream::binary);
+        if (!fs)
+            return;
+        std::copy(grid_type.begin(), grid_type.end(), std::begin(header.grid_type));
+        std::copy(grid_res.begin(), grid_res.end(), std::begin(header.grid_res));
+        header.grid_offset = header.payload_offset + header.payload_size;
+        // invalidate the old grid before it is overwritten
+        header.grid_size = 0;
+        fs.seekp(0, fs.beg);
+        fs.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+        fs.seekp(static_cast<std::streamoff>(header.grid_offset), fs.beg);
+        fs.write(grid.data(), static_cast<std::streamsize>(grid.size()));
+        header.grid_size = grid.size();
+        fs.seekp(0, fs.beg);
+        fs.write(reinterpret_cast<const char *>(&header), sizeof(CacheHeader));
+        if (!fs)
+            std::cerr << "WARNING: Could not update cache file " << name << std::endl;
+        return;
+    }
+}
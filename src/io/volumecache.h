@@ -0,0 +1,140 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#include "src/io/mappedfile.h"
+
+/// <summary>
+/// Persistent on-disk cache of preprocessed volume data.
+/// For each raw file, a versioned binary cache file holds the normalized voxel payload,
+/// the histogram, the data range, and optionally a min/max brick grid. Cache files are
+/// stored next to the raw file ("<raw file>.vrcache") or, if that directory is not writable,
+/// in a user cache directory. An entry is only valid if size, modification time, format,
+/// endianness and resolution of the raw file match.
+/// </summary>
+class VolumeCache
+{
+public:
+    /// <summary>
+    /// Identifies the raw file and the preprocessing of a cache entry.
+    /// </summary>
+    struct Key
+    {
+        uint64_t raw_size = 0;
+        int64_t raw_mtime = 0;
+        uint32_t format = 0;
+        uint32_t endianness = 0;
+        std::array<uint32_t, 3> volume_res = {{0, 0, 0}};
+    };
+
+    /// <summary>
+    /// Preprocessed data of one raw file. If payload_size is 0, the raw file can be used
+    /// as is (e.g. UCHAR data that does not need any conversion).
+    /// </summary>
+    struct Entry
+    {
+        std::array<double, 256> histogram = {{0}};
+        float min_value = 0.f;
+        float max_value = 1.f;
+        uint64_t payload_offset = 0;
+        uint64_t payload_size = 0;
+    };
+
+    /// <summary>
+    /// Create the cache key for a raw file from its file system status.
+    /// </summary>
+    /// <param name="raw_path">Name and full path of the raw file.</param>
+    /// <param name="key">Key with format, endianness and resolution set, size and
+    /// modification time are filled in.</param>
+    /// <returns><c>true</c> if the file status could be determined.</returns>
+    static bool stat_key(const std::string &raw_path, Key &key);
+
+    /// <summary>
+    /// Look up and map the cache entry of a raw file.
+    /// </summary>
+    /// <param name="raw_path">Name and full path of the raw file.</param>
+    /// <param name="key">The cache key of the raw file.</param>
+    /// <param name="mapping">Mapping of the cache file, the payload starts at
+    /// entry.payload_offset.</param>
+    /// <param name="entry">The cached entry.</param>
+    /// <returns><c>true</c> on a cache hit.</returns>
+    static bool load(const std::string &raw_path, const Key &key,
+                     MappedFile &mapping, Entry &entry);
+
+    /// <summary>
+    /// Write the cache entry of a raw file. Failures are reported but not fatal.
+    /// </summary>
+    /// <param name="raw_path">Name and full path of the raw file.</param>
+    /// <param name="key">The cache key of the raw file.</param>
+    /// <param name="entry">Histogram and data range, payload_size is the size of the payload.
+    /// </param>
+    /// <param name="payload">The preprocessed voxel data, may be null if payload_size is 0.
+    /// </param>
+    static void store(const std::string &raw_path, const Key &key, const Entry &entry,
+                      const char *payload);
+
+    /// <summary>
+    /// Read a min/max brick grid from the cache entry of a raw file.
+    /// </summary>
+    /// <param name="raw_path">Name and full path of the raw file.</param>
+    /// <param name="key">The cache key of the raw file.</param>
+    /// <param name="grid_type">User defined type of the grid, e.g. the voxels per brick.</param>
+    /// <param name="grid_res">Resolution of the grid.</param>
+    /// <param name="grid">The grid data.</param>
+    /// <returns><c>true</c> if a grid of the given type and resolution is cached.</returns>
+    static bool load_bricks(const std::string &raw_path, const Key &key,
+                            const std::array<uint32_t, 4> &grid_type,
+                            const std::array<uint32_t, 3> &grid_res, std::vector<char> &grid);
+
+    /// <summary>
+    /// Add or replace the min/max brick grid of an existing cache entry.
+    /// </summary>
+    /// <param name="raw_path">Name and full path of the raw file.</param>
+    /// <param name="key">The cache key of the raw file.</param>
+    /// <param name="grid_type">User defined type of the grid, e.g. the voxels per brick.</param>
+    /// <param name="grid_res">Resolution of the grid.</param>
+    /// <param name="grid">The grid data.</param>
+    static void store_bricks(const std::string &raw_path, const Key &key,
+                             const std::array<uint32_t, 4> &grid_type,
+                             const std::array<uint32_t, 3> &grid_res,
+                             const std::vector<char> &grid);
+
+    /// <summary>
+    /// Get (and create) the user cache directory of the application.
+    /// </summary>
+    /// <returns>The directory including a trailing separator, empty if not available.
+    /// </returns>
+    static std::string user_cache_dir();
+
+private:
+    /// <summary>
+    /// Candidate cache file names of a raw file: next to the raw file and in the user
+    /// cache directory.
+    /// </summary>
+    static std::array<std::string, 2> cache_file_names(const std::string &raw_path);
+};
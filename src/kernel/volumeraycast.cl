@@ -26,6 +26,11 @@
 
 
 #define ERT_THRESHOLD 0.98
+#define MAX_BRICK_LEVELS 16
+#define REPROJECTION_ALPHA 0.5f     // opacity that defines the representative depth of a ray
+#define REPROJECT_OFF     0u
+#define REPROJECT_DEPTH   1u        // write the representative depth for the next frame
+#define REPROJECT_HISTORY 2u        // the last frame is reprojected into this one
 
 constant sampler_t linearSmp = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP_TO_EDGE |
                                CLK_FILTER_LINEAR;
@@ -33,6 +38,64 @@ constant sampler_t nearestSmp = CLK_NORMALIZED_COORDS_TRUE | CLK_ADDRESS_CLAMP |
                                 CLK_FILTER_NEAREST;
 constant sampler_t nearestIntSmp = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP |
                                    CLK_FILTER_NEAREST;
+constant sampler_t historySmp = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE |
+                                CLK_FILTER_LINEAR;
+
+#ifdef PAGED
+// bricked mode: volData is a brick atlas, bricks are looked up through a page table
+constant sampler_t atlasLinearSmp = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE |
+                                    CLK_FILTER_LINEAR;
+constant sampler_t atlasNearestSmp = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE |
+                                     CLK_FILTER_NEAREST;
+// bricks are stored with a one voxel apron for seamless interpolation
+#define BRICK_SLOT_SIZE (BRICK_SIZE + 2)
+#define BRICK_UNUSED  0
+#define BRICK_USED    1
+#endif // PAGED
+
+// compact storage: quantized volumes hold (value - VOL_OFFSET) / VOL_SCALE
+#ifdef VOL_SCALE
+#define dequantize(x) mad((x), VOL_SCALE, VOL_OFFSET)
+#else
+#define dequantize(x) (x)
+#endif // VOL_SCALE
+
+// resolution of the (logical) volume data set
+int3 volumeRes(read_only image3d_t vol)
+{
+#ifdef PAGED
+    return (int3)(VOL_RES_X, VOL_RES_Y, VOL_RES_Z);
+#else
+    return get_image_dim(vol).xyz;
+#endif // PAGED
+}
+
+// sample the volume at a normalized position, in bricked mode through the page table
+float4 readVolume(read_only image3d_t vol, read_only image3d_t pageTable, const float4 pos,
+                  const bool linear)
+{
+#ifdef PAGED
+    float3 voxel = pos.xyz * convert_float3(volumeRes(vol));
+    int3 brick = clamp(convert_int3(floor(voxel / (float)(BRICK_SIZE))),
+                       (int3)(0), get_image_dim(pageTable).xyz - 1);
+    uint entry = read_imageui(pageTable, nearestIntSmp, (int4)(brick, 0)).x;
+    if (entry == 0u)    // not resident (yet)
+        return (float4)(0.f);
+
+    uint slot = entry - 1u;
+    int3 slots = get_image_dim(vol).xyz / BRICK_SLOT_SIZE;
+    int3 slotCoord = (int3)(slot % slots.x, (slot / slots.x) % slots.y, slot / (slots.x*slots.y));
+    float3 local = clamp(voxel - convert_float3(brick * BRICK_SIZE),
+                         (float3)(-0.5f), (float3)(BRICK_SIZE + 0.5f));
+    float4 atlasPos = (float4)(convert_float3(slotCoord * BRICK_SLOT_SIZE) + 1.f + local, 0.f);
+    return linear ? read_imagef(vol, atlasLinearSmp, atlasPos)
+                  : read_imagef(vol, atlasNearestSmp, atlasPos);
+#else
+    float4 sample = linear ? read_imagef(vol, linearSmp, pos) : read_imagef(vol, nearestSmp, pos);
+    sample.x = dequantize(sample.x);
+    return sample;
+#endif // PAGED
+}
 
 // init random number generator (hybrid ui_randworthy)
 uint4 initRNG(uint seed)
@@ -156,19 +219,19 @@ int intersectPlane(const float3 rayOrigin, const float3 rayDir,
 }
 
 // Compute gradient using central difference: f' = ( f(x+h)-f(x-h) )
-float4 gradientCentralDiff(read_only image3d_t vol, const float4 pos)
+float4 gradientCentralDiff(read_only image3d_t vol, read_only image3d_t pageTable, const float4 pos)
 {
-    float3 volResf = convert_float3(get_image_dim(vol).xyz);
+    float3 volResf = convert_float3(volumeRes(vol));
     float3 offset = native_divide((float3)(1.0f), volResf);
     float3 s1;
     float3 s2;
-    s1.x = read_imagef(vol, linearSmp, pos + (float4)(-offset.x, 0, 0, 0)).x;
-    s1.y = read_imagef(vol, linearSmp, pos + (float4)(0, -offset.y, 0, 0)).x;
-    s1.z = read_imagef(vol, linearSmp, pos + (float4)(0, 0, -offset.z, 0)).x;
+    s1.x = readVolume(vol, pageTable, pos + (float4)(-offset.x, 0, 0, 0), true).x;
+    s1.y = readVolume(vol, pageTable, pos + (float4)(0, -offset.y, 0, 0), true).x;
+    s1.z = readVolume(vol, pageTable, pos + (float4)(0, 0, -offset.z, 0), true).x;
 
-    s2.x = read_imagef(vol, linearSmp, pos + (float4)(+offset.x, 0, 0, 0)).x;
-    s2.y = read_imagef(vol, linearSmp, pos + (float4)(0, +offset.y, 0, 0)).x;
-    s2.z = read_imagef(vol, linearSmp, pos + (float4)(0, 0, +offset.z, 0)).x;
+    s2.x = readVolume(vol, pageTable, pos + (float4)(+offset.x, 0, 0, 0), true).x;
+    s2.y = readVolume(vol, pageTable, pos + (float4)(0, +offset.y, 0, 0), true).x;
+    s2.z = readVolume(vol, pageTable, pos + (float4)(0, 0, +offset.z, 0), true).x;
 
     float3 normal = fast_normalize(s2 - s1).xyz;
     if (length(normal) == 0.0f) // TODO: zero correct
@@ -178,25 +241,26 @@ float4 gradientCentralDiff(read_only image3d_t vol, const float4 pos)
 }
 
 // Compute gradient using central difference: f' = ( f(x+h)-f(x-h) ) and the transfer funciton
-float4 gradientCentralDiffTff(read_only image3d_t vol, const float4 pos, read_only image1d_t tff)
+float4 gradientCentralDiffTff(read_only image3d_t vol, read_only image3d_t pageTable,
+                              const float4 pos, read_only image1d_t tff)
 {
-    float3 volResf = convert_float3(get_image_dim(vol).xyz);
+    float3 volResf = convert_float3(volumeRes(vol));
     float3 offset = native_divide((float3)(1.0f), volResf);
     float3 s1;
     float3 s2;
     s1.x = read_imagef(tff, linearSmp,
-                       read_imagef(vol, linearSmp, pos + (float4)(-offset.x, 0, 0, 0)).x).w;
+                       readVolume(vol, pageTable, pos + (float4)(-offset.x, 0, 0, 0), true).x).w;
     s1.y = read_imagef(tff, linearSmp,
-                       read_imagef(vol, linearSmp, pos + (float4)(0, -offset.y, 0, 0)).x).w;
+                       readVolume(vol, pageTable, pos + (float4)(0, -offset.y, 0, 0), true).x).w;
     s1.z = read_imagef(tff, linearSmp,
-                       read_imagef(vol, linearSmp, pos + (float4)(0, 0, -offset.z, 0)).x).w;
+                       readVolume(vol, pageTable, pos + (float4)(0, 0, -offset.z, 0), true).x).w;
 
     s2.x = read_imagef(tff, linearSmp,
-                       read_imagef(vol, linearSmp, pos + (float4)(+offset.x, 0, 0, 0)).x).w;
+                       readVolume(vol, pageTable, pos + (float4)(+offset.x, 0, 0, 0), true).x).w;
     s2.y = read_imagef(tff, linearSmp,
-                       read_imagef(vol, linearSmp, pos + (float4)(0, +offset.y, 0, 0)).x).w;
+                       readVolume(vol, pageTable, pos + (float4)(0, +offset.y, 0, 0), true).x).w;
     s2.z = read_imagef(tff, linearSmp,
-                       read_imagef(vol, linearSmp, pos + (float4)(0, 0, +offset.z, 0)).x).w;
+                       readVolume(vol, pageTable, pos + (float4)(0, 0, +offset.z, 0), true).x).w;
 
     float3 normal = fast_normalize(s2 - s1).xyz;
     if (length(normal) == 0.0f) // TODO: zero correct
@@ -214,7 +278,7 @@ float getf4(float4 v, int id)
 }
 
 // Compute gradient using a sobel filter (1,2,4)
-float4 gradientSobel(read_only image3d_t vol, const float4 pos)
+float4 gradientSobel(read_only image3d_t vol, read_only image3d_t pageTable, const float4 pos)
 {
     float sobelWeights[3][3][3][3] = {
             {{{-1, -2, -1},
@@ -245,7 +309,7 @@ float4 gradientSobel(read_only image3d_t vol, const float4 pos)
               {-2,  0,  2},
               {-1,  0,  1}}}
     };
-    float3 volResf = convert_float3(get_image_dim(vol).xyz);
+    float3 volResf = convert_float3(volumeRes(vol));
     float3 offset = native_divide((float3)(1.0f), volResf);
 
     float4 gradient = (float4)(0.f);
@@ -259,7 +323,7 @@ float4 gradientSobel(read_only image3d_t vol, const float4 pos)
                 {
                     float4 samplePos = pos + (float4)(offset*(float3)(i,j,k), 0);
                     float weight = sobelWeights[dir][i + 1][j + 1][k + 1]
-                                        * read_imagef(vol, linearSmp, samplePos).x;
+                                        * readVolume(vol, pageTable, samplePos, true).x;
                     if (dir == 0) gradient.x += weight;
                     else if (dir == 1) gradient.y += weight;
                     else if (dir == 2) gradient.z += weight;
@@ -276,6 +340,28 @@ float4 gradientSobel(read_only image3d_t vol, const float4 pos)
     return gradient;
 }
 
+// Fetch the gradient from a precomputed RGBA8 volume: packed normal and clamped magnitude
+float4 gradientPrecomputed(read_only image3d_t gradients, const float4 pos)
+{
+    float4 packed = read_imagef(gradients, linearSmp, pos);
+    float3 normal = packed.xyz * 2.f - 1.f;
+    // interpolation between opposing normals may cancel out
+    normal = dot(normal, normal) > 1e-6f ? fast_normalize(normal) : (float3)(0.57735f);
+    return (float4)(normal, packed.w);
+}
+
+// Look up the color and opacity of a ray segment between two densities in the pre-integrated
+// transfer function table, the opacity is already corrected for the segment length
+float4 preIntegratedTff(read_only image2d_t table, const float front, const float back)
+{
+    float2 size = convert_float2(get_image_dim(table));
+    float2 coord = ((float2)(front, back) * (size - 1.f) + 0.5f) / size;
+    float4 segment = read_imagef(table, linearSmp, coord);
+    // the table holds associated colors, shading is applied to the plain color
+    segment.xyz = segment.w > 1e-6f ? segment.xyz / segment.w : (float3)(0.f);
+    return segment;
+}
+
 // specular part of blinn-phong shading model
 float3 specularBlinnPhong(float3 lightColor, float specularExp, float3 materialColor,
                           float3 normal, float3 toLightDir, float3 toCameraDir)
@@ -365,8 +451,8 @@ float3 getUniformRandomSampleDirectionUpper(const float3 n, uint4 *ui_rand)
 
 
 // Calculate object space ambient occlusion factor with monte carlo sampling
-float calcAO(float3 n, uint4 *ui_rand, image3d_t volData, float3 pos, float stepSize, float r,
-             image1d_t tff)
+float calcAO(float3 n, uint4 *ui_rand, image3d_t volData, image3d_t pageTable, float3 pos,
+             float stepSize, float r, image1d_t tff)
 {
     float ao = 0.f;
     int rays = 16;
@@ -379,7 +465,8 @@ float calcAO(float3 n, uint4 *ui_rand, image3d_t volData, float3 pos, float step
         while (cnt*stepSize < r)
         {
             ++cnt;
-            float density = read_imagef(volData, linearSmp, (float4)(pos + dir*cnt*stepSize, 1.f)).x;
+            float density = readVolume(volData, pageTable, (float4)(pos + dir*cnt*stepSize, 1.f),
+                                       true).x;
             sample += read_imagef(tff, linearSmp, density).w;
             if (sample > 0.98f)
                 break;
@@ -397,10 +484,11 @@ float calcAO(float3 n, uint4 *ui_rand, image3d_t volData, float3 pos, float step
  * volume tracing
  */
 float get_extinction(const float3 pos,
-                     read_only image3d_t vol)
+                     read_only image3d_t vol,
+                     read_only image3d_t pageTable)
 {
     float4 samplePos = (float4)(pos * 0.5f + 0.5f, 1.f);
-    return read_imagef(vol, linearSmp, samplePos).x;
+    return readVolume(vol, pageTable, samplePos, true).x;
 }
 
 //
@@ -409,6 +497,7 @@ bool sample_interaction(uint rand,
                         const float3 ray_dir,
                         const float max_extinction,
                         read_only image3d_t vol,
+                        read_only image3d_t pageTable,
                         read_only image1d_t tff,
                         float4 *colorOut)
 {
@@ -425,7 +514,7 @@ bool sample_interaction(uint rand,
         pos = *ray_pos + ray_dir * t;
         if (!in_volume(pos))
             return false;
-        sample = get_extinction(pos, vol);
+        sample = get_extinction(pos, vol, pageTable);
         color = read_imagef(tff, linearSmp, sample);
         if (cnt > 512)  // TODO: variable or based on data set resolution
             return false;
@@ -440,11 +529,12 @@ bool sample_interaction(uint rand,
 float3 surface_scatter(float3 ray_pos,
                        float3 ray_dir,
                        read_only image3d_t vol,
+                       read_only image3d_t pageTable,
                        read_only image1d_t tff,
                        float4 color)
 {
     float4 samplePos = (float4)(ray_pos * 0.5f + 0.5f, 1.f);
-    float4 gradient = -gradientCentralDiffTff(vol, samplePos, tff);
+    float4 gradient = -gradientCentralDiffTff(vol, pageTable, samplePos, tff);
     return illumination(samplePos, color.xyz, -ray_dir + (float3)(0.5f, 0.5f, 0.f), gradient.xyz);
 //    float p = color.w *(1.f - exp(-gradient));
 }
@@ -466,6 +556,7 @@ float3 trace_volume(uint rand,
                     float t0,
                     const float max_extinction,
                     read_only image3d_t vol,
+                    read_only image3d_t pageTable,
                     read_only image1d_t tff,
                     float4 backgroundColor)
 {
@@ -474,13 +565,14 @@ float3 trace_volume(uint rand,
     unsigned int num_interactions = 0;
     float4 color = backgroundColor;
     bool isInteraction = false;
-    isInteraction = sample_interaction(rand, &ray_pos, ray_dir, max_extinction, vol, tff, &color);
+    isInteraction = sample_interaction(rand, &ray_pos, ray_dir, max_extinction, vol, pageTable, tff,
+                                       &color);
     if (isInteraction) // scatter event
     {
         float3 light_dir = -ray_dir + (float3)(0.5f, 0.5f, 0.f);
         // surface scattering (phong based)
         float4 samplePos = (float4)(ray_pos * 0.5f + 0.5f, 1.f);
-        float4 gradient = -gradientCentralDiffTff(vol, samplePos, tff);
+        float4 gradient = -gradientCentralDiffTff(vol, pageTable, samplePos, tff);
         if (length(gradient) > 0.5f)    // high gradient -> phong illumination
         {
             color.xyz = illumination(samplePos, color.xyz, light_dir, gradient.xyz);
@@ -490,12 +582,14 @@ float3 trace_volume(uint rand,
             float3 ray_dir_scatter = get_dir_phase_function(rand);
             float3 ray_pos_scatter = ray_pos;
             float4 scatterColor = backgroundColor;
-            sample_interaction(rand, &ray_pos_scatter, ray_dir_scatter, max_extinction, vol, tff, &scatterColor);
+            sample_interaction(rand, &ray_pos_scatter, ray_dir_scatter, max_extinction, vol, pageTable,
+                               tff, &scatterColor);
             color = mix(color, scatterColor, 0.5f);
         }
         // shadow ray towards point light
         float4 colorShadow = backgroundColor;
-        isInteraction = sample_interaction(rand, &ray_pos, light_dir, max_extinction, vol, tff, &colorShadow);
+        isInteraction = sample_interaction(rand, &ray_pos, light_dir, max_extinction, vol, pageTable,
+                                           tff, &colorShadow);
         if (isInteraction)
             w = 0.6f;
     }
@@ -524,6 +618,150 @@ uint4 getLastHit(__read_only image2d_t inHitImg, const int2 groupId)
     return lastHit;
 }
 
+// read a min/max node of the brick hierarchy, levels > 0 are packed along x in brickMips
+float2 readBrickNode(read_only image3d_t volBrickData, read_only image3d_t brickMips,
+                     const int3 node, const int level)
+{
+    if (level == 0)
+        return read_imagef(volBrickData, (int4)(node, 0)).xy;
+    int bricksResX = get_image_dim(volBrickData).x;
+    int offset = 0;
+    for (int l = 1; l < level; ++l)
+        offset += (bricksResX + (1 << l) - 1) >> l;
+    return read_imagef(brickMips, (int4)(node.x + offset, node.y, node.z, 0)).xy;
+}
+
+// number of nodes of a level of the brick hierarchy
+int brickLevelNodes(const int3 bricksRes, const int level)
+{
+    int3 levelRes = (bricksRes + (1 << level) - 1) >> level;
+    return levelRes.x * levelRes.y * levelRes.z;
+}
+
+// read the occupancy bit of a node, levels are stored consecutively starting at level 0
+bool isOccupied(__global const uint *occupancy, const uint levelOffset, const int3 node,
+                const int3 levelRes)
+{
+    uint bit = levelOffset + node.x + levelRes.x*(node.y + levelRes.y*node.z);
+    return (occupancy[bit >> 5] >> (bit & 31u)) & 1u;
+}
+
+// check if all densities in [min, max] are mapped to full transparency
+bool isEmptyNode(const float2 minMaxDensity, read_only image1d_t tffData,
+                 read_only image1d_t tffPrefix)
+{
+    float alphaMax = read_imagef(tffData, linearSmp, minMaxDensity.y).w;
+    if (alphaMax >= 1e-6f)
+        return false;
+    uint prefixMin = read_imageui(tffPrefix, nearestSmp, minMaxDensity.x).x;
+    uint prefixMax = read_imageui(tffPrefix, nearestSmp, minMaxDensity.y).x;
+    return prefixMin == prefixMax;
+}
+
+// add to a 64 bit counter stored as two uints (low, high)
+void addStepCounter(volatile __global uint *counter, const uint value)
+{
+    if (value == 0u)
+        return;
+    uint old = atomic_add(counter, value);
+    if (old + value < old)
+        atomic_inc(counter + 1);
+}
+
+// per-pixel cost of a ray: samples, skipped bricks, gradient evaluations and the sample that
+// terminated the ray (0: not terminated), the placeholder image only covers the first pixel
+void writeDiagnostics(__write_only image2d_t diagnosticImg, const int2 texCoords,
+                      const uint4 cost, const uint enabled)
+{
+    if (enabled && all(texCoords < get_image_dim(diagnosticImg)))
+        write_imageui(diagnosticImg, texCoords, cost);
+}
+
+// representative depth of a ray for the temporal reprojection (< 0: none), the placeholder image
+// only covers the first pixel
+void writeDepth(__write_only image2d_t depthImg, const int2 texCoords, const float depth,
+                const uint reproject)
+{
+    if (reproject != REPROJECT_OFF && all(texCoords < get_image_dim(depthImg)))
+        write_imagef(depthImg, texCoords, (float4)(depth, 0.f, 0.f, 1.f));
+}
+
+// index of the work-group tile of a pixel in the tile error buffers, which are sized like the
+// output image plus one column and row
+uint tileIndex(const int2 texCoords, const int2 localSize, const int imageWidth)
+{
+    int2 groupId = texCoords / localSize;
+    return (uint)(groupId.x + groupId.y*(imageWidth / localSize.x + 1));
+}
+
+// global id of a work-item in the pixel traversal order: with traversal > 0, the linear
+// work-group id is remapped to vertical strips of traversal groups, so that the groups in flight
+// cover a compact region of the frame instead of whole rows
+int2 traversalId(const uint traversal)
+{
+    if (traversal == 0)
+        return (int2)(get_global_id(0), get_global_id(1));
+    uint2 groups = (uint2)(get_num_groups(0), get_num_groups(1));
+    uint group = get_group_id(0) + get_group_id(1)*groups.x;
+    uint strip = group / (traversal*groups.y);
+    uint stripWidth = min(traversal, groups.x - strip*traversal);
+    uint stripGroup = group - strip*traversal*groups.y;
+    uint2 groupId = (uint2)(strip*traversal + stripGroup % stripWidth, stripGroup / stripWidth);
+    return convert_int2(groupId * (uint2)(get_local_size(0), get_local_size(1))
+                        + (uint2)(get_local_id(0), get_local_id(1))
+                        + (uint2)(get_global_offset(0), get_global_offset(1)));
+}
+
+// blend a new sample into the running mean of the accumulation buffer and estimate the
+// standard error of the mean, the alpha channel holds the mean of the squared luminance
+float4 accumulateSample(__read_only image2d_t inAccumulate, __write_only image2d_t outAccumulate,
+                        const int2 texCoords, const float3 col, const uint iteration,
+                        float *error)
+{
+    const float3 lumWeights = (float3)(0.2126f, 0.7152f, 0.0722f);
+    float lum = dot(col, lumWeights);
+    float4 acc = (float4)(col, lum*lum);
+    if (iteration > 0)
+    {
+        float4 prev = read_imagef(inAccumulate, nearestIntSmp, texCoords);
+        acc = prev + (acc - prev) / (float4)(iteration + 1);
+    }
+    write_imagef(outAccumulate, texCoords, acc);
+    float meanLum = dot(acc.xyz, lumWeights);
+    *error = sqrt(max(acc.w - meanLum*meanLum, 0.f) / (float)(iteration + 1));
+    return acc;
+}
+
+// raise the error of the tile to the error of a pixel, positive floats compare like uints
+// and each tile passes the threshold at most once per frame
+void addTileError(volatile __global uint *tileError, volatile __global uint *activeTiles,
+                  const uint tile, const float error, const float threshold)
+{
+    if (threshold <= 0.f)
+        return;
+    uint old = atomic_max(tileError + tile, as_uint(error));
+    if (as_uint(error) >= as_uint(threshold) && old < as_uint(threshold))
+        atomic_inc(activeTiles);
+}
+
+// ray entry (x) and exit (y) distance of the occupied bricks, rasterized at the pixel centers:
+// the 3x3 neighborhood also covers the jittered rays at silhouettes, negative if not covered
+float2 proxyInterval(read_only image2d_t proxyDepth, const int2 texCoords)
+{
+    float2 interval = (float2)(FLT_MAX, -1.f);
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            float2 d = read_imagef(proxyDepth, nearestIntSmp, texCoords + (int2)(x, y)).xy;
+            if (d.y > 0.f)  // also skips the zero border outside of the image
+                interval = (float2)(min(interval.x, d.x), max(interval.y, d.y));
+        }
+    }
+    // margin for the interpolation of the rasterized distances
+    return interval.y < 0.f ? interval : interval + (float2)(-1e-3f, 1e-3f);
+}
+
 // transform vector using 3x3 matrix
 float3 transformVec3(const float16 mat, const float3 vec)
 {
@@ -564,6 +802,15 @@ typedef struct tag_rendering_params
     uint technique;     // raycast (0) or pathtracing (1)
     uint seed;
     uint iteration;
+
+    float errorThreshold;   // progressive refinement, 0: off
+    uint minIterations;     // iterations before a tile may converge
+    int2 frameSize;         // padded size of the whole frame, the NDRange may cover a band of it
+    int2 tileOrigin;        // pixel of the frame at the image origin, the images may cover a tile
+    uint proxy;             // rasterized ray intervals: 0 off, 1 exit only, 2 entry and exit
+    uint reproject;         // temporal reprojection: REPROJECT_OFF, _DEPTH or _HISTORY
+    float reprojectionRate; // sampling rate factor of pixels with a valid history
+    uint traversal;         // work-group order of volumeRender: 0 rows, n strips of n groups
 } rendering_params;
 
 typedef struct tag_raycast_params
@@ -572,6 +819,10 @@ typedef struct tag_raycast_params
     uint useAO;         // bool
     uint contours;      // bool
     uint aerial;        // bool
+    uint brickLevels;   // levels of the min/max brick hierarchy
+    uint countSteps;    // bool
+    uint preIntegrated; // bool
+    uint diagnostics;   // bool, per-pixel ray cost output
 
     float3 brickRes;
 } raycast_params;
@@ -581,50 +832,83 @@ typedef struct tag_pathtrace_params
     float max_extinction;
 } pathtrace_params;
 
-/**
- * ===============================
- * direct volume raycasting kernel
- * ===============================
- */
-__kernel void volumeRender(  __read_only image3d_t volData
-                           , __read_only image3d_t volBrickData
-                           , __read_only image1d_t tffData     // constant transfer function values
-                           , __write_only image2d_t outImg
-                           , __read_only image1d_t tffPrefix
-                           , __read_only image2d_t inAccumulate
-                           , __write_only image2d_t outAccumulate
-                           , __read_only image2d_t inHitImg
-                           , __write_only image2d_t outHitImg
-                           , __read_only image2d_t environment
-                           , const camera_params camera
-                           , const rendering_params render
-                           , const raycast_params raycast
-                           , const pathtrace_params pathtrace
-                           )
+typedef struct tag_reprojection_params
 {
-    int2 globalId = (int2)(get_global_id(0), get_global_id(1));
-    if(any(globalId >= get_image_dim(outImg)))
-        return;
-    int2 texCoords = globalId;
-
-    // pseudo random number [0,1] for ray offsets to avoid moire patterns
-    uint4 ui_rand = ParallelRNG3(globalId.x, globalId.y, render.seed); //initRNG(1);
-    float rand = (float)(ParallelRNG3(globalId.x, globalId.y, render.seed)) / (float)(UINT_MAX);
+    float16 historyInvView; // inverse of the rotation (rows s012, s456, s89a) of the history
+                            // view, its camera position in s37b
+    float blend;            // weight of the samples of this frame
+    float depthTolerance;   // relative depth difference of a valid history sample
+} reprojection_params;
+
+// Render options are compile time constants in specialized kernel variants
+// (e.g. -DILLUM_TYPE=1), runtime parameters in the generic variant.
+#ifdef ILLUM_TYPE
+  #define OPT_ILLUM_TYPE ILLUM_TYPE
+#else
+  #define OPT_ILLUM_TYPE render.illumType
+#endif
+#ifdef TECHNIQUE
+  #define OPT_TECHNIQUE TECHNIQUE
+#else
+  #define OPT_TECHNIQUE render.technique
+#endif
+#ifdef LINEAR_SAMPLING
+  #define OPT_LINEAR LINEAR_SAMPLING
+#else
+  #define OPT_LINEAR render.useLinear
+#endif
+#ifdef CONTOURS
+  #define OPT_CONTOURS CONTOURS
+#else
+  #define OPT_CONTOURS raycast.contours
+#endif
+#ifdef AERIAL
+  #define OPT_AERIAL AERIAL
+#else
+  #define OPT_AERIAL raycast.aerial
+#endif
+#ifdef AMBIENT_OCCLUSION
+  #define OPT_AO AMBIENT_OCCLUSION
+#else
+  #define OPT_AO raycast.useAO
+#endif
+#ifdef PREINTEGRATED
+  #define OPT_PREINTEGRATED PREINTEGRATED
+#else
+  #define OPT_PREINTEGRATED raycast.preIntegrated
+#endif
+#ifdef CHANNEL_ORDER
+  #define OPT_CHANNEL_ORDER CHANNEL_ORDER
+#else
+  #define OPT_CHANNEL_ORDER get_image_channel_order(volData)
+#endif
+// density gradients from one texel of the gradient volume instead of a stencil
+#ifdef GRADIENT_VOLUME
+  #define GRADIENT_CENTRAL(p) gradientPrecomputed(gradientData, (float4)(p, 1.f))
+  #define GRADIENT_SOBEL(p) gradientPrecomputed(gradientData, (float4)(p, 1.f))
+#else
+  #define GRADIENT_CENTRAL(p) gradientCentralDiff(volData, pageTable, (float4)(p, 1.f))
+  #define GRADIENT_SOBEL(p) gradientSobel(volData, pageTable, (float4)(p, 1.f))
+#endif
 
-    float aspectRatio = native_divide((float)get_global_size(1), (float)(get_global_size(0)));
-    aspectRatio = min(aspectRatio, native_divide((float)get_global_size(0), (float)(get_global_size(1))));
-    int maxImgSize = max(get_global_size(0), get_global_size(1));
+// primary ray through the pixel in world space, jittered inside the pixel
+void cameraRay(const int2 globalId, const float rand, const camera_params *camera,
+               const rendering_params *render, float3 *camPosOut, float3 *rayDirOut)
+{
+    float aspectRatio = native_divide((float)render->frameSize.y, (float)(render->frameSize.x));
+    aspectRatio = min(aspectRatio, native_divide((float)render->frameSize.x, (float)(render->frameSize.y)));
+    int maxImgSize = max(render->frameSize.x, render->frameSize.y);
     float2 imgCoords;
     imgCoords.x = native_divide((globalId.x), convert_float(maxImgSize)) * 2.f;
     imgCoords.y = native_divide((globalId.y), convert_float(maxImgSize)) * 2.f;
     // calculate correct offset based on aspect ratio
-    imgCoords -= get_global_size(0) > get_global_size(1) ?
+    imgCoords -= render->frameSize.x > render->frameSize.y ?
                         (float2)(1.0f, aspectRatio) : (float2)(aspectRatio, 1.0);
     imgCoords.y *= -1.f;   // flip y coord
 
     // jitter ray starting position inside pixel
-    float2 pixelSize = 2.f / (float2)(get_global_size(0), get_global_size(1));
-    float rand2 = (float)(ParallelRNG3(globalId.y, globalId.x, 2*render.seed)) / (float)(UINT_MAX);
+    float2 pixelSize = 2.f / convert_float2(render->frameSize);
+    float rand2 = (float)(ParallelRNG3(globalId.y, globalId.x, 2*render->seed)) / (float)(UINT_MAX);
     imgCoords += (float2)(rand2, -rand)*pixelSize;
 
     // z position of view plane is -1.0 to fit the cube to the screen quad when axes are aligned,
@@ -632,39 +916,117 @@ __kernel void volumeRender(  __read_only image3d_t volData
     // (with FoV of 90° and near plane in range [-1,+1]).
     float3 nearPlanePos = (float3)(imgCoords, -1.0f);
     // transform nearPlane from view space to world space
-    float3 rayDir = transformVec3(camera.viewMat, nearPlanePos);
+    float3 rayDir = transformVec3(camera->viewMat, nearPlanePos);
     // camera position in world space (ray origin) is translation vector of view matrix
-    float3 camPos = camera.viewMat.s37b*render.modelScale;
+    float3 camPos = camera->viewMat.s37b*render->modelScale;
 
-    if (camera.ortho)
+    if (camera->ortho)
     {
-        camPos = (float3)(camera.viewMat.s37b);
-        float3 viewPlane_x = camera.viewMat.s048;
-        float3 viewPlane_y = camera.viewMat.s159;
-        float3 viewPlane_z = camera.viewMat.s26a;
+        camPos = (float3)(camera->viewMat.s37b);
+        float3 viewPlane_x = camera->viewMat.s048;
+        float3 viewPlane_y = camera->viewMat.s159;
+        float3 viewPlane_z = camera->viewMat.s26a;
         rayDir = -viewPlane_z;
         nearPlanePos = camPos + imgCoords.x*viewPlane_x + imgCoords.y*viewPlane_y;
         nearPlanePos *= length(camPos);
-        camPos = nearPlanePos * render.modelScale;
+        camPos = nearPlanePos * render->modelScale;
     }
-    rayDir = fast_normalize(rayDir*render.modelScale);
+    *camPosOut = camPos;
+    *rayDirOut = fast_normalize(rayDir*render->modelScale);
+}
 
-    // sample environment map as background color if set
-    float4 envirCol = render.backgroundColor;
-    envirCol *= render.useGradient ? (float4)(0.7f + 0.5f * rayDir.y) : 1.f;
+// sample environment map as background color if set
+float4 backgroundColor(const float3 rayDir, const rendering_params *render,
+                       read_only image2d_t environment)
+{
+    float4 envirCol = render->backgroundColor;
+    envirCol *= render->useGradient ? (float4)(0.7f + 0.5f * rayDir.y) : 1.f;
     if (get_image_dim(environment).x > 1)
         envirCol = read_imagef(environment, linearSmp, get_environment_coords(rayDir));
+    return envirCol;
+}
+
+/**
+ * ===============================
+ * direct volume raycasting kernel
+ * ===============================
+ */
+__kernel void volumeRender(  __read_only image3d_t volData
+                           , __read_only image3d_t volBrickData
+                           , __read_only image1d_t tffData     // constant transfer function values
+                           , __write_only image2d_t outImg
+                           , __read_only image1d_t tffPrefix
+                           , __read_only image2d_t inAccumulate
+                           , __write_only image2d_t outAccumulate
+                           , __read_only image2d_t inHitImg
+                           , __write_only image2d_t outHitImg
+                           , __read_only image2d_t environment
+                           , const camera_params camera
+                           , const rendering_params render
+                           , const raycast_params raycast
+                           , const pathtrace_params pathtrace
+                           , __read_only image3d_t pageTable
+                           , __global uint *brickRequests
+                           , __read_only image3d_t brickMips
+                           , __global uint *essCounters
+                           , __global const uint *occupancy
+                           , __global const uint *inTileError
+                           , volatile __global uint *outTileError
+                           , volatile __global uint *activeTiles
+                           , __read_only image3d_t gradientData
+                           , __read_only image2d_t preIntegrationData
+                           , __read_only image2d_t proxyDepth
+                           , __write_only image2d_t diagnosticImg
+                           , __write_only image2d_t depthImg
+                           , __read_only image2d_t historyMask
+                           )
+{
+    // rays are set up in the whole frame, the images only cover the tile of the NDRange
+    int2 globalId = traversalId(render.traversal);
+    int2 texCoords = globalId - render.tileOrigin;
+    if(any(texCoords >= get_image_dim(outImg)))
+        return;
+
+    // work-group and tile ids in the image, band and tile offsets are multiples of the group size
+    int2 localSize = (int2)((int)get_local_size(0), (int)get_local_size(1));
+    int2 groupId = texCoords / localSize;
+    uint tile = tileIndex(texCoords, localSize, get_image_width(outImg));
+
+    // progressive refinement: converged tiles only pass on their accumulated color
+    if (render.errorThreshold > 0.f && render.iteration >= render.minIterations
+            && inTileError[tile] < as_uint(render.errorThreshold))
+    {
+        float4 acc = read_imagef(inAccumulate, nearestIntSmp, texCoords);
+        write_imagef(outAccumulate, texCoords, acc);
+        write_imagef(outImg, texCoords, (float4)(acc.xyz, 1.f));
+        if (render.imgEss && get_local_id(0) + get_local_id(1) == 0)
+            write_imageui(outHitImg, groupId, read_imageui(inHitImg, nearestIntSmp, groupId));
+        writeDiagnostics(diagnosticImg, texCoords, (uint4)(0u), raycast.diagnostics);
+        return;
+    }
+
+    // pseudo random number [0,1] for ray offsets to avoid moire patterns
+    uint4 ui_rand = ParallelRNG3(globalId.x, globalId.y, render.seed); //initRNG(1);
+    float rand = (float)(ParallelRNG3(globalId.x, globalId.y, render.seed)) / (float)(UINT_MAX);
+
+    float3 camPos;
+    float3 rayDir;
+    cameraRay(globalId, rand, &camera, &render, &camPos, &rayDir);
+    float4 envirCol = backgroundColor(rayDir, &render, environment);
 
     // image order ess
     local uint hits;
     if (render.imgEss)
     {
         hits = 0;
-        uint4 lastHit = getLastHit(inHitImg, (int2)(get_group_id(0), get_group_id(1)));
+        uint4 lastHit = getLastHit(inHitImg, groupId);
         if (!lastHit.x)
         {
+            write_imagef(outAccumulate, texCoords, (float4)(envirCol.xyz, 0.f));
             write_imagef(outImg, texCoords, render.showEss ? (float4)(1.f) - envirCol : envirCol);
-            write_imageui(outHitImg, (int2)(get_group_id(0), get_group_id(1)), (uint4)(0u));
+            write_imageui(outHitImg, groupId, (uint4)(0u));
+            writeDiagnostics(diagnosticImg, texCoords, (uint4)(0u), raycast.diagnostics);
+            writeDepth(depthImg, texCoords, -1.f, render.reproject);
             return;
         }
     }
@@ -674,44 +1036,68 @@ __kernel void volumeRender(  __read_only image3d_t volData
     int hit = 0;
     // uniform bbox from (-1,-1,-1) to (+1,+1,+1)
     hit = intersectBBox(camPos, rayDir, camera.bbox_bl, camera.bbox_tr, &tnear, &tfar);
+    // tight interval of the occupied bricks from the rasterized proxy geometry
+    if (hit && render.proxy && OPT_TECHNIQUE == 0 && !camera.ortho)
+    {
+        float2 proxy = proxyInterval(proxyDepth, globalId);
+        if (proxy.y < 0.f)
+            hit = 0;
+        else
+        {
+            if (render.proxy == 2)
+                tnear = max(tnear, proxy.x);
+            tfar = min(tfar, proxy.y);
+        }
+    }
     if (!hit || tfar < 0)
     {
+        write_imagef(outAccumulate, texCoords, (float4)(envirCol.xyz, 0.f));
         write_imagef(outImg, texCoords, envirCol);
         if (render.imgEss)
-            write_imageui(outHitImg, (int2)(get_group_id(0), get_group_id(1)), (uint4)(0u));
+            write_imageui(outHitImg, groupId, (uint4)(0u));
+        writeDiagnostics(diagnosticImg, texCoords, (uint4)(0u), raycast.diagnostics);
+        writeDepth(depthImg, texCoords, -1.f, render.reproject);
         return;
     }
 
     // ---- path tracing ----
-    if (render.technique == 1)
+    if (OPT_TECHNIQUE == 1)
     {
-        uint random = ParallelRNG3(texCoords.x, texCoords.y, render.seed);
+        uint random = ParallelRNG3(globalId.x, globalId.y, render.seed);
         float3 col = trace_volume(random, camPos, rayDir, tnear, pathtrace.max_extinction,
-                                  volData, tffData, envirCol);
+                                  volData, pageTable, tffData, envirCol);
         // Accumulation
-        if (render.iteration == 0)
-        {
-            write_imagef(outAccumulate, texCoords, (float4)(col, 1.f));
-        }
-        else
-        {
-            float3 prevCol = read_imagef(inAccumulate, nearestIntSmp, texCoords).xyz;
-            col = prevCol + (col - prevCol) / (float3)(render.iteration + 1);
-            write_imagef(outAccumulate, texCoords, (float4)(col, 1.f));
-        }
+        float error = 0.f;
+        col = accumulateSample(inAccumulate, outAccumulate, texCoords, col, render.iteration,
+                               &error).xyz;
+        addTileError(outTileError, activeTiles, tile, error, render.errorThreshold);
         //col *= (1.f + col*0.1f) / (1.f + col);
         //col = min(pow(max(col, 0.0f), (float3)(1.f / 2.2f)), (float3)(1.0f));
         write_imagef(outImg, texCoords, (float4)(col, 1.f));
+        writeDiagnostics(diagnosticImg, texCoords, (uint4)(0u), raycast.diagnostics);
         return;
     }
 
     // ---- ray casting ----
     float sampleDist = tfar - tnear;
     if (sampleDist <= 0.f)
+    {
+        write_imagef(outAccumulate, texCoords, (float4)(envirCol.xyz, 0.f));
+        writeDiagnostics(diagnosticImg, texCoords, (uint4)(0u), raycast.diagnostics);
+        writeDepth(depthImg, texCoords, -1.f, render.reproject);
         return;
-    int3 volRes = get_image_dim(volData).xyz;
+    }
+    // pre-integrated segments between the previous and the current density sample
+    bool preIntegrated = OPT_PREINTEGRATED && OPT_CHANNEL_ORDER == CLK_R && OPT_ILLUM_TYPE != 4;
+    // pixels with a valid reprojected history are refined at a reduced sampling rate, the
+    // pre-integration table is only valid for the configured one
+    float samplingRate = raycast.samplingRate;
+    if (render.reproject == REPROJECT_HISTORY && !preIntegrated
+            && read_imageui(historyMask, nearestIntSmp, texCoords).x)
+        samplingRate *= render.reprojectionRate;
+    int3 volRes = volumeRes(volData);
     float stepSize = min(sampleDist, sampleDist /
-                          (raycast.samplingRate*length(sampleDist*rayDir*convert_float3(volRes))));
+                          (samplingRate*length(sampleDist*rayDir*convert_float3(volRes))));
     float samples = ceil(sampleDist/stepSize);
     stepSize = sampleDist/samples;
 
@@ -726,66 +1112,86 @@ __kernel void volumeRender(  __read_only image3d_t volData
     float t = tnear;
 
     float3 voxLen = (float3)(1.f) / convert_float3(volRes);
-    float refSamplingInterval = 1.f / raycast.samplingRate;
+    float refSamplingInterval = 1.f / samplingRate;
     float t_exit = tfar;
+    float prevDensity = -1.f;
+    // representative depth: where the opacity passes REPROJECTION_ALPHA, the opacity weighted
+    // mean depth for translucent rays
+    float depth = -1.f;
+    float depthSum = 0.f;
 
     // offset by random distance to avoid moiré pattern and interpolation issues
     float offset = length(voxLen)*rand*2.0f;
+    uint skippedSteps = 0;
+    uint sampledSteps = 0;
+    uint skippedBricks = 0;     // empty nodes of any level and missing bricks
+    uint gradients = 0;
+    uint terminationStep = 0;
 
 #ifdef ESS
-    // 3D DDA initialization
+    // hierarchical DDA initialization
     int3 bricksRes = get_image_dim(volBrickData).xyz;
-//        if ((bricksRes.x & 1) != 0) bricksRes.x -= 1;
-//        if ((bricksRes.y & 1) != 0) bricksRes.y -= 1;
-//        if ((bricksRes.z & 1) != 0) bricksRes.z -= 1;
     float3 brickLen = (float3)(1.f) / raycast.brickRes;    // actual fractal brick resolution
-    float3 invRay = 1.f/rayDir;
-    int3 step = select(convert_int3(sign(rayDir)), (int3)(1), approxEq3(rayDir, (float3)(0)));
-    invRay = select(invRay, (float3)(FLT_MAX), approxEq3(rayDir, (float3)(0.f)));
-
-    float3 deltaT = convert_float3(step)*(brickLen*2.f*invRay);
-    float3 voxIncr = (float3)0;
-
-    // convert ray starting point to cell coordinates
-    float3 rayOrigCell = (camPos + rayDir * tnear) - (float3)(-1.f);
-    int3 cell = clamp(convert_int3(floor(rayOrigCell / (2.f*brickLen))),
-                        (int3)(0), convert_int3(bricksRes.xyz) - 1);
-
-    // add +1 to cells if ray dir component is negative: rayDir >= 0 ? (-1) : 0
-    float3 tv = tnear + (convert_float3(cell - isgreaterequal(rayDir, (float3)(0)))
-                            * (2.f*brickLen) - rayOrigCell) * invRay;
-    int3 exit = step * bricksRes.xyz;
-    exit = select(exit, (int3)(-1), exit < (int3)(0));
-    // length of diagonal of a brick => longest distance through brick
-    float brickDia = length(brickLen)*2.f;
-
-    // 3D DDA loop over low-res grid for image order empty space skipping
+    // traverse the cells along the jittered sample positions, in level 0 cell coordinates
+    float3 rayOrigCell = (camPos - offset*rayDir - (float3)(-1.f)) / (2.f*brickLen);
+    float3 rayDirCell = rayDir / (2.f*brickLen);
+    float3 invRayCell = (2.f*brickLen) / rayDir;
+    invRayCell = select(invRayCell, (float3)(FLT_MAX), approxEq3(rayDir, (float3)(0.f)));
+    int topLevel = clamp((int)(raycast.brickLevels) - 1, 0, MAX_BRICK_LEVELS - 1);
+    int level = topLevel;
+    uint levelOffsets[MAX_BRICK_LEVELS];
+    levelOffsets[0] = 0;
+    for (int l = 1; l <= topLevel; ++l)
+        levelOffsets[l] = levelOffsets[l - 1] + brickLevelNodes(bricksRes, l - 1);
+
+    // hierarchical DDA: skip empty nodes as coarse as possible, refine non-empty ones
     while (t < tfar)
     {
-        float2 minMaxDensity = read_imagef(volBrickData, (int4)(cell, 0)).xy;
-        // increment to next brick
-        voxIncr.x = (tv.x <= tv.y) && (tv.x <= tv.z) ? 1 : 0;
-        voxIncr.y = (tv.y <= tv.x) && (tv.y <= tv.z) ? 1 : 0;
-        voxIncr.z = (tv.z <= tv.x) && (tv.z <= tv.y) ? 1 : 0;
-        cell += convert_int3(voxIncr) * step;    // [0; res-1]
-
-        t_exit = dot((float3)(1), tv * voxIncr);
-        t_exit = clamp(t_exit, t+stepSize, t+brickDia);
-        tv += voxIncr*deltaT;
-
-        // skip bricks that contain only fully transparent voxels
-        float alphaMax = read_imagef(tffData, linearSmp, minMaxDensity.y).w;
-        if (alphaMax < 1e-6f)
+        // level 0 cell at the ray position, slightly moved along the ray to leave the last node
+        float3 posCell = rayOrigCell + (t + stepSize*1e-3f)*rayDirCell;
+        int3 cell = clamp(convert_int3(floor(posCell)), (int3)(0), bricksRes - 1);
+        int3 node = cell >> level;
+        int3 levelRes = (bricksRes + (1 << level) - 1) >> level;
+
+        // exit distance of the node
+        float3 nodeLower = convert_float3(node << level);
+        float3 nodeUpper = nodeLower + (float)(1 << level);
+        float3 tNode = fmax((nodeLower - rayOrigCell) * invRayCell,
+                            (nodeUpper - rayOrigCell) * invRayCell);
+        t_exit = max(min(min(tNode.x, tNode.y), tNode.z), t + stepSize);
+
+        // skip nodes that contain only fully transparent voxels and continue on the parent level
+        if (!isOccupied(occupancy, levelOffsets[level], node, levelRes))
         {
-            uint prefixMin = read_imageui(tffPrefix, nearestSmp, minMaxDensity.x).x;
-            uint prefixMax = read_imageui(tffPrefix, nearestSmp, minMaxDensity.y).x;
-            if (prefixMin == prefixMax)
-            {
-                t = t_exit;
-                continue;
-            }
+            skippedSteps += convert_uint(ceil((min(t_exit, tfar) - t) / stepSize));
+            ++skippedBricks;
+            t = t_exit;
+            level = min(level + 1, topLevel);
+            continue;
+        }
+        if (level > 0)
+        {
+            --level;
+            continue;
+        }
+#ifdef PAGED
+        // non-empty brick: count the rays requesting it if it is not resident (its screen
+        // coverage, used to prioritize the uploads), mark it as used otherwise
+        size_t brickId = cell.x + bricksRes.x*(cell.y + bricksRes.y*cell.z);
+        if (read_imageui(pageTable, nearestIntSmp, (int4)(cell, 0)).x == 0u)
+        {
+            atomic_inc(&brickRequests[brickId]);
+            ++skippedBricks;
+            t = t_exit;
+            level = min(1, topLevel);
+            continue;
         }
+        if (brickRequests[brickId] != BRICK_USED)
+            brickRequests[brickId] = BRICK_USED;
+#endif  // PAGED
 #endif  // ESS
+        // the first sample after skipped space has no valid front sample
+        prevDensity = -1.f;
         // standard raycasting loop
         while (t < t_exit)
         {
@@ -793,60 +1199,70 @@ __kernel void volumeRender(  __read_only image3d_t volData
             pos = pos * 0.5f + 0.5f;    // normalize to [0,1]
 
             float4 gradient = (float4)(0.f);
-            if (render.illumType == 4)   // gradient magnitude based shading
+            if (OPT_ILLUM_TYPE == 4)   // gradient magnitude based shading
             {
-                gradient = -gradientCentralDiff(volData, (float4)(pos, 1.f));
+                gradient = -GRADIENT_CENTRAL(pos);
+                ++gradients;
                 tfColor = read_imagef(tffData, linearSmp, -gradient.w);
             }
             else    // density based shading and optional illumination
             {
-                if (get_image_channel_order(volData) == CLK_R)
+                if (OPT_CHANNEL_ORDER == CLK_R)
                 {
-                    density = render.useLinear ? read_imagef(volData,  linearSmp, (float4)(pos, 1.f)).x
-                                               : read_imagef(volData, nearestSmp, (float4)(pos, 1.f)).x;
+                    density = readVolume(volData, pageTable, (float4)(pos, 1.f), OPT_LINEAR).x;
 //                    density /= 10.f;  // TODO: normalization with max density
-                    tfColor = read_imagef(tffData, linearSmp, density);  // map density to color
-                    if (tfColor.w > 0.1f && render.illumType)
+                    if (preIntegrated)
+                        tfColor = preIntegratedTff(preIntegrationData,
+                                                   prevDensity < 0.f ? density : prevDensity,
+                                                   density);
+                    else
+                        tfColor = read_imagef(tffData, linearSmp, density);  // map density to color
+                    prevDensity = density;
+                    if (tfColor.w > 0.1f && OPT_ILLUM_TYPE)
                     {
-                        switch (render.illumType)
+                        gradients += OPT_ILLUM_TYPE <= 3 ? 1u : 0u;
+                        switch (OPT_ILLUM_TYPE)
                         {
                         case 1:     // central diff
-                            gradient = -gradientCentralDiff(volData, (float4)(pos, 1.f));
+                            gradient = -GRADIENT_CENTRAL(pos);
                             break;
                         case 2:     // central diff & transfer function
-                            gradient = -gradientCentralDiffTff(volData, (float4)(pos, 1.f), tffData);
+                            gradient = -gradientCentralDiffTff(volData, pageTable, (float4)(pos, 1.f),
+                                                               tffData);
                             break;
                         case 3:     // sobel filter
-                            gradient = -gradientSobel(volData, (float4)(pos, 1.f));
+                            gradient = -GRADIENT_SOBEL(pos);
                         default:
                             break;
                         }
-                        if (render.illumType == 5)
+                        if (OPT_ILLUM_TYPE == 5)
                         {
-                            gradient = -gradientCentralDiff(volData, (float4)(pos, 1.f));
+                            gradient = -GRADIENT_CENTRAL(pos);
+                            ++gradients;
                             tfColor.xyz = celShading(tfColor.xyz, -rayDir, gradient.xyz);
                         }
                         else
                             tfColor.xyz = illumination((float4)(pos, 1.f), tfColor.xyz, -rayDir, gradient.xyz);
                     }
-                    if (tfColor.w > 0.1f && raycast.contours) // edge enhancement
+                    if (tfColor.w > 0.1f && OPT_CONTOURS) // edge enhancement
                     {
-                        if (!render.illumType) // no illumination
-                            gradient = -gradientCentralDiff(volData, (float4)(pos, 1.f));
+                        if (!OPT_ILLUM_TYPE) // no illumination
+                        {
+                            gradient = -GRADIENT_CENTRAL(pos);
+                            ++gradients;
+                        }
                         tfColor.xyz *= fabs(dot(rayDir, gradient.xyz));
                     }
                 }
                 // RGBA: use values directly
-                else if (get_image_channel_order(volData) == CLK_RGBA)
+                else if (OPT_CHANNEL_ORDER == CLK_RGBA)
                 {
-                    tfColor = render.useLinear ? read_imagef(volData,  linearSmp, (float4)(pos, 1.f))
-                                               : read_imagef(volData, nearestSmp, (float4)(pos, 1.f));
+                    tfColor = readVolume(volData, pageTable, (float4)(pos, 1.f), OPT_LINEAR);
                 }
                 // RG: 2D vector, map magnitude to alpha
-                else if (get_image_channel_order(volData) == CLK_RG)
+                else if (OPT_CHANNEL_ORDER == CLK_RG)
                 {
-                    tfColor = render.useLinear ? read_imagef(volData,  linearSmp, (float4)(pos, 1.f))
-                                               : read_imagef(volData, nearestSmp, (float4)(pos, 1.f));
+                    tfColor = readVolume(volData, pageTable, (float4)(pos, 1.f), OPT_LINEAR);
                     //tfColor.xyz = read_imagef(tffData, linearSmp, tfColor.x).xyz;
                     density = length(tfColor.y / 1.f);
                     tfColor.y = 0.f;
@@ -854,24 +1270,32 @@ __kernel void volumeRender(  __read_only image3d_t volData
                 }
             }
             tfColor.xyz = envirCol.xyz - tfColor.xyz;
-            if (raycast.aerial) // depth cue as aerial perspective
+            if (OPT_AERIAL) // depth cue as aerial perspective
             {
                 float depthCue = 1.f - (t - tnear)/sampleDist; // [0..1]
                 tfColor.w *= depthCue;
             }
 
             // Taylor expansion approximation
-            opacity = 1.f - native_powr(1.f - tfColor.w, refSamplingInterval);
+            opacity = preIntegrated ? tfColor.w
+                                    : 1.f - native_powr(1.f - tfColor.w, refSamplingInterval);
             result.xyz = result.xyz - tfColor.xyz * opacity * (1.f - alpha);
+            depthSum += (t - offset) * opacity * (1.f - alpha);
             alpha = alpha + opacity * (1.f - alpha);
+            if (depth < 0.f && alpha > REPROJECTION_ALPHA)
+                depth = t - offset;
+            ++sampledSteps;
 
             if (t >= tfar) break;
             if (alpha > ERT_THRESHOLD)   // early ray termination check
             {
-                if (raycast.useAO)  // ambient occlusion only on solid surfaces
+                terminationStep = sampledSteps;
+                if (OPT_AO)  // ambient occlusion only on solid surfaces
                 {
-                    float3 n = -gradientCentralDiff(volData, (float4)(pos, 1.f)).xyz;
-                    float ao = calcAO(n, &ui_rand, volData, pos, length(voxLen)*0.9f, length(voxLen)*5.f, tffData);
+                    float3 n = -GRADIENT_CENTRAL(pos).xyz;
+                    ++gradients;
+                    float ao = calcAO(n, &ui_rand, volData, pageTable, pos, length(voxLen)*0.9f,
+                                      length(voxLen)*5.f, tffData);
                     result.xyz *= 1.f - 0.5f*ao;
                 }
                 break;
@@ -880,11 +1304,26 @@ __kernel void volumeRender(  __read_only image3d_t volData
         }
 #ifdef ESS
         if (t >= tfar || alpha > ERT_THRESHOLD) break;
-        if (any(cell == exit)) break;
         t = t_exit;
+        level = min(1, topLevel);
     }
 #endif  // ESS
 
+    if (raycast.countSteps || raycast.diagnostics)
+    {
+        addStepCounter(essCounters, skippedSteps);
+        addStepCounter(essCounters + 2, sampledSteps);
+        addStepCounter(essCounters + 4, skippedBricks);
+        addStepCounter(essCounters + 6, gradients);
+        addStepCounter(essCounters + 8, terminationStep > 0 ? 1u : 0u);
+    }
+    writeDiagnostics(diagnosticImg, texCoords,
+                     (uint4)(sampledSteps, skippedBricks, gradients, terminationStep),
+                     raycast.diagnostics);
+    if (depth < 0.f && alpha > 0.01f)
+        depth = depthSum / alpha;
+    writeDepth(depthImg, texCoords, depth, render.reproject);
+
     // visualize empty space skipping
     if (render.showEss)
     {
@@ -896,16 +1335,10 @@ __kernel void volumeRender(  __read_only image3d_t volData
     }
     // write final image
     result.w = alpha;
-    if (render.iteration == 0)
-    {
-        write_imagef(outAccumulate, texCoords, result);
-    }
-    else
-    {
-        float3 prevCol = read_imagef(inAccumulate, nearestIntSmp, texCoords).xyz;
-        result.xyz = prevCol + (result.xyz - prevCol) / (float3)(render.iteration + 1);
-        write_imagef(outAccumulate, texCoords, result);
-    }
+    float error = 0.f;
+    result.xyz = accumulateSample(inAccumulate, outAccumulate, texCoords, result.xyz,
+                                  render.iteration, &error).xyz;
+    addTileError(outTileError, activeTiles, tile, error, render.errorThreshold);
     write_imagef(outImg, texCoords, result);
 
     // image order empty space skipping
@@ -918,13 +1351,468 @@ __kernel void volumeRender(  __read_only image3d_t volData
         if (get_local_id(0) + get_local_id(1) == 0)
         {
             if (hits == 0)
-                write_imageui(outHitImg, (int2)(get_group_id(0), get_group_id(1)), (uint4)(0u));
+                write_imageui(outHitImg, groupId, (uint4)(0u));
+            else
+                write_imageui(outHitImg, groupId, (uint4)(1u));
+        }
+    }
+}
+
+//************************** Temporal reprojection ****************************
+
+// pixel of a world space point in the frame of the history view, false behind its camera
+bool projectHistory(const float3 p, const reprojection_params *reprojection,
+                    const rendering_params *render, float2 *pixel)
+{
+    // inverse of the primary ray setup in cameraRay without the jitter
+    float3 d = p / render->modelScale - reprojection->historyInvView.s37b;
+    float3 v = transformVec3(reprojection->historyInvView, d);
+    if (v.z >= 0.f)
+        return false;
+    float2 imgCoords = -v.xy / v.z;
+    imgCoords.y *= -1.f;
+    float aspectRatio = native_divide((float)render->frameSize.y, (float)(render->frameSize.x));
+    aspectRatio = min(aspectRatio, native_divide((float)render->frameSize.x,
+                                                 (float)(render->frameSize.y)));
+    imgCoords += render->frameSize.x > render->frameSize.y ?
+                        (float2)(1.0f, aspectRatio) : (float2)(aspectRatio, 1.0);
+    *pixel = imgCoords * (float)(max(render->frameSize.x, render->frameSize.y)) * 0.5f;
+    return true;
+}
+
+/**
+ * Temporal reprojection of the last frame into the samples of this frame: the history color
+ * is fetched at the reprojected representative depth, rejected on depth mismatch, clamped to
+ * the color range of the neighborhood of this frame's samples and blended with the sample.
+ */
+__kernel void reprojectHistory(  __write_only image2d_t outImg
+                               , __read_only image2d_t samples    // accumulation of this frame
+                               , __read_only image2d_t depthImg
+                               , __read_only image2d_t history    // resolved color of last frame
+                               , __read_only image2d_t historyDepth
+                               , __write_only image2d_t resolved
+                               , __write_only image2d_t historyMask
+                               , const camera_params camera
+                               , const rendering_params render
+                               , const reprojection_params reprojection
+                               )
+{
+    int2 globalId = (int2)(get_global_id(0), get_global_id(1));
+    int2 imgSize = get_image_dim(outImg);
+    if(any(globalId >= imgSize))
+        return;
+
+    float4 newSample = read_imagef(samples, nearestIntSmp, globalId);
+    float3 lower = newSample.xyz;
+    float3 upper = newSample.xyz;
+    for (int y = -1; y <= 1; ++y)
+    {
+        for (int x = -1; x <= 1; ++x)
+        {
+            int2 neighbor = clamp(globalId + (int2)(x, y), (int2)(0), imgSize - 1);
+            float3 col = read_imagef(samples, nearestIntSmp, neighbor).xyz;
+            lower = fmin(lower, col);
+            upper = fmax(upper, col);
+        }
+    }
+
+    float3 color = newSample.xyz;
+    uint valid = 0;
+    float depth = read_imagef(depthImg, nearestIntSmp, globalId).x;
+    float2 pixel;
+    if (depth > 0.f && !camera.ortho)
+    {
+        // same jittered ray as in volumeRender
+        float rand = (float)(ParallelRNG3(globalId.x, globalId.y, render.seed)) / (float)(UINT_MAX);
+        float3 camPos;
+        float3 rayDir;
+        cameraRay(globalId, rand, &camera, &render, &camPos, &rayDir);
+        float3 p = camPos + depth*rayDir;
+        if (projectHistory(p, &reprojection, &render, &pixel)
+                && all(pixel >= (float2)(0.f)) && all(pixel < convert_float2(imgSize - 1)))
+        {
+            // disocclusion test: the history has to see the same representative depth
+            float prevDepth = read_imagef(historyDepth, nearestIntSmp,
+                                          convert_int2(pixel + 0.5f)).x;
+            float dist = length(p - reprojection.historyInvView.s37b*render.modelScale);
+            if (prevDepth > 0.f && fabs(prevDepth - dist) < reprojection.depthTolerance*dist)
+            {
+                float3 prev = read_imagef(history, historySmp, pixel + 0.5f).xyz;
+                color = mix(clamp(prev, lower, upper), newSample.xyz, reprojection.blend);
+                valid = 1;
+            }
+        }
+    }
+    // same layout as the accumulation, the refinement continues from the resolved color
+    const float3 lumWeights = (float3)(0.2126f, 0.7152f, 0.0722f);
+    float lum = dot(color, lumWeights);
+    write_imagef(resolved, globalId, (float4)(color, lum*lum));
+    write_imagef(outImg, globalId, (float4)(color, 1.f));
+    write_imageui(historyMask, globalId, (uint4)(valid));
+}
+
+//************************** Wavefront path tracing ***************************
+
+// status of a path in the color channel w
+#define PATH_ACTIVE  0.f
+#define PATH_DONE    1.f    // color is accumulated by wavefrontAccumulate
+#define PATH_WRITTEN 2.f    // pixel was written by ray generation (converged tile or miss)
+
+// segment of the current free flight
+#define PATH_PRIMARY 0u
+#define PATH_SCATTER 1u
+#define PATH_SHADOW  2u
+
+// state of a path of the wavefront path tracer, one per pixel of the rendered band
+typedef struct tag_path_state
+{
+    float4 origin;      // xyz: start of the current segment (camera or first interaction)
+    float4 dir;         // xyz: direction of the current segment
+    float4 light;       // xyz: direction towards the light from the first interaction
+    float4 color;       // xyz: color of the path, w: path status
+    float4 hitPos;      // xyz: interaction of the last free flight, w: 1 if there was one
+    float4 hitColor;    // transfer function color at the interaction
+    float4 background;  // environment color of the primary ray
+    uint rng;           // state of the random number generator
+    uint stage;         // segment of the current free flight
+    uint pad[2];
+} path_state;
+
+// append the ids of live paths to a queue, one global atomic per work-group
+// keeps the queue compact, must be reached by all work-items of the group
+void appendPath(__global uint *queue, volatile __global uint *queueCount, const uint pathId,
+                const bool alive, local uint *groupCount, local uint *groupOffset)
+{
+    bool first = get_local_id(0) == 0 && get_local_id(1) == 0;
+    if (first)
+        *groupCount = 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    uint slot = alive ? atomic_inc(groupCount) : 0;
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (first)
+        *groupOffset = atomic_add(queueCount, *groupCount);
+    barrier(CLK_LOCAL_MEM_FENCE);
+    if (alive)
+        queue[*groupOffset + slot] = pathId;
+}
+
+// Woodcock tracking through the min/max brick grid: the majorant of each brick is the
+// maximum opacity of its density range, transparent bricks are crossed without sampling
+bool sample_interaction_bricks(uint *rng,
+                               float3 *ray_pos,
+                               const float3 ray_dir,
+                               const float max_extinction,
+                               read_only image3d_t vol,
+                               read_only image3d_t pageTable,
+                               read_only image1d_t tff,
+                               read_only image3d_t volBrickData,
+                               __global const float *majorants,
+                               float4 *colorOut)
+{
+    int3 bricksRes = get_image_dim(volBrickData).xyz;
+    int3 volRes = volumeRes(vol);
+    // same brick size as in generateBricks
+    int3 voxPerCell = (volRes + bricksRes - 1) / bricksRes;
+    float3 cellScale = convert_float3(volRes) / convert_float3(voxPerCell);
+
+    // the ray in brick grid coordinates, the ray parameter stays in world space units
+    float3 origin = (*ray_pos * 0.5f + 0.5f) * cellScale;
+    float3 dir = ray_dir * 0.5f * cellScale;
+    dir = copysign(max(fabs(dir), (float3)(1e-8f)), dir);
+    int3 cell = clamp(convert_int3_rtn(origin), (int3)(0), bricksRes - 1);
+    int3 cellStep = select((int3)(-1), (int3)(1), dir > 0.f);
+    float3 tDelta = fabs(1.f / dir);
+    float3 tMax = (convert_float3(cell + max(cellStep, (int3)(0))) - origin) / dir;
+
+    float t = 0.f;
+    uint cnt = 0;
+    while (cnt < 512)  // TODO: variable or based on data set resolution
+    {
+        float tCell = min(tMax.x, min(tMax.y, tMax.z));
+        float alphaMax = majorants[cell.x + bricksRes.x*(cell.y + bricksRes.y*cell.z)];
+        float dt = FLT_MAX;
+        if (alphaMax > 0.f)
+        {
+            *rng = ParallelRNG(*rng);
+            dt = -log(max(1.f - mapUintFloat(*rng), FLT_MIN)) / (max_extinction * alphaMax);
+        }
+        if (t + dt >= tCell)
+        {
+            // no collision in this brick, the free path length is memoryless
+            t = tCell;
+            if (tMax.x <= tMax.y && tMax.x <= tMax.z)
+            {
+                cell.x += cellStep.x;
+                tMax.x += tDelta.x;
+            }
+            else if (tMax.y <= tMax.z)
+            {
+                cell.y += cellStep.y;
+                tMax.y += tDelta.y;
+            }
             else
-                write_imageui(outHitImg, (int2)(get_group_id(0), get_group_id(1)), (uint4)(1u));
+            {
+                cell.z += cellStep.z;
+                tMax.z += tDelta.z;
+            }
+            if (any(cell < 0) || any(cell >= bricksRes))
+                return false;
+            continue;
+        }
+        ++cnt;
+        t += dt;
+        float3 pos = *ray_pos + ray_dir * t;
+        if (!in_volume(pos))
+            return false;
+        float4 color = read_imagef(tff, linearSmp, get_extinction(pos, vol, pageTable));
+        // real collision with the ratio of the local and the majorant extinction
+        *rng = ParallelRNG(*rng);
+        if (color.w >= mapUintFloat(*rng) * alphaMax)
+        {
+            *colorOut = color;
+            *ray_pos = pos;
+            return true;
+        }
+    }
+    return false;
+}
+
+// continue a path after a free flight, same events as in trace_volume
+// returns true if the path needs another free flight
+bool scatterPath(__global path_state *path,
+                 read_only image3d_t vol,
+                 read_only image3d_t pageTable,
+                 read_only image1d_t tff)
+{
+    bool isInteraction = path->hitPos.w > 0.f;
+    if (path->stage == PATH_PRIMARY)
+    {
+        if (!isInteraction)
+        {
+            path->color = (float4)(path->background.xyz, PATH_DONE);
+            return false;
+        }
+        float4 color = path->hitColor;
+        float3 light_dir = -path->dir.xyz + (float3)(0.5f, 0.5f, 0.f);
+        path->origin = (float4)(path->hitPos.xyz, 1.f);
+        path->light = (float4)(light_dir, 0.f);
+        // surface scattering (phong based)
+        float4 samplePos = (float4)(path->hitPos.xyz * 0.5f + 0.5f, 1.f);
+        float4 gradient = -gradientCentralDiffTff(vol, pageTable, samplePos, tff);
+        if (length(gradient) > 0.5f)    // high gradient -> phong illumination
+        {
+            color.xyz = illumination(samplePos, color.xyz, light_dir, gradient.xyz);
+            path->stage = PATH_SHADOW;
+            path->dir = path->light;
         }
+        else    // low gradient -> second scatter ray
+        {
+            path->rng = ParallelRNG(path->rng);
+            path->stage = PATH_SCATTER;
+            path->dir = (float4)(get_dir_phase_function(path->rng), 0.f);
+        }
+        path->color = (float4)(color.xyz, PATH_ACTIVE);
+        return true;
     }
+    if (path->stage == PATH_SCATTER)
+    {
+        float4 scatterColor = isInteraction ? path->hitColor : path->background;
+        path->color.xyz = mix(path->color.xyz, scatterColor.xyz, 0.5f);
+        // shadow ray towards point light
+        path->stage = PATH_SHADOW;
+        path->dir = path->light;
+        return true;
+    }
+    // shadow ray
+    float w = isInteraction ? 0.6f : 1.f;
+    path->color = (float4)(path->color.xyz * w, PATH_DONE);
+    return false;
 }
 
+// index of the path of a pixel in the band of the NDRange
+uint bandPathId(const int2 globalId)
+{
+    return (uint)(globalId.x - (int)get_global_offset(0))
+         + (uint)(globalId.y - (int)get_global_offset(1)) * (uint)get_global_size(0);
+}
+
+/**
+ * wavefront ray generation: handles converged tiles and rays missing the volume like
+ * volumeRender, all other rays start a path
+ */
+__kernel void wavefrontGenerate(  __write_only image2d_t outImg
+                                , __read_only image2d_t inAccumulate
+                                , __write_only image2d_t outAccumulate
+                                , __read_only image2d_t environment
+                                , const camera_params camera
+                                , const rendering_params render
+                                , __global const uint *inTileError
+                                , __global path_state *paths
+                                , __global uint *queue
+                                , volatile __global uint *queueCount
+                                )
+{
+    local uint groupCount;
+    local uint groupOffset;
+    int2 globalId = (int2)(get_global_id(0), get_global_id(1));
+    int2 texCoords = globalId - render.tileOrigin;
+    uint pathId = bandPathId(globalId);
+    int2 localSize = (int2)((int)get_local_size(0), (int)get_local_size(1));
+    uint tile = tileIndex(texCoords, localSize, get_image_width(outImg));
+
+    bool alive = all(texCoords < get_image_dim(outImg));
+    paths[pathId].color.w = PATH_WRITTEN;
+    if (alive && render.errorThreshold > 0.f && render.iteration >= render.minIterations
+            && inTileError[tile] < as_uint(render.errorThreshold))
+    {
+        // progressive refinement: converged tiles only pass on their accumulated color
+        float4 acc = read_imagef(inAccumulate, nearestIntSmp, texCoords);
+        write_imagef(outAccumulate, texCoords, acc);
+        write_imagef(outImg, texCoords, (float4)(acc.xyz, 1.f));
+        alive = false;
+    }
+    if (alive)
+    {
+        float rand = (float)(ParallelRNG3(globalId.x, globalId.y, render.seed)) / (float)(UINT_MAX);
+        float3 camPos;
+        float3 rayDir;
+        cameraRay(globalId, rand, &camera, &render, &camPos, &rayDir);
+        float4 envirCol = backgroundColor(rayDir, &render, environment);
+
+        float tnear = FLT_MIN;
+        float tfar = FLT_MAX;
+        int hit = intersectBBox(camPos, rayDir, camera.bbox_bl, camera.bbox_tr, &tnear, &tfar);
+        if (!hit || tfar < 0)
+        {
+            write_imagef(outAccumulate, texCoords, (float4)(envirCol.xyz, 0.f));
+            write_imagef(outImg, texCoords, envirCol);
+            alive = false;
+        }
+        else
+        {
+            __global path_state *path = paths + pathId;
+            path->origin = (float4)(camPos + rayDir * tnear, 1.f);
+            path->dir = (float4)(rayDir, 0.f);
+            path->color = (float4)(envirCol.xyz, PATH_ACTIVE);
+            path->background = envirCol;
+            path->rng = ParallelRNG3(globalId.x, globalId.y, render.seed);
+            path->stage = PATH_PRIMARY;
+        }
+    }
+    appendPath(queue, queueCount, pathId, alive, &groupCount, &groupOffset);
+}
+
+/**
+ * wavefront free flight: Woodcock tracking of the current segment of all live paths
+ */
+__kernel void wavefrontFreeFlight(  __read_only image3d_t volData
+                                  , __read_only image3d_t volBrickData
+                                  , __read_only image1d_t tffData
+                                  , __read_only image3d_t pageTable
+                                  , const pathtrace_params pathtrace
+                                  , __global const float *majorants
+                                  , __global path_state *paths
+                                  , __global const uint *queue
+                                  , __global const uint *queueCount
+                                  )
+{
+    uint i = get_global_id(0);
+    if (i >= *queueCount)
+        return;
+    __global path_state *path = paths + queue[i];
+    uint rng = path->rng;
+    float3 pos = path->origin.xyz;
+    float4 color = (float4)(0.f);
+    bool isInteraction = sample_interaction_bricks(&rng, &pos, path->dir.xyz,
+                                                   pathtrace.max_extinction, volData, pageTable,
+                                                   tffData, volBrickData, majorants, &color);
+    path->hitPos = (float4)(pos, isInteraction ? 1.f : 0.f);
+    path->hitColor = color;
+    path->rng = rng;
+}
+
+/**
+ * wavefront scattering: evaluates the interactions and compacts the paths that need
+ * another segment into the output queue
+ */
+__kernel void wavefrontScatter(  __read_only image3d_t volData
+                               , __read_only image1d_t tffData
+                               , __read_only image3d_t pageTable
+                               , __global path_state *paths
+                               , __global const uint *queue
+                               , __global const uint *queueCount
+                               , __global uint *outQueue
+                               , volatile __global uint *outQueueCount
+                               )
+{
+    local uint groupCount;
+    local uint groupOffset;
+    uint i = get_global_id(0);
+    bool alive = i < *queueCount;
+    uint pathId = alive ? queue[i] : 0u;
+    if (alive)
+        alive = scatterPath(paths + pathId, volData, pageTable, tffData);
+    appendPath(outQueue, outQueueCount, pathId, alive, &groupCount, &groupOffset);
+}
+
+/**
+ * wavefront accumulation of the finished paths, same as the path tracing branch of
+ * volumeRender
+ */
+__kernel void wavefrontAccumulate(  __write_only image2d_t outImg
+                                  , __read_only image2d_t inAccumulate
+                                  , __write_only image2d_t outAccumulate
+                                  , const rendering_params render
+                                  , volatile __global uint *outTileError
+                                  , volatile __global uint *activeTiles
+                                  , __global const path_state *paths
+                                  )
+{
+    int2 globalId = (int2)(get_global_id(0), get_global_id(1));
+    int2 texCoords = globalId - render.tileOrigin;
+    if(any(texCoords >= get_image_dim(outImg)))
+        return;
+    float4 color = paths[bandPathId(globalId)].color;
+    if (color.w != PATH_DONE)
+        return;
+    int2 localSize = (int2)((int)get_local_size(0), (int)get_local_size(1));
+    uint tile = tileIndex(texCoords, localSize, get_image_width(outImg));
+
+    float error = 0.f;
+    float3 col = accumulateSample(inAccumulate, outAccumulate, texCoords, color.xyz,
+                                  render.iteration, &error).xyz;
+    addTileError(outTileError, activeTiles, tile, error, render.errorThreshold);
+    write_imagef(outImg, texCoords, (float4)(col, 1.f));
+}
+
+
+//************************** Path tracing majorants ***************************
+
+// maximum opacity of the density range of each brick, bounds the extinction for the
+// Woodcock tracking of the wavefront path tracer
+__kernel void generateMajorants(  __read_only image3d_t volBrickData
+                                , __read_only image1d_t tffData
+                                , __global float *majorants
+                               )
+{
+    int3 bricksRes = get_image_dim(volBrickData).xyz;
+    int id = get_global_id(0);
+    if (id >= bricksRes.x*bricksRes.y*bricksRes.z)
+        return;
+    int3 brick = (int3)(id % bricksRes.x, (id / bricksRes.x) % bricksRes.y,
+                        id / (bricksRes.x * bricksRes.y));
+    float2 minMaxDensity = read_imagef(volBrickData, (int4)(brick, 0)).xy;
+    // all entries the linear interpolation of the density range may touch
+    int tffSize = get_image_width(tffData);
+    int lower = clamp((int)floor(minMaxDensity.x*tffSize - 0.5f), 0, tffSize - 1);
+    int upper = clamp((int)ceil(minMaxDensity.y*tffSize - 0.5f), 0, tffSize - 1);
+    float alphaMax = 0.f;
+    for (int i = lower; i <= upper; ++i)
+        alphaMax = max(alphaMax, read_imagef(tffData, nearestIntSmp, i).w);
+    majorants[id] = alphaMax;
+}
+
+
 #pragma OPENCL EXTENSION cl_khr_3d_image_writes : enable
 
 //************************** Generate brick volume ***************************
@@ -939,8 +1827,9 @@ __kernel void generateBricks(  __read_only image3d_t volData
 
     int3 voxPerCell = convert_int3(ceil(convert_float4(get_image_dim(volData))/
                                           convert_float4(get_image_dim(volBrickData))).xyz);
-    int3 volCoordLower = voxPerCell * coord;
-    int3 volCoordUpper = clamp(volCoordLower + voxPerCell, (int3)(0), get_image_dim(volData).xyz-1);
+    // include the one voxel apron that is used for interpolation at the cell borders
+    int3 volCoordLower = max(voxPerCell * coord - 1, (int3)(0));
+    int3 volCoordUpper = min(voxPerCell * (coord + 1) + 1, get_image_dim(volData).xyz);
 
     float maxVal = 0.f;
     float minVal = 1.f;
@@ -951,7 +1840,7 @@ __kernel void generateBricks(  __read_only image3d_t volData
         {
             for (int i = volCoordLower.x; i < volCoordUpper.x; ++i)
             {
-                value = read_imagef(volData, nearestIntSmp, (int4)(i, j, k, 0)).x;  // [0; 1]
+                value = dequantize(read_imagef(volData, nearestIntSmp, (int4)(i, j, k, 0)).x);
                 minVal = min(minVal, value);
                 maxVal = max(maxVal, value);
             }
@@ -961,6 +1850,147 @@ __kernel void generateBricks(  __read_only image3d_t volData
 }
 
 
+//********************** Pre-integrate transfer function ***********************
+
+__kernel void preIntegrateTff(  __read_only image1d_t tffData
+                              , __write_only image2d_t preIntegrationData
+                              , const float segmentLength     // in units of the tff opacity
+                             )
+{
+    int2 coord = (int2)(get_global_id(0), get_global_id(1));
+    int2 size = get_image_dim(preIntegrationData);
+    if(any(coord >= size))
+        return;
+
+    float front = coord.x / (float)(size.x - 1);
+    float back = coord.y / (float)(size.y - 1);
+    // at least one sub-step per transfer function entry between the two densities
+    int steps = (int)(fabs(back - front) * get_image_width(tffData)) + 1;
+    float stepLength = segmentLength / (float)(steps);
+    float4 segment = (float4)(0.f);
+    for (int i = 0; i < steps; ++i)
+    {
+        float density = mix(front, back, (i + 0.5f) / (float)(steps));
+        float4 tfColor = read_imagef(tffData, linearSmp, density);
+        float opacity = 1.f - native_powr(1.f - tfColor.w, stepLength);
+        segment.xyz += (1.f - segment.w) * opacity * tfColor.xyz;
+        segment.w += (1.f - segment.w) * opacity;
+    }
+    write_imagef(preIntegrationData, coord, segment);
+}
+
+
+//************************** Generate gradient volume ***************************
+
+__kernel void generateGradients(  __read_only image3d_t volData
+                                , __write_only image3d_t gradientData
+                                , const uint sobel
+                               )
+{
+    int3 coord = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+    if(any(coord >= get_image_dim(gradientData).xyz))
+        return;
+
+    // the page table is only used in bricked mode, which has no gradient volume
+    float4 pos = (float4)((convert_float3(coord) + 0.5f) / convert_float3(volumeRes(volData)), 1.f);
+    float4 gradient = sobel ? gradientSobel(volData, volData, pos)
+                            : gradientCentralDiff(volData, volData, pos);
+    // the magnitude is used as transfer function coordinate, which is clamped anyways
+    write_imagef(gradientData, (int4)(coord, 0),
+                 (float4)(gradient.xyz * 0.5f + 0.5f, clamp(gradient.w, 0.f, 1.f)));
+}
+
+
+//*********************** Generate brick hierarchy ************************
+
+__kernel void generateBrickMips(  __read_only image3d_t volBrickData
+                                , __write_only image3d_t brickMips
+                                , const uint levels
+                               )
+{
+    int3 coord = (int3)(get_global_id(0), get_global_id(1), get_global_id(2));
+    if(any(coord >= get_image_dim(brickMips).xyz))
+        return;
+
+    // levels 1..n are packed along x: find the level of this node
+    int3 bricksRes = get_image_dim(volBrickData).xyz;
+    int level = 1;
+    int offset = 0;
+    int levelWidth = (bricksRes.x + 1) >> 1;
+    while (level + 1 < (int)levels && coord.x >= offset + levelWidth)
+    {
+        offset += levelWidth;
+        ++level;
+        levelWidth = (bricksRes.x + (1 << level) - 1) >> level;
+    }
+    int3 node = (int3)(coord.x - offset, coord.yz);
+    if (any(node >= (bricksRes + (1 << level) - 1) >> level))
+        return;
+
+    // min/max directly over the covered level 0 cells
+    int3 cellLower = node << level;
+    int3 cellUpper = min(cellLower + (1 << level), bricksRes);
+    float maxVal = 0.f;
+    float minVal = 1.f;
+    for (int k = cellLower.z; k < cellUpper.z; ++k)
+    {
+        for (int j = cellLower.y; j < cellUpper.y; ++j)
+        {
+            for (int i = cellLower.x; i < cellUpper.x; ++i)
+            {
+                float2 minMax = read_imagef(volBrickData, (int4)(i, j, k, 0)).xy;
+                minVal = min(minVal, minMax.x);
+                maxVal = max(maxVal, minMax.y);
+            }
+        }
+    }
+    write_imagef(brickMips, (int4)(coord, 0), (float4)(minVal, maxVal, 0, 1.f));
+}
+
+
+//********************* Transfer function occupancy ***********************
+
+// one bit per node of all levels of the brick hierarchy, set if the node is not empty under
+// the current transfer function
+__kernel void generateOccupancy(  __read_only image3d_t volBrickData
+                                , __read_only image3d_t brickMips
+                                , __read_only image1d_t tffData
+                                , __read_only image1d_t tffPrefix
+                                , __global uint *occupancy
+                                , const uint levels
+                                , const uint numNodes
+                               )
+{
+    uint word = get_global_id(0);
+    if (word*32u >= numNodes)
+        return;
+
+    int3 bricksRes = get_image_dim(volBrickData).xyz;
+    uint bits = 0;
+    int level = 0;
+    uint levelOffset = 0;
+    uint levelNodes = brickLevelNodes(bricksRes, 0);
+    for (uint b = 0; b < 32u && word*32u + b < numNodes; ++b)
+    {
+        uint id = word*32u + b;
+        while (id >= levelOffset + levelNodes && level + 1 < (int)levels)
+        {
+            levelOffset += levelNodes;
+            ++level;
+            levelNodes = brickLevelNodes(bricksRes, level);
+        }
+        int3 levelRes = (bricksRes + (1 << level) - 1) >> level;
+        uint i = id - levelOffset;
+        int3 node = (int3)(i % levelRes.x, (i / levelRes.x) % levelRes.y,
+                           i / (levelRes.x * levelRes.y));
+        float2 minMaxDensity = readBrickNode(volBrickData, brickMips, node, level);
+        if (!isEmptyNode(minMaxDensity, tffData, tffPrefix))
+            bits |= 1u << b;
+    }
+    occupancy[word] = bits;
+}
+
+
 //************************** Downsample volume ***************************
 
 __kernel void downsampling(  __read_only image3d_t volData
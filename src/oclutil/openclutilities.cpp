@@ -33,6 +33,12 @@
 
 #include "src/oclutil/openclutilities.h"
 
+#include <sstream>
+#include <iomanip>
+#include <functional>
+#include <cstdio>
+#include <cstdint>
+
 #ifdef WIN32
 #else
 #include <sys/stat.h>
@@ -172,15 +178,38 @@ cl::Context createCLContext(std::vector<cl::Device> devices)
 }
 
 
+static std::string readSourceFile(const std::string &filename)
+{
+    std::ifstream sourceFile(filename.c_str());
+    if(sourceFile.fail())
+        throw std::invalid_argument("Failed to open OpenCL kernel file " + filename);
+    return std::string(std::istreambuf_iterator<char>(sourceFile),
+                       (std::istreambuf_iterator<char>()));
+}
+
+
+static void buildProgram(cl::Program &program, const std::vector<cl::Device> &devices,
+                         const std::string &buildOptions)
+{
+    try {
+        program.build(devices, buildOptions.c_str());
+    } catch(cl::Error error)
+    {
+        if(error.err() == CL_BUILD_PROGRAM_FAILURE)
+        {
+            std::cout << "Build log:" << std::endl
+                      << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << std::endl;
+        }
+        throw error;
+    }
+}
+
+
 cl::Program buildProgramFromSource(cl::Context context, const std::string &filename,
                                    const std::string &buildOptions)
 {
         // Read source file
-        std::ifstream sourceFile(filename.c_str());
-        if(sourceFile.fail())
-            throw std::invalid_argument("Failed to open OpenCL kernel file " + filename);
-        std::string sourceCode(std::istreambuf_iterator<char>(sourceFile),
-                               (std::istreambuf_iterator<char>()));
+        std::string sourceCode = readSourceFile(filename);
         //cl::Program::Sources source(1, std::make_pair(sourceCode.c_str(), sourceCode.length()+1));
 
         // Make program of the source code in the context
@@ -189,18 +218,146 @@ cl::Program buildProgramFromSource(cl::Context context, const std::string &filen
         std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
 
         // Build program for these specific devices
+        buildProgram(program, devices, buildOptions);
+        return program;
+}
+
+
+// Hash of a kernel source, including the files it includes with #include "file".
+static size_t hashKernelSource(const std::string &filename, const std::string &source,
+                               const int depth = 0)
+{
+    size_t hash = std::hash<std::string>()(source);
+    std::istringstream is(source);
+    std::string line;
+    while(std::getline(is, line) && depth < 8)
+    {
+        size_t pos = line.find("#include");
+        size_t begin = pos == std::string::npos ? pos : line.find('"', pos);
+        size_t end = begin == std::string::npos ? begin : line.find('"', begin + 1);
+        if(end == std::string::npos)
+            continue;
+        std::string name = line.substr(begin + 1, end - begin - 1);
+        // includes are resolved relative to the working directory or the including file
+        std::ifstream include(name.c_str());
+        size_t slash = filename.find_last_of("/\\");
+        if(include.fail() && slash != std::string::npos)
+        {
+            name = filename.substr(0, slash + 1) + name;
+            include.open(name.c_str());
+        }
+        if(include.fail())
+            continue;
+        std::string includeSource(std::istreambuf_iterator<char>(include),
+                                  (std::istreambuf_iterator<char>()));
+        hash ^= hashKernelSource(name, includeSource, depth + 1)
+                + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+    }
+    return hash;
+}
+
+
+// Cache files start with the length of the key and the key itself to detect hash collisions.
+static bool readProgramBinary(const std::string &name, const std::string &key,
+                              std::vector<unsigned char> &binary)
+{
+    std::ifstream is(name.c_str(), std::ios::in | std::ios::binary);
+    uint64_t keySize = 0;
+    if(!is.read(reinterpret_cast<char *>(&keySize), sizeof(keySize)) || keySize != key.size())
+        return false;
+    std::string fileKey(keySize, '\0');
+    if(!is.read(&fileKey[0], static_cast<std::streamsize>(keySize)) || fileKey != key)
+        return false;
+    binary.assign(std::istreambuf_iterator<char>(is), std::istreambuf_iterator<char>());
+    return !binary.empty();
+}
+
+
+static void writeProgramBinary(const std::string &name, const std::string &key,
+                               const std::vector<unsigned char> &binary)
+{
+    // write to a temporary file first, so that no partial binary is ever loaded
+    const std::string tmpName = name + ".tmp";
+    {
+        std::ofstream os(tmpName.c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+        uint64_t keySize = key.size();
+        os.write(reinterpret_cast<const char *>(&keySize), sizeof(keySize));
+        os.write(key.data(), static_cast<std::streamsize>(key.size()));
+        os.write(reinterpret_cast<const char *>(binary.data()),
+                 static_cast<std::streamsize>(binary.size()));
+        if(!os)
+        {
+            os.close();
+            std::remove(tmpName.c_str());
+            std::cerr << "WARNING: Could not write program binary " << name << std::endl;
+            return;
+        }
+    }
+    std::remove(name.c_str());
+    if(std::rename(tmpName.c_str(), name.c_str()) != 0)
+        std::remove(tmpName.c_str());
+}
+
+
+cl::Program buildProgramFromBinaryCache(cl::Context context, const std::string &filename,
+                                        const std::string &buildOptions,
+                                        const std::string &cacheDir)
+{
+    if(cacheDir.empty())
+        return buildProgramFromSource(context, filename, buildOptions);
+
+    std::string sourceCode = readSourceFile(filename);
+    std::stringstream sourceHash;
+    sourceHash << std::hex << hashKernelSource(filename, sourceCode);
+    std::vector<cl::Device> devices = context.getInfo<CL_CONTEXT_DEVICES>();
+
+    // one binary per device, keyed by device, driver, build options and source
+    std::vector<std::string> keys;
+    std::vector<std::string> names;
+    for(const auto &device : devices)
+    {
+        std::string key = device.getInfo<CL_DEVICE_NAME>() + "|"
+                + device.getInfo<CL_DEVICE_VERSION>() + "|"
+                + device.getInfo<CL_DRIVER_VERSION>() + "|"
+                + buildOptions + "|" + sourceHash.str();
+        std::stringstream name;
+        name << cacheDir << "kernel_" << std::hex << std::setw(16) << std::setfill('0')
+             << std::hash<std::string>()(key) << ".clbin";
+        keys.push_back(key);
+        names.push_back(name.str());
+    }
+
+    cl::Program::Binaries binaries(devices.size());
+    bool cached = true;
+    for(size_t i = 0; i < devices.size() && cached; ++i)
+        cached = readProgramBinary(names.at(i), keys.at(i), binaries.at(i));
+    if(cached)
+    {
         try {
+            cl::Program program = cl::Program(context, devices, binaries);
             program.build(devices, buildOptions.c_str());
-        } catch(cl::Error error)
+            return program;
+        } catch(cl::Error error) {
+            std::cerr << "WARNING: Cached program binary could not be used ("
+                      << getCLErrorString(error.err()) << "), building from source." << std::endl;
+        }
+    }
+
+    // fall back to building from source and store the binaries for the next time
+    cl::Program program = cl::Program(context, sourceCode);
+    buildProgram(program, devices, buildOptions);
+    try {
+        binaries = program.getInfo<CL_PROGRAM_BINARIES>();
+        for(size_t i = 0; i < binaries.size() && i < names.size(); ++i)
         {
-            if(error.err() == CL_BUILD_PROGRAM_FAILURE)
-            {
-                std::cout << "Build log:" << std::endl
-                          << program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(devices[0]) << std::endl;
-            }
-            throw error;
+            if(!binaries.at(i).empty())
+                writeProgramBinary(names.at(i), keys.at(i), binaries.at(i));
         }
-        return program;
+    } catch(cl::Error error) {
+        std::cerr << "WARNING: Could not get program binaries ("
+                  << getCLErrorString(error.err()) << ")." << std::endl;
+    }
+    return program;
 }
 
 
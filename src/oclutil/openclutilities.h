@@ -80,4 +80,10 @@ cl::Platform getPlatform(cl_device_type = CL_DEVICE_TYPE_ALL, cl_vendor vendor =
 cl::Program buildProgramFromSource(cl::Context context, const std::string &filename, 
                                    const std::string &buildOptions = "");
 
+// Build a program, using the program binaries cached in cacheDir (from a previous build with
+// the same device, driver, build options and source) if available.
+cl::Program buildProgramFromBinaryCache(cl::Context context, const std::string &filename,
+                                        const std::string &buildOptions = "",
+                                        const std::string &cacheDir = "");
+
 std::string getCLErrorString(cl_int err);
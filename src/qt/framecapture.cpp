@@ -0,0 +1,267 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/qt/framecapture.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cstring>
+
+
+/**
+ * @brief FrameCapture::FrameCapture
+ * @param pboCount
+ * @param bufferCount
+ */
+FrameCapture::FrameCapture(size_t pboCount, size_t bufferCount)
+    : _pbos(std::max(size_t(1), pboCount), 0)
+    , _buffers(std::max(size_t(1), bufferCount))
+    , _busy(_buffers.size(), false)
+{
+}
+
+
+/**
+ * @brief FrameCapture::~FrameCapture
+ */
+FrameCapture::~FrameCapture()
+{
+    // the writer threads may still reference the host buffers
+    _video.finish();
+    _writer.finish();
+}
+
+
+/**
+ * @brief FrameCapture::initializeGL
+ * @param gl
+ */
+void FrameCapture::initializeGL(QOpenGLFunctions_4_3_Core *gl)
+{
+    _gl = gl;
+    _gl->glGenBuffers(GLsizei(_pbos.size()), _pbos.data());
+    _width = 0;
+    _height = 0;
+}
+
+
+/**
+ * @brief FrameCapture::releaseGL
+ */
+void FrameCapture::releaseGL()
+{
+    if (_gl == nullptr)
+        return;
+    finish();
+    _gl->glDeleteBuffers(GLsizei(_pbos.size()), _pbos.data());
+    _gl = nullptr;
+}
+
+
+/**
+ * @brief FrameCapture::resize
+ * @param width
+ * @param height
+ */
+void FrameCapture::resize(int width, int height)
+{
+    // all frames of the old size have to be written before the buffers are reallocated
+    finish();
+    _width = width;
+    _height = height;
+    const size_t frameSize = size_t(width) * size_t(height) * 4;
+    for (GLuint pbo : _pbos)
+    {
+        _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+        _gl->glBufferData(GL_PIXEL_PACK_BUFFER, GLsizeiptr(frameSize), nullptr, GL_STREAM_READ);
+    }
+    _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    for (auto &buffer : _buffers)
+        buffer.resize(frameSize);
+}
+
+
+/**
+ * @brief FrameCapture::capture
+ * @param fbo
+ * @param width
+ * @param height
+ * @param fileName
+ */
+void FrameCapture::capture(GLuint fbo, int width, int height, const QString &fileName)
+{
+    if (_gl == nullptr || width <= 0 || height <= 0)
+        return;
+    if (_video.running() && (size_t(width) != _video.width() || size_t(height) != _video.height()))
+    {
+        qWarning() << "Skipping frame with a different size than the video.";
+        return;
+    }
+    if (width != _width || height != _height)
+        resize(width, height);
+    // reuse the oldest pixel buffer if all of them are in flight
+    if (_inFlight.size() == _pbos.size())
+        retire();
+
+    Readback r;
+    r.pbo = _nextPbo;
+    r.fileName = fileName;
+    _nextPbo = (_nextPbo + 1) % _pbos.size();
+    _gl->glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbos.at(r.pbo));
+    _gl->glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    _gl->glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    r.fence = _gl->glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    _gl->glFlush();
+    _inFlight.push_back(r);
+}
+
+
+/**
+ * @brief FrameCapture::poll
+ * @param wait
+ */
+void FrameCapture::poll(bool wait)
+{
+    if (_gl == nullptr)
+        return;
+    while (!_inFlight.empty())
+    {
+        if (!wait)
+        {
+            const GLenum status = _gl->glClientWaitSync(_inFlight.front().fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+        }
+        retire();
+    }
+}
+
+
+/**
+ * @brief FrameCapture::retire
+ */
+void FrameCapture::retire()
+{
+    Readback r = _inFlight.front();
+    _inFlight.pop_front();
+    _gl->glClientWaitSync(r.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(-1));
+    _gl->glDeleteSync(r.fence);
+
+    // copy out of the pixel buffer so it can be reused right away
+    const size_t buffer = acquireBuffer();
+    const size_t frameSize = _buffers.at(buffer).size();
+    _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbos.at(r.pbo));
+    const void *mapped = _gl->glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, GLsizeiptr(frameSize),
+                                               GL_MAP_READ_BIT);
+    if (mapped == nullptr)
+    {
+        _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        releaseBuffer(buffer);
+        qWarning() << "Could not map the captured frame.";
+        return;
+    }
+    std::memcpy(_buffers.at(buffer).data(), mapped, frameSize);
+    _gl->glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    _gl->glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    const unsigned char *pixels = _buffers.at(buffer).data();
+    if (_video.running())
+        _video.write(pixels, [this, buffer]() { releaseBuffer(buffer); });
+    else
+        _writer.write(pixels, size_t(_width), size_t(_height), r.fileName.toStdString(),
+                      FrameWriter::PNG, [this, buffer]() { releaseBuffer(buffer); });
+}
+
+
+/**
+ * @brief FrameCapture::acquireBuffer
+ * @return
+ */
+size_t FrameCapture::acquireBuffer()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    // blocks if the encoders fall behind
+    size_t buffer = 0;
+    _cv.wait(lock, [&]{
+        for (buffer = 0; buffer < _busy.size(); ++buffer)
+            if (!_busy.at(buffer))
+                return true;
+        return false;
+    });
+    _busy.at(buffer) = true;
+    return buffer;
+}
+
+
+/**
+ * @brief FrameCapture::releaseBuffer
+ * @param buffer
+ */
+void FrameCapture::releaseBuffer(size_t buffer)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _busy.at(buffer) = false;
+    }
+    _cv.notify_all();
+}
+
+
+/**
+ * @brief FrameCapture::startVideo
+ * @param fileName
+ * @param width
+ * @param height
+ * @param fps
+ * @return
+ */
+bool FrameCapture::startVideo(const QString &fileName, int width, int height, double fps)
+{
+    finish();
+    return _video.start(fileName.toStdString(), size_t(width), size_t(height), fps);
+}
+
+
+/**
+ * @brief FrameCapture::stopVideo
+ */
+void FrameCapture::stopVideo()
+{
+    poll(true);
+    _video.finish();
+}
+
+
+/**
+ * @brief FrameCapture::finish
+ */
+void FrameCapture::finish()
+{
+    poll(true);
+    _writer.finish();
+    // wait for the video encoder to release the host buffers
+    std::unique_lock<std::mutex> lock(_mutex);
+    _cv.wait(lock, [&]{ return std::find(_busy.begin(), _busy.end(), true) == _busy.end(); });
+}
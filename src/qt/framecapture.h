@@ -0,0 +1,127 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <QString>
+#include <qopenglfunctions_4_3_core.h>
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+
+#include "src/cli/framewriter.h"
+#include "src/cli/videoencoder.h"
+
+/**
+ * @brief Asynchronous capture of rendered frames. The framebuffer is read back into a ring of
+ *        pixel buffer objects and copied into preallocated host buffers once the GPU is done,
+ *        the encoding to image files or a video runs on background threads.
+ *        All methods except the constructor need the OpenGL context to be current.
+ */
+class FrameCapture
+{
+public:
+    /**
+     * @param pboCount Number of pixel buffer objects, i.e. frames read back at the same time.
+     * @param bufferCount Number of host buffers, i.e. frames waiting for the encoders.
+     */
+    explicit FrameCapture(size_t pboCount = 3, size_t bufferCount = 8);
+    ~FrameCapture();
+
+    FrameCapture(const FrameCapture &) = delete;
+    FrameCapture &operator=(const FrameCapture &) = delete;
+
+    /**
+     * @brief Set the OpenGL functions of the context the frames are captured from.
+     */
+    void initializeGL(QOpenGLFunctions_4_3_Core *gl);
+
+    /**
+     * @brief Finish all captures and delete the OpenGL resources.
+     */
+    void releaseGL();
+
+    /**
+     * @brief Enqueue the readback of a frame, does not wait for the rendering to finish.
+     * @param fbo The framebuffer object to read from.
+     * @param width The frame width in pixels.
+     * @param height The frame height in pixels.
+     * @param fileName The PNG image file, not used while a video is recorded.
+     */
+    void capture(GLuint fbo, int width, int height, const QString &fileName);
+
+    /**
+     * @brief Hand the frames whose readback is complete over to the encoders.
+     * @param wait Wait for all frames in flight.
+     */
+    void poll(bool wait = false);
+
+    /**
+     * @brief Encode the following captures into a video instead of image files.
+     * @return false if the video encoder could not be started.
+     */
+    bool startVideo(const QString &fileName, int width, int height, double fps);
+
+    /**
+     * @brief Encode all captured frames and close the video.
+     */
+    void stopVideo();
+
+    bool isRecordingVideo() const { return _video.running(); }
+
+    /**
+     * @brief Wait until all captured frames are written.
+     */
+    void finish();
+
+private:
+    struct Readback
+    {
+        size_t pbo = 0;
+        GLsync fence = nullptr;
+        QString fileName;
+    };
+
+    void resize(int width, int height);
+    void retire();
+    size_t acquireBuffer();
+    void releaseBuffer(size_t buffer);
+
+    QOpenGLFunctions_4_3_Core *_gl = nullptr;
+    std::vector<GLuint> _pbos;
+    std::deque<Readback> _inFlight;     // oldest first
+    size_t _nextPbo = 0;
+    int _width = 0;
+    int _height = 0;
+
+    // host buffers, in use until the encoders copied the pixels
+    std::vector<std::vector<unsigned char> > _buffers;
+    std::vector<bool> _busy;
+    std::mutex _mutex;                  // guards _busy
+    std::condition_variable _cv;
+
+    FrameWriter _writer;
+    VideoEncoder _video;
+};
@@ -37,6 +37,7 @@
 #include <QJsonObject>
 #include <QJsonDocument>
 #include <QInputDialog>
+#include <QActionGroup>
 
 /**
  * @brief MainWindow::MainWindow
@@ -90,6 +91,8 @@ MainWindow::MainWindow(QWidget *parent) :
             ui->volumeRenderWidget, &VolumeRenderWidget::saveFrame);
     connect(ui->actionRecord, &QAction::triggered,
             ui->volumeRenderWidget, &VolumeRenderWidget::toggleVideoRecording);
+    connect(ui->actionRecordVideo, &QAction::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setVideoEncoding);
     connect(ui->actionRecordCamera, &QAction::triggered,
             ui->volumeRenderWidget, &VolumeRenderWidget::toggleViewRecording);
 	connect(ui->actionLogInteraction, &QAction::triggered,
@@ -115,6 +118,21 @@ MainWindow::MainWindow(QWidget *parent) :
             ui->volumeRenderWidget, &VolumeRenderWidget::setImgEss);
     connect(ui->actionShow_skipped, &QAction::toggled,
             ui->volumeRenderWidget, &VolumeRenderWidget::setShowEss);
+    connect(ui->actionRenderThread, &QAction::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setRenderThread);
+    connect(ui->actionReprojection, &QAction::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setTemporalReprojection);
+    QActionGroup *heatmapGroup = new QActionGroup(this);
+    const QList<QAction *> heatmapActions = {ui->actionHeatmapOff, ui->actionHeatmapSamples,
+                                             ui->actionHeatmapSkipped, ui->actionHeatmapGradients,
+                                             ui->actionHeatmapTermination};
+    for (int i = 0; i < heatmapActions.size(); ++i)
+    {
+        heatmapGroup->addAction(heatmapActions.at(i));
+        // channel -1: off
+        connect(heatmapActions.at(i), &QAction::triggered, ui->volumeRenderWidget,
+                [this, i]() { ui->volumeRenderWidget->setCostHeatmap(i - 1); });
+    }
     // menu - about
     connect(ui->actionAbout, &QAction::triggered, this, &MainWindow::showAboutDialog);
 
@@ -156,6 +174,21 @@ MainWindow::MainWindow(QWidget *parent) :
             ui->volumeRenderWidget, &VolumeRenderWidget::setContRendering);
     connect(ui->chbGradient, &QCheckBox::toggled,
             ui->volumeRenderWidget, &VolumeRenderWidget::setUseGradient);
+    connect(ui->chbInteractionLod, &QCheckBox::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setInteractionLod);
+    connect(ui->chbInteractionLod, &QCheckBox::toggled, ui->chbLowResVolume, &QCheckBox::setEnabled);
+    connect(ui->chbLowResVolume, &QCheckBox::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setInteractionLowResVolume);
+    connect(ui->dsbConvergence,
+            static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+            ui->volumeRenderWidget, &VolumeRenderWidget::setConvergenceThreshold);
+    ui->volumeRenderWidget->setConvergenceThreshold(ui->dsbConvergence->value());
+    connect(ui->chbGradientVolume, &QCheckBox::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setGradientVolume);
+    connect(ui->chbPreIntegration, &QCheckBox::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setPreIntegration);
+    connect(ui->chbProxyGeometry, &QCheckBox::toggled,
+            ui->volumeRenderWidget, &VolumeRenderWidget::setProxyGeometry);
     connect(ui->dsbExtinction,
             static_cast<void (QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
             ui->volumeRenderWidget, &VolumeRenderWidget::setExtinction);
@@ -853,7 +886,8 @@ void MainWindow::openVolumeFile()
     QString defaultPath = _settings->value( "LastVolumeFile" ).toString();
     QString pickedFile = dialog.getOpenFileName(
                 this, tr("Open Volume Data"), defaultPath,
-                tr("Volume data files (*.dat); Volume raw files (*.raw); All files (*)"));
+                tr("Volume data files (*.dat); Chunked volumes (*.cvol); "
+                   "Volume raw files (*.raw); All files (*)"));
     if (!pickedFile.isEmpty())
     {
         if (!readVolumeFile(pickedFile))
@@ -885,7 +919,7 @@ void MainWindow::dragEnterEvent(QDragEnterEvent *ev)
             if (!url.fileName().isEmpty())
             {
                 QFileInfo finf(url.fileName());
-                if (finf.suffix() == "dat" || finf.suffix() == "raw" )
+                if (finf.suffix() == "dat" || finf.suffix() == "cvol" || finf.suffix() == "raw" )
                     valid = true;
             }
         }
@@ -0,0 +1,339 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include "src/qt/renderthread.h"
+
+#include <QDebug>
+
+
+/**
+ * @brief RenderThread::RenderThread
+ * @param renderer
+ * @param parent
+ */
+RenderThread::RenderThread(VolumeRenderCL &renderer, QObject *parent)
+    : QObject(parent)
+    , _renderer(renderer)
+{
+}
+
+
+/**
+ * @brief RenderThread::~RenderThread
+ */
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+
+/**
+ * @brief RenderThread::start
+ * @param presented
+ */
+void RenderThread::start(size_t presented)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_running)
+        return;
+    _presented = presented % NUM_TEXTURES;
+    _ready = NONE;
+    _requested = false;
+    _requestedGeneration = NONE;
+    _stop = false;
+    _running = true;
+    _thread = std::thread(&RenderThread::run, this);
+}
+
+
+/**
+ * @brief RenderThread::stop
+ */
+void RenderThread::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_running)
+            return;
+        _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+
+    std::deque<Command> commands;
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _running = false;
+        commands.swap(_commands);
+    }
+    // parameter changes that were not rendered yet
+    runCommands(commands);
+}
+
+
+/**
+ * @brief RenderThread::isRunning
+ * @return
+ */
+bool RenderThread::isRunning() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _running;
+}
+
+
+/**
+ * @brief RenderThread::post
+ * @param command
+ */
+void RenderThread::post(Command command)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        if (!_running)
+        {
+            lock.unlock();
+            command(_renderer);
+            return;
+        }
+        _commands.push_back(std::move(command));
+        ++_generation;
+    }
+    _cv.notify_all();
+}
+
+
+/**
+ * @brief RenderThread::invoke
+ * @param command
+ */
+void RenderThread::invoke(const Command &command)
+{
+    Pause pause(*this);
+    command(_renderer);
+}
+
+
+/**
+ * @brief RenderThread::Pause::Pause
+ * @param thread
+ */
+RenderThread::Pause::Pause(RenderThread &thread)
+    : _thread(thread)
+    , _paused(thread.pause())
+{
+}
+
+
+/**
+ * @brief RenderThread::Pause::~Pause
+ */
+RenderThread::Pause::~Pause()
+{
+    if (_paused)
+        _thread.resume();
+}
+
+
+/**
+ * @brief RenderThread::pause
+ * @return false if the thread is not running.
+ */
+bool RenderThread::pause()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    if (!_running)
+        return false;
+    ++_pauses;
+    _cv.wait(lock, [&]{ return !_busy; });
+    std::deque<Command> commands;
+    commands.swap(_commands);
+    lock.unlock();
+    runCommands(commands);
+    return true;
+}
+
+
+/**
+ * @brief RenderThread::resume
+ */
+void RenderThread::resume()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        --_pauses;
+        // the paused caller may have changed anything
+        ++_generation;
+    }
+    _cv.notify_all();
+}
+
+
+/**
+ * @brief RenderThread::runCommands
+ * @param commands
+ */
+void RenderThread::runCommands(const std::deque<Command> &commands)
+{
+    try
+    {
+        for (const auto &command : commands)
+            command(_renderer);
+    }
+    catch (std::exception &e)
+    {
+        qCritical() << e.what();
+    }
+}
+
+
+/**
+ * @brief RenderThread::requestFrame
+ * @param request
+ * @param refine
+ */
+void RenderThread::requestFrame(const Frame &request, bool refine)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_running)
+            return;
+        if (!refine && _requestedGeneration == _generation
+                && request.width == _request.width && request.height == _request.height
+                && request.outputWidth == _request.outputWidth
+                && request.outputHeight == _request.outputHeight
+                && request.useGL == _request.useGL && request.diagnostics == _request.diagnostics)
+            return;
+        _request = request;
+        _request.pixels.clear();
+        _requested = true;
+        _requestedGeneration = _generation;
+    }
+    _cv.notify_all();
+}
+
+
+/**
+ * @brief RenderThread::takeFrame
+ * @param frame
+ * @return
+ */
+bool RenderThread::takeFrame(Frame &frame)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_ready == NONE)
+        return false;
+    _presented = _ready;
+    _ready = NONE;
+    frame = std::move(_readyFrame);
+    return true;
+}
+
+
+/**
+ * @brief RenderThread::render
+ * @param frame
+ */
+void RenderThread::render(Frame &frame)
+{
+    if (frame.useGL)
+    {
+        _renderer.selectOutputImg(frame.texture);
+        _renderer.runRaycast(frame.width, frame.height);
+    }
+    else
+    {
+        _renderer.runRaycastNoGL(frame.width, frame.height, frame.pixels);
+        _renderer.updateOutputImg(frame.outputWidth, frame.outputHeight, 0);
+    }
+    frame.execTime = _renderer.getLastExecTime();
+    frame.sampledSteps = _renderer.getSampledSteps();
+    frame.skippedSteps = _renderer.getSkippedSteps();
+    for (size_t i = 0; i < frame.costs.size(); ++i)
+        frame.costs.at(i) = _renderer.getCostCounter(VolumeRenderCL::cost_counter(i));
+    frame.costImage.clear();
+    if (frame.diagnostics && !_renderer.getDiagnostics(frame.costImage, frame.costWidth,
+                                                       frame.costHeight))
+        frame.costImage.clear();
+    frame.converged = _renderer.isConverged();
+    frame.pendingBricks = _renderer.hasPendingBricks();
+    frame.pendingTimestep = _renderer.hasPendingTimestep();
+}
+
+
+/**
+ * @brief RenderThread::run
+ */
+void RenderThread::run()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (true)
+    {
+        _cv.wait(lock, [&]{
+            return _stop || (_pauses == 0 && (_requested || !_commands.empty()));
+        });
+        if (_stop)
+            return;
+        _busy = true;
+        std::deque<Command> commands;
+        commands.swap(_commands);
+        const bool renderFrame = _requested;
+        Frame frame;
+        if (renderFrame)
+        {
+            frame = _request;
+            _requested = false;
+            // neither the presented nor the ready texture
+            for (frame.texture = 0; frame.texture < NUM_TEXTURES; ++frame.texture)
+                if (frame.texture != _presented && frame.texture != _ready)
+                    break;
+        }
+        lock.unlock();
+
+        runCommands(commands);
+        try
+        {
+            if (renderFrame)
+                render(frame);
+        }
+        catch (std::exception &e)
+        {
+            qCritical() << e.what();
+        }
+
+        lock.lock();
+        _busy = false;
+        if (renderFrame)
+        {
+            // a ready frame that was not presented yet is replaced by the newer one
+            _ready = frame.texture;
+            _readyFrame = std::move(frame);
+        }
+        _cv.notify_all();
+        if (renderFrame)
+        {
+            lock.unlock();
+            emit frameReady();
+            lock.lock();
+        }
+    }
+}
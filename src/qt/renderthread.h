@@ -0,0 +1,181 @@
+/**
+ * \file
+ *
+ * \author Valentin Bruder
+ *
+ * \copyright Copyright (C) 2018 Valentin Bruder
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#pragma once
+
+#include <QObject>
+
+#include <array>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+
+#include "src/core/volumerendercl.h"
+
+/**
+ * @brief Render thread that owns all OpenCL work of a renderer while it is running.
+ *        The GUI thread posts parameter changes, requests frames and presents the newest
+ *        finished one. Frames are rendered round robin into three shared output textures
+ *        (see VolumeRenderCL::setOutputTextures): one is presented, one is ready and one is
+ *        rendered into. Requests that have not been started are replaced by newer ones, so
+ *        outdated parameters are never rendered.
+ *        If the thread is not running, all commands execute on the calling thread.
+ */
+class RenderThread : public QObject
+{
+    Q_OBJECT
+
+public:
+    using Command = std::function<void(VolumeRenderCL &)>;
+    static const size_t NUM_TEXTURES = 3;
+
+    /**
+     * @brief Parameters of a frame request and the statistics of the rendered frame.
+     */
+    struct Frame
+    {
+        size_t width = 0;               // render size in pixels
+        size_t height = 0;
+        size_t outputWidth = 0;         // output image size without context sharing
+        size_t outputHeight = 0;
+        bool useGL = true;
+        bool diagnostics = false;       // read back the per-pixel ray costs
+        size_t texture = 0;             // output texture the frame was rendered into
+        std::vector<float> pixels;      // color output without context sharing
+
+        double execTime = 0.0;
+        cl_ulong sampledSteps = 0;
+        cl_ulong skippedSteps = 0;
+        std::array<cl_ulong, VolumeRenderCL::NUM_COST_COUNTERS> costs = {};
+        std::vector<cl_uint> costImage;
+        size_t costWidth = 0;
+        size_t costHeight = 0;
+        bool converged = true;
+        bool pendingBricks = false;
+        bool pendingTimestep = false;
+    };
+
+    explicit RenderThread(VolumeRenderCL &renderer, QObject *parent = nullptr);
+    ~RenderThread() override;
+
+    /**
+     * @brief Start the render thread.
+     * @param presented Index of the output texture that is currently presented.
+     */
+    void start(size_t presented = 0);
+
+    /**
+     * @brief Finish the current frame and stop the render thread, following commands run on
+     *        the calling thread.
+     */
+    void stop();
+
+    bool isRunning() const;
+
+    /**
+     * @brief Queue a parameter change, executed before the next frame is rendered.
+     */
+    void post(Command command);
+
+    /**
+     * @brief Run a command on the calling thread once the current frame is finished, the
+     *        render thread waits until it returns. For commands that need a result,
+     *        the OpenGL context or may throw.
+     */
+    void invoke(const Command &command);
+
+    /**
+     * @brief Scoped pause of the render thread after the current frame, e.g. to recreate
+     *        shared OpenGL resources. Queued parameter changes are applied on the creating
+     *        thread first.
+     */
+    class Pause
+    {
+    public:
+        explicit Pause(RenderThread &thread);
+        ~Pause();
+        Pause(const Pause &) = delete;
+        Pause &operator=(const Pause &) = delete;
+    private:
+        RenderThread &_thread;
+        bool _paused;
+    };
+
+    /**
+     * @brief Request a frame with the current parameters. Ignored if neither the parameters
+     *        nor the request changed since the last request, unless refine is set.
+     * @param request Frame size and options.
+     * @param refine Render even without changes, e.g. for progressive refinement.
+     */
+    void requestFrame(const Frame &request, bool refine);
+
+    /**
+     * @brief Take the newest finished frame for presentation. The output texture of the
+     *        previously presented frame is handed back to the render thread, the caller has
+     *        to make sure that OpenGL does not access it anymore.
+     * @return false if no frame was finished since the last call.
+     */
+    bool takeFrame(Frame &frame);
+
+    /**
+     * @brief Render a frame on the calling thread and collect its statistics.
+     */
+    void render(Frame &frame);
+
+signals:
+    /**
+     * @brief Emitted from the render thread when a frame is ready to be taken.
+     */
+    void frameReady();
+
+private:
+    void run();
+    bool pause();
+    void resume();
+    void runCommands(const std::deque<Command> &commands);
+
+    static const size_t NONE = std::numeric_limits<size_t>::max();
+
+    VolumeRenderCL &_renderer;
+    std::thread _thread;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+
+    std::deque<Command> _commands;
+    size_t _generation = 0;             // incremented with every parameter change
+    size_t _requestedGeneration = NONE;
+    Frame _request;
+    bool _requested = false;
+
+    Frame _readyFrame;
+    size_t _presented = 0;
+    size_t _ready = NONE;
+
+    size_t _pauses = 0;                 // invoke calls waiting or running
+    bool _busy = false;
+    bool _running = false;
+    bool _stop = false;
+};
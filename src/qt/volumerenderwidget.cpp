@@ -33,8 +33,10 @@
 #include <QLoggingCategory>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QDateTime>
 
 #include <algorithm>
+#include <array>
 
 const static double Z_NEAR = 1.0;
 const static double Z_FAR = 500.0;
@@ -57,17 +59,19 @@ static const char *pFsScreenQuadSource =
     "uniform highp int width;\n"
     "uniform highp int height;\n"
     "uniform highp sampler2D outTex;\n"     
+    "uniform highp vec2 texScale;\n"   // rendered part of the texture, see interaction LOD
     "void main() {\n"
     "   vec2 os = vec2(1.0)/vec2(width, height);"
-    "   vec3 color = texture(outTex, vec2(texCoord.x, texCoord.y)).xyz;\n"
+    "   vec2 tc = min(texCoord * texScale, texScale - 0.5/vec2(textureSize(outTex, 0)));\n"
+    "   vec3 color = texture(outTex, tc).xyz;\n"
     "   bool gaussFilter = false;\n"
     "   if (gaussFilter)\n"
     "   {\n"
     "       color *= 0.6;\n"
-    "       color += 0.1 * texture(outTex, vec2(texCoord.x, texCoord.y+os.y)).xyz;\n"
-    "       color += 0.1 * texture(outTex, vec2(texCoord.x, texCoord.y-os.y)).xyz;\n"
-    "       color += 0.1 * texture(outTex, vec2(texCoord.x+os.x, texCoord.y)).xyz;\n"
-    "       color += 0.1 * texture(outTex, vec2(texCoord.x-os.x, texCoord.y)).xyz;\n"
+    "       color += 0.1 * texture(outTex, vec2(tc.x, tc.y+os.y)).xyz;\n"
+    "       color += 0.1 * texture(outTex, vec2(tc.x, tc.y-os.y)).xyz;\n"
+    "       color += 0.1 * texture(outTex, vec2(tc.x+os.x, tc.y)).xyz;\n"
+    "       color += 0.1 * texture(outTex, vec2(tc.x-os.x, tc.y)).xyz;\n"
     "       //color += 0.05 * texture(outTex, vec2(texCoord.x+os.x, texCoord.y+os.y)).xyz;\n"
     "       //color += 0.05 * texture(outTex, vec2(texCoord.x-os.x, texCoord.y-os.y)).xyz;\n"
     "       //color += 0.05 * texture(outTex, vec2(texCoord.x+os.x, texCoord.y-os.y)).xyz;\n"
@@ -78,6 +82,30 @@ static const char *pFsScreenQuadSource =
     "   fragColor.a = 1.0f;\n"
     "}\n";
 
+// proxy geometry: distance of the brick faces from the camera, the same distance is
+// written as depth to keep the nearest (entry) or farthest (exit) face
+static const char *pVsProxySource =
+    "#version 330\n"
+    "layout(location = 0) in highp vec3 vertex;\n"
+    "out highp vec3 pos;\n"
+    "uniform highp mat4 clipMatrix;\n"
+    "void main() {\n"
+    "   pos = vertex;\n"
+    "   gl_Position = clipMatrix * vec4(vertex, 1.0f);\n"
+    "}\n";
+
+static const char *pFsProxySource =
+    "#version 330\n"
+    "in highp vec3 pos;\n"
+    "out highp vec4 fragColor;\n"
+    "uniform highp vec3 camPos;\n"
+    "uniform highp float maxDistance;\n"
+    "void main() {\n"
+    "   float dist = length(pos - camPos);\n"
+    "   fragColor = vec4(dist, dist, 0.0f, 0.0f);\n"
+    "   gl_FragDepth = clamp(dist / maxDistance, 0.0f, 1.0f);\n"
+    "}\n";
+
 
 /**
  * @brief VolumeRenderWidget::VolumeRenderWidget
@@ -101,8 +129,14 @@ VolumeRenderWidget::VolumeRenderWidget(QWidget *parent)
     , _logView(false)
 	, _logInteraction(false)
     , _contRendering(false)
+    , _renderThread(_volumerender)
 {
     this->setMouseTracking(true);
+    connect(&_renderThread, &RenderThread::frameReady, this,
+            static_cast<void (QWidget::*)()>(&QWidget::update), Qt::QueuedConnection);
+    _lod.idle.setSingleShot(true);
+    _lod.idle.setInterval(200);
+    connect(&_lod.idle, &QTimer::timeout, this, &VolumeRenderWidget::endInteraction);
 }
 
 
@@ -111,6 +145,8 @@ VolumeRenderWidget::VolumeRenderWidget(QWidget *parent)
  */
 VolumeRenderWidget::~VolumeRenderWidget()
 {
+    _renderThread.stop();
+    cleanup();
 }
 
 static void drawLineFloat(QPainter &p, float x1, float y1, float x2, float y2)
@@ -175,6 +211,93 @@ void VolumeRenderWidget::paintFps(QPainter &p, const double fps, const double la
     p.drawText(10, 36, s);
     s = QString(_volumerender.getCurrentDeviceName().c_str());
     p.drawText(10, 52, s);
+    // only available if step counting is enabled
+    if (_frame.sampledSteps + _frame.skippedSteps > 0)
+    {
+        s = "Steps sampled/skipped: " + QString::number(_frame.sampledSteps) + "/"
+                + QString::number(_frame.skippedSteps);
+        p.drawText(10, 68, s);
+    }
+    // only available with the cost heatmap
+    if (_heatmapChannel >= 0)
+    {
+        s = "Bricks skipped: "
+                + QString::number(_frame.costs.at(VolumeRenderCL::COST_SKIPPED_BRICKS))
+                + ", gradients: "
+                + QString::number(_frame.costs.at(VolumeRenderCL::COST_GRADIENTS))
+                + ", terminated rays: "
+                + QString::number(_frame.costs.at(VolumeRenderCL::COST_TERMINATED_RAYS));
+        p.drawText(10, 84, s);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderWidget::paintHeatmap
+ * @param p
+ */
+void VolumeRenderWidget::paintHeatmap(QPainter &p)
+{
+    if (_heatmap.isNull())
+        return;
+    static const std::array<const char *, 4> names = {{"Samples", "Skipped bricks",
+                                                        "Gradient evaluations",
+                                                        "Termination step"}};
+    p.setOpacity(0.6);
+    p.drawImage(this->rect(), _heatmap);
+    p.setOpacity(1.0);
+    p.setPen(Qt::darkGreen);
+    p.setFont(QFont("Helvetica", 11));
+    p.drawText(10, height() - 10, QString(names.at(size_t(_heatmapChannel))) + " (blue: 1, red: "
+               + QString::number(_heatmapMax) + " or more)");
+}
+
+
+/**
+ * @brief VolumeRenderWidget::updateHeatmap
+ */
+void VolumeRenderWidget::updateHeatmap()
+{
+    // read back with the frame
+    const std::vector<cl_uint> &costs = _frame.costImage;
+    const size_t width = _frame.costWidth;
+    const size_t height = _frame.costHeight;
+    if (_heatmapChannel < 0 || costs.size() < width * height * 4 || costs.empty())
+    {
+        _heatmap = QImage();
+        return;
+    }
+    const size_t channel = size_t(_heatmapChannel);
+    // normalize to the 99th percentile of the rays with costs, outliers saturate
+    std::vector<cl_uint> values;
+    values.reserve(width * height);
+    for (size_t i = 0; i < width * height; ++i)
+        if (costs.at(i*4 + channel) > 0)
+            values.push_back(costs.at(i*4 + channel));
+    _heatmapMax = 1;
+    if (!values.empty())
+    {
+        auto percentile = values.begin() + long((values.size() - 1) * 99 / 100);
+        std::nth_element(values.begin(), percentile, values.end());
+        _heatmapMax = std::max(1u, *percentile);
+    }
+
+    // blue to red, transparent without costs
+    std::array<QRgb, 256> colors;
+    for (size_t i = 0; i < colors.size(); ++i)
+        colors.at(i) = QColor::fromHsvF((1.0 - i / 255.0) * 2.0 / 3.0, 1.0, 1.0).rgb();
+    _heatmap = QImage(int(width), int(height), QImage::Format_ARGB32);
+    for (size_t y = 0; y < height; ++y)
+    {
+        // the frame starts with the bottom row
+        QRgb *line = reinterpret_cast<QRgb *>(_heatmap.scanLine(int(height - 1 - y)));
+        for (size_t x = 0; x < width; ++x)
+        {
+            const cl_uint v = costs.at((y * width + x)*4 + channel);
+            const size_t c = std::min(size_t(255), size_t(v) * 255 / _heatmapMax);
+            line[x] = v > 0 ? colors.at(c) : qRgba(0, 0, 0, 0);
+        }
+    }
 }
 
 
@@ -188,6 +311,7 @@ void VolumeRenderWidget::initializeGL()
 
     initializeOpenGLFunctions();
     makeCurrent();
+    _capture.initializeGL(this);
 
     glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     glDisable(GL_CULL_FACE);
@@ -226,6 +350,14 @@ void VolumeRenderWidget::initializeGL()
     _spScreenQuad.release();
     _screenQuadVao.release();
 
+    _spProxy.addShaderFromSourceCode(QOpenGLShader::Vertex, pVsProxySource);
+    _spProxy.addShaderFromSourceCode(QOpenGLShader::Fragment, pFsProxySource);
+    _spProxy.bindAttributeLocation("vertex", 0);
+    _spProxy.link();
+    _proxyVao.create();
+    _proxyVbo.create();
+    glGenFramebuffers(1, &_proxyFboId);
+
     initVolumeRenderer();
 	// FIXME: dual gpu setup
 	//initVolumeRenderer(false, false); 
@@ -236,6 +368,7 @@ void VolumeRenderWidget::initializeGL()
  */
 void VolumeRenderWidget::initVolumeRenderer(bool useGL, const bool useCPU)
 {
+    RenderThread::Pause pause(_renderThread);
     try
     {
         // try to use GPU with GL context sharing
@@ -282,10 +415,39 @@ void VolumeRenderWidget::toggleVideoRecording()
     qInfo() << (_recordVideo ? "Stopped recording." : "Started recording.");
 
     _recordVideo = !_recordVideo;
+    makeCurrent();
+    if (_recordVideo && _encodeVideo)
+    {
+        if (!QDir("img").exists())
+            QDir().mkdir("img");
+        // a constant frame rate, interaction sequences are recorded frame by frame
+        const QString fileName = "img/video_"
+                + QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss") + ".mp4";
+        const qreal ratio = devicePixelRatioF();
+        if (_capture.startVideo(fileName, int(width() * ratio), int(height() * ratio), 30.0))
+            qInfo() << "Encoding video" << fileName;
+        else
+            qWarning() << "Could not start the video encoder, writing images instead.";
+    }
+    else if (!_recordVideo)
+    {
+        _capture.stopVideo();
+    }
+    doneCurrent();
     _writeImage = true;
     update();
 }
 
+
+/**
+ * @brief VolumeRenderWidget::setVideoEncoding
+ * @param video
+ */
+void VolumeRenderWidget::setVideoEncoding(bool video)
+{
+    _encodeVideo = video;
+}
+
 /**
  * @brief VolumeRenderWidget::toggleViewRecording
  * Toggle writing camera configuration (rotation as quaternion and translation as a vecor)
@@ -381,7 +543,8 @@ void VolumeRenderWidget::setSequenceStep(QString line)
     {
         int pos = line.lastIndexOf(';');
         _timestep = line.remove(0, pos + 2).toInt();
-        _volumerender.setTimestep(size_t(_timestep));
+        const size_t t = size_t(_timestep);
+        _renderThread.post([t](VolumeRenderCL &r) { r.setTimestep(t); });
     }
     else if (line.contains("transferFunction"))
     {
@@ -435,7 +598,7 @@ void VolumeRenderWidget::playInteractionSequence(const QString &fileName, bool r
 void VolumeRenderWidget::setTimeStep(int timestep)
 {
     _timestep = timestep;
-    _volumerender.setTimestep(size_t(timestep));
+    _renderThread.post([timestep](VolumeRenderCL &r) { r.setTimestep(size_t(timestep)); });
     update();
 	if (_logInteraction)
 	{
@@ -464,34 +627,57 @@ void VolumeRenderWidget::setImageSamplingRate(const double samplingRate)
 void VolumeRenderWidget::paintGL()
 {
     double fps = 0.0;
+    bool presented = false;
+    const bool threaded = _renderThread.isRunning();
+    if (_presentFence != nullptr)
+    {
+        // OpenGL has to be done with a texture before it is handed back to the render thread
+        glClientWaitSync(_presentFence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+        glDeleteSync(_presentFence);
+        _presentFence = nullptr;
+    }
     if (this->_loadingFinished && _volumerender.hasData() && !_noUpdate)
     {
         // OpenCL raycast
         try
         {
-            if (_useGL)
-                _volumerender.runRaycast(size_t(floor(this->size().width() * _imgSamplingRate)),
-                                         size_t(floor(this->size().height()* _imgSamplingRate)));
+            if (threaded)
+                presented = _renderThread.takeFrame(_frame);
+            // reduced sizes render into the lower left part of the output texture
+            const int texWidth = int(floor(this->size().width() * _imgSamplingRate));
+            const int texHeight = int(floor(this->size().height()* _imgSamplingRate));
+            updateInteractionLod(texWidth);
+            RenderThread::Frame request;
+            request.width = size_t(qMax(1, int(floor(texWidth * _lod.scale))));
+            request.height = size_t(qMax(1, int(floor(texHeight * _lod.scale))));
+            request.outputWidth = static_cast<size_t>(width());
+            request.outputHeight = static_cast<size_t>(height());
+            request.useGL = _useGL;
+            request.diagnostics = _heatmapChannel >= 0;
+            if (threaded)
+            {
+                // presented once it is finished, see RenderThread::frameReady
+                _renderThread.requestFrame(request, needsRefinement());
+            }
             else
             {
-                std::vector<float> d;
-                _volumerender.runRaycastNoGL(size_t(floor(this->size().width() * _imgSamplingRate)),
-                                             size_t(floor(this->size().height()* _imgSamplingRate)), d);
-                glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F,
-                             int(floor(this->size().width() * _imgSamplingRate)),
-                             int(floor(this->size().height()* _imgSamplingRate)),
-                             0, GL_RGBA, GL_FLOAT,
-                             d.data());
-                glGenerateMipmap(GL_TEXTURE_2D);
-                _volumerender.updateOutputImg(static_cast<size_t>(width()),
-                                              static_cast<size_t>(height()), _outTexId);
+                if (_useGL)
+                    renderProxy(int(request.width), int(request.height));
+                request.texture = _frame.texture;
+                _frame = std::move(request);
+                _renderThread.render(_frame);
+                presented = true;
             }
+            if (presented)
+                presentFrame(texWidth, texHeight);
         }
         catch (std::runtime_error e)
         {
             qCritical() << e.what();
         }
         fps = getFps();
+        if (presented)
+            updateHeatmap();
     }
 
     QPainter p(this);
@@ -519,7 +705,10 @@ void VolumeRenderWidget::paintGL()
         _spScreenQuad.setUniformValue( _spScreenQuad.uniformLocation("height"), height());
 
         _spScreenQuad.setUniformValue(_spScreenQuad.uniformLocation("outTex"), GL_TEXTURE0);
+        _spScreenQuad.setUniformValue(_spScreenQuad.uniformLocation("texScale"), _lod.texScale);
         glDrawArrays( GL_TRIANGLE_STRIP, 0, 4 );
+        if (threaded)
+            _presentFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
         _screenQuadVao.release();
         _quadVbo.release();
         _spScreenQuad.release();
@@ -527,9 +716,9 @@ void VolumeRenderWidget::paintGL()
         glDisable(GL_CULL_FACE);
         glDisable(GL_DEPTH_TEST);
 
-        if (_volumerender.hasData() && _writeImage)
+        // recordings only contain new frames of the render thread
+        if (_volumerender.hasData() && _writeImage && (presented || !threaded || !_recordVideo))
         {
-            QImage img = this->grabFramebuffer();
             QString number = QString("%1").arg(_imgCount++, 6, 10, QChar('0'));
             if (!_recordVideo)
             {
@@ -540,16 +729,22 @@ void VolumeRenderWidget::paintGL()
             }
             if (!QDir("img").exists())
                 QDir().mkdir("img");
-            img.save("img/frame_" + number + "_"
-                     + QString::number(_volumerender.getLastExecTime()) + ".png");
+            // read back without the overlays and encode on the writer threads
+            const qreal ratio = devicePixelRatioF();
+            _capture.capture(defaultFramebufferObject(), int(width() * ratio),
+                             int(height() * ratio), "img/frame_" + number + "_"
+                             + QString::number(_frame.execTime) + ".png");
         }
+        // a single screenshot is not followed by another frame necessarily
+        _capture.poll(!_recordVideo);
     }
     p.endNativePainting();
 
     // render overlays
+    paintHeatmap(p);
     if (_showOverlay)
     {
-        paintFps(p, fps, _volumerender.getLastExecTime());
+        paintFps(p, fps, _frame.execTime);
         paintOrientationAxis(p);
     }
 
@@ -562,11 +757,15 @@ void VolumeRenderWidget::paintGL()
     p.endNativePainting();
     p.end();
 
-    if (_contRendering)
+    // keep rendering while missing bricks or timesteps are streamed in, progressive
+    // refinement stops once the whole frame has converged
+    if (!threaded && needsRefinement())
         update();
 
-    if (_interaction.play)
+    // the render thread advances the sequence frame by frame
+    if (_interaction.play && (presented || !threaded))
     {
+        startInteraction();
         setSequenceStep(_interaction.sequence.at(_interaction.pos));
         _interaction.pos++;
         if (_interaction.pos >= _interaction.sequence.size())
@@ -613,46 +812,154 @@ void VolumeRenderWidget::resizeGL(const int w, const int h)
  */
 void VolumeRenderWidget::generateOutputTextures(const int width, const int height)
 {
-	glDeleteTextures(1, &_outTexId);
-	glGenTextures(1, &_outTexId);
+    // the render thread must not write into the textures while they are recreated
+    RenderThread::Pause pause(_renderThread);
+    glDeleteTextures(GLsizei(_outTexIds.size()), _outTexIds.data());
+    glGenTextures(GLsizei(_outTexIds.size()), _outTexIds.data());
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, _outTexId);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    QImage img;
     if (!_volumerender.hasData())
     {
-        QImage img(width, height, QImage::Format_RGBA8888);
+        img = QImage(width, height, QImage::Format_RGBA8888);
         img.fill(Qt::white);
         QPainter p(&img);
         p.setFont(QFont("Helvetia", 12));
         p.drawText(width/2 - 110, height/2, "Drop your volume data file here.");
         p.end();
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
-                     width, height, 0,
-                     GL_RGBA, GL_UNSIGNED_BYTE,
-                     img.bits());
     }
-    else
+    // output textures of the render thread, see RenderThread
+    for (const GLuint texId : _outTexIds)
     {
+        glBindTexture(GL_TEXTURE_2D, texId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8,
                      width, height, 0,
                      GL_RGBA, GL_UNSIGNED_BYTE,
-                     nullptr);
+                     img.isNull() ? nullptr : img.bits());
+        glGenerateMipmap(GL_TEXTURE_2D);
     }
-    glGenerateMipmap(GL_TEXTURE_2D);
+    _outTexId = _outTexIds.at(_frame.texture);
+    glBindTexture(GL_TEXTURE_2D, _outTexId);
+    _lod.texScale = QVector2D(1.f, 1.f);
 
     _volumerender.updateOutputImg(static_cast<size_t>(width), static_cast<size_t>(height),
-                                      _outTexId);
+                                      _outTexIds.front());
+    _volumerender.setOutputTextures(std::vector<cl_GLuint>(_outTexIds.begin(), _outTexIds.end()));
+    _volumerender.selectOutputImg(_frame.texture);
+
+    // ray intervals of the proxy geometry, large enough for the padded frame
+    if (_useGL)
+    {
+        glDeleteTextures(1, &_proxyTexId);
+        glGenTextures(1, &_proxyTexId);
+        glBindTexture(GL_TEXTURE_2D, _proxyTexId);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width + 8, height + 8, 0,
+                     GL_RGBA, GL_FLOAT, nullptr);
+        glDeleteRenderbuffers(1, &_proxyDepthRbId);
+        glGenRenderbuffers(1, &_proxyDepthRbId);
+        glBindRenderbuffer(GL_RENDERBUFFER, _proxyDepthRbId);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width + 8, height + 8);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        glBindFramebuffer(GL_FRAMEBUFFER, _proxyFboId);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                               _proxyTexId, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER,
+                                  _proxyDepthRbId);
+        const bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+        glBindTexture(GL_TEXTURE_2D, _outTexId);
+        if (!complete)
+            qWarning() << "Proxy geometry framebuffer incomplete, proxy geometry disabled.";
+        _volumerender.setProxyTex(complete ? _proxyTexId : 0);
+    }
 
     updateView(0, 0);
 }
 
+
+/**
+ * @brief VolumeRenderWidget::renderProxy
+ * @param width
+ * @param height
+ */
+void VolumeRenderWidget::renderProxy(const int width, const int height)
+{
+    const VolumeRenderCL::ProxyView view = _volumerender.getProxyView(size_t(width),
+                                                                      size_t(height));
+    if (!_useProxy || !view.valid || _proxyTexId == 0)
+    {
+        _volumerender.setProxyActive(false);
+        return;
+    }
+
+    // the geometry only changes with the occupancy of the bricks, i.e. the transfer function
+    std::vector<float> vertices;
+    if (_volumerender.getProxyGeometry(_proxyVersion, vertices))
+    {
+        _proxyVbo.bind();
+        _proxyVbo.allocate(vertices.data(), int(vertices.size() * sizeof(float)));
+        _proxyVbo.release();
+        _proxyVertexCount = GLsizei(vertices.size() / 3);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, _proxyFboId);
+    glViewport(0, 0, view.viewport.at(0), view.viewport.at(1));
+    glClearColor(-1.0f, -1.0f, 0.0f, 0.0f);
+    glClearDepth(1.0);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (_proxyVertexCount > 0)
+    {
+        _spProxy.bind();
+        _spProxy.setUniformValue(_spProxy.uniformLocation("clipMatrix"),
+                                 QMatrix4x4(view.clipMatrix.data()).transposed());
+        _spProxy.setUniformValue(_spProxy.uniformLocation("camPos"),
+                                 QVector3D(view.camPos.at(0), view.camPos.at(1),
+                                           view.camPos.at(2)));
+        _spProxy.setUniformValue(_spProxy.uniformLocation("maxDistance"), view.maxDistance);
+        _proxyVao.bind();
+        _proxyVbo.bind();
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+
+        glEnable(GL_DEPTH_TEST);
+        // entry distance: nearest face
+        glDepthFunc(GL_LESS);
+        glColorMask(GL_TRUE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDrawArrays(GL_TRIANGLES, 0, _proxyVertexCount);
+        // exit distance: farthest face
+        glClearDepth(0.0);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDepthFunc(GL_GREATER);
+        glColorMask(GL_FALSE, GL_TRUE, GL_FALSE, GL_FALSE);
+        glDrawArrays(GL_TRIANGLES, 0, _proxyVertexCount);
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_LESS);
+        glClearDepth(1.0);
+        glDisable(GL_DEPTH_TEST);
+        _proxyVbo.release();
+        _proxyVao.release();
+        _spProxy.release();
+    }
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+    glViewport(0, 0, int(this->width() * devicePixelRatioF()),
+               int(this->height() * devicePixelRatioF()));
+    // the raycaster acquires the texture in its own queue
+    glFinish();
+    _volumerender.setProxyActive(_proxyVertexCount > 0);
+}
+
 void VolumeRenderWidget::setShowOverlay(bool showOverlay)
 {
     _showOverlay = showOverlay;
+    _renderThread.post([showOverlay](VolumeRenderCL &r) { r.setStepCounting(showOverlay); });
     updateView();
 }
 
@@ -681,6 +988,7 @@ void VolumeRenderWidget::setCamTranslation(const QVector3D &translation)
  */
 void VolumeRenderWidget::showSelectOpenCL()
 {
+    RenderThread::Pause pause(_renderThread);
     std::vector<std::string> names;
     try
     {
@@ -766,6 +1074,8 @@ void VolumeRenderWidget::showSelectOpenCL()
                 try {
                     _volumerender.initialize(_useGL, type == "CPU", vendor, device.toStdString(),
                                              static_cast<int>(platformId));
+                    setupPeerDevices(platformId, devices, devices.indexOf(device),
+                                     type == "GPU");
                 } catch (std::runtime_error e) {
                     qCritical() << e.what() << "\nSwitching to CPU fallback mode.";
                     _useGL = false;
@@ -782,6 +1092,44 @@ void VolumeRenderWidget::showSelectOpenCL()
 }
 
 
+/**
+ * @brief VolumeRenderWidget::setupPeerDevices
+ * @param platformId
+ * @param devices
+ * @param selected
+ * @param gpu
+ */
+void VolumeRenderWidget::setupPeerDevices(const size_t platformId, const QStringList &devices,
+                                          const int selected, const bool gpu)
+{
+    std::vector<size_t> peers;
+    if (gpu && devices.size() > 1)
+    {
+        QMessageBox msgBox;
+        msgBox.setText(QString("Do you wish to render with all %1 GPUs of this platform?")
+                       .arg(devices.size()));
+        msgBox.setStandardButtons(QMessageBox::Yes | QMessageBox::No);
+        msgBox.setDefaultButton(QMessageBox::No);
+        if (msgBox.exec() == QMessageBox::Yes)
+        {
+            for (int i = 0; i < devices.size(); ++i)
+                if (i != selected)
+                    peers.push_back(static_cast<size_t>(i));
+        }
+    }
+    if (peers.empty() && _volumerender.getDeviceCount() == 1)
+        return;
+    try
+    {
+        _volumerender.setPeerDevices(platformId, peers);
+    }
+    catch (std::exception &e)
+    {
+        qCritical() << "Could not set up rendering on multiple devices:" << e.what();
+    }
+}
+
+
 /**
  * @brief VolumeRenderWidget::setupVertexAttribs
  */
@@ -805,6 +1153,8 @@ void VolumeRenderWidget::setVolumeData(const DatRawReader::Properties volumeFile
     size_t timesteps = 0;
     try
     {
+        // runs on a loader thread, the render thread waits until the data is loaded
+        RenderThread::Pause pause(_renderThread);
         timesteps = _volumerender.loadVolumeData(volumeFileProps);
     }
     catch (std::invalid_argument e)
@@ -856,7 +1206,7 @@ const QVector4D VolumeRenderWidget::getVolumeResolution() const
  */
 void VolumeRenderWidget::updateSamplingRate(double samplingRate)
 {
-    _volumerender.updateSamplingRate(samplingRate);
+    _renderThread.post([samplingRate](VolumeRenderCL &r) { r.updateSamplingRate(samplingRate); });
     update();
 }
 
@@ -900,7 +1250,7 @@ void VolumeRenderWidget::setRawTransferFunction(std::vector<unsigned char> tff)
 {
     try
     {
-        _volumerender.setTransferFunction(tff);
+        _renderThread.post([tff](VolumeRenderCL &r) { r.setTransferFunction(tff); });
         update();
     }
     catch (std::runtime_error e)
@@ -939,10 +1289,12 @@ void VolumeRenderWidget::updateTransferFunction(QGradientStops stops)
 
     try
     {
-        _volumerender.setTransferFunction(tff);
         // TODO: replace with std::exclusicve_scan(std::par, ... )
         std::partial_sum(prefixSum.begin(), prefixSum.end(), prefixSum.begin());
-        _volumerender.setTffPrefixSum(prefixSum);
+        _renderThread.post([tff, prefixSum](VolumeRenderCL &r) {
+            r.setTransferFunction(tff);
+            r.setTffPrefixSum(prefixSum);
+        });
     }
     catch (std::runtime_error e)
     {
@@ -999,6 +1351,12 @@ void VolumeRenderWidget::cleanup()
 //    makeCurrent();
 //    if (_quadVbo.isCreated())
 //        _quadVbo.destroy();
+    // write the outstanding frames of a recording
+    if (context() == nullptr)
+        return;
+    makeCurrent();
+    _capture.releaseGL();
+    doneCurrent();
 }
 
 
@@ -1095,7 +1453,7 @@ void VolumeRenderWidget::updateViewMatrix()
         viewArray.at(i) = viewMat.transposed().constData()[i];
     try
     {
-        _volumerender.updateView(viewArray);
+        _renderThread.post([viewArray](VolumeRenderCL &r) { r.updateView(viewArray); });
     }
     catch (std::runtime_error e)
     {
@@ -1146,6 +1504,8 @@ void VolumeRenderWidget::mouseMoveEvent(QMouseEvent *event)
     float dx = float(event->pos().x() - _lastLocalCursorPos.x()) / width();
     float dy = float(event->pos().y() - _lastLocalCursorPos.y()) / height();
 
+    if (event->buttons() & (Qt::LeftButton | Qt::MiddleButton))
+        startInteraction();
     // rotate object
     if (event->buttons() & Qt::LeftButton)
     {
@@ -1182,6 +1542,7 @@ void VolumeRenderWidget::wheelEvent(QWheelEvent *event)
     float t = 1600.0;
     if (event->modifiers() & Qt::ShiftModifier)
         t *= 6.f;
+    startInteraction();
     // limit translation to origin, otherwise camera setup breaks (flips)
     _translation.setZ(qMax(0.01f, _translation.z() - event->angleDelta().y() / t));
     updateView();
@@ -1239,7 +1600,7 @@ void VolumeRenderWidget::setLoadingFinished(const bool loadingFinished)
  */
 void VolumeRenderWidget::setCamOrtho(const bool camOrtho)
 {
-    _volumerender.setCamOrtho(camOrtho);
+    _renderThread.post([camOrtho](VolumeRenderCL &r) { r.setCamOrtho(camOrtho); });
     _overlayProjMX.setToIdentity();
     if (camOrtho)
         _overlayProjMX.ortho(QRect(0, 0, width(), height()));
@@ -1264,7 +1625,8 @@ void VolumeRenderWidget::setContRendering(const bool contRendering)
  */
 void VolumeRenderWidget::setIllumination(const int illum)
 {
-    _volumerender.setIllumination(static_cast<unsigned int>(illum));
+    const unsigned int illumType = static_cast<unsigned int>(illum);
+    _renderThread.post([illumType](VolumeRenderCL &r) { r.setIllumination(illumType); });
     this->updateView();
 }
 
@@ -1275,7 +1637,7 @@ void VolumeRenderWidget::setIllumination(const int illum)
  */
 void VolumeRenderWidget::setAmbientOcclusion(const bool ao)
 {
-    _volumerender.setAmbientOcclusion(ao);
+    _renderThread.post([ao](VolumeRenderCL &r) { r.setAmbientOcclusion(ao); });
     this->updateView();
 }
 
@@ -1285,7 +1647,7 @@ void VolumeRenderWidget::setAmbientOcclusion(const bool ao)
  */
 void VolumeRenderWidget::setLinearInterpolation(const bool linear)
 {
-    _volumerender.setLinearInterpolation(linear);
+    _renderThread.post([linear](VolumeRenderCL &r) { r.setLinearInterpolation(linear); });
     this->updateView();
 }
 
@@ -1295,7 +1657,7 @@ void VolumeRenderWidget::setLinearInterpolation(const bool linear)
  */
 void VolumeRenderWidget::setContours(const bool contours)
 {
-    _volumerender.setContours(contours);
+    _renderThread.post([contours](VolumeRenderCL &r) { r.setContours(contours); });
     this->updateView();
 }
 
@@ -1305,7 +1667,7 @@ void VolumeRenderWidget::setContours(const bool contours)
  */
 void VolumeRenderWidget::setAerial(const bool aerial)
 {
-    _volumerender.setAerial(aerial);
+    _renderThread.post([aerial](VolumeRenderCL &r) { r.setAerial(aerial); });
     this->updateView();
 }
 
@@ -1315,7 +1677,7 @@ void VolumeRenderWidget::setAerial(const bool aerial)
  */
 void VolumeRenderWidget::setUseGradient(const bool useGradient)
 {
-    _volumerender.setUseGradient(useGradient);
+    _renderThread.post([useGradient](VolumeRenderCL &r) { r.setUseGradient(useGradient); });
     this->updateView();
 }
 
@@ -1326,9 +1688,12 @@ void VolumeRenderWidget::setUseGradient(const bool useGradient)
 void VolumeRenderWidget::setImgEss(const bool useEss)
 {
     if (useEss)
+    {
+        RenderThread::Pause pause(_renderThread);
         _volumerender.updateOutputImg(static_cast<size_t>(width() * _imgSamplingRate),
                                       static_cast<size_t>(height() * _imgSamplingRate), _outTexId);
-    _volumerender.setImgEss(useEss);
+    }
+    _renderThread.post([useEss](VolumeRenderCL &r) { r.setImgEss(useEss); });
     this->updateView();
 }
 
@@ -1338,7 +1703,7 @@ void VolumeRenderWidget::setImgEss(const bool useEss)
  */
 void VolumeRenderWidget::setObjEss(const bool useEss)
 {
-    _volumerender.setObjEss(useEss);
+    _renderThread.post([useEss](VolumeRenderCL &r) { r.setObjEss(useEss); });
     this->updateView();
 }
 
@@ -1348,7 +1713,7 @@ void VolumeRenderWidget::setObjEss(const bool useEss)
  */
 void VolumeRenderWidget::setShowEss(const bool showEss)
 {
-    _volumerender.setShowESS(showEss);
+    _renderThread.post([showEss](VolumeRenderCL &r) { r.setShowESS(showEss); });
     this->updateView();
 }
 
@@ -1364,7 +1729,7 @@ void VolumeRenderWidget::setBackgroundColor(const QColor col)
                                     static_cast<float>(col.greenF()),
                                     static_cast<float>(col.blueF()),
                                     static_cast<float>(col.alphaF()) }};
-    _volumerender.setBackground(color);
+    _renderThread.post([color](VolumeRenderCL &r) { r.setBackground(color); });
     this->updateView();
 }
 
@@ -1384,8 +1749,9 @@ void VolumeRenderWidget::setBBox(QVector3D botLeft, QVector3D topRight)
                                     _volumerender.getResolution().at(2));
     topRight = topRight * 2.f - QVector3D(1.f, 1.f, 1.f);
 //    qDebug() << botLeft << topRight;
-    _volumerender.setBBox(botLeft.x(), botLeft.y(), botLeft.z(),
-                          topRight.x(), topRight.y(), topRight.z());
+    _renderThread.post([botLeft, topRight](VolumeRenderCL &r) {
+        r.setBBox(botLeft.x(), botLeft.y(), botLeft.z(), topRight.x(), topRight.y(), topRight.z());
+    });
     updateView();
 }
 
@@ -1394,6 +1760,7 @@ void VolumeRenderWidget::setBBox(QVector3D botLeft, QVector3D topRight)
  */
 const std::array<double, 256> & VolumeRenderWidget::getHistogram(unsigned int timestep)
 {
+    RenderThread::Pause pause(_renderThread);
     return _volumerender.getHistogram(timestep);
 }
 
@@ -1404,10 +1771,8 @@ const std::array<double, 256> & VolumeRenderWidget::getHistogram(unsigned int ti
  */
 double VolumeRenderWidget::getFps()
 {
-    _times.push_back(_volumerender.getLastExecTime());
-    if (_times.length() > 60)
-        _times.pop_front();
-
+    if (_times.empty())
+        return 0.0;
     double sum = 0.0;
 #pragma omp parallel for reduction(+:sum)
     for (int i = 0; i < _times.size(); ++i)
@@ -1420,6 +1785,223 @@ double VolumeRenderWidget::getFps()
 }
 
 
+/**
+ * @brief VolumeRenderWidget::startInteraction
+ */
+void VolumeRenderWidget::startInteraction()
+{
+    // recorded frames are always rendered in full quality
+    if (!_lod.enabled || _recordVideo)
+        return;
+    _lod.active = true;
+    _lod.idle.start();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::endInteraction
+ */
+void VolumeRenderWidget::endInteraction()
+{
+    _lod.idle.stop();
+    const bool refine = _lod.active;
+    _lod.active = false;
+    _lod.scale = 1.0;
+    if (_lod.volumeReduced)
+        _renderThread.post([](VolumeRenderCL &r) { r.setLowResVolume(false); });
+    _lod.volumeReduced = false;
+    if (refine)
+        update();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::updateInteractionLod
+ */
+void VolumeRenderWidget::updateInteractionLod(const int texWidth)
+{
+    if (!_lod.active)
+        return;
+    const double lastTime = _frame.execTime;
+    if (lastTime <= 0.0)
+        return;
+    // the scale of the last frame, frames of the render thread lag behind the requests
+    const double lastScale = (texWidth > 0 && _frame.width > 0)
+            ? double(_frame.width) / double(texWidth) : _lod.scale;
+    // the ray casting time is roughly proportional to the number of pixels
+    const double scale = lastScale * sqrt(_lod.targetTime / lastTime);
+    if (scale < _lod.minScale && _lod.lowResVolume && !_lod.volumeReduced
+            && _volumerender.isLowResVolumeSupported())
+    {
+        // still too slow at the lowest image scale: also reduce the volume resolution
+        _renderThread.post([](VolumeRenderCL &r) { r.setLowResVolume(true); });
+        _lod.volumeReduced = true;
+    }
+    _lod.scale = qBound(_lod.minScale, scale, 1.0);
+}
+
+
+/**
+ * @brief VolumeRenderWidget::presentFrame
+ * @param texWidth
+ * @param texHeight
+ */
+void VolumeRenderWidget::presentFrame(const int texWidth, const int texHeight)
+{
+    _times.push_back(_frame.execTime);
+    if (_times.length() > 60)
+        _times.pop_front();
+
+    glActiveTexture(GL_TEXTURE0);
+    if (_frame.useGL)
+    {
+        _outTexId = _outTexIds.at(_frame.texture);
+        glBindTexture(GL_TEXTURE_2D, _outTexId);
+        _lod.texScale = QVector2D(float(_frame.width) / float(qMax(1, texWidth)),
+                                  float(_frame.height) / float(qMax(1, texHeight)));
+    }
+    else
+    {
+        glBindTexture(GL_TEXTURE_2D, _outTexId);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F,
+                     int(_frame.width), int(_frame.height),
+                     0, GL_RGBA, GL_FLOAT,
+                     _frame.pixels.data());
+        _lod.texScale = QVector2D(1.f, 1.f);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+}
+
+
+/**
+ * @brief VolumeRenderWidget::needsRefinement
+ * @return
+ */
+bool VolumeRenderWidget::needsRefinement() const
+{
+    return (_contRendering && !_frame.converged) || _frame.pendingBricks
+            || _frame.pendingTimestep;
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setRenderThread
+ * @param threaded
+ */
+void VolumeRenderWidget::setRenderThread(bool threaded)
+{
+    if (threaded == _renderThread.isRunning())
+        return;
+    if (threaded)
+    {
+        // the proxy geometry is rasterized on the GUI thread for the view of each frame
+        _renderThread.post([](VolumeRenderCL &r) { r.setProxyActive(false); });
+        _renderThread.start(_frame.texture);
+    }
+    else
+    {
+        _renderThread.stop();
+    }
+    updateView();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setInteractionLod
+ * @param lod
+ */
+void VolumeRenderWidget::setInteractionLod(bool lod)
+{
+    _lod.enabled = lod;
+    if (!lod)
+        endInteraction();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setInteractionLowResVolume
+ * @param lowRes
+ */
+void VolumeRenderWidget::setInteractionLowResVolume(bool lowRes)
+{
+    _lod.lowResVolume = lowRes;
+    if (!lowRes && _lod.volumeReduced)
+    {
+        _renderThread.post([](VolumeRenderCL &r) { r.setLowResVolume(false); });
+        _lod.volumeReduced = false;
+    }
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setConvergenceThreshold
+ * @param threshold
+ */
+void VolumeRenderWidget::setConvergenceThreshold(double threshold)
+{
+    _renderThread.post([threshold](VolumeRenderCL &r) { r.setConvergenceThreshold(threshold); });
+    update();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setGradientVolume
+ * @param precompute
+ */
+void VolumeRenderWidget::setGradientVolume(bool precompute)
+{
+    _renderThread.post([precompute](VolumeRenderCL &r) { r.setGradientVolume(precompute); });
+    this->updateView();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setPreIntegration
+ * @param preIntegrate
+ */
+void VolumeRenderWidget::setPreIntegration(bool preIntegrate)
+{
+    _renderThread.post([preIntegrate](VolumeRenderCL &r) { r.setPreIntegration(preIntegrate); });
+    this->updateView();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setProxyGeometry
+ * @param useProxy
+ */
+void VolumeRenderWidget::setProxyGeometry(bool useProxy)
+{
+    _useProxy = useProxy;
+    this->updateView();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setTemporalReprojection
+ * @param reproject
+ */
+void VolumeRenderWidget::setTemporalReprojection(bool reproject)
+{
+    _renderThread.post([reproject](VolumeRenderCL &r) { r.setTemporalReprojection(reproject); });
+    this->updateView();
+}
+
+
+/**
+ * @brief VolumeRenderWidget::setCostHeatmap
+ * @param channel
+ */
+void VolumeRenderWidget::setCostHeatmap(int channel)
+{
+    _heatmapChannel = qBound(-1, channel, 3);
+    _heatmap = QImage();
+    const bool diagnostics = _heatmapChannel >= 0;
+    _renderThread.post([diagnostics](VolumeRenderCL &r) { r.setDiagnostics(diagnostics); });
+    this->updateView();
+}
+
+
 /**
  * @brief VolumeRenderWidget::generateLowResVolume
  * @param factor
@@ -1433,6 +2015,7 @@ void VolumeRenderWidget::generateLowResVolume()
     {
         try
         {
+            RenderThread::Pause pause(_renderThread);
             std::string name = _volumerender.volumeDownsampling(static_cast<size_t>(_timestep),
                                                                 factor);
             QLoggingCategory category("volumeDownSampling");
@@ -1521,6 +2104,7 @@ void VolumeRenderWidget::reloadKernels()
 void VolumeRenderWidget::setEnvironmentMap(QString fileName)
 {
     try {
+        RenderThread::Pause pause(_renderThread);
         _volumerender.createEnvironmentMap(fileName.toStdString());
     } catch (std::runtime_error e) {
         qWarning() << e.what();
@@ -1533,7 +2117,7 @@ void VolumeRenderWidget::setEnvironmentMap(QString fileName)
  */
 void VolumeRenderWidget::enableRaycast()
 {
-    _volumerender.setTechnique(VolumeRenderCL::TECH_RAYCAST);
+    _renderThread.post([](VolumeRenderCL &r) { r.setTechnique(VolumeRenderCL::TECH_RAYCAST); });
     this->updateView();
 }
 
@@ -1542,7 +2126,7 @@ void VolumeRenderWidget::enableRaycast()
  */
 void VolumeRenderWidget::enablePathtrace()
 {
-    _volumerender.setTechnique(VolumeRenderCL::TECH_PATHTRACE);
+    _renderThread.post([](VolumeRenderCL &r) { r.setTechnique(VolumeRenderCL::TECH_PATHTRACE); });
     this->updateView();
 }
 
@@ -1551,6 +2135,6 @@ void VolumeRenderWidget::enablePathtrace()
  */
 void VolumeRenderWidget::setExtinction(const double extinction)
 {
-    _volumerender.setExtinction(extinction);
+    _renderThread.post([extinction](VolumeRenderCL &r) { r.setExtinction(extinction); });
     this->updateView();
 }
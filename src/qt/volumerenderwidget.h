@@ -41,8 +41,12 @@
 #include <qopenglfunctions_4_3_core.h>
 #include <QPainter>
 #include <QElapsedTimer>
+#include <QTimer>
+#include <QVector2D>
 
 #include "src/core/volumerendercl.h"
+#include "src/qt/framecapture.h"
+#include "src/qt/renderthread.h"
 
 class VolumeRenderWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_3_Core
 {
@@ -62,6 +66,20 @@ class VolumeRenderWidget : public QOpenGLWidget, protected QOpenGLFunctions_4_3_
         }
     };
 
+    // adaptive level of detail while the camera is moving
+    struct interaction_lod
+    {
+        bool enabled = true;
+        bool lowResVolume = true;       // fall back to a down-sampled volume if still too slow
+        bool active = false;            // user interaction or sequence playback in progress
+        bool volumeReduced = false;
+        double scale = 1.0;             // image scale in (0, 1]
+        double minScale = 0.25;
+        double targetTime = 1.0/30.0;   // target frame time in seconds
+        QVector2D texScale = QVector2D(1.f, 1.f);   // rendered part of the output texture
+        QTimer idle;                    // refine to full quality once it times out
+    };
+
 public:
     explicit VolumeRenderWidget(QWidget *parent = nullptr);
     virtual ~VolumeRenderWidget() override;
@@ -132,9 +150,62 @@ public slots:
     void setBackgroundColor(const QColor col);
     void setImageSamplingRate(const double samplingRate);
     void setShowOverlay(bool showOverlay);
+    /**
+     * @brief Render at a reduced image resolution while the camera is moving.
+     * @param lod
+     */
+    void setInteractionLod(bool lod);
+    /**
+     * @brief Render on a separate thread, the GUI thread only presents the finished frames.
+     *        The proxy geometry is not used while the render thread is running.
+     * @param threaded
+     */
+    void setRenderThread(bool threaded);
+    /**
+     * @brief Allow rendering from a down-sampled volume while the camera is moving.
+     * @param lowRes
+     */
+    void setInteractionLowResVolume(bool lowRes);
+    /**
+     * @brief Set the error threshold of the progressive refinement, continued rendering
+     *        stops once all image tiles have converged.
+     * @param threshold Maximum standard error of the pixel luminance, 0 to disable.
+     */
+    void setConvergenceThreshold(double threshold);
+    /**
+     * @brief Use a precomputed gradient volume instead of gradient stencils.
+     * @param precompute
+     */
+    void setGradientVolume(bool precompute);
+    /**
+     * @brief Use a pre-integrated transfer function for the ray segments.
+     * @param preIntegrate
+     */
+    void setPreIntegration(bool preIntegrate);
+    /**
+     * @brief Rasterize the occupied bricks to restrict the rays to their depth interval.
+     * @param useProxy
+     */
+    void setProxyGeometry(bool useProxy);
+    /**
+     * @brief Reproject the last frame on camera changes instead of restarting the accumulation,
+     *        pixels with a valid history are traced at half the sampling rate.
+     * @param reproject
+     */
+    void setTemporalReprojection(bool reproject);
+    /**
+     * @brief Show a ray cost of the ray casting kernel as heatmap over the image.
+     * @param channel 0: samples, 1: skipped bricks, 2: gradient evaluations,
+     *        3: early ray termination step, -1: off.
+     */
+    void setCostHeatmap(int channel);
 
     void saveFrame();
     void toggleVideoRecording();
+    /**
+     * @brief Encode recordings into a video (requires ffmpeg) instead of PNG images.
+     */
+    void setVideoEncoding(bool video);
     void toggleViewRecording();
 	void toggleInteractionLogging();
     void setTimeStep(int timestep);
@@ -168,6 +239,11 @@ protected:
 private:
     void paintOrientationAxis(QPainter &p);
     void paintFps(QPainter &p, const double fps, const double lastTime);
+    void paintHeatmap(QPainter &p);
+    /**
+     * @brief Read back the ray costs of the last frame and color the selected channel.
+     */
+    void updateHeatmap();
     double getFps();
     void updateViewMatrix();
 
@@ -178,6 +254,17 @@ private:
      */
     void initVolumeRenderer(bool useGL = true, const bool useCPU = false);
 
+    /**
+     * @brief Ask whether the other GPUs of the platform should render bands of the image
+     *        (sort-first) and set them up as peer devices of the volume renderer.
+     * @param platformId OpenCL platform of the devices.
+     * @param devices Names of the devices of the platform.
+     * @param selected Index of the device used for display.
+     * @param gpu Whether the devices are GPUs.
+     */
+    void setupPeerDevices(const size_t platformId, const QStringList &devices,
+                          const int selected, const bool gpu);
+
 	/**
 	 * @brief create the OpenGL output texture to display on the screen quad.
 	 * @param width Width of the texture in pixels.
@@ -185,6 +272,14 @@ private:
 	 */
     void generateOutputTextures(const int width, const int height);
 
+    /**
+     * @brief Rasterize the proxy geometry of the occupied bricks into the ray interval
+     *        texture of the raycaster.
+     * @param width Render width in pixels.
+     * @param height Render height in pixels.
+     */
+    void renderProxy(const int width, const int height);
+
 	/**
 	 * @brief Log camera configurations rotation and zoom) to two files selected by the user.
 	 */
@@ -203,6 +298,31 @@ private:
      */
     void setSequenceStep(QString line);
 
+    /**
+     * @brief Mark the start or continuation of a user interaction, renders in reduced
+     *        quality until the input went idle.
+     */
+    void startInteraction();
+
+    /**
+     * @brief End the interaction and render the next frame in full quality.
+     */
+    void endInteraction();
+
+    /**
+     * @brief Update the level of detail from the last measured frame time.
+     * @param texWidth Width of the output texture the frame was rendered into.
+     */
+    void updateInteractionLod(const int texWidth);
+    /**
+     * @brief Show the last taken or rendered frame.
+     */
+    void presentFrame(const int texWidth, const int texHeight);
+    /**
+     * @brief Check if the last frame has to be refined, e.g. while bricks are streamed in.
+     */
+    bool needsRefinement() const;
+
     // -------Member variables--------
     //
     // OpenGL
@@ -212,6 +332,20 @@ private:
     QOpenGLBuffer _quadVbo;
     GLuint _overlayFboId;
     GLuint _overlayTexId;
+    // proxy geometry of the occupied bricks, see renderProxy
+    QOpenGLShaderProgram _spProxy;
+    QOpenGLVertexArrayObject _proxyVao;
+    QOpenGLBuffer _proxyVbo;
+    GLuint _proxyFboId = 0;
+    GLuint _proxyTexId = 0;
+    GLuint _proxyDepthRbId = 0;
+    GLsizei _proxyVertexCount = 0;
+    size_t _proxyVersion = 0;
+    bool _useProxy = true;
+    // ray cost heatmap, see setCostHeatmap
+    int _heatmapChannel = -1;
+    QImage _heatmap;
+    unsigned int _heatmapMax = 0;
 
     QMatrix4x4 _screenQuadProjMX;
     QMatrix4x4 _viewMX;
@@ -222,7 +356,11 @@ private:
 
     QPoint _tffRange;
     GLuint _outTexId;
+    std::array<GLuint, RenderThread::NUM_TEXTURES> _outTexIds = {};    // see RenderThread
+    GLsync _presentFence = nullptr;     // last draw call sampling the presented texture
     VolumeRenderCL _volumerender;
+    RenderThread _renderThread;
+    RenderThread::Frame _frame;         // last presented frame
     QEasingCurve _tffInterpol;
     int _timestep;
 
@@ -235,6 +373,8 @@ private:
     bool _loadingFinished;
     bool _writeImage;
     bool _recordVideo;
+    bool _encodeVideo = false;
+    FrameCapture _capture;          // asynchronous readback and encoding of recorded frames
     qint64 _imgCount;
     QVector<double> _times;
     double _imgSamplingRate;       // image oversampling rate
@@ -248,4 +388,5 @@ private:
     QGradientStops _tffStops;
 	QElapsedTimer _timer;
     interaction_sequence _interaction;
+    interaction_lod _lod;
 };